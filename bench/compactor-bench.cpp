@@ -0,0 +1,918 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+/*
+ * Microbenchmarks for the main processing stages of the compactor
+ * and inspector.
+ *
+ * Each benchmark runs a fixed workload repeatedly until a minimum
+ * time has elapsed, and reports the time per item processed. The
+ * workload is synthetic, but generated from a fixed seed so results
+ * are comparable between runs and releases.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "config.h"
+
+#include "blockcbordata.hpp"
+#include "blockcborreader.hpp"
+#include "blockcborwriter.hpp"
+#include "capturedns.hpp"
+#include "cbordecoder.hpp"
+#include "cborencoder.hpp"
+#include "configuration.hpp"
+#include "dnsmessage.hpp"
+#include "ipaddress.hpp"
+#include "log.hpp"
+#include "makeunique.hpp"
+#include "matcher.hpp"
+#include "packetstatistics.hpp"
+#include "queryresponse.hpp"
+#include "streamwriter.hpp"
+
+#if ENABLE_PSEUDOANONYMISATION
+#include "pseudoanonymise.hpp"
+#endif
+
+namespace po = boost::program_options;
+namespace bf = boost::filesystem;
+
+using namespace block_cbor;
+
+namespace {
+    /**
+     * \brief the number of query/response pairs in the workload.
+     */
+    const std::size_t N_TRANSACTIONS = 20000;
+
+    /**
+     * \brief the number of distinct clients in the workload.
+     */
+    const std::size_t N_CLIENTS = 2000;
+
+    /**
+     * \brief the number of distinct query names in the workload.
+     */
+    const std::size_t N_NAMES = 5000;
+
+    /**
+     * \brief the size of the data written in stream writer benchmarks.
+     */
+    const std::size_t STREAM_DATA_SIZE = 4 * 1024 * 1024;
+
+    /**
+     * \brief the size of each write in stream writer benchmarks.
+     */
+    const std::size_t STREAM_WRITE_SIZE = 64 * 1024;
+
+    /**
+     * \struct Result
+     * \brief The result of a benchmark.
+     */
+    struct Result
+    {
+        /**
+         * \brief the benchmark name.
+         */
+        std::string name;
+
+        /**
+         * \brief the number of iterations run.
+         */
+        uint64_t iterations;
+
+        /**
+         * \brief the total run time, in seconds.
+         */
+        double seconds;
+
+        /**
+         * \brief the total number of items processed.
+         */
+        uint64_t items;
+
+        /**
+         * \brief the total number of bytes processed.
+         */
+        uint64_t bytes;
+    };
+
+    /**
+     * \class BenchRunner
+     * \brief Run benchmarks and collect the results.
+     */
+    class BenchRunner
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param min_time minimum run time of each benchmark, in seconds.
+         * \param filter   only run benchmarks whose name contains this.
+         * \param list     list benchmark names instead of running them.
+         */
+        BenchRunner(double min_time, const std::string& filter, bool list)
+            : min_time_(min_time), filter_(filter), list_(list) {}
+
+        /**
+         * \brief Determine if a benchmark is to be run.
+         *
+         * Setting up a benchmark workload may be expensive, so check
+         * this before setting up.
+         *
+         * \param name the benchmark name.
+         * \returns <code>true</code> if the benchmark should run.
+         */
+        bool wanted(const std::string& name) const
+        {
+            if ( list_ )
+                std::cout << name << "\n";
+            return !list_ && name.find(filter_) != std::string::npos;
+        }
+
+        /**
+         * \brief Run a benchmark.
+         *
+         * The benchmark function is run once to warm up, and then
+         * repeatedly until the minimum time has elapsed.
+         *
+         * \param name  the benchmark name.
+         * \param fn    run one iteration, returning the number of
+         *              items processed.
+         * \param bytes the number of bytes processed per iteration.
+         */
+        void run(const std::string& name, const std::function<std::size_t()>& fn, std::size_t bytes = 0)
+        {
+            if ( !wanted(name) )
+                return;
+
+            fn();
+
+            Result res{name, 0, 0.0, 0, 0};
+            auto start = std::chrono::steady_clock::now();
+            do
+            {
+                res.items += fn();
+                res.bytes += bytes;
+                res.iterations++;
+                res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while ( res.seconds < min_time_ );
+
+            std::cout << std::left << std::setw(40) << name << std::right
+                      << std::setw(10) << res.iterations
+                      << std::setw(14) << std::fixed << std::setprecision(1)
+                      << res.seconds * 1e9 / res.items << " ns/item"
+                      << std::setw(14) << std::setprecision(0)
+                      << res.items / res.seconds << " items/s";
+            if ( res.bytes > 0 )
+                std::cout << std::setw(10) << std::setprecision(1)
+                          << res.bytes / res.seconds / ( 1024 * 1024 ) << " MiB/s";
+            std::cout << std::endl;
+
+            results_.push_back(res);
+        }
+
+        /**
+         * \brief Write the results as JSON.
+         *
+         * \param os the output stream.
+         */
+        void write_json(std::ostream& os) const
+        {
+            os << "{\n"
+               << "  \"program\": \"compactor-bench\",\n"
+               << "  \"version\": \"" << PACKAGE_VERSION << "\",\n"
+               << "  \"min_time\": " << min_time_ << ",\n"
+               << "  \"benchmarks\": [";
+            bool first = true;
+            for ( const auto& r : results_ )
+            {
+                os << ( first ? "\n" : ",\n" );
+                first = false;
+                os << std::fixed << std::setprecision(3)
+                   << "    {\"name\": \"" << r.name << "\""
+                   << ", \"iterations\": " << r.iterations
+                   << ", \"seconds\": " << r.seconds
+                   << ", \"items\": " << r.items
+                   << ", \"bytes\": " << r.bytes
+                   << ", \"ns_per_item\": " << r.seconds * 1e9 / r.items
+                   << ", \"items_per_second\": " << r.items / r.seconds
+                   << ", \"bytes_per_second\": " << r.bytes / r.seconds
+                   << "}";
+            }
+            os << "\n  ]\n}\n";
+        }
+
+    private:
+        /**
+         * \brief minimum run time of each benchmark, in seconds.
+         */
+        double min_time_;
+
+        /**
+         * \brief only run benchmarks whose name contains this.
+         */
+        std::string filter_;
+
+        /**
+         * \brief list benchmark names instead of running them.
+         */
+        bool list_;
+
+        /**
+         * \brief the results.
+         */
+        std::vector<Result> results_;
+    };
+
+    /**
+     * \class CountingEncoder
+     * \brief A CBOR encoder that discards output, counting the bytes.
+     */
+    class CountingEncoder : public CborBaseEncoder
+    {
+    public:
+        /**
+         * \brief Constructor.
+         */
+        CountingEncoder() : CborBaseEncoder(), n_bytes(0) {}
+
+        /**
+         * \brief the number of bytes written.
+         */
+        std::size_t n_bytes;
+
+    protected:
+        virtual void writeBytes(const uint8_t*, std::ptrdiff_t n) override
+        {
+            n_bytes += n;
+        }
+    };
+
+    /**
+     * \class MemoryEncoder
+     * \brief A CBOR encoder that writes to a string.
+     */
+    class MemoryEncoder : public CborBaseEncoder
+    {
+    public:
+        /**
+         * \brief the output.
+         */
+        std::string out;
+
+    protected:
+        virtual void writeBytes(const uint8_t* p, std::ptrdiff_t n) override
+        {
+            out.append(reinterpret_cast<const char*>(p), n);
+        }
+    };
+
+    /**
+     * \class MemoryFileEncoder
+     * \brief A CBOR file encoder that writes its file to a string.
+     */
+    class MemoryFileEncoder : public CborBaseStreamFileEncoder
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param out the output string.
+         */
+        explicit MemoryFileEncoder(std::string& out) : out_(out), open_(false) {}
+
+        virtual void open(const std::string&, bool) override
+        {
+            out_.clear();
+            open_ = true;
+        }
+
+        virtual void close() override
+        {
+            flush();
+            open_ = false;
+        }
+
+        virtual bool is_open() const override
+        {
+            return open_;
+        }
+
+        virtual const char* suggested_extension() override
+        {
+            return "";
+        }
+
+        virtual std::uintmax_t bytes_written() override
+        {
+            return out_.size();
+        }
+
+    protected:
+        virtual void writeBytes(const uint8_t* p, std::ptrdiff_t n) override
+        {
+            out_.append(reinterpret_cast<const char*>(p), n);
+        }
+
+    private:
+        /**
+         * \brief the output.
+         */
+        std::string& out_;
+
+        /**
+         * \brief is the file open?
+         */
+        bool open_;
+    };
+
+    /**
+     * \class Workload
+     * \brief Synthetic DNS traffic used by the benchmarks.
+     *
+     * Clients and query names are chosen with a skewed distribution,
+     * so a few are very popular, as in real traffic.
+     */
+    class Workload
+    {
+    public:
+        /**
+         * \brief Constructor.
+         */
+        Workload() : rng_(20230101)
+        {
+            for ( std::size_t i = 0; i < N_CLIENTS; ++i )
+            {
+                std::ostringstream oss;
+                if ( i % 4 == 0 )
+                    oss << "2001:db8:" << std::hex << i << "::53";
+                else
+                    oss << "10." << ( i >> 16 ) << "." << ( ( i >> 8 ) & 0xff ) << "." << ( i & 0xff );
+                clients_.push_back(IPAddress(oss.str()));
+            }
+
+            for ( std::size_t i = 0; i < N_NAMES; ++i )
+                names_.push_back("host" + std::to_string(i) + ".zone" + std::to_string(i % 97) + ".example.com");
+
+            const CaptureDNS::QueryType qtypes[] = {
+                CaptureDNS::A, CaptureDNS::A, CaptureDNS::A, CaptureDNS::AAAA,
+                CaptureDNS::AAAA, CaptureDNS::MX, CaptureDNS::TXT, CaptureDNS::NS
+            };
+            auto start = std::chrono::system_clock::time_point(std::chrono::hours(24 * 365 * 50));
+
+            for ( std::size_t i = 0; i < N_TRANSACTIONS; ++i )
+            {
+                DNSMessage query;
+                const IPAddress& client = clients_[skewed(N_CLIENTS)];
+                query.timestamp = start + std::chrono::microseconds(i * 50);
+                query.clientIP = client;
+                query.serverIP = client.is_ipv6() ? IPAddress("2001:db8::1") : IPAddress("192.0.2.1");
+                query.clientPort = 1024 + rng_() % 60000;
+                query.serverPort = 53;
+                query.hoplimit = 64;
+                query.ipv6 = client.is_ipv6();
+                query.transport_type = ( i % 20 == 0 ) ? TransportType::TCP : TransportType::UDP;
+                query.dns.type(CaptureDNS::QUERY);
+                query.dns.id(rng_() & 0xffff);
+                query.dns.recursion_desired(1);
+                const std::string& name = names_[skewed(N_NAMES)];
+                CaptureDNS::QueryType qtype = qtypes[rng_() % (sizeof(qtypes) / sizeof(qtypes[0]))];
+                query.dns.add_query(CaptureDNS::query(name, qtype, CaptureDNS::IN));
+
+                DNSMessage response = query;
+                response.timestamp += std::chrono::microseconds(200 + rng_() % 2000);
+                response.dns.type(CaptureDNS::RESPONSE);
+                if ( qtype == CaptureDNS::A )
+                {
+                    const uint8_t addr[] = { 192, 0, 2, static_cast<uint8_t>(i) };
+                    response.dns.add_answer(CaptureDNS::resource(name, byte_string(addr, sizeof(addr)), qtype, CaptureDNS::IN, 300));
+                }
+                else if ( i % 10 == 0 )
+                    response.dns.rcode(CaptureDNS::NXDOMAIN);
+
+                query.wire_size = query.dns.size();
+                response.wire_size = response.dns.size();
+                messages.push_back(std::move(query));
+                messages.push_back(std::move(response));
+            }
+        }
+
+        /**
+         * \brief Query and response messages, in arrival order.
+         */
+        std::vector<DNSMessage> messages;
+
+    private:
+        /**
+         * \brief Choose a value skewed towards the low end of a range.
+         *
+         * \param n the range size.
+         * \returns a value in the range 0 to n - 1.
+         */
+        std::size_t skewed(std::size_t n)
+        {
+            double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
+            return std::min(n - 1, static_cast<std::size_t>(n * u * u * u));
+        }
+
+        /**
+         * \brief the random number generator.
+         */
+        std::mt19937 rng_;
+
+        /**
+         * \brief the clients.
+         */
+        std::vector<IPAddress> clients_;
+
+        /**
+         * \brief the query names.
+         */
+        std::vector<std::string> names_;
+    };
+
+    /**
+     * \brief Match the workload messages into query/responses.
+     *
+     * \param workload the workload.
+     * \returns the query/responses.
+     */
+    std::vector<std::shared_ptr<QueryResponse>> match(const Workload& workload)
+    {
+        std::vector<std::shared_ptr<QueryResponse>> res;
+        QueryResponseMatcher matcher(
+            [&](std::shared_ptr<QueryResponse> qr)
+            {
+                res.push_back(qr);
+            });
+        for ( const auto& m : workload.messages )
+            matcher.add(make_unique<DNSMessage>(m));
+        matcher.flush();
+        return res;
+    }
+
+    /**
+     * \brief Add the header items for a query/response to block data.
+     *
+     * This adds the same header items as the C-DNS writer does for
+     * the basic query/response information.
+     *
+     * \param data the block data.
+     * \param qr   the query/response.
+     * \returns the query/response item.
+     */
+    QueryResponseItem add_headers(BlockData& data, const QueryResponse& qr)
+    {
+        const DNSMessage& d = qr.has_query() ? qr.query() : qr.response();
+        QueryResponseItem qri;
+        QueryResponseSignature qs;
+
+        qri.client_address = data.add_address(d.clientIP->asNetworkBinary());
+        qri.client_port = d.clientPort;
+        qri.hoplimit = d.hoplimit;
+        qri.id = d.dns.id();
+        qri.tstamp = qr.timestamp();
+        if ( qr.has_query() && qr.has_response() )
+            qri.response_delay = std::chrono::duration_cast<std::chrono::nanoseconds>(qr.response().timestamp - qr.query().timestamp);
+        if ( qr.has_query() )
+            qri.query_size = qr.query().wire_size;
+        if ( qr.has_response() )
+            qri.response_size = qr.response().wire_size;
+
+        if ( !d.dns.queries().empty() )
+        {
+            const auto& q = d.dns.queries().front();
+            ClassType ct;
+            ct.qtype = q.query_type();
+            ct.qclass = q.query_class();
+            qs.query_classtype = data.add_classtype(ct);
+            qri.qname = data.add_name_rdata(q.dname());
+
+            Question question;
+            question.qname = qri.qname;
+            question.classtype = qs.query_classtype;
+            data.add_question(question);
+        }
+
+        qs.server_address = data.add_address(d.serverIP->asNetworkBinary());
+        qs.server_port = d.serverPort;
+        qs.qr_transport_flags = ( d.ipv6 ? 1 : 0 ) | ( d.transport_type == TransportType::TCP ? 2 : 0 );
+        qs.qr_flags = ( qr.has_query() ? 1 : 0 ) | ( qr.has_response() ? 2 : 0 );
+        qs.qdcount = d.dns.questions_count();
+        qs.query_opcode = d.dns.opcode();
+        if ( qr.has_response() )
+            qs.response_rcode = static_cast<CaptureDNS::Rcode>(qr.response().dns.rcode());
+        qri.signature = data.add_query_response_signature(qs);
+
+        return qri;
+    }
+
+    /**
+     * \brief Fill a block with query/responses.
+     *
+     * \param data the block data.
+     * \param qrs  the query/responses.
+     */
+    void fill_block(BlockData& data, const std::vector<std::shared_ptr<QueryResponse>>& qrs)
+    {
+        data.earliest_time = qrs.front()->timestamp();
+        data.start_time = data.earliest_time;
+        for ( const auto& qr : qrs )
+        {
+            if ( data.is_full() )
+                break;
+            data.query_response_items.push_back(add_headers(data, *qr));
+            data.end_time = qr->timestamp();
+        }
+    }
+
+    /**
+     * \brief Run the DNS message parsing benchmarks.
+     *
+     * \param runner   the benchmark runner.
+     * \param workload the workload.
+     */
+    void bench_capturedns(BenchRunner& runner, const Workload& workload)
+    {
+        for ( int query = 1; query >= 0; --query )
+        {
+            std::string name = query ? "capturedns/parse-query" : "capturedns/parse-response";
+            if ( !runner.wanted(name) )
+                continue;
+
+            std::vector<Tins::PDU::serialization_type> wire;
+            std::size_t n_bytes = 0;
+            for ( std::size_t i = query ? 0 : 1; i < workload.messages.size(); i += 2 )
+            {
+                DNSMessage m = workload.messages[i];
+                wire.push_back(m.dns.serialize());
+                n_bytes += wire.back().size();
+            }
+
+            runner.run(name, [&]()
+                       {
+                           std::size_t n = 0;
+                           for ( const auto& w : wire )
+                           {
+                               CaptureDNS dns(w.data(), w.size());
+                               n += dns.questions_count();
+                           }
+                           return n;
+                       }, n_bytes);
+        }
+    }
+
+    /**
+     * \brief Run the query/response matcher benchmarks.
+     *
+     * \param runner   the benchmark runner.
+     * \param workload the workload.
+     */
+    void bench_matcher(BenchRunner& runner, const Workload& workload)
+    {
+        runner.run("matcher/add-matched", [&]()
+                   {
+                       std::size_t n = 0;
+                       QueryResponseMatcher matcher([&](std::shared_ptr<QueryResponse>) { ++n; });
+                       for ( const auto& m : workload.messages )
+                           matcher.add(make_unique<DNSMessage>(m));
+                       matcher.flush();
+                       return workload.messages.size();
+                   });
+
+        runner.run("matcher/add-timeout", [&]()
+                   {
+                       std::size_t n = 0;
+                       QueryResponseMatcher matcher([&](std::shared_ptr<QueryResponse>) { ++n; });
+                       matcher.set_query_timeout(std::chrono::milliseconds(1));
+                       matcher.set_skew_timeout(std::chrono::microseconds(1));
+                       for ( std::size_t i = 0; i < workload.messages.size(); i += 2 )
+                           matcher.add(make_unique<DNSMessage>(workload.messages[i]));
+                       matcher.flush();
+                       return workload.messages.size() / 2;
+                   });
+    }
+
+    /**
+     * \brief Run the block data benchmarks.
+     *
+     * \param runner the benchmark runner.
+     * \param qrs    the query/responses.
+     */
+    void bench_blockdata(BenchRunner& runner, const std::vector<std::shared_ptr<QueryResponse>>& qrs)
+    {
+        std::vector<BlockParameters> bpv(1);
+
+        runner.run("blockdata/add-headers", [&]()
+                   {
+                       BlockData data(bpv);
+                       fill_block(data, qrs);
+                       return data.query_response_items.size();
+                   });
+
+        if ( !runner.wanted("blockdata/write-cbor") )
+            return;
+
+        BlockData data(bpv);
+        fill_block(data, qrs);
+        CountingEncoder enc;
+        data.writeCbor(enc);
+        enc.flush();
+        std::size_t block_size = enc.n_bytes;
+
+        runner.run("blockdata/write-cbor", [&]()
+                   {
+                       data.writeCbor(enc);
+                       enc.flush();
+                       return data.query_response_items.size();
+                   }, block_size);
+    }
+
+    /**
+     * \brief Run the CBOR decoder benchmark.
+     *
+     * \param runner the benchmark runner.
+     * \param qrs    the query/responses.
+     */
+    void bench_cbordecoder(BenchRunner& runner, const std::vector<std::shared_ptr<QueryResponse>>& qrs)
+    {
+        if ( !runner.wanted("cbordecoder/read") )
+            return;
+
+        // Encode a typical mix of items: a block's worth of maps of
+        // small integers, with some strings.
+        std::vector<BlockParameters> bpv(1);
+        BlockData data(bpv);
+        fill_block(data, qrs);
+        MemoryEncoder enc;
+        std::size_t n_items = 0;
+        enc.writeArrayHeader();
+        for ( const auto& qri : data.query_response_items )
+        {
+            enc.writeMapHeader(4);
+            enc.write(0, *qri.client_address);
+            enc.write(1, *qri.client_port);
+            enc.write(2, *qri.id);
+            enc.write(3, std::string("host.example.com"));
+            n_items += 9;
+        }
+        enc.writeBreak();
+        enc.flush();
+
+        runner.run("cbordecoder/read", [&]()
+                   {
+                       std::istringstream is(enc.out);
+                       CborStreamDecoder dec(is);
+                       bool indef;
+                       dec.readArrayHeader(indef);
+                       while ( dec.type() != CborBaseDecoder::TYPE_BREAK )
+                       {
+                           dec.readMapHeader(indef);
+                           for ( int i = 0; i < 3; ++i )
+                           {
+                               dec.read_unsigned();
+                               dec.read_unsigned();
+                           }
+                           dec.read_unsigned();
+                           dec.read_string();
+                       }
+                       dec.readBreak();
+                       return n_items;
+                   }, enc.out.size());
+    }
+
+    /**
+     * \brief Run the C-DNS reader benchmark.
+     *
+     * \param runner the benchmark runner.
+     * \param qrs    the query/responses.
+     */
+    void bench_blockcborreader(BenchRunner& runner, const std::vector<std::shared_ptr<QueryResponse>>& qrs)
+    {
+        if ( !runner.wanted("blockcborreader/read-qr-data") )
+            return;
+
+        // Write a C-DNS file into memory with the C-DNS writer.
+        std::string cdns;
+        {
+            Configuration config;
+            config.output_pattern = "compactor-bench.cdns";
+            BlockCborWriter writer(config, make_unique<MemoryFileEncoder>(cdns), false);
+            PacketStatistics stats{};
+            for ( const auto& qr : qrs )
+                writer.writeQR(qr, stats);
+        }
+
+        runner.run("blockcborreader/read-qr-data", [&]()
+                   {
+                       std::istringstream is(cdns);
+                       CborStreamDecoder dec(is);
+                       Configuration config;
+                       Defaults defaults;
+                       BlockCborReader cbr(dec, config, defaults);
+                       std::size_t n = 0;
+                       bool eof = false;
+                       for ( QueryResponseData qr = cbr.readQRData(eof);
+                             !eof;
+                             qr = cbr.readQRData(eof) )
+                           ++n;
+                       return n;
+                   }, cdns.size());
+    }
+
+#if ENABLE_PSEUDOANONYMISATION
+    /**
+     * \brief Run the pseudo-anonymisation benchmarks.
+     *
+     * \param runner   the benchmark runner.
+     * \param workload the workload.
+     */
+    void bench_pseudoanonymise(BenchRunner& runner, const Workload& workload)
+    {
+        PseudoAnonymise pa("compactor-bench passphrase");
+
+        for ( int ipv6 = 0; ipv6 < 2; ++ipv6 )
+        {
+            std::vector<IPAddress> addrs;
+            for ( std::size_t i = 0; i < workload.messages.size() && addrs.size() < 1000; i += 2 )
+                if ( workload.messages[i].clientIP->is_ipv6() == static_cast<bool>(ipv6) )
+                    addrs.push_back(*workload.messages[i].clientIP);
+
+            runner.run(ipv6 ? "pseudoanonymise/ipv6" : "pseudoanonymise/ipv4", [&]()
+                       {
+                           std::size_t n = 0;
+                           for ( const auto& a : addrs )
+                               n += ( pa.address(a).is_ipv6() == static_cast<bool>(ipv6) );
+                           return n;
+                       });
+        }
+    }
+#endif
+
+    /**
+     * \brief Run a stream writer benchmark.
+     *
+     * \param runner the benchmark runner.
+     * \param name   the benchmark name.
+     * \param dir    the directory for output files.
+     * \param data   the data to write.
+     * \param level  the compression level.
+     */
+    template<typename Writer>
+    void bench_streamwriter(BenchRunner& runner, const std::string& name,
+                            const bf::path& dir, const std::string& data,
+                            unsigned level)
+    {
+        std::string path = ( dir / "out" ).string();
+
+        runner.run(name, [&]()
+                   {
+                       {
+                           Writer writer(path, level, false);
+                           const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+                           for ( std::size_t off = 0; off < data.size(); off += STREAM_WRITE_SIZE )
+                               writer.writeBytes(p + off, std::min(STREAM_WRITE_SIZE, data.size() - off));
+                       }
+                       std::remove(path.c_str());
+                       return data.size() / STREAM_WRITE_SIZE;
+                   }, data.size());
+    }
+
+    /**
+     * \brief Run the stream writer benchmarks.
+     *
+     * \param runner the benchmark runner.
+     * \param qrs    the query/responses.
+     */
+    void bench_streamwriters(BenchRunner& runner, const std::vector<std::shared_ptr<QueryResponse>>& qrs)
+    {
+        if ( !runner.wanted("streamwriter/") )
+            return;
+
+        // Compress encoded C-DNS, so compression ratios are realistic.
+        std::vector<BlockParameters> bpv(1);
+        BlockData block(bpv);
+        fill_block(block, qrs);
+        MemoryEncoder enc;
+        block.writeCbor(enc);
+        enc.flush();
+        std::string data;
+        while ( data.size() < STREAM_DATA_SIZE )
+            data += enc.out;
+        data.resize(STREAM_DATA_SIZE);
+
+        bf::path dir = bf::temp_directory_path() / bf::unique_path("compactor-bench-%%%%-%%%%");
+        bf::create_directories(dir);
+
+        bench_streamwriter<StreamWriter>(runner, "streamwriter/plain", dir, data, 0);
+        bench_streamwriter<GzipStreamWriter>(runner, "streamwriter/gzip", dir, data, 6);
+        bench_streamwriter<XzStreamWriter>(runner, "streamwriter/xz", dir, data, 6);
+
+        bf::remove_all(dir);
+    }
+}
+
+int main(int ac, char *av[])
+{
+    double min_time;
+    std::string filter;
+    std::string json_file;
+
+    po::options_description options("Options");
+    options.add_options()
+        ("help,h", "show this help message.")
+        ("list,l", "list benchmarks.")
+        ("min-time,t",
+         po::value<double>(&min_time)->default_value(1.0),
+         "minimum run time of each benchmark, in seconds.")
+        ("filter,f",
+         po::value<std::string>(&filter),
+         "only run benchmarks whose name contains this.")
+        ("json,j",
+         po::value<std::string>(&json_file),
+         "write results as JSON to this file, or - for standard output.");
+
+    po::variables_map vm;
+
+    try
+    {
+        po::store(po::parse_command_line(ac, av, options), vm);
+        po::notify(vm);
+    }
+    catch (po::error& err)
+    {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    if ( vm.count("help") )
+    {
+        std::cerr << "Usage: " << av[0] << " [options]\n" << options;
+        return 0;
+    }
+
+    init_logging();
+
+    try
+    {
+        BenchRunner runner(min_time, filter, vm.count("list") > 0);
+        std::ostream& out = ( json_file == "-" ) ? std::cerr : std::cout;
+        std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+
+        Workload workload;
+        std::vector<std::shared_ptr<QueryResponse>> qrs = match(workload);
+
+        bench_capturedns(runner, workload);
+        bench_matcher(runner, workload);
+        bench_blockdata(runner, qrs);
+        bench_cbordecoder(runner, qrs);
+        bench_blockcborreader(runner, qrs);
+#if ENABLE_PSEUDOANONYMISATION
+        bench_pseudoanonymise(runner, workload);
+#endif
+        bench_streamwriters(runner, qrs);
+
+        std::cout.rdbuf(saved);
+
+        if ( json_file == "-" )
+            runner.write_json(std::cout);
+        else if ( !json_file.empty() )
+        {
+            std::ofstream ofs(json_file);
+            runner.write_json(ofs);
+            if ( ofs.fail() )
+                throw std::runtime_error("Can't write " + json_file);
+        }
+    }
+    catch (const std::exception& err)
+    {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
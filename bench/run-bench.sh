@@ -0,0 +1,124 @@
+#!/bin/sh
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, you can obtain one at https://mozilla.org/MPL/2.0/.
+#
+# Run the microbenchmarks and end to end throughput runs, and write
+# the results as JSON.
+#
+# Run from the build directory, after building compactor, inspector,
+# compactor-bench and the test pcaps. 'make bench' does this.
+#
+# Environment:
+#   BENCH_OUTPUT    output file, default bench.json.
+#   BENCH_MIN_TIME  minimum time for each microbenchmark, default 1.
+#   BENCH_REPEAT    runs of each throughput test; the fastest is
+#                   reported. Default 3.
+#   BENCH_PCAPS     pcap files for throughput tests.
+
+COMP=./compactor
+INSP=./inspector
+BENCH=./compactor-bench
+
+DEFAULTS="--defaultsfile $srcdir/test-scripts/test.defaults"
+
+OUTPUT=${BENCH_OUTPUT:-bench.json}
+MIN_TIME=${BENCH_MIN_TIME:-1}
+REPEAT=${BENCH_REPEAT:-3}
+PCAPS=${BENCH_PCAPS:-"gold.pcap dns.pcap matching.pcap testcontent.pcap knot-live.raw.pcap nsd-live.raw.pcap"}
+
+command -v mktemp > /dev/null 2>&1 || { echo "No mktemp, can't run benchmarks." >&2; exit 1; }
+
+tmpdir=`mktemp -d -t "bench.XXXXXX"`
+
+cleanup()
+{
+    rm -rf $tmpdir
+    exit $1
+}
+
+trap "cleanup 1" HUP INT TERM
+
+# Time in nanoseconds.
+now_ns()
+{
+    date +%s%N
+}
+
+# Run a command REPEAT times, and print the fastest time in ns.
+best_time()
+{
+    best=""
+    i=0
+    while [ $i -lt $REPEAT ]; do
+        start=`now_ns`
+        "$@" > /dev/null 2>&1 || return 1
+        t=$((`now_ns` - $start))
+        if [ -z "$best" ] || [ $t -lt $best ]; then
+            best=$t
+        fi
+        i=$(($i + 1))
+    done
+    echo $best
+}
+
+# Print a throughput result as a JSON object.
+result()
+{
+    name=$1
+    file=$2
+    ns=$3
+    bytes=`wc -c < $file | tr -d ' '`
+    awk -v name="$name" -v file="$file" -v bytes=$bytes -v ns=$ns 'BEGIN {
+        printf "    {\"name\": \"%s\", \"input\": \"%s\", \"bytes\": %d, \"seconds\": %.6f, \"bytes_per_second\": %.0f}", name, file, bytes, ns / 1e9, bytes * 1e9 / ns
+    }'
+}
+
+$BENCH --min-time $MIN_TIME --json $tmpdir/micro.json
+if [ $? -ne 0 ]; then
+    cleanup 1
+fi
+
+first=1
+for pcap in $PCAPS; do
+    if [ ! -f $pcap ]; then
+        echo "No $pcap, skipping." >&2
+        continue
+    fi
+
+    rm -f $tmpdir/out.cbor $tmpdir/out.pcap
+    ns=`best_time sh -c "rm -f $tmpdir/out.cbor; $COMP -c /dev/null --include all -o $tmpdir/out.cbor $pcap"`
+    if [ $? -ne 0 ]; then
+        echo "compactor failed on $pcap" >&2
+        cleanup 1
+    fi
+    [ $first -eq 1 ] || echo "," >> $tmpdir/throughput.json
+    first=0
+    result "pcap-to-cdns" $pcap $ns >> $tmpdir/throughput.json
+    echo "pcap-to-cdns $pcap: $ns ns" >&2
+
+    ns=`best_time sh -c "rm -f $tmpdir/out.pcap; $INSP $DEFAULTS -o $tmpdir/out.pcap $tmpdir/out.cbor"`
+    if [ $? -ne 0 ]; then
+        echo "inspector failed on $pcap" >&2
+        cleanup 1
+    fi
+    echo "," >> $tmpdir/throughput.json
+    result "cdns-to-pcap" $tmpdir/out.cbor $ns | sed -e "s|$tmpdir/out.cbor|$pcap.cbor|" >> $tmpdir/throughput.json
+    echo "cdns-to-pcap $pcap: $ns ns" >&2
+done
+
+{
+    echo "{"
+    echo "  \"micro\":"
+    sed -e 's/^/  /' $tmpdir/micro.json
+    echo "  ,"
+    echo "  \"throughput\": ["
+    [ -f $tmpdir/throughput.json ] && cat $tmpdir/throughput.json
+    echo ""
+    echo "  ]"
+    echo "}"
+} > $OUTPUT
+
+echo "Results written to $OUTPUT" >&2
+cleanup 0
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "config.h"
+
+#include "blockcbor.hpp"
+#include "channel.hpp"
+#include "ipaddress.hpp"
+
+#include "aggregate.hpp"
+
+namespace {
+    /**
+     * \struct KeyInfo
+     * \brief Name and identifier of a grouping key.
+     */
+    struct KeyInfo
+    {
+        /**
+         * \brief the key name.
+         */
+        const char* name;
+
+        /**
+         * \brief the key.
+         */
+        Aggregator::Key key;
+    };
+
+    /**
+     * \brief The grouping keys, in enum order.
+     */
+    const KeyInfo KEYS[] =
+    {
+        { "qtype", Aggregator::Key::QTYPE },
+        { "qclass", Aggregator::Key::QCLASS },
+        { "rcode", Aggregator::Key::RCODE },
+        { "opcode", Aggregator::Key::OPCODE },
+        { "transport", Aggregator::Key::TRANSPORT },
+        { "server-address", Aggregator::Key::SERVER_ADDRESS },
+        { "server-port", Aggregator::Key::SERVER_PORT },
+    };
+
+    /**
+     * \brief Format an optional value.
+     *
+     * \param val the value.
+     * \returns the value as a decimal string, or an empty string if
+     *          no value.
+     */
+    template<typename T>
+    std::string format(const boost::optional<T>& val)
+    {
+        if ( !val )
+            return std::string();
+        return std::to_string(static_cast<unsigned>(*val));
+    }
+
+    /**
+     * \brief Write a string as a JSON string.
+     *
+     * Values are decimal numbers or IP addresses, so no escaping
+     * is required.
+     *
+     * \param os  the output stream.
+     * \param str the string.
+     */
+    void write_json_string(std::ostream& os, const std::string& str)
+    {
+        os << '"' << str << '"';
+    }
+}
+
+Aggregator::Key Aggregator::find_key(const std::string& name)
+{
+    for ( const auto& k : KEYS )
+        if ( name == k.name )
+            return k.key;
+    throw aggregate_error("Unknown aggregation key " + name);
+}
+
+Aggregator::Aggregator(const std::vector<Key>& keys,
+                       const Defaults& defaults,
+                       boost::optional<PseudoAnonymise> pseudo_anon,
+                       boost::optional<QueryResponseFilter> filter)
+    : keys_(keys), defaults_(defaults),
+      pseudo_anon_(pseudo_anon), filter_(filter), items_(0)
+{
+}
+
+void Aggregator::aggregate(BlockCborReader& cbr, unsigned threads)
+{
+    if ( threads == 0 )
+        threads = 1;
+
+    // Only the extent of each block is found on this thread. Blocks
+    // are decoded and counted by the workers.
+    Channel<std::shared_ptr<byte_string>> blocks(threads * 2);
+    std::vector<Counts> partials(threads);
+    std::vector<uint64_t> partial_items(threads);
+    std::vector<std::thread> workers;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    for ( unsigned i = 0; i < threads; ++i )
+        workers.emplace_back([&, i]()
+        {
+            boost::optional<QueryResponseFilter> filter = filter_;
+            std::shared_ptr<byte_string> block;
+            bool failed = false;
+
+            // Keep draining the channel after an error so the reader
+            // doesn't block.
+            while ( blocks.get(block) )
+            {
+                if ( failed )
+                    continue;
+
+                try
+                {
+                    partial_items[i] += aggregate_block(*cbr.decodeBlock(*block),
+                                                        cbr.block_parameters(),
+                                                        cbr.file_format_version(),
+                                                        filter, partials[i]);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if ( !error )
+                        error = std::current_exception();
+                    failed = true;
+                }
+            }
+        });
+
+    try
+    {
+        for (;;)
+        {
+            auto block = std::make_shared<byte_string>();
+            if ( !cbr.readRawBlock(*block) )
+                break;
+            blocks.put(std::move(block));
+        }
+    }
+    catch (...)
+    {
+        blocks.close();
+        for ( auto& w : workers )
+            w.join();
+        throw;
+    }
+
+    blocks.close();
+    for ( auto& w : workers )
+        w.join();
+
+    if ( error )
+        std::rethrow_exception(error);
+
+    for ( unsigned i = 0; i < threads; ++i )
+    {
+        for ( const auto& c : partials[i] )
+            counts_[c.first] += c.second;
+        items_ += partial_items[i];
+    }
+}
+
+uint64_t Aggregator::aggregate_block(const block_cbor::BlockData& block,
+                                     const std::vector<block_cbor::BlockParameters>& bp,
+                                     block_cbor::FileFormatVersion version,
+                                     boost::optional<QueryResponseFilter>& filter,
+                                     Counts& counts) const
+{
+    if ( filter &&
+         !filter->select_block(block,
+                               bp.at(block.block_parameters_index).storage_parameters,
+                               defaults_,
+                               version) )
+        return 0;
+
+    // Signature indexes may be zero or one based depending on file
+    // version, so allow for either.
+    std::vector<uint64_t> sig_counts(block.query_response_signatures.size() + 1);
+    uint64_t no_sig_count = 0;
+    uint64_t res = 0;
+
+    for ( const auto& qri : block.query_response_items )
+    {
+        if ( filter && !filter->accept(qri) )
+            continue;
+
+        if ( !qri.signature )
+            no_sig_count++;
+        else if ( *qri.signature < sig_counts.size() )
+            sig_counts[*qri.signature]++;
+        else
+            throw cbor_file_format_error("Block index out of range");
+        res++;
+    }
+
+    for ( std::size_t i = 0; i < sig_counts.size(); ++i )
+        if ( sig_counts[i] > 0 )
+            counts[group(block, &block.query_response_signatures[i], version)] += sig_counts[i];
+    if ( no_sig_count > 0 )
+        counts[group(block, nullptr, version)] += no_sig_count;
+
+    return res;
+}
+
+Aggregator::GroupKey Aggregator::group(const block_cbor::BlockData& block,
+                                       const block_cbor::QueryResponseSignature* sig,
+                                       block_cbor::FileFormatVersion version) const
+{
+    block_cbor::QueryResponseSignature empty_sig;
+    if ( !sig )
+        sig = &empty_sig;
+
+    boost::optional<uint8_t> transport_flags;
+    if ( sig->qr_transport_flags )
+        transport_flags = block_cbor::convert_transport_flags(*sig->qr_transport_flags, version);
+    else
+        transport_flags = defaults_.transport;
+
+    GroupKey res;
+    res.reserve(keys_.size());
+    for ( auto key : keys_ )
+    {
+        switch ( key )
+        {
+        case Key::QTYPE:
+        case Key::QCLASS:
+            if ( sig->query_classtype )
+            {
+                const block_cbor::ClassType& ct = block.class_types[*sig->query_classtype];
+                res.push_back(( key == Key::QTYPE ) ? format(ct.qtype) : format(ct.qclass));
+            }
+            else
+                res.push_back(( key == Key::QTYPE ) ? format(defaults_.query_type) : format(defaults_.query_class));
+            break;
+
+        case Key::RCODE:
+            res.push_back(format(( sig->response_rcode ) ? sig->response_rcode : defaults_.response_rcode));
+            break;
+
+        case Key::OPCODE:
+            res.push_back(format(( sig->query_opcode ) ? sig->query_opcode : defaults_.query_opcode));
+            break;
+
+        case Key::TRANSPORT:
+            res.push_back(format(transport_flags));
+            break;
+
+        case Key::SERVER_ADDRESS:
+            if ( sig->server_address )
+            {
+                byte_string b = block.ip_addresses[*sig->server_address].str;
+                bool ipv6 = ( transport_flags )
+                    ? ( *transport_flags & block_cbor::IPV6 )
+                    : ( b.size() > 4 );
+                b.resize(( ipv6 || b.size() > 4 ) ? 16 : 4, 0);
+                IPAddress addr(b);
+#if ENABLE_PSEUDOANONYMISATION
+                if ( pseudo_anon_ )
+                    addr = pseudo_anon_->address(addr);
+#endif
+                res.push_back(addr.str());
+            }
+            else if ( defaults_.server_address )
+                res.push_back(defaults_.server_address->str());
+            else
+                res.push_back(std::string());
+            break;
+
+        case Key::SERVER_PORT:
+            res.push_back(format(( sig->server_port ) ? sig->server_port : defaults_.server_port));
+            break;
+        }
+    }
+    return res;
+}
+
+std::vector<std::pair<Aggregator::GroupKey, uint64_t>> Aggregator::sorted() const
+{
+    std::vector<std::pair<GroupKey, uint64_t>> res(counts_.begin(), counts_.end());
+    std::stable_sort(res.begin(), res.end(),
+                     [](const std::pair<GroupKey, uint64_t>& a,
+                        const std::pair<GroupKey, uint64_t>& b)
+                     {
+                         return a.second > b.second;
+                     });
+    return res;
+}
+
+void Aggregator::write_csv(std::ostream& os) const
+{
+    for ( auto key : keys_ )
+        os << KEYS[static_cast<unsigned>(key)].name << ",";
+    os << "count\n";
+    for ( const auto& r : sorted() )
+    {
+        for ( const auto& val : r.first )
+            os << val << ",";
+        os << r.second << "\n";
+    }
+}
+
+void Aggregator::write_json(std::ostream& os) const
+{
+    bool first = true;
+
+    os << "[";
+    for ( const auto& r : sorted() )
+    {
+        os << ( first ? "\n" : ",\n" ) << "  {";
+        first = false;
+        for ( std::size_t k = 0; k < keys_.size(); ++k )
+        {
+            write_json_string(os, KEYS[static_cast<unsigned>(keys_[k])].name);
+            os << ": ";
+            if ( r.first[k].empty() )
+                os << "null";
+            else if ( keys_[k] == Key::SERVER_ADDRESS )
+                write_json_string(os, r.first[k]);
+            else
+                os << r.first[k];
+            os << ", ";
+        }
+        os << "\"count\": " << r.second << "}";
+    }
+    os << ( first ? "]\n" : "\n]\n" );
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef AGGREGATE_HPP
+#define AGGREGATE_HPP
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "blockcbordata.hpp"
+#include "blockcborreader.hpp"
+#include "configuration.hpp"
+#include "pseudoanonymise.hpp"
+#include "qrfilter.hpp"
+
+/**
+ * \class aggregate_error
+ * \brief Signals an aggregation error.
+ */
+class aggregate_error : public std::runtime_error
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param what message detailing the problem.
+     */
+    explicit aggregate_error(const std::string& what)
+        : std::runtime_error(what) {}
+
+    /**
+     * \brief Constructor.
+     *
+     * \param what message detailing the problem.
+     */
+    explicit aggregate_error(const char* what)
+        : std::runtime_error(what) {}
+};
+
+/**
+ * \class Aggregator
+ * \brief Count query/response items grouped by query/response signature
+ * values.
+ *
+ * All the grouping keys are values held in the block query/response
+ * signature table or the class/type table it refers to. So rather
+ * than build a record for each item, items in a block are counted
+ * per signature index, and the counts then folded through the
+ * signature table. Blocks are processed in parallel, each worker
+ * accumulating a partial result that is merged when input is
+ * exhausted.
+ */
+class Aggregator
+{
+public:
+    /**
+     * \enum Key
+     * \brief The available grouping keys.
+     */
+    enum class Key
+    {
+        QTYPE,
+        QCLASS,
+        RCODE,
+        OPCODE,
+        TRANSPORT,
+        SERVER_ADDRESS,
+        SERVER_PORT,
+    };
+
+    /**
+     * \brief Find a grouping key by name.
+     *
+     * \param name the key name.
+     * \returns the key.
+     * \throws aggregate_error if the key name is not recognised.
+     */
+    static Key find_key(const std::string& name);
+
+    /**
+     * \brief Constructor.
+     *
+     * \param keys        the grouping keys.
+     * \param defaults    default values for items not in the file.
+     * \param pseudo_anon pseudo-anonymisation, if to use.
+     * \param filter      query/response filter, if to use.
+     */
+    Aggregator(const std::vector<Key>& keys,
+               const Defaults& defaults,
+               boost::optional<PseudoAnonymise> pseudo_anon = {},
+               boost::optional<QueryResponseFilter> filter = {});
+
+    /**
+     * \brief Aggregate all remaining blocks from a reader.
+     *
+     * The reader must not have a filter applied; any filtering is
+     * done by the aggregator. Blocks are decoded and counted by the
+     * worker threads.
+     *
+     * \param cbr     the reader.
+     * \param threads the number of worker threads to use.
+     */
+    void aggregate(BlockCborReader& cbr, unsigned threads);
+
+    /**
+     * \brief Return the number of items counted.
+     *
+     * \returns the number of items.
+     */
+    uint64_t items() const
+    {
+        return items_;
+    }
+
+    /**
+     * \brief Write the result as CSV.
+     *
+     * Rows are sorted by descending count.
+     *
+     * \param os the output stream.
+     */
+    void write_csv(std::ostream& os) const;
+
+    /**
+     * \brief Write the result as a JSON array of objects.
+     *
+     * Rows are sorted by descending count.
+     *
+     * \param os the output stream.
+     */
+    void write_json(std::ostream& os) const;
+
+private:
+    /**
+     * \brief Values for each grouping key, formatted for output.
+     *
+     * An empty string denotes a missing value.
+     */
+    using GroupKey = std::vector<std::string>;
+
+    /**
+     * \brief Counts for each group.
+     */
+    using Counts = std::map<GroupKey, uint64_t>;
+
+    /**
+     * \brief Aggregate a single block into a partial result.
+     *
+     * \param block   the block.
+     * \param bp      block parameters from the file.
+     * \param version the file format version.
+     * \param filter  the worker's filter, if to use.
+     * \param counts  the partial result.
+     * \returns the number of items counted.
+     */
+    uint64_t aggregate_block(const block_cbor::BlockData& block,
+                             const std::vector<block_cbor::BlockParameters>& bp,
+                             block_cbor::FileFormatVersion version,
+                             boost::optional<QueryResponseFilter>& filter,
+                             Counts& counts) const;
+
+    /**
+     * \brief Determine the group values for a signature.
+     *
+     * \param block   the block.
+     * \param sig     the signature, or <code>nullptr</code> if the item
+     *                has no signature.
+     * \param version the file format version.
+     * \returns the group values.
+     */
+    GroupKey group(const block_cbor::BlockData& block,
+                   const block_cbor::QueryResponseSignature* sig,
+                   block_cbor::FileFormatVersion version) const;
+
+    /**
+     * \brief Return the result sorted by descending count.
+     *
+     * \returns the sorted result.
+     */
+    std::vector<std::pair<GroupKey, uint64_t>> sorted() const;
+
+    /**
+     * \brief the grouping keys.
+     */
+    std::vector<Key> keys_;
+
+    /**
+     * \brief default values.
+     */
+    const Defaults& defaults_;
+
+    /**
+     * \brief pseudo-anonymisation, if to use.
+     */
+    boost::optional<PseudoAnonymise> pseudo_anon_;
+
+    /**
+     * \brief query/response filter, if to use.
+     */
+    boost::optional<QueryResponseFilter> filter_;
+
+    /**
+     * \brief the merged counts.
+     */
+    Counts counts_;
+
+    /**
+     * \brief the total number of items counted.
+     */
+    uint64_t items_;
+};
+
+#endif
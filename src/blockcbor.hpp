@@ -476,6 +476,7 @@ namespace block_cbor {
         pcap_packets,
         pcap_missing_if,
         pcap_missing_os,
+        compactor_sampling_rate,
 
         // Obsolete
         partially_malformed_packets,
@@ -993,6 +994,7 @@ namespace block_cbor {
         BlockStatisticsField::pcap_packets,
         BlockStatisticsField::pcap_missing_if,
         BlockStatisticsField::pcap_missing_os,
+        BlockStatisticsField::compactor_sampling_rate,
     };
 
     /**
@@ -10,6 +10,7 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
 #include <cstdint>
 #include <type_traits>
 
@@ -867,27 +868,27 @@ namespace block_cbor {
             !!query_edns_payload_size + !!query_opt_rdata + !!response_rcode;
 
         enc.writeMapHeader(nitems);
-        enc.write(server_address_index, server_address);
-        enc.write(server_port_index, server_port);
-        enc.write(qr_transport_flags_index, qr_transport_flags);
-        if ( qr_type )
-            enc.write(qr_type_index, qr_type);
-        enc.write(qr_dns_flags_index, dns_flags);
-        enc.write(qr_sig_flags_index, qr_flags);
-        enc.write(query_qd_index, qdcount);
-        enc.write(query_classtype_index, query_classtype);
+        enc.reserve(nitems * CborBaseEncoder::MAX_FIELD_SIZE);
+        enc.writeReserved<server_address_index>(server_address);
+        enc.writeReserved<server_port_index>(server_port);
+        enc.writeReserved<qr_transport_flags_index>(qr_transport_flags);
+        enc.writeReserved<qr_type_index>(qr_type);
+        enc.writeReserved<qr_dns_flags_index>(dns_flags);
+        enc.writeReserved<qr_sig_flags_index>(qr_flags);
+        enc.writeReserved<query_qd_index>(qdcount);
+        enc.writeReserved<query_classtype_index>(query_classtype);
         if ( query_rcode )
-            enc.write(query_rcode_index, static_cast<unsigned>(*query_rcode));
+            enc.writeReserved<query_rcode_index>(static_cast<unsigned>(*query_rcode));
         if ( query_opcode )
-            enc.write(query_opcode_index, static_cast<unsigned>(*query_opcode));
-        enc.write(query_an_index, query_ancount);
-        enc.write(query_ar_index, query_arcount);
-        enc.write(query_ns_index, query_nscount);
-        enc.write(edns_version_index, query_edns_version);
-        enc.write(udp_buf_size_index, query_edns_payload_size);
-        enc.write(opt_rdata_index, query_opt_rdata);
+            enc.writeReserved<query_opcode_index>(static_cast<unsigned>(*query_opcode));
+        enc.writeReserved<query_an_index>(query_ancount);
+        enc.writeReserved<query_ar_index>(query_arcount);
+        enc.writeReserved<query_ns_index>(query_nscount);
+        enc.writeReserved<edns_version_index>(query_edns_version);
+        enc.writeReserved<udp_buf_size_index>(query_edns_payload_size);
+        enc.writeReserved<opt_rdata_index>(query_opt_rdata);
         if ( response_rcode )
-            enc.write(response_rcode_index, static_cast<unsigned>(*response_rcode));
+            enc.writeReserved<response_rcode_index>(static_cast<unsigned>(*response_rcode));
     }
 
     std::size_t hash_value(const QueryResponseSignature& qs)
@@ -1125,19 +1126,22 @@ namespace block_cbor {
         constexpr int query_extended_index = find_query_response_index(QueryResponseField::query_extended);
         constexpr int response_extended_index = find_query_response_index(QueryResponseField::response_extended);
 
+        // All the fixed fields are integers, so reserve space for
+        // them all and write them without further checks.
         enc.writeMapHeader();
+        enc.reserve(10 * CborBaseEncoder::MAX_FIELD_SIZE);
         if ( tstamp )
-            enc.write(time_index, std::chrono::duration_cast<std::chrono::nanoseconds>(*tstamp - earliest_time).count() * block_parameters.storage_parameters.ticks_per_second / NS_PER_SEC);
-        enc.write(client_address_index, client_address);
-        enc.write(client_port_index, client_port);
-        enc.write(transaction_id_index, id);
-        enc.write(qr_signature_index, signature);
-        enc.write(client_hoplimit_index, hoplimit);
+            enc.writeReserved<time_index>(std::chrono::duration_cast<std::chrono::nanoseconds>(*tstamp - earliest_time).count() * block_parameters.storage_parameters.ticks_per_second / NS_PER_SEC);
+        enc.writeReserved<client_address_index>(client_address);
+        enc.writeReserved<client_port_index>(client_port);
+        enc.writeReserved<transaction_id_index>(id);
+        enc.writeReserved<qr_signature_index>(signature);
+        enc.writeReserved<client_hoplimit_index>(hoplimit);
         if ( response_delay )
-            enc.write(delay_index, response_delay->count() * block_parameters.storage_parameters.ticks_per_second / NS_PER_SEC);
-        enc.write(query_name_index, qname);
-        enc.write(query_size_index, query_size);
-        enc.write(response_size_index, response_size);
+            enc.writeReserved<delay_index>(response_delay->count() * block_parameters.storage_parameters.ticks_per_second / NS_PER_SEC);
+        enc.writeReserved<query_name_index>(qname);
+        enc.writeReserved<query_size_index>(query_size);
+        enc.writeReserved<response_size_index>(response_size);
 
         if ( query_extra_info )
             writeExtraInfo(enc, query_extended_index, *query_extra_info);
@@ -1651,6 +1655,10 @@ namespace block_cbor {
                 last_packet_statistics.pcap_drop_count += dec.read_unsigned();
                 break;
 
+            case BlockStatisticsField::compactor_sampling_rate:
+                last_packet_statistics.sampling_rate = dec.read_unsigned();
+                break;
+
             default:
                 dec.skip();
                 break;
@@ -1867,6 +1875,7 @@ namespace block_cbor {
         constexpr int pcap_packets_index = find_block_statistics_index(BlockStatisticsField::pcap_packets);
         constexpr int pcap_missing_if_index = find_block_statistics_index(BlockStatisticsField::pcap_missing_if);
         constexpr int pcap_missing_os_index = find_block_statistics_index(BlockStatisticsField::pcap_missing_os);
+        constexpr int sampling_rate_index = find_block_statistics_index(BlockStatisticsField::compactor_sampling_rate);
 
         enc.writeMapHeader();
         enc.write(processed_messages_index);
@@ -1905,6 +1914,15 @@ namespace block_cbor {
         enc.write(last_packet_statistics.pcap_ifdrop_count - start_packet_statistics.pcap_ifdrop_count);
         enc.write(pcap_missing_os_index);
         enc.write(last_packet_statistics.pcap_drop_count - start_packet_statistics.pcap_drop_count);
+        // Sampling may have started or stopped during the block; record
+        // the rate if it was active at either end.
+        uint64_t sampling_rate = std::max(start_packet_statistics.sampling_rate,
+                                          last_packet_statistics.sampling_rate);
+        if ( sampling_rate > 0 )
+        {
+            enc.write(sampling_rate_index);
+            enc.write(sampling_rate);
+        }
         enc.writeBreak();
     }
 
@@ -46,14 +46,16 @@ namespace
 BlockCborReader::BlockCborReader(CborBaseDecoder& dec,
                                  Configuration& config,
                                  const Defaults& defaults,
-                                 boost::optional<PseudoAnonymise> pseudo_anon)
+                                 boost::optional<PseudoAnonymise> pseudo_anon,
+                                 boost::optional<QueryResponseFilter> filter)
     : dec_(dec),
       defaults_(defaults),
       next_item_(0),
       need_block_(true),
       file_format_version_(block_cbor::FileFormatVersion::format_10),
       current_block_num_(0),
-      pseudo_anon_(pseudo_anon)
+      pseudo_anon_(pseudo_anon),
+      filter_(filter)
 {
     readFileHeader(config);
     block_ = make_unique<block_cbor::BlockData>(block_parameters_, file_format_version_);
@@ -405,6 +407,7 @@ bool BlockCborReader::readBlock()
 
     block_->clear();
     block_->readCbor(dec_, *fields_);
+    reset_block_memo();
 
     // If any block does not have an end time, there is no end time.
     // Otherwise it's the latest of the end times.
@@ -439,20 +442,66 @@ bool BlockCborReader::readBlock()
     next_item_ = 0;
     need_block_ = (block_->query_response_items.size() == next_item_);
     current_block_num_++;
+
+    // Check the filter against the block tables. If nothing can
+    // match, skip the block without looking at any items.
+    if ( !need_block_ && filter_ &&
+         !filter_->select_block(*block_,
+                                block_parameters_[block_->block_parameters_index].storage_parameters,
+                                defaults_,
+                                file_format_version_) )
+        need_block_ = true;
+
     return true;
 }
 
+bool BlockCborReader::readRawBlock(byte_string& raw)
+{
+    if ( blocks_indef_ )
+    {
+        if ( dec_.type() == CborBaseDecoder::TYPE_BREAK )
+        {
+            dec_.readBreak();
+            return false;
+        }
+    }
+    else if ( nblocks_ == 0 )
+        return false;
+    else
+        --nblocks_;
+
+    dec_.read_raw(raw);
+    current_block_num_++;
+    return true;
+}
+
+std::shared_ptr<block_cbor::BlockData> BlockCborReader::decodeBlock(const byte_string& raw) const
+{
+    auto res = std::make_shared<block_cbor::BlockData>(block_parameters_, file_format_version_);
+    CborBufferDecoder dec(raw);
+    res->readCbor(dec, *fields_);
+    return res;
+}
+
 QueryResponseData BlockCborReader::readQRData(bool& eof)
 {
     QueryResponseData res{};
 
     eof = false;
-    while ( need_block_ )
-        if ( !readBlock() )
-        {
-            eof = true;
-            return res;
-        }
+    for (;;)
+    {
+        while ( need_block_ )
+            if ( !readBlock() )
+            {
+                eof = true;
+                return res;
+            }
+
+        if ( !filter_ || filter_->accept(block_->query_response_items[next_item_]) )
+            break;
+
+        need_block_ = (block_->query_response_items.size() == ++next_item_);
+    }
 
     const block_cbor::QueryResponseItem& qri = block_->query_response_items[next_item_];
     need_block_ = (block_->query_response_items.size() == ++next_item_);
@@ -535,13 +584,7 @@ QueryResponseData BlockCborReader::readQRData(bool& eof)
     res.query_edns_version = ( sig->query_edns_version ) ? sig->query_edns_version : defaults_.query_edns_version;
     res.query_edns_payload_size = ( sig->query_edns_payload_size ) ? sig->query_edns_payload_size : defaults_.query_udp_size;
     if ( sig->query_opt_rdata )
-    {
-        res.query_opt_rdata = block_->names_rdatas[*sig->query_opt_rdata].str;
-#if ENABLE_PSEUDOANONYMISATION
-        if ( pseudo_anon_ )
-            res.query_opt_rdata = pseudo_anon_->edns0(block_->names_rdatas[*sig->query_opt_rdata].str);
-#endif
-    }
+        res.query_opt_rdata = get_block_opt_rdata(*sig->query_opt_rdata);
     else
         res.query_opt_rdata = defaults_.query_opt_rdata;
     res.query_size = ( qri.query_size ) ? qri.query_size : defaults_.query_size;
@@ -705,7 +748,7 @@ IPAddress BlockCborReader::get_client_address(std::size_t index, boost::optional
     else
         ipv6 = (*transport_flags & block_cbor::IPV6);
 
-    return string_to_addr(addr_b, ipv6);
+    return get_block_address(index, addr_b, ipv6);
 }
 
 bool BlockCborReader::is_ipv4_server_full_address(const byte_string& b) const
@@ -736,7 +779,42 @@ IPAddress BlockCborReader::get_server_address(std::size_t index, boost::optional
     else
         ipv6 = (*transport_flags & block_cbor::IPV6);
 
-    return string_to_addr(addr_b, ipv6);
+    return get_block_address(index, addr_b, ipv6);
+}
+
+const IPAddress& BlockCborReader::get_block_address(std::size_t index, const byte_string& addr_b, bool ipv6)
+{
+    // index has already been checked by the table lookup for addr_b.
+    boost::optional<IPAddress>& memo = address_memo_[ipv6 ? 1 : 0][index];
+    if ( !memo )
+        memo = string_to_addr(addr_b, ipv6);
+    return *memo;
+}
+
+const byte_string& BlockCborReader::get_block_opt_rdata(std::size_t index)
+{
+    const byte_string& rdata = block_->names_rdatas[index].str;
+
+#if ENABLE_PSEUDOANONYMISATION
+    if ( pseudo_anon_ )
+    {
+        boost::optional<byte_string>& memo = opt_rdata_memo_[index];
+        if ( !memo )
+            memo = pseudo_anon_->edns0(rdata);
+        return *memo;
+    }
+#endif
+
+    return rdata;
+}
+
+void BlockCborReader::reset_block_memo()
+{
+    // Table indexes may be zero or one based, so allow for either.
+    for ( auto& memo : address_memo_ )
+        memo.assign(block_->ip_addresses.size() + 1, boost::none);
+    if ( pseudo_anon_ )
+        opt_rdata_memo_.assign(block_->names_rdatas.size() + 1, boost::none);
 }
 
 uint8_t BlockCborReader::synthesise_qr_flags(const block_cbor::QueryResponseItem& qri,
@@ -27,6 +27,7 @@
 #include "blockcbordata.hpp"
 #include "configuration.hpp"
 #include "pseudoanonymise.hpp"
+#include "qrfilter.hpp"
 #include "queryresponse.hpp"
 
 /**
@@ -318,11 +319,13 @@ public:
      * \param config            the configuration.
      * \param defaults          default values.
      * \param pseudo_anon       pseudo-anonymisation, if to use.
+     * \param filter            query/response filter, if to use.
      */
     BlockCborReader(CborBaseDecoder& dec,
                     Configuration& config,
                     const Defaults& defaults,
-                    boost::optional<PseudoAnonymise> pseudo_anon ={});
+                    boost::optional<PseudoAnonymise> pseudo_anon ={},
+                    boost::optional<QueryResponseFilter> filter ={});
 
     /**
      * \brief Return the data for the next Query/Response pair.
@@ -336,6 +339,51 @@ public:
      */
     QueryResponseData readQRData(bool& eof);
 
+    /**
+     * \brief Read the encoding of the next block without decoding it.
+     *
+     * This allows blocks to be decoded with <code>decodeBlock()</code>
+     * on other threads. Finding the end of a block is much cheaper
+     * than decoding it. Block times and address event counts are not
+     * accumulated from blocks read this way. It must not be mixed with
+     * calls to <code>readQRData()</code>.
+     *
+     * \param raw returns the encoded block.
+     * \returns <code>false</code> at end of input.
+     */
+    bool readRawBlock(byte_string& raw);
+
+    /**
+     * \brief Decode a block read by <code>readRawBlock()</code>.
+     *
+     * This may be called from several threads at once.
+     *
+     * \param raw the encoded block.
+     * \returns the block.
+     * \throws cbor_decode_error if the CBOR is invalid.
+     */
+    std::shared_ptr<block_cbor::BlockData> decodeBlock(const byte_string& raw) const;
+
+    /**
+     * \brief Return the block parameters read from the file.
+     *
+     * \returns the block parameters.
+     */
+    const std::vector<block_cbor::BlockParameters>& block_parameters() const
+    {
+        return block_parameters_;
+    }
+
+    /**
+     * \brief Return the file format version.
+     *
+     * \returns the file format version.
+     */
+    block_cbor::FileFormatVersion file_format_version() const
+    {
+        return file_format_version_;
+    }
+
     /**
      * \brief Dump the statistics for the block to the stream provided
      *
@@ -345,6 +393,18 @@ public:
         block_->last_packet_statistics.dump_stats(os);
     }
 
+    /**
+     * \brief Dump the query/response filter statistics to the stream provided.
+     *
+     * Nothing is written if no filter is in use.
+     *
+     * \param os output stream.
+     */
+    void dump_filter_stats(std::ostream& os) const {
+        if ( filter_ )
+            filter_->dump_stats(os);
+    }
+
     /**
      * \brief Dump information on the collector to the stream provided.
      *
@@ -463,6 +523,35 @@ private:
      */
     IPAddress get_server_address(std::size_t index, boost::optional<uint8_t> transport_flags);
 
+    /**
+     * \brief Get the address for an entry in the current block address table.
+     *
+     * The address, pseudo-anonymised if required, is calculated only
+     * once per block for each table entry and family.
+     *
+     * \param index  the address table index.
+     * \param addr_b the table entry.
+     * \param ipv6   <code>true</code> if the address is IPv6.
+     * \returns the address.
+     */
+    const IPAddress& get_block_address(std::size_t index, const byte_string& addr_b, bool ipv6);
+
+    /**
+     * \brief Get the query OPT RDATA for an entry in the current block name/RDATA table.
+     *
+     * If pseudo-anonymising, the pseudo-anonymised RDATA is calculated
+     * only once per block for each table entry.
+     *
+     * \param index the name/RDATA table index.
+     * \returns the OPT RDATA.
+     */
+    const byte_string& get_block_opt_rdata(std::size_t index);
+
+    /**
+     * \brief Reset the derived values memoised for the current block.
+     */
+    void reset_block_memo();
+
     /**
      * \brief Determine if client prefix means a full IPv4 address.
      *
@@ -565,6 +654,20 @@ private:
      */
     std::unique_ptr<block_cbor::BlockData> block_;
 
+    /**
+     * \brief addresses derived from the current block address table.
+     *
+     * Indexed by the table index, with IPv4 interpretations in the first
+     * vector and IPv6 in the second.
+     */
+    std::vector<boost::optional<IPAddress>> address_memo_[2];
+
+    /**
+     * \brief pseudo-anonymised OPT RDATA derived from the current block
+     * name/RDATA table.
+     */
+    std::vector<boost::optional<byte_string>> opt_rdata_memo_;
+
     /**
      * \brief the number of the current block
      */
@@ -590,6 +693,11 @@ private:
      */
     boost::optional<PseudoAnonymise> pseudo_anon_;
 
+    /**
+     * \brief query/response filter, if to use.
+     */
+    boost::optional<QueryResponseFilter> filter_;
+
     /**
      * \brief accumulated address events from the file.
      */
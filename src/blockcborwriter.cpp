@@ -26,6 +26,7 @@
 #include "blockcbordata.hpp"
 #include "blockcborwriter.hpp"
 #include "log.hpp"
+#include "stagetimes.hpp"
 
 namespace {
     byte_string addr_to_string(const IPAddress& addr, const Configuration& config, bool is_client = true)
@@ -52,7 +53,8 @@ BlockCborWriter::BlockCborWriter(const Configuration& config,
       enc_(std::move(enc)),
       live_(live),
       query_response_(), ext_rr_(nullptr), ext_group_(nullptr),
-      last_end_block_statistics_(), need_start_block_stats_(true)
+      last_end_block_statistics_(), need_start_block_stats_(true),
+      record_start_(0)
 {
     block_cbor::BlockParameters bp;
     config.populate_block_parameters(bp);
@@ -123,12 +125,24 @@ void BlockCborWriter::startRecord(const std::shared_ptr<QueryResponse>& qr)
     }
     query_response_.clear();
     clear_in_progress_extra_info();
+    record_start_ = StageTimes::enabled() ? StageTimes::now() : 0;
 }
 
-void BlockCborWriter::endRecord(const std::shared_ptr<QueryResponse>&)
+void BlockCborWriter::endRecord(const std::shared_ptr<QueryResponse>& qr)
 {
     data_->query_response_items.push_back(std::move(query_response_));
     query_response_.clear();
+
+    if ( record_start_ )
+    {
+        StageTimes::record(StageTimes::Stage::BLOCK_BUILD, StageTimes::now() - record_start_);
+        record_start_ = 0;
+
+        // Packet timestamps are only comparable with the current
+        // time when capturing live.
+        if ( live_ )
+            block_timestamps_.push_back(qr->timestamp());
+    }
 }
 
 void BlockCborWriter::writeBasic(const std::shared_ptr<QueryResponse>& qr,
@@ -393,7 +407,20 @@ void BlockCborWriter::writeFileFooter()
 void BlockCborWriter::writeBlock()
 {
     data_->last_packet_statistics = last_end_block_statistics_;
+    uint64_t start = StageTimes::enabled() ? StageTimes::now() : 0;
     data_->writeCbor(*enc_);
+    uint64_t encoded = start ? StageTimes::now() : 0;
+    // Hand the whole encoded block to the output in one write, so
+    // the output size used for rotation is exact.
+    enc_->flush();
+    if ( start )
+    {
+        StageTimes::record(StageTimes::Stage::ENCODE, encoded - start);
+        StageTimes::record(StageTimes::Stage::WRITE, StageTimes::now() - encoded);
+    }
+    for ( const auto& ts : block_timestamps_ )
+        StageTimes::record_since(StageTimes::Stage::END_TO_END, ts);
+    block_timestamps_.clear();
     data_->clear();
     need_start_block_stats_ = true;
 }
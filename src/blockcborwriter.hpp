@@ -16,6 +16,7 @@
 #include <chrono>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "baseoutputwriter.hpp"
 #include "cborencoder.hpp"
@@ -267,6 +268,17 @@ private:
      */
     bool need_start_block_stats_;
 
+    /**
+     * \brief when the current record was started, if stage timing is enabled.
+     */
+    uint64_t record_start_;
+
+    /**
+     * \brief timestamps of the records in the current block, if
+     * stage timing is enabled during live capture.
+     */
+    std::vector<std::chrono::system_clock::time_point> block_timestamps_;
+
     /**
      * \brief Clear in-progress extras info.
      */
@@ -317,6 +317,25 @@ void CborBaseDecoder::skip()
     }
 }
 
+void CborBaseDecoder::read_raw(byte_string& raw)
+{
+    needRead();
+    raw.clear();
+    capture_ = &raw;
+    capture_start_ = p_;
+    try
+    {
+        skip();
+    }
+    catch (...)
+    {
+        capture_ = nullptr;
+        throw;
+    }
+    raw.append(capture_start_, p_);
+    capture_ = nullptr;
+}
+
 void CborBaseDecoder::read_type_unsigned(unsigned& major, unsigned& minor, uint64_t& value)
 {
     major_minor(major, minor);
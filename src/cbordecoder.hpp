@@ -95,7 +95,8 @@ public:
      * \brief Constructor.
      */
     CborBaseDecoder()
-        : buf_(), bufend_(&buf_[0]), p_(bufend_) {}
+        : buf_(), bufend_(&buf_[0]), p_(bufend_),
+          capture_(nullptr), capture_start_(nullptr) {}
 
     /**
      * \brief Returns the type of the current basic CBOR record.
@@ -269,6 +270,18 @@ public:
      */
     void skip();
 
+    /**
+     * \brief Read the encoding of the current CBOR item.
+     *
+     * The item is not decoded, but its encoding is copied so it
+     * can be decoded later, for example with a CborBufferDecoder.
+     * Reading moves on the next CBOR item.
+     *
+     * \param raw returns the encoded item.
+     * \throws cbor_decode_error if the CBOR is invalid.
+     */
+    void read_raw(byte_string& raw);
+
 protected:
     /**
      * Read more CBOR input values into the buffer.
@@ -318,9 +331,12 @@ private:
     {
         if ( p_ == bufend_ )
         {
+            if ( capture_ )
+                capture_->append(capture_start_, bufend_);
             unsigned nread = readBytes(buf_, sizeof(buf_));
             p_ = &buf_[0];
             bufend_ = &buf_[nread];
+            capture_start_ = p_;
         }
     }
 
@@ -364,6 +380,16 @@ private:
      * \brief Pointer to the current buffer position.
      */
     uint8_t* p_;
+
+    /**
+     * \brief Where to copy input as it is read, if anywhere.
+     */
+    byte_string* capture_;
+
+    /**
+     * \brief The start of buffer contents not yet copied.
+     */
+    uint8_t* capture_start_;
 };
 
 /**
@@ -405,4 +431,51 @@ protected:
     std::istream& is_;
 };
 
+/**
+ * \class CborBufferDecoder
+ * \brief A class for decoding basic CBOR values from memory.
+ */
+class CborBufferDecoder : public CborBaseDecoder
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * The buffer must remain valid while the decoder is used.
+     *
+     * \param buf the CBOR encoding.
+     */
+    explicit CborBufferDecoder(const byte_string& buf)
+        : input_(buf), pos_(0) {}
+
+protected:
+    /**
+     * Read more CBOR input values into the buffer.
+     *
+     * \param p       pointer to the buffer.
+     * \param n_bytes maximum number of bytes to read.
+     * \return the number of bytes read.
+     * \throws cbor_end_of_input when at the end of the buffer.
+     */
+    virtual unsigned readBytes(uint8_t* p, std::ptrdiff_t n_bytes)
+    {
+        if ( pos_ == input_.size() )
+            throw cbor_end_of_input();
+
+        std::size_t n = input_.copy(p, n_bytes, pos_);
+        pos_ += n;
+        return n;
+    }
+
+    /**
+     * \brief The CBOR encoding.
+     */
+    const byte_string& input_;
+
+    /**
+     * \brief The current read position.
+     */
+    std::size_t pos_;
+};
+
 #endif
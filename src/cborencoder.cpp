@@ -10,72 +10,24 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
-#include <limits>
 
 #include "cborencoder.hpp"
 #include "log.cpp"
 
-void CborBaseEncoder::writeTypeValue(unsigned cbor_type, unsigned long value)
+void CborBaseEncoder::grow(std::size_t n_bytes)
 {
-    if ( value < 24 )
-        writeByte((cbor_type << 5) | value);
-    else if ( value <= std::numeric_limits<uint8_t>::max() )
-    {
-        writeByte((cbor_type << 5) | 24);
-        writeByte(value);
-    }
-    else if ( value <= std::numeric_limits<uint16_t>::max() )
-    {
-        writeByte((cbor_type << 5) | 25);
-        writeByte(value >> 8);
-        writeByte(value);
-    }
-    else
-    {
-        writeByte((cbor_type << 5) | 26);
-        writeByte(value >> 24);
-        writeByte(value >> 16);
-        writeByte(value >> 8);
-        writeByte(value);
-    }
-}
+    if ( bytes_buffered() >= FLUSH_THRESHOLD )
+        flush();
 
-void CborBaseEncoder::writeTypeValue64(unsigned cbor_type, unsigned long long value)
-{
-    if ( value < 24 )
-        writeByte((cbor_type << 5) | value);
-    else if ( value <= std::numeric_limits<uint8_t>::max() )
-    {
-        writeByte((cbor_type << 5) | 24);
-        writeByte(value);
-    }
-    else if ( value <= std::numeric_limits<uint16_t>::max() )
-    {
-        writeByte((cbor_type << 5) | 25);
-        writeByte(value >> 8);
-        writeByte(value);
-    }
-    else if ( value <= std::numeric_limits<uint32_t>::max() )
-    {
-        writeByte((cbor_type << 5) | 26);
-        writeByte(value >> 24);
-        writeByte(value >> 16);
-        writeByte(value >> 8);
-        writeByte(value);
-    }
-    else
+    std::size_t used = bytes_buffered();
+    if ( buf_.size() - used < n_bytes )
     {
-        writeByte((cbor_type << 5) | 27);
-        writeByte(value >> 56);
-        writeByte(value >> 48);
-        writeByte(value >> 40);
-        writeByte(value >> 32);
-        writeByte(value >> 24);
-        writeByte(value >> 16);
-        writeByte(value >> 8);
-        writeByte(value);
+        buf_.resize(std::max(buf_.size() * 2, used + n_bytes));
+        p_ = buf_.data() + used;
+        end_ = buf_.data() + buf_.size();
     }
 }
 
@@ -158,15 +110,13 @@ void CborBaseEncoder::write(const char* str, bool is_text)
 void CborBaseEncoder::write(const std::string& str, bool is_text)
 {
     writeTypeValue(is_text ? 3 : 2, str.size());
-    for ( auto c : str )
-        writeByte(c);
+    writeBytesToBuffer(str.data(), str.size());
 }
 
 void CborBaseEncoder::write(const byte_string& str)
 {
     writeTypeValue(2, str.size());
-    for ( auto c : str )
-        writeByte(c);
+    writeBytesToBuffer(str.data(), str.size());
 }
 
 void CborBaseEncoder::writeArrayHeader(unsigned int array_size)
@@ -23,6 +23,7 @@
 #include <mutex>
 #include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 #include <boost/optional.hpp>
@@ -30,6 +31,7 @@
 #include "bytestring.hpp"
 #include "log.hpp"
 #include "makeunique.hpp"
+#include "stagetimes.hpp"
 #include "streamwriter.hpp"
 #include "util.hpp"
 
@@ -42,15 +44,66 @@
  * CBOR is written to an internal buffer for efficiency. When the buffer
  * should be flushed, `writeBytes()` is called to write the output.
  *
+ * The buffer grows as needed and is reused after each flush, so a
+ * writer that flushes once per block hands each whole encoded block
+ * to `writeBytes()` in a single call. To bound memory use if output
+ * is not flushed, the buffer is flushed early if it exceeds
+ * <code>FLUSH_THRESHOLD</code>.
+ *
  * [cbor]: http://cbor.io "CBOR website"
  */
 class CborBaseEncoder
 {
 public:
+    /**
+     * \brief The maximum encoded size of an integer value.
+     */
+    static constexpr std::size_t MAX_INTEGER_SIZE = 9;
+
+    /**
+     * \brief The maximum encoded size of a constant key and integer value.
+     */
+    static constexpr std::size_t MAX_FIELD_SIZE = 1 + MAX_INTEGER_SIZE;
+
+    /**
+     * \brief The initial size of the output buffer.
+     */
+    static constexpr std::size_t INITIAL_BUFFER_SIZE = 64 * 1024;
+
+    /**
+     * \brief Buffered output size above which output is flushed early.
+     */
+    static constexpr std::size_t FLUSH_THRESHOLD = 64 * 1024 * 1024;
+
+    /**
+     * \brief The encoding of a constant map key.
+     *
+     * C-DNS map keys are small integers, positive for standard fields
+     * and negative for implementation fields. Those in the range -24 to
+     * 23 encode as a single byte, computed at compile time.
+     */
+    template<int Index>
+    struct Key
+    {
+        static_assert(Index >= -24 && Index < 24, "map key must encode as a single byte");
+
+        /**
+         * \brief the encoded key.
+         */
+        static constexpr uint8_t byte =
+            ( Index < 0 ) ? ( ( 1 << 5 ) | ( -1 - Index ) ) : Index;
+    };
+
     /**
      * \brief The default constructor.
      */
-    CborBaseEncoder() : buf_(), p_(&buf_[0]) {}
+    CborBaseEncoder()
+        : buf_(INITIAL_BUFFER_SIZE), p_(buf_.data()), end_(buf_.data() + buf_.size()) {}
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~CborBaseEncoder() {}
 
     /**
      * \brief Write optional values.
@@ -223,6 +276,50 @@ public:
      */
     void writeBreak();
 
+    /**
+     * \brief Ensure there is space for output without further checks.
+     *
+     * Record encoders reserve the worst case size of a run of fields
+     * once, and then write them with writeReserved().
+     *
+     * \param n_bytes the space required.
+     */
+    void reserve(std::size_t n_bytes)
+    {
+        if ( static_cast<std::size_t>(end_ - p_) < n_bytes )
+            grow(n_bytes);
+    }
+
+    /**
+     * \brief Write constant index and integer value to reserved space.
+     *
+     * There must be at least <code>MAX_FIELD_SIZE</code> bytes
+     * reserved with reserve().
+     *
+     * \param value the value to write.
+     */
+    template<int Index, typename T>
+    void writeReserved(const T& value)
+    {
+        *p_++ = Key<Index>::byte;
+        putValue(value);
+    }
+
+    /**
+     * \brief Write constant index and optional integer value to reserved space.
+     *
+     * If there is no value, write nothing. Otherwise there must be at
+     * least <code>MAX_FIELD_SIZE</code> bytes reserved with reserve().
+     *
+     * \param value the value to write.
+     */
+    template<int Index, typename T>
+    void writeReserved(const boost::optional<T>& value)
+    {
+        if ( value )
+            writeReserved<Index>(*value);
+    }
+
     /**
      * \brief Force writing of any accumulated output.
      */
@@ -230,13 +327,21 @@ public:
     {
         // Writing zero length output may be a problem if a filter on
         // the underlying stream is closed.
-        if ( p_ != buf_ )
+        if ( p_ != buf_.data() )
         {
-            writeBytes(buf_, p_ - buf_);
-            p_ = buf_;
+            writeBytes(buf_.data(), p_ - buf_.data());
+            p_ = buf_.data();
         }
     }
 
+    /**
+     * \brief Return the number of bytes of output not yet flushed.
+     */
+    std::size_t bytes_buffered() const
+    {
+        return p_ - buf_.data();
+    }
+
 protected:
     /**
      * \brief Write all output accumulated in the buffer.
@@ -253,7 +358,11 @@ private:
      * \param cbor_type the CBOR major type.
      * \param value     additional information value.
      */
-    void writeTypeValue(unsigned cbor_type, unsigned long value);
+    void writeTypeValue(unsigned cbor_type, unsigned long value)
+    {
+        reserve(MAX_INTEGER_SIZE);
+        putTypeValue(cbor_type, value);
+    }
 
     /**
      * \brief Write a basic CBOR major type and unsigned 64bit value.
@@ -261,7 +370,105 @@ private:
      * \param cbor_type the CBOR major type.
      * \param value     additional information value.
      */
-    void writeTypeValue64(unsigned cbor_type, unsigned long long value);
+    void writeTypeValue64(unsigned cbor_type, unsigned long long value)
+    {
+        reserve(MAX_INTEGER_SIZE);
+        putTypeValue64(cbor_type, value);
+    }
+
+    /**
+     * \brief Put a basic CBOR major type and unsigned 32bit value
+     *        into reserved space.
+     *
+     * \param cbor_type the CBOR major type.
+     * \param value     additional information value.
+     */
+    void putTypeValue(unsigned cbor_type, unsigned long value)
+    {
+        uint8_t type = cbor_type << 5;
+
+        if ( value < 24 )
+            *p_++ = type | value;
+        else if ( value <= 0xff )
+        {
+            p_[0] = type | 24;
+            p_[1] = value;
+            p_ += 2;
+        }
+        else if ( value <= 0xffff )
+        {
+            p_[0] = type | 25;
+            p_[1] = value >> 8;
+            p_[2] = value;
+            p_ += 3;
+        }
+        else
+        {
+            p_[0] = type | 26;
+            p_[1] = value >> 24;
+            p_[2] = value >> 16;
+            p_[3] = value >> 8;
+            p_[4] = value;
+            p_ += 5;
+        }
+    }
+
+    /**
+     * \brief Put a basic CBOR major type and unsigned 64bit value
+     *        into reserved space.
+     *
+     * \param cbor_type the CBOR major type.
+     * \param value     additional information value.
+     */
+    void putTypeValue64(unsigned cbor_type, unsigned long long value)
+    {
+        if ( value <= 0xffffffff )
+            putTypeValue(cbor_type, value);
+        else
+        {
+            *p_++ = ( cbor_type << 5 ) | 27;
+            for ( int shift = 56; shift >= 0; shift -= 8 )
+                *p_++ = value >> shift;
+        }
+    }
+
+    /**
+     * \brief Put an unsigned integer value into reserved space.
+     *
+     * \param value the value.
+     */
+    template<typename T>
+    typename std::enable_if<std::is_unsigned<T>::value && !std::is_same<T, bool>::value>::type putValue(T value)
+    {
+        if ( std::is_same<T, unsigned long long>::value )
+            putTypeValue64(0, value);
+        else
+            putTypeValue(0, value);
+    }
+
+    /**
+     * \brief Put a signed integer value into reserved space.
+     *
+     * \param value the value.
+     */
+    template<typename T>
+    typename std::enable_if<std::is_signed<T>::value>::type putValue(T value)
+    {
+        if ( std::is_same<T, long long>::value )
+        {
+            if ( value < 0 )
+                putTypeValue64(1, static_cast<unsigned long long>(-1 - value));
+            else
+                putTypeValue64(0, static_cast<unsigned long long>(value));
+        }
+        else
+        {
+            if ( value < 0 )
+                putTypeValue(1, static_cast<unsigned long>(-1 - value));
+            else
+                putTypeValue(0, static_cast<unsigned long>(value));
+        }
+    }
 
     /**
      * \brief Output a single encoder output byte to the internal buffer.
@@ -270,20 +477,48 @@ private:
      */
     void writeByte(uint8_t byte)
     {
+        if ( p_ == end_ )
+            grow(1);
         *p_++ = byte;
-        if ( p_ == &buf_[sizeof(buf_)] )
-            flush();
     }
 
+    /**
+     * \brief Output bytes to the internal buffer.
+     *
+     * \param p       pointer to the bytes.
+     * \param n_bytes number of bytes.
+     */
+    void writeBytesToBuffer(const void* p, std::size_t n_bytes)
+    {
+        reserve(n_bytes);
+        std::memcpy(p_, p, n_bytes);
+        p_ += n_bytes;
+    }
+
+    /**
+     * \brief Make space in the buffer.
+     *
+     * If the buffered output exceeds the flush threshold, flush it.
+     * Then enlarge the buffer if there is still not enough space.
+     *
+     * \param n_bytes the space required.
+     */
+    void grow(std::size_t n_bytes);
+
     /**
      * \brief Buffer to accumulate output.
      */
-    uint8_t buf_[2048];
+    std::vector<uint8_t> buf_;
 
     /**
      * \brief Next output position in buffer.
      */
     uint8_t *p_;
+
+    /**
+     * \brief End of buffer.
+     */
+    uint8_t *end_;
 };
 
 /**
@@ -497,6 +732,16 @@ public:
      * compression done by this pool.
      */
     virtual const char* suggested_extension() = 0;
+
+    /**
+     * \brief Return the number of compressions in progress.
+     */
+    virtual unsigned active_threads() = 0;
+
+    /**
+     * \brief Return the maximum number of compressions in progress at once.
+     */
+    virtual unsigned max_threads() = 0;
 };
 
 /**
@@ -653,6 +898,23 @@ public:
         return Writer::suggested_extension();
     }
 
+    /**
+     * \brief Return the number of compressions in progress.
+     */
+    virtual unsigned active_threads()
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return nthreads_;
+    }
+
+    /**
+     * \brief Return the maximum number of compressions in progress at once.
+     */
+    virtual unsigned max_threads()
+    {
+        return max_threads_;
+    }
+
 private:
     /**
      * \brief Compression thread function.
@@ -677,6 +939,7 @@ private:
                 throw std::runtime_error("Can't open file " + input);
             ifs.exceptions(std::ifstream::badbit);
 
+            uint64_t start = StageTimes::enabled() ? StageTimes::now() : 0;
             {
                 Writer writer(output, level_, logging_);
                 uint8_t buf[OUTPUT_BUFFER_SIZE];
@@ -689,6 +952,8 @@ private:
             }
 
             ifs.close();
+            if ( start )
+                StageTimes::record(StageTimes::Stage::COMPRESS, StageTimes::now() - start);
             if ( !abort_)
             {
                 if (logging_)
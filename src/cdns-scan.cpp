@@ -0,0 +1,537 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+#include <boost/program_options.hpp>
+
+#include "config.h"
+
+#include "bytestring.hpp"
+#include "capturedns.hpp"
+#include "columnar.hpp"
+#include "ipaddress.hpp"
+#include "log.hpp"
+
+const std::string PROGNAME = "cdns-scan";
+
+namespace po = boost::program_options;
+
+/**
+ * \brief The maximum number of group-by keys.
+ */
+const std::size_t MAX_KEYS = 4;
+
+/**
+ * \brief Key value for absent values.
+ */
+const uint64_t NULL_KEY = ~uint64_t(0);
+
+/**
+ * \enum KeyType
+ * \brief The items that can be grouped by.
+ */
+enum class KeyType
+{
+    QTYPE,
+    QCLASS,
+    RCODE,
+    OPCODE,
+    TRANSPORT,
+    CLIENT_PREFIX,
+    SERVER_ADDRESS,
+    QNAME
+};
+
+/**
+ * \struct Key
+ * \brief A group-by key.
+ */
+struct Key
+{
+    /**
+     * \brief the key name.
+     */
+    std::string name;
+
+    /**
+     * \brief the key type.
+     */
+    KeyType type;
+
+    /**
+     * \brief the column holding the key values.
+     */
+    columnar::Column column;
+};
+
+/**
+ * \typedef GroupKey
+ * \brief The key values for a group.
+ */
+using GroupKey = std::array<uint64_t, MAX_KEYS>;
+
+/**
+ * \class Scanner
+ * \brief Count records in columnar files by group.
+ *
+ * Dictionary indexes are file-specific, so values from dictionary
+ * columns are converted into indexes into a table of values
+ * common to all files.
+ */
+class Scanner
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param keys          the group-by keys.
+     * \param ipv4_prefix   the IPv4 client prefix length.
+     * \param ipv6_prefix   the IPv6 client prefix length.
+     * \param start         the earliest timestamp to include, nanoseconds.
+     * \param end           the latest timestamp to include, nanoseconds.
+     */
+    Scanner(const std::vector<Key>& keys,
+            unsigned ipv4_prefix, unsigned ipv6_prefix,
+            int64_t start, int64_t end)
+        : keys_(keys), ipv4_prefix_(ipv4_prefix), ipv6_prefix_(ipv6_prefix),
+          start_(start), end_(end),
+          chunks_read_(0), chunks_skipped_(0) {}
+
+    /**
+     * \brief Scan a columnar file.
+     *
+     * \param path the file path.
+     */
+    void scan(const std::string& path);
+
+    /**
+     * \brief Write the group counts, largest first, as CSV.
+     *
+     * \param os the output stream.
+     */
+    void write_csv(std::ostream& os) const;
+
+    /**
+     * \brief Write scan statistics.
+     *
+     * \param os the output stream.
+     */
+    void dump_stats(std::ostream& os) const
+    {
+        os << "Chunks: " << chunks_read_ << " read, "
+           << chunks_skipped_ << " skipped.\n";
+    }
+
+private:
+    /**
+     * \brief Convert a file dictionary index into a common value index.
+     *
+     * \param reader    the file reader.
+     * \param key       the key.
+     * \param index     the file dictionary index.
+     * \param cache     file dictionary index conversions.
+     * \returns the common value index.
+     */
+    uint64_t dictionary_key(const columnar::Reader& reader, const Key& key,
+                            uint32_t index, std::vector<uint64_t>& cache);
+
+    /**
+     * \brief Format a key value.
+     *
+     * \param key   the key.
+     * \param val   the key value.
+     * \returns the formatted value.
+     */
+    std::string format(const Key& key, uint64_t val) const;
+
+    /**
+     * \brief the group-by keys.
+     */
+    std::vector<Key> keys_;
+
+    /**
+     * \brief the IPv4 client prefix length.
+     */
+    unsigned ipv4_prefix_;
+
+    /**
+     * \brief the IPv6 client prefix length.
+     */
+    unsigned ipv6_prefix_;
+
+    /**
+     * \brief the earliest timestamp to include.
+     */
+    int64_t start_;
+
+    /**
+     * \brief the latest timestamp to include.
+     */
+    int64_t end_;
+
+    /**
+     * \brief the group counts.
+     */
+    std::unordered_map<GroupKey, uint64_t, boost::hash<GroupKey>> counts_;
+
+    /**
+     * \brief dictionary values common to all files.
+     */
+    std::vector<std::string> values_;
+
+    /**
+     * \brief index of dictionary values common to all files.
+     */
+    std::unordered_map<std::string, uint64_t> value_index_;
+
+    /**
+     * \brief number of chunks read.
+     */
+    uint64_t chunks_read_;
+
+    /**
+     * \brief number of chunks skipped.
+     */
+    uint64_t chunks_skipped_;
+};
+
+uint64_t Scanner::dictionary_key(const columnar::Reader& reader, const Key& key,
+                                 uint32_t index, std::vector<uint64_t>& cache)
+{
+    if ( index == columnar::NO_INDEX )
+        return NULL_KEY;
+    if ( index >= cache.size() )
+        throw columnar::columnar_error("Dictionary index out of range");
+    if ( cache[index] != NULL_KEY )
+        return cache[index];
+
+    std::string val;
+    if ( key.type == KeyType::QNAME )
+        val = CaptureDNS::decode_domain_name(reader.name(index));
+    else
+    {
+        byte_string addr = reader.address(index);
+        if ( key.type == KeyType::CLIENT_PREFIX )
+        {
+            unsigned len = ( addr.size() == 4 ) ? ipv4_prefix_ : ipv6_prefix_;
+            for ( unsigned i = 0; i < addr.size(); ++i )
+            {
+                if ( len >= 8 * (i + 1) )
+                    continue;
+                else if ( len > 8 * i )
+                    addr[i] &= 0xff << (8 * (i + 1) - len);
+                else
+                    addr[i] = 0;
+            }
+            val = IPAddress(addr).str() + "/" + std::to_string(len);
+        }
+        else
+            val = IPAddress(addr).str();
+    }
+
+    auto it = value_index_.find(val);
+    if ( it == value_index_.end() )
+    {
+        it = value_index_.emplace(val, values_.size()).first;
+        values_.push_back(val);
+    }
+    cache[index] = it->second;
+    return it->second;
+}
+
+void Scanner::scan(const std::string& path)
+{
+    columnar::Reader reader(path);
+    std::vector<std::vector<uint64_t>> caches(keys_.size());
+
+    for ( std::size_t k = 0; k < keys_.size(); ++k )
+    {
+        switch ( keys_[k].type )
+        {
+        case KeyType::QNAME:
+            caches[k].assign(reader.name_count(), NULL_KEY);
+            break;
+
+        case KeyType::CLIENT_PREFIX:
+        case KeyType::SERVER_ADDRESS:
+            caches[k].assign(reader.address_count(), NULL_KEY);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    for ( std::size_t c = 0; c < reader.chunks(); ++c )
+    {
+        std::size_t rows = reader.rows(c);
+        bool time_filter = ( start_ != columnar::NULL_INT64 || end_ != columnar::NULL_INT64 );
+
+        if ( time_filter )
+        {
+            int64_t min = reader.min(c, columnar::TIMESTAMP);
+            int64_t max = reader.max(c, columnar::TIMESTAMP);
+            if ( min == columnar::NULL_INT64 ||
+                 ( end_ != columnar::NULL_INT64 && min > end_ ) ||
+                 ( start_ != columnar::NULL_INT64 && max < start_ ) )
+            {
+                chunks_skipped_++;
+                continue;
+            }
+            if ( ( start_ == columnar::NULL_INT64 || min >= start_ ) &&
+                 ( end_ == columnar::NULL_INT64 || max <= end_ ) )
+                time_filter = false;
+        }
+        chunks_read_++;
+
+        const int64_t* timestamps = reader.column<int64_t>(c, columnar::TIMESTAMP);
+        std::vector<const uint8_t*> columns;
+        for ( const auto& key : keys_ )
+            columns.push_back(reader.column_data(c, key.column));
+
+        for ( std::size_t r = 0; r < rows; ++r )
+        {
+            if ( time_filter &&
+                 ( timestamps[r] == columnar::NULL_INT64 ||
+                   ( start_ != columnar::NULL_INT64 && timestamps[r] < start_ ) ||
+                   ( end_ != columnar::NULL_INT64 && timestamps[r] > end_ ) ) )
+                continue;
+
+            GroupKey group;
+            group.fill(0);
+            for ( std::size_t k = 0; k < keys_.size(); ++k )
+            {
+                const Key& key = keys_[k];
+                uint64_t val;
+
+                switch ( columnar::column_width(key.column) )
+                {
+                case 1:
+                    val = columns[k][r];
+                    break;
+
+                case 2:
+                    val = reinterpret_cast<const uint16_t*>(columns[k])[r];
+                    break;
+
+                default:
+                    val = reinterpret_cast<const uint32_t*>(columns[k])[r];
+                    break;
+                }
+
+                if ( static_cast<int64_t>(val) == columnar::column_null(key.column) )
+                    val = NULL_KEY;
+                else if ( !caches[k].empty() )
+                    val = dictionary_key(reader, key, val, caches[k]);
+                group[k] = val;
+            }
+            counts_[group]++;
+        }
+    }
+}
+
+std::string Scanner::format(const Key& key, uint64_t val) const
+{
+    if ( val == NULL_KEY )
+        return "";
+
+    switch ( key.type )
+    {
+    case KeyType::CLIENT_PREFIX:
+    case KeyType::SERVER_ADDRESS:
+        return values_[val];
+
+    case KeyType::QNAME:
+    {
+        // CSV escaping as per RFC4180.
+        const std::string& name = values_[val];
+        if ( name.find_first_of("\",\r\n") == std::string::npos )
+            return name;
+        std::string res = "\"";
+        for ( char c : name )
+        {
+            if ( c == '"' )
+                res.push_back('"');
+            res.push_back(c);
+        }
+        res.push_back('"');
+        return res;
+    }
+
+    default:
+        return std::to_string(val);
+    }
+}
+
+void Scanner::write_csv(std::ostream& os) const
+{
+    std::vector<std::pair<GroupKey, uint64_t>> res(counts_.begin(), counts_.end());
+    std::sort(res.begin(), res.end(),
+              [](const std::pair<GroupKey, uint64_t>& a,
+                 const std::pair<GroupKey, uint64_t>& b)
+              {
+                  return ( a.second != b.second )
+                      ? a.second > b.second
+                      : a.first < b.first;
+              });
+
+    for ( const auto& key : keys_ )
+        os << key.name << ",";
+    os << "count\n";
+    for ( const auto& r : res )
+    {
+        for ( std::size_t k = 0; k < keys_.size(); ++k )
+            os << format(keys_[k], r.first[k]) << ",";
+        os << r.second << "\n";
+    }
+}
+
+/**
+ * \brief Find a group-by key.
+ *
+ * \param name the key name.
+ * \returns the key.
+ * \throws po::error if the key name is not recognised.
+ */
+static Key find_key(const std::string& name)
+{
+    static const std::vector<Key> keys =
+    {
+        { "qtype", KeyType::QTYPE, columnar::QUERY_TYPE },
+        { "qclass", KeyType::QCLASS, columnar::QUERY_CLASS },
+        { "rcode", KeyType::RCODE, columnar::RESPONSE_RCODE },
+        { "opcode", KeyType::OPCODE, columnar::OPCODE },
+        { "transport", KeyType::TRANSPORT, columnar::TRANSPORT_FLAGS },
+        { "client-prefix", KeyType::CLIENT_PREFIX, columnar::CLIENT_ADDRESS },
+        { "server-address", KeyType::SERVER_ADDRESS, columnar::SERVER_ADDRESS },
+        { "qname", KeyType::QNAME, columnar::QUERY_NAME },
+    };
+
+    for ( const auto& key : keys )
+        if ( key.name == name )
+            return key;
+    throw po::error("unknown group-by item " + name);
+}
+
+int main(int ac, char *av[])
+{
+    init_logging();
+
+    std::vector<std::string> group_by;
+    unsigned ipv4_prefix;
+    unsigned ipv6_prefix;
+    int64_t start = columnar::NULL_INT64;
+    int64_t end = columnar::NULL_INT64;
+
+    po::options_description visible("Options");
+    visible.add_options()
+        ("help,h", "show this help message.")
+        ("version,v", "show version information.")
+        ("group-by,g",
+         po::value<std::vector<std::string>>(&group_by),
+         "count records by qtype, qclass, rcode, opcode, transport, client-prefix, server-address or qname. This argument can be repeated.")
+        ("ipv4-prefix-length",
+         po::value<unsigned>(&ipv4_prefix)->default_value(24),
+         "IPv4 client prefix length for client-prefix.")
+        ("ipv6-prefix-length",
+         po::value<unsigned>(&ipv6_prefix)->default_value(48),
+         "IPv6 client prefix length for client-prefix.")
+        ("start",
+         po::value<int64_t>(),
+         "only count records at or after this time, in seconds since the epoch.")
+        ("end",
+         po::value<int64_t>(),
+         "only count records before this time, in seconds since the epoch.")
+        ("stats,S",
+         "report scan statistics.");
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("columnar-file",
+         po::value<std::vector<std::string>>(),
+         "input columnar file.");
+    po::options_description all("Options");
+    all.add(visible).add(hidden);
+
+    po::positional_options_description positional;
+    positional.add("columnar-file", -1);
+
+    po::variables_map vm;
+    std::vector<Key> keys;
+
+    try {
+        po::store(po::command_line_parser(ac, av).options(all).positional(positional).run(), vm);
+
+        if ( vm.count("help") )
+        {
+            std::cerr
+                << "Usage: " << PROGNAME << " [options] columnar-file [...]\n"
+                << visible;
+            return 1;
+        }
+
+        if ( vm.count("version") )
+        {
+            std::cout << PROGNAME << " " PACKAGE_VERSION "\n";
+            return 1;
+        }
+
+        po::notify(vm);
+
+        if ( !vm.count("columnar-file") )
+            throw po::error("specify some columnar files to scan");
+        if ( ipv4_prefix > 32 || ipv6_prefix > 128 )
+            throw po::error("invalid prefix length");
+        if ( group_by.size() > MAX_KEYS )
+            throw po::error("too many group-by items");
+        for ( const auto& g : group_by )
+            keys.push_back(find_key(g));
+
+        // Timestamps are in nanoseconds; end is exclusive.
+        if ( vm.count("start") )
+            start = vm["start"].as<int64_t>() * 1000000000;
+        if ( vm.count("end") )
+            end = vm["end"].as<int64_t>() * 1000000000 - 1;
+    }
+    catch (po::error& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        Scanner scanner(keys, ipv4_prefix, ipv6_prefix, start, end);
+
+        for ( const auto& fname : vm["columnar-file"].as<std::vector<std::string>>() )
+            scanner.scan(fname);
+
+        scanner.write_csv(std::cout);
+        if ( vm.count("stats") )
+            scanner.dump_stats(std::cerr);
+    }
+    catch (const std::runtime_error& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
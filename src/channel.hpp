@@ -14,9 +14,15 @@
 #define CHANNEL_HPP
 
 #include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
 #include <queue>
 #include <mutex>
 #include <thread>
+#include <utility>
+
+#include "memorybudget.hpp"
 
 // This implementation of something vaguely like a Go channel is
 // based on https://st.xorian.net/blog/2012/08/go-style-channel-in-c/.
@@ -40,17 +46,27 @@
  * Unlike Go, no select() is currently supported, and the channel capacity
  * can either be fixed or will expand indefinitely as items are added.
  *
+ * The channel may also be given a memory budget stage. Each item is then
+ * charged against the stage while it is in the channel, and an item
+ * that would exceed the budget is treated as if the channel were full.
+ *
  * This class requires C++11 threading, mutexes etc.
  */
 template<class item>
 class Channel
 {
 public:
+    /**
+     * \typedef SizeFunction
+     * \brief Function returning the approximate memory used by an item.
+     */
+    using SizeFunction = std::function<std::size_t (const item&)>;
+
     /**
      * \brief Default constructor.
      */
     explicit Channel(unsigned max_len = 0)
-        : closed_(false), max_len_(max_len) {}
+        : closed_(false), max_len_(max_len), budget_stage_() {}
 
     /**
      * \brief Mark the channel as closed.
@@ -89,7 +105,8 @@ public:
      *
      * \param i    the item to add.
      * \param wait if `true` and queue is full, wait for it to have room.
-     * \return `false` is queue is full and we're not waiting.
+     *             Memory budget limits are not applied when waiting.
+     * \return `false` is queue is full or over budget and we're not waiting.
      * \throws std::logic_error if the channel is closed.
      */
     bool put(const item &i, bool wait = true)
@@ -106,7 +123,11 @@ public:
         if ( closed_ )
             throw std::logic_error("put to closed channel");
 
-        queue_.push(i);
+        std::size_t bytes;
+        if ( !charge(i, wait, bytes) )
+            return false;
+
+        queue_.push(std::make_pair(i, bytes));
         cv_.notify_one();
         return true;
     }
@@ -120,7 +141,8 @@ public:
      *
      * \param i the item to add.
      * \param wait if `true` and queue is full, wait for it to have room.
-     * \return `false` is queue is full and we're not waiting.
+     *             Memory budget limits are not applied when waiting.
+     * \return `false` is queue is full or over budget and we're not waiting.
      * \throws std::logic_error if the channel is closed.
      */
     bool put(item &&i, bool wait = true)
@@ -137,7 +159,11 @@ public:
         if ( closed_ )
             throw std::logic_error("put to closed channel");
 
-        queue_.push(i);
+        std::size_t bytes;
+        if ( !charge(i, wait, bytes) )
+            return false;
+
+        queue_.push(std::make_pair(std::move(i), bytes));
         cv_.notify_one();
         return true;
     }
@@ -157,7 +183,9 @@ public:
             cv_.wait(lock, [this](){ return closed_ || !queue_.empty(); });
         if ( queue_.empty() )
             return false;
-        out = std::move(queue_.front());
+        out = std::move(queue_.front().first);
+        if ( budget_ )
+            budget_->release(budget_stage_, queue_.front().second);
         queue_.pop();
         cv_.notify_one();
         return true;
@@ -176,11 +204,55 @@ public:
         max_len_ = max_items;
     }
 
+    /**
+     * \brief Charge items in the channel to a memory budget stage.
+     *
+     * This must be set before any items are added to the channel.
+     *
+     * \param budget the memory budget.
+     * \param stage  the stage to charge.
+     * \param size   function giving the size of an item.
+     */
+    void set_memory_budget(std::shared_ptr<MemoryBudget> budget,
+                           MemoryBudget::Stage stage,
+                           SizeFunction size)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        budget_ = budget;
+        budget_stage_ = stage;
+        size_ = size;
+    }
+
 private:
     /**
-     * \brief the channel item queue.
+     * \brief Charge an item to the memory budget, if any.
+     *
+     * Call with the mutex held.
+     *
+     * \param i     the item.
+     * \param wait  if `true`, charge regardless of limits.
+     * \param bytes set to the charge made.
+     * \return `false` if the item would exceed the budget.
      */
-    std::queue<item> queue_;
+    bool charge(const item& i, bool wait, std::size_t& bytes)
+    {
+        bytes = 0;
+        if ( !budget_ )
+            return true;
+
+        bytes = size_(i);
+        if ( wait )
+        {
+            budget_->charge_always(budget_stage_, bytes);
+            return true;
+        }
+        return budget_->charge(budget_stage_, bytes);
+    }
+
+    /**
+     * \brief the channel item queue, with the memory charged for each item.
+     */
+    std::queue<std::pair<item, std::size_t>> queue_;
 
     /**
      * \brief mutex guarding access to the channel.
@@ -203,6 +275,21 @@ private:
      * 0 means 'no maximum'.
      */
     unsigned max_len_;
+
+    /**
+     * \brief the memory budget, if any.
+     */
+    std::shared_ptr<MemoryBudget> budget_;
+
+    /**
+     * \brief the memory budget stage to charge.
+     */
+    MemoryBudget::Stage budget_stage_;
+
+    /**
+     * \brief function giving the size of an item.
+     */
+    SizeFunction size_;
 };
 
 #endif
@@ -0,0 +1,411 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <type_traits>
+
+#include "config.h"
+
+#include "capturedns.hpp"
+#include "log.hpp"
+#include "makeunique.hpp"
+
+#include "clickhouse-backend.hpp"
+
+namespace
+{
+    /**
+     * \brief Output buffer size at which to write to the output.
+     */
+    const std::size_t OUTPUT_BUFFER_FLUSH_SIZE = 1024 * 1024;
+
+    /**
+     ** RowBinary encoding
+     **/
+
+    template<typename T>
+    void append_le(std::string& out, T val)
+    {
+        typename std::make_unsigned<T>::type u = val;
+
+        for ( std::size_t i = 0; i < sizeof(T); ++i )
+        {
+            out.push_back(static_cast<char>(u & 0xff));
+            u >>= 8;
+        }
+    }
+
+    void append_varint(std::string& out, uint64_t val)
+    {
+        while ( val >= 0x80 )
+        {
+            out.push_back(static_cast<char>((val & 0x7f) | 0x80));
+            val >>= 7;
+        }
+        out.push_back(static_cast<char>(val));
+    }
+
+    void append_string(std::string& out, const std::string& val)
+    {
+        append_varint(out, val.size());
+        out.append(val);
+    }
+
+    void append_null(std::string& out)
+    {
+        out.push_back(1);
+    }
+
+    template<typename T>
+    void append_nullable(std::string& out, T val)
+    {
+        out.push_back(0);
+        append_le<T>(out, val);
+    }
+
+    template<typename T, typename V>
+    void append_nullable(std::string& out, const boost::optional<V>& val)
+    {
+        if ( val )
+            append_nullable<T>(out, static_cast<T>(*val));
+        else
+            append_null(out);
+    }
+
+    void append_nullable_address(std::string& out, const boost::optional<IPAddress>& addr)
+    {
+        if ( !addr )
+        {
+            append_null(out);
+            return;
+        }
+
+        out.push_back(0);
+        Tins::IPv6Address addr6 = *addr;
+        for ( auto addrbyte : addr6 )
+            out.push_back(static_cast<char>(addrbyte));
+    }
+
+    template<typename T>
+    std::size_t list_size(const boost::optional<std::vector<T>>& list)
+    {
+        return ( list ) ? (*list).size() : 0;
+    }
+
+    /**
+     * \struct Column
+     * \brief A column in the output table.
+     */
+    struct Column
+    {
+        /**
+         * \brief the column name.
+         */
+        const char* name;
+
+        /**
+         * \brief the ClickHouse column type.
+         */
+        const char* type;
+
+        /**
+         * \brief append the column value to a row.
+         */
+        void (*write)(const QueryResponseData& qr, std::string& out);
+    };
+
+    /**
+     * \brief The output table. Names and values are as in the template backend.
+     */
+    const Column COLUMNS[] =
+    {
+        { "timestamp_nanosecs", "Nullable(Int64)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.timestamp )
+                  append_nullable<int64_t>(out, std::chrono::duration_cast<std::chrono::nanoseconds>((*qr.timestamp).time_since_epoch()).count());
+              else
+                  append_null(out);
+          } },
+        { "client_address", "Nullable(IPv6)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable_address(out, qr.client_address);
+          } },
+        { "client_port", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.client_port);
+          } },
+        { "client_hoplimit", "Nullable(UInt8)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint8_t>(out, qr.client_hoplimit);
+          } },
+        { "server_address", "Nullable(IPv6)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable_address(out, qr.server_address);
+          } },
+        { "server_port", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.server_port);
+          } },
+        { "transport_flags", "Nullable(UInt8)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint8_t>(out, qr.qr_transport_flags);
+          } },
+        { "transaction_type", "Nullable(UInt8)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint8_t>(out, qr.qr_type);
+          } },
+        { "query_response_flags", "UInt8",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_le<uint8_t>(out, qr.qr_flags);
+          } },
+        { "dns_flags", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.dns_flags);
+          } },
+        { "id", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.id);
+          } },
+        { "query_opcode", "Nullable(UInt8)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint8_t>(out, qr.query_opcode);
+          } },
+        { "query_rcode", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.query_rcode);
+          } },
+        { "query_class", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.query_class);
+          } },
+        { "query_type", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.query_type);
+          } },
+        { "query_name", "Nullable(String)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.qname )
+              {
+                  out.push_back(0);
+                  append_string(out, CaptureDNS::decode_domain_name(*qr.qname));
+              }
+              else
+                  append_null(out);
+          } },
+        { "query_len", "Nullable(UInt32)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint32_t>(out, qr.query_size);
+          } },
+        { "query_qdcount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( !(qr.qr_flags & block_cbor::HAS_QUERY) )
+                  append_null(out);
+              else if ( qr.qr_flags & block_cbor::QUERY_HAS_NO_QUESTION )
+                  append_nullable<uint16_t>(out, 0);
+              else
+                  append_nullable<uint16_t>(out, 1 + list_size(qr.query_questions));
+          } },
+        { "query_ancount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.qr_flags & block_cbor::HAS_QUERY )
+                  append_nullable<uint16_t>(out, list_size(qr.query_answers));
+              else
+                  append_null(out);
+          } },
+        { "query_nscount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.qr_flags & block_cbor::HAS_QUERY )
+                  append_nullable<uint16_t>(out, list_size(qr.query_authorities));
+              else
+                  append_null(out);
+          } },
+        { "query_arcount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.qr_flags & block_cbor::HAS_QUERY )
+                  append_nullable<uint16_t>(out,
+                                            !!(qr.qr_flags & block_cbor::QUERY_HAS_OPT) +
+                                            list_size(qr.query_additionals));
+              else
+                  append_null(out);
+          } },
+        { "query_edns_version", "Nullable(UInt8)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint8_t>(out, qr.query_edns_version);
+          } },
+        { "query_edns_udp_payload_size", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.query_edns_payload_size);
+          } },
+        { "query_opt_codes", "Array(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( ( qr.qr_flags & block_cbor::QUERY_HAS_OPT ) && qr.query_opt_rdata )
+              {
+                  CaptureDNS::EDNS0 e0(CaptureDNS::INTERNET, 0, *qr.query_opt_rdata);
+                  append_varint(out, e0.options().size());
+                  for ( auto& opt : e0.options() )
+                      append_le<uint16_t>(out, opt.code());
+              }
+              else
+                  append_varint(out, 0);
+          } },
+        { "response_delay_nanosecs", "Nullable(Int64)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.response_delay )
+                  append_nullable<int64_t>(out, (*qr.response_delay).count());
+              else
+                  append_null(out);
+          } },
+        { "response_rcode", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint16_t>(out, qr.response_rcode);
+          } },
+        { "response_len", "Nullable(UInt32)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              append_nullable<uint32_t>(out, qr.response_size);
+          } },
+        { "response_qdcount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( !(qr.qr_flags & block_cbor::HAS_RESPONSE) )
+                  append_null(out);
+              else if ( qr.qr_flags & block_cbor::RESPONSE_HAS_NO_QUESTION )
+                  append_nullable<uint16_t>(out, 0);
+              else
+                  append_nullable<uint16_t>(out, 1 + list_size(qr.response_questions));
+          } },
+        { "response_ancount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.qr_flags & block_cbor::HAS_RESPONSE )
+                  append_nullable<uint16_t>(out, list_size(qr.response_answers));
+              else
+                  append_null(out);
+          } },
+        { "response_nscount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.qr_flags & block_cbor::HAS_RESPONSE )
+                  append_nullable<uint16_t>(out, list_size(qr.response_authorities));
+              else
+                  append_null(out);
+          } },
+        { "response_arcount", "Nullable(UInt16)",
+          [](const QueryResponseData& qr, std::string& out)
+          {
+              if ( qr.qr_flags & block_cbor::HAS_RESPONSE )
+                  append_nullable<uint16_t>(out, list_size(qr.response_additionals));
+              else
+                  append_null(out);
+          } },
+    };
+}
+
+ClickHouseBackend::ClickHouseBackend(const ClickHouseBackendOptions& opts, const std::string& fname)
+    : OutputBackend(opts.baseopts), opts_(opts)
+{
+    output_path_ = output_name(fname);
+
+    if ( opts.baseopts.xz_output )
+        writer_ = make_unique<XzStreamWriter>(output_path_, opts.baseopts.xz_preset);
+    else if ( opts.baseopts.gzip_output )
+        writer_ = make_unique<GzipStreamWriter>(output_path_, opts.baseopts.gzip_level);
+    else
+        writer_ = make_unique<StreamWriter>(output_path_, 0);
+
+    buffer_.reserve(OUTPUT_BUFFER_FLUSH_SIZE + OUTPUT_BUFFER_FLUSH_SIZE / 4);
+}
+
+ClickHouseBackend::~ClickHouseBackend()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR << "Error writing " << output_path_ << ": " << e.what();
+    }
+}
+
+std::string ClickHouseBackend::structure()
+{
+    std::string res;
+
+    for ( const auto& col : COLUMNS )
+    {
+        if ( !res.empty() )
+            res.append(", ");
+        res.append(col.name);
+        res.push_back(' ');
+        res.append(col.type);
+    }
+    return res;
+}
+
+void ClickHouseBackend::encode_row(const QueryResponseData& qr, std::string& out)
+{
+    for ( const auto& col : COLUMNS )
+        col.write(qr, out);
+}
+
+void ClickHouseBackend::output(const QueryResponseData& qr, const Configuration& /* config */)
+{
+    encode_row(qr, buffer_);
+
+    if ( buffer_.size() >= OUTPUT_BUFFER_FLUSH_SIZE )
+        flush();
+}
+
+void ClickHouseBackend::flush()
+{
+    if ( !buffer_.empty() && writer_ )
+    {
+        writer_->writeBytes(buffer_);
+        buffer_.clear();
+    }
+}
+
+std::string ClickHouseBackend::output_file()
+{
+    if ( output_path_ == StreamWriter::STDOUT_FILE_NAME )
+        return "";
+    return output_path_;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef CLICKHOUSE_BACKEND_HPP
+#define CLICKHOUSE_BACKEND_HPP
+
+#include <memory>
+#include <string>
+
+#include "streamwriter.hpp"
+
+#include "backend.hpp"
+
+/**
+ * \struct ClickHouseBackendOptions
+ * \brief Options for the ClickHouse backend.
+ */
+struct ClickHouseBackendOptions
+{
+    /**
+     * \brief base options.
+     */
+    OutputBackendOptions baseopts;
+};
+
+/**
+ * \class ClickHouseBackend
+ * \brief ClickHouse RowBinary backend for inspector.
+ *
+ * This writes query/response records in ClickHouse `RowBinary` format
+ * using a fixed table structure. Column names are the same as
+ * the equivalent template field names. Data items not present in a
+ * record are written as `NULL`.
+ */
+class ClickHouseBackend : public OutputBackend
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param opts              options information.
+     * \param fname             output file path.
+     */
+    ClickHouseBackend(const ClickHouseBackendOptions& opts, const std::string& fname);
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~ClickHouseBackend();
+
+    /**
+     * \brief Output a QueryResponse.
+     *
+     * \param qr        the QueryResponse.
+     * \param config    the configuration applying when recording the QR.
+     */
+    virtual void output(const QueryResponseData& qr, const Configuration& config);
+
+    /**
+     * \brief the output file path.
+     *
+     * \return the output file path. "" if unnamed stream, e.g. stdout.
+     */
+    virtual std::string output_file();
+
+    /**
+     * \brief the ClickHouse table structure of the output.
+     *
+     * \return the structure, as a comma-separated list of
+     * `<name> <type>` pairs, suitable for `CREATE TABLE` or
+     * the `clickhouse-local --structure` option.
+     */
+    static std::string structure();
+
+    /**
+     * \brief Encode a QueryResponse as a RowBinary row.
+     *
+     * \param qr        the QueryResponse.
+     * \param out       string to which the row is appended.
+     */
+    static void encode_row(const QueryResponseData& qr, std::string& out);
+
+private:
+    /**
+     * \brief Write the output buffer to the output.
+     */
+    void flush();
+
+    /**
+     * \brief the options.
+     */
+    ClickHouseBackendOptions opts_;
+
+    /**
+     * \brief the output file path.
+     */
+    std::string output_path_;
+
+    /**
+     * \brief the output writer.
+     */
+    std::unique_ptr<StreamWriter> writer_;
+
+    /**
+     * \brief the output buffer.
+     */
+    std::string buffer_;
+};
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <string>
+
+#include "config.h"
+
+#include "makeunique.hpp"
+
+#include "columnar-backend.hpp"
+
+ColumnarBackend::ColumnarBackend(const ColumnarBackendOptions& opts, const std::string& fname)
+    : OutputBackend(opts.baseopts)
+{
+    if ( opts.baseopts.xz_output || opts.baseopts.gzip_output )
+        throw backend_error("Columnar output can't be compressed.");
+
+    output_path_ = output_name(fname);
+    writer_ = make_unique<columnar::Writer>(make_unique<StreamWriter>(output_path_, 0));
+}
+
+ColumnarBackend::~ColumnarBackend()
+{
+}
+
+void ColumnarBackend::output(const QueryResponseData& qr, const Configuration& /* config */)
+{
+    columnar::Row row;
+
+    if ( qr.timestamp )
+        row.values[columnar::TIMESTAMP] = std::chrono::duration_cast<std::chrono::nanoseconds>((*qr.timestamp).time_since_epoch()).count();
+    if ( qr.client_address )
+        row.values[columnar::CLIENT_ADDRESS] = writer_->address_index((*qr.client_address).asNetworkBinary());
+    if ( qr.client_port )
+        row.values[columnar::CLIENT_PORT] = *qr.client_port;
+    if ( qr.server_address )
+        row.values[columnar::SERVER_ADDRESS] = writer_->address_index((*qr.server_address).asNetworkBinary());
+    if ( qr.server_port )
+        row.values[columnar::SERVER_PORT] = *qr.server_port;
+    if ( qr.qr_transport_flags )
+        row.values[columnar::TRANSPORT_FLAGS] = *qr.qr_transport_flags;
+    row.values[columnar::QR_FLAGS] = qr.qr_flags;
+    if ( qr.dns_flags )
+        row.values[columnar::DNS_FLAGS] = *qr.dns_flags;
+    if ( qr.id )
+        row.values[columnar::ID] = *qr.id;
+    if ( qr.query_opcode )
+        row.values[columnar::OPCODE] = *qr.query_opcode;
+    if ( qr.qname )
+        row.values[columnar::QUERY_NAME] = writer_->name_index(*qr.qname);
+    if ( qr.query_class )
+        row.values[columnar::QUERY_CLASS] = *qr.query_class;
+    if ( qr.query_type )
+        row.values[columnar::QUERY_TYPE] = *qr.query_type;
+    if ( qr.query_size )
+        row.values[columnar::QUERY_SIZE] = *qr.query_size;
+    if ( qr.response_rcode )
+        row.values[columnar::RESPONSE_RCODE] = *qr.response_rcode;
+    if ( qr.response_size )
+        row.values[columnar::RESPONSE_SIZE] = *qr.response_size;
+    if ( qr.response_delay )
+        row.values[columnar::RESPONSE_DELAY] = (*qr.response_delay).count();
+
+    writer_->add(row);
+}
+
+std::string ColumnarBackend::output_file()
+{
+    if ( output_path_ == StreamWriter::STDOUT_FILE_NAME )
+        return "";
+    return output_path_;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef COLUMNAR_BACKEND_HPP
+#define COLUMNAR_BACKEND_HPP
+
+#include <memory>
+#include <string>
+
+#include "columnar.hpp"
+
+#include "backend.hpp"
+
+/**
+ * \struct ColumnarBackendOptions
+ * \brief Options for the columnar backend.
+ */
+struct ColumnarBackendOptions
+{
+    /**
+     * \brief base options.
+     */
+    OutputBackendOptions baseopts;
+};
+
+/**
+ * \class ColumnarBackend
+ * \brief Columnar analysis file backend for inspector.
+ *
+ * The output is a memory-mappable columnar file for use by
+ * *cdns-scan*. See columnar.hpp.
+ */
+class ColumnarBackend : public OutputBackend
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param opts              options information.
+     * \param fname             output file path.
+     * \throws backend_error if compressed output is requested.
+     */
+    ColumnarBackend(const ColumnarBackendOptions& opts, const std::string& fname);
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~ColumnarBackend();
+
+    /**
+     * \brief Output a QueryResponse.
+     *
+     * \param qr        the QueryResponse.
+     * \param config    the configuration applying when recording the QR.
+     */
+    virtual void output(const QueryResponseData& qr, const Configuration& config);
+
+    /**
+     * \brief the output file path.
+     *
+     * \return the output file path. "" if unnamed stream, e.g. stdout.
+     */
+    virtual std::string output_file();
+
+private:
+    /**
+     * \brief the output file path.
+     */
+    std::string output_path_;
+
+    /**
+     * \brief the columnar file writer.
+     */
+    std::unique_ptr<columnar::Writer> writer_;
+};
+
+#endif
@@ -0,0 +1,433 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#include "log.hpp"
+
+#include "columnar.hpp"
+
+namespace columnar {
+
+    namespace {
+        /**
+         * \brief Header magic.
+         */
+        const char HEADER_MAGIC[8] = { 'C', 'D', 'N', 'S', 'C', 'O', 'L', '1' };
+
+        /**
+         * \brief Trailer magic.
+         */
+        const char TRAILER_MAGIC[8] = { 'C', 'D', 'N', 'S', 'C', 'O', 'L', 'F' };
+
+        /**
+         * \brief Size of the trailer.
+         */
+        const uint64_t TRAILER_SIZE = 16;
+
+        /**
+         * \brief Size of the fixed part of the footer.
+         */
+        const uint64_t FOOTER_SIZE = 24;
+
+        /**
+         * \brief Size of footer information on each chunk.
+         */
+        const uint64_t CHUNK_INFO_SIZE = 8 + 24 * COLUMN_COUNT;
+
+        /**
+         * \brief Description of a column.
+         */
+        struct ColumnInfo
+        {
+            /**
+             * \brief the column name.
+             */
+            const char* name;
+
+            /**
+             * \brief the width of a column value in bytes.
+             */
+            unsigned width;
+
+            /**
+             * \brief <code>true</code> if the column value is signed.
+             */
+            bool is_signed;
+        };
+
+        /**
+         * \brief Column descriptions, in column order.
+         */
+        const ColumnInfo COLUMN_INFO[COLUMN_COUNT] =
+        {
+            { "timestamp_nanosecs", 8, true },
+            { "client_address", 4, false },
+            { "client_port", 4, false },
+            { "server_address", 4, false },
+            { "server_port", 4, false },
+            { "transport_flags", 1, false },
+            { "query_response_flags", 1, false },
+            { "dns_flags", 4, false },
+            { "id", 4, false },
+            { "query_opcode", 1, false },
+            { "query_name", 4, false },
+            { "query_class", 2, false },
+            { "query_type", 2, false },
+            { "query_len", 4, false },
+            { "response_rcode", 2, false },
+            { "response_len", 4, false },
+            { "response_delay_nanosecs", 8, true },
+        };
+
+        /**
+         * \brief Append a little-endian value to a buffer.
+         *
+         * \param out   the buffer.
+         * \param val   the value.
+         * \param width the number of bytes to append.
+         */
+        void append_le(std::string& out, uint64_t val, unsigned width)
+        {
+            for ( unsigned i = 0; i < width; ++i )
+            {
+                out.push_back(static_cast<char>(val & 0xff));
+                val >>= 8;
+            }
+        }
+
+        /**
+         * \brief Is this host little-endian?
+         */
+        bool little_endian_host()
+        {
+            const uint16_t val = 1;
+            uint8_t first;
+            std::memcpy(&first, &val, 1);
+            return first == 1;
+        }
+    }
+
+    unsigned column_width(Column col)
+    {
+        return COLUMN_INFO[col].width;
+    }
+
+    int64_t column_null(Column col)
+    {
+        if ( COLUMN_INFO[col].is_signed )
+            return NULL_INT64;
+        if ( COLUMN_INFO[col].width == 8 )
+            return -1;
+        return (int64_t(1) << (8 * COLUMN_INFO[col].width)) - 1;
+    }
+
+    const char* column_name(Column col)
+    {
+        return COLUMN_INFO[col].name;
+    }
+
+    Writer::Writer(std::unique_ptr<StreamWriter> writer, uint32_t chunk_rows)
+        : writer_(std::move(writer)), chunk_rows_(chunk_rows),
+          offset_(0), closed_(false)
+    {
+        rows_.reserve(chunk_rows_);
+
+        std::string header(HEADER_MAGIC, sizeof(HEADER_MAGIC));
+        append_le(header, FORMAT_VERSION, 4);
+        append_le(header, COLUMN_COUNT, 4);
+        for ( unsigned i = 0; i < COLUMN_COUNT; ++i )
+            append_le(header, COLUMN_INFO[i].width, 1);
+        write(header);
+        align();
+    }
+
+    Writer::~Writer()
+    {
+        try
+        {
+            close();
+        }
+        catch (const std::exception& e)
+        {
+            LOG_ERROR << "Error closing columnar file: " << e.what();
+        }
+    }
+
+    uint32_t Writer::dictionary_index(std::vector<byte_string>& dict,
+                                      DictionaryIndex& index,
+                                      const byte_string& item)
+    {
+        auto it = index.find(item);
+        if ( it != index.end() )
+            return it->second;
+
+        uint32_t res = dict.size();
+        if ( res == NO_INDEX )
+            throw columnar_error("Dictionary full");
+        dict.push_back(item);
+        index.emplace(item, res);
+        return res;
+    }
+
+    void Writer::add(const Row& row)
+    {
+        rows_.push_back(row);
+        if ( rows_.size() >= chunk_rows_ )
+            write_chunk();
+    }
+
+    void Writer::close()
+    {
+        if ( closed_ )
+            return;
+        closed_ = true;
+
+        if ( !rows_.empty() )
+            write_chunk();
+
+        uint64_t address_dict = offset_;
+        write_dictionary(addresses_);
+        uint64_t name_dict = offset_;
+        write_dictionary(names_);
+
+        uint64_t footer = offset_;
+        std::string buf;
+        append_le(buf, chunks_.size(), 8);
+        append_le(buf, address_dict, 8);
+        append_le(buf, name_dict, 8);
+        for ( const auto& ci : chunks_ )
+        {
+            append_le(buf, ci.rows, 8);
+            for ( unsigned i = 0; i < COLUMN_COUNT; ++i )
+            {
+                append_le(buf, ci.offsets[i], 8);
+                append_le(buf, ci.min[i], 8);
+                append_le(buf, ci.max[i], 8);
+            }
+        }
+        append_le(buf, footer, 8);
+        buf.append(TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+        write(buf);
+        writer_.reset();
+    }
+
+    void Writer::write_chunk()
+    {
+        ChunkInfo ci;
+        std::string buf;
+
+        ci.rows = rows_.size();
+        for ( unsigned i = 0; i < COLUMN_COUNT; ++i )
+        {
+            Column col = static_cast<Column>(i);
+            unsigned width = column_width(col);
+            int64_t null = column_null(col);
+            int64_t min = null;
+            int64_t max = null;
+
+            buf.clear();
+            buf.reserve(rows_.size() * width);
+            for ( const auto& row : rows_ )
+            {
+                int64_t val = row.values[i];
+                append_le(buf, val, width);
+                if ( val == null )
+                    continue;
+                if ( min == null || val < min )
+                    min = val;
+                if ( max == null || val > max )
+                    max = val;
+            }
+
+            align();
+            ci.offsets[i] = offset_;
+            ci.min[i] = min;
+            ci.max[i] = max;
+            write(buf);
+        }
+        align();
+
+        chunks_.push_back(ci);
+        rows_.clear();
+    }
+
+    void Writer::write_dictionary(const std::vector<byte_string>& dict)
+    {
+        std::string buf;
+        uint64_t pos = 0;
+
+        append_le(buf, dict.size(), 8);
+        append_le(buf, pos, 8);
+        for ( const auto& item : dict )
+        {
+            pos += item.size();
+            append_le(buf, pos, 8);
+        }
+        for ( const auto& item : dict )
+            buf.append(reinterpret_cast<const char*>(item.data()), item.size());
+        write(buf);
+        align();
+    }
+
+    void Writer::write(const std::string& buf)
+    {
+        writer_->writeBytes(buf);
+        offset_ += buf.size();
+    }
+
+    void Writer::align()
+    {
+        if ( offset_ % 8 != 0 )
+            write(std::string(8 - offset_ % 8, '\0'));
+    }
+
+    Reader::Reader(const std::string& path)
+        : data_(nullptr), size_(0)
+    {
+        if ( !little_endian_host() )
+            throw columnar_error("Columnar files can only be read on little-endian hosts");
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if ( fd == -1 )
+            throw columnar_error("Can't open " + path);
+
+        struct stat st;
+        if ( fstat(fd, &st) == -1 || st.st_size == 0 )
+        {
+            ::close(fd);
+            throw columnar_error("Can't read " + path);
+        }
+        size_ = st.st_size;
+
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if ( addr == MAP_FAILED )
+            throw columnar_error("Can't map " + path);
+        data_ = static_cast<const uint8_t*>(addr);
+
+        try
+        {
+            if ( std::memcmp(at(0, sizeof(HEADER_MAGIC)), HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0 ||
+                 std::memcmp(at(size_ - sizeof(TRAILER_MAGIC), sizeof(TRAILER_MAGIC)), TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) != 0 )
+                throw columnar_error(path + " is not a columnar file");
+
+            uint32_t version, column_count;
+            std::memcpy(&version, at(8, 4), 4);
+            std::memcpy(&column_count, at(12, 4), 4);
+            if ( version != FORMAT_VERSION || column_count != COLUMN_COUNT )
+                throw columnar_error(path + " has an unsupported format version");
+            const uint8_t* widths = at(16, COLUMN_COUNT);
+            for ( unsigned i = 0; i < COLUMN_COUNT; ++i )
+                if ( widths[i] != COLUMN_INFO[i].width )
+                    throw columnar_error(path + " has an unsupported format version");
+
+            uint64_t footer = u64(size_ - TRAILER_SIZE);
+            chunk_count_ = u64(footer);
+            address_dict_ = u64(footer + 8);
+            name_dict_ = u64(footer + 16);
+            chunk_info_ = footer + FOOTER_SIZE;
+            // Check the count before multiplying, so a corrupt count
+            // can't wrap around and pass the bounds check.
+            if ( chunk_info_ > size_ || chunk_count_ > ( size_ - chunk_info_ ) / CHUNK_INFO_SIZE )
+                throw columnar_error("Columnar file truncated or corrupt");
+        }
+        catch (...)
+        {
+            munmap(const_cast<uint8_t*>(data_), size_);
+            throw;
+        }
+    }
+
+    Reader::~Reader()
+    {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+
+    std::size_t Reader::rows(std::size_t chunk) const
+    {
+        return u64(chunk_info(chunk));
+    }
+
+    int64_t Reader::min(std::size_t chunk, Column col) const
+    {
+        return u64(chunk_info(chunk) + 8 + 24 * col + 8);
+    }
+
+    int64_t Reader::max(std::size_t chunk, Column col) const
+    {
+        return u64(chunk_info(chunk) + 8 + 24 * col + 16);
+    }
+
+    const uint8_t* Reader::at(uint64_t offset, uint64_t len) const
+    {
+        if ( offset > size_ || len > size_ - offset )
+            throw columnar_error("Columnar file truncated or corrupt");
+        return data_ + offset;
+    }
+
+    uint64_t Reader::u64(uint64_t offset) const
+    {
+        uint64_t res;
+        std::memcpy(&res, at(offset, 8), 8);
+        return res;
+    }
+
+    uint64_t Reader::chunk_info(std::size_t chunk) const
+    {
+        if ( chunk >= chunk_count_ )
+            throw columnar_error("Chunk out of range");
+        return chunk_info_ + chunk * CHUNK_INFO_SIZE;
+    }
+
+    const uint8_t* Reader::column_data(std::size_t chunk, Column col) const
+    {
+        uint64_t offset = u64(chunk_info(chunk) + 8 + 24 * col);
+        uint64_t rows = this->rows(chunk);
+        unsigned width = column_width(col);
+        // As with the chunk count, check before multiplying.
+        if ( offset > size_ || rows > ( size_ - offset ) / width )
+            throw columnar_error("Columnar file truncated or corrupt");
+        return at(offset, rows * width);
+    }
+
+    std::size_t Reader::dictionary_size(uint64_t dict) const
+    {
+        return u64(dict);
+    }
+
+    byte_string Reader::dictionary_item(uint64_t dict, uint32_t index) const
+    {
+        uint64_t count = u64(dict);
+        if ( index >= count )
+            throw columnar_error("Dictionary index out of range");
+        // The count has been read, so dict + 8 is within the file.
+        // Check the count and item offsets before using them in
+        // arithmetic, so corrupt values can't wrap around.
+        if ( count >= ( size_ - dict - 8 ) / 8 )
+            throw columnar_error("Columnar file truncated or corrupt");
+        uint64_t start = u64(dict + 8 + 8 * index);
+        uint64_t end = u64(dict + 8 + 8 * (index + 1));
+        uint64_t items = dict + 8 + 8 * (count + 1);
+        if ( end < start || start > size_ - items )
+            throw columnar_error("Columnar file truncated or corrupt");
+        return byte_string(at(items + start, end - start), end - start);
+    }
+}
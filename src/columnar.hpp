@@ -0,0 +1,545 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef COLUMNAR_HPP
+#define COLUMNAR_HPP
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+
+#include "bytestring.hpp"
+#include "streamwriter.hpp"
+
+/**
+ * \brief Memory-mappable columnar query/response files.
+ *
+ * A columnar file holds query/response records as one fixed-width
+ * array per field, so that scanning a field touches only that field's
+ * data, and the file can be used directly via `mmap()`.
+ *
+ * The file is a header, followed by chunks of records, followed by
+ * dictionaries and a footer. Within a chunk, each column is a
+ * contiguous array of little-endian values, aligned on an 8 byte
+ * boundary. Addresses and names are stored in the column as indexes
+ * into an address or name dictionary. Each column of each chunk has
+ * minimum and maximum value statistics in the footer, so that chunks
+ * can be skipped without reading them. A trailer at the end of the
+ * file gives the footer location.
+ *
+ * Absent values are stored as the column null value. This is the
+ * maximum value for unsigned columns and the minimum value for signed
+ * columns. Column widths are chosen so that no valid value is null.
+ */
+namespace columnar {
+
+    /**
+     * \brief The file format version.
+     */
+    const uint32_t FORMAT_VERSION = 1;
+
+    /**
+     * \brief The default number of records in a chunk.
+     */
+    const uint32_t DEFAULT_CHUNK_ROWS = 65536;
+
+    /**
+     * \brief Value of absent dictionary indexes.
+     */
+    const uint32_t NO_INDEX = std::numeric_limits<uint32_t>::max();
+
+    /**
+     * \brief Value of absent signed 64 bit values.
+     */
+    const int64_t NULL_INT64 = std::numeric_limits<int64_t>::min();
+
+    /**
+     * \enum Column
+     * \brief The file columns.
+     */
+    enum Column : unsigned
+    {
+        TIMESTAMP,              // int64, nanoseconds since the epoch.
+        CLIENT_ADDRESS,         // uint32, address dictionary index.
+        CLIENT_PORT,            // uint32.
+        SERVER_ADDRESS,         // uint32, address dictionary index.
+        SERVER_PORT,            // uint32.
+        TRANSPORT_FLAGS,        // uint8.
+        QR_FLAGS,               // uint8.
+        DNS_FLAGS,              // uint32.
+        ID,                     // uint32.
+        OPCODE,                 // uint8.
+        QUERY_NAME,             // uint32, name dictionary index.
+        QUERY_CLASS,            // uint16.
+        QUERY_TYPE,             // uint16.
+        QUERY_SIZE,             // uint32.
+        RESPONSE_RCODE,         // uint16.
+        RESPONSE_SIZE,          // uint32.
+        RESPONSE_DELAY,         // int64, nanoseconds.
+        COLUMN_COUNT
+    };
+
+    /**
+     * \brief Get the width of a column value in bytes.
+     *
+     * \param col the column.
+     * \returns the width.
+     */
+    unsigned column_width(Column col);
+
+    /**
+     * \brief Get the null value of a column.
+     *
+     * \param col the column.
+     * \returns the null value.
+     */
+    int64_t column_null(Column col);
+
+    /**
+     * \brief Get the name of a column.
+     *
+     * \param col the column.
+     * \returns the name, as the equivalent template field name.
+     */
+    const char* column_name(Column col);
+
+    /**
+     * \class columnar_error
+     * \brief Signals a columnar file error.
+     */
+    class columnar_error : public std::runtime_error
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param what message detailing the problem.
+         */
+        explicit columnar_error(const std::string& what)
+            : std::runtime_error(what) {}
+    };
+
+    /**
+     * \struct Row
+     * \brief A record to be written. Values default to null.
+     */
+    struct Row
+    {
+        /**
+         * \brief Constructor.
+         */
+        Row()
+        {
+            for ( unsigned i = 0; i < COLUMN_COUNT; ++i )
+                values[i] = column_null(static_cast<Column>(i));
+        }
+
+        /**
+         * \brief the column values.
+         */
+        int64_t values[COLUMN_COUNT];
+    };
+
+    /**
+     * \class Writer
+     * \brief Write a columnar file.
+     */
+    class Writer
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param writer     the output stream writer.
+         * \param chunk_rows the number of records in each chunk.
+         */
+        explicit Writer(std::unique_ptr<StreamWriter> writer,
+                        uint32_t chunk_rows = DEFAULT_CHUNK_ROWS);
+
+        /**
+         * \brief Destructor.
+         *
+         * Closes the file if not already closed.
+         */
+        ~Writer();
+
+        /**
+         * \brief Get the dictionary index for an address.
+         *
+         * \param addr the address in network binary format.
+         * \returns the index.
+         */
+        uint32_t address_index(const byte_string& addr)
+        {
+            return dictionary_index(addresses_, address_index_, addr);
+        }
+
+        /**
+         * \brief Get the dictionary index for a name.
+         *
+         * \param name the name in label format.
+         * \returns the index.
+         */
+        uint32_t name_index(const byte_string& name)
+        {
+            return dictionary_index(names_, name_index_, name);
+        }
+
+        /**
+         * \brief Add a record.
+         *
+         * \param row the record.
+         */
+        void add(const Row& row);
+
+        /**
+         * \brief Write any outstanding records, the dictionaries and the footer.
+         */
+        void close();
+
+    private:
+        /**
+         * \struct ChunkInfo
+         * \brief Footer information on a written chunk.
+         */
+        struct ChunkInfo
+        {
+            /**
+             * \brief the number of records.
+             */
+            uint64_t rows;
+
+            /**
+             * \brief column file offsets.
+             */
+            uint64_t offsets[COLUMN_COUNT];
+
+            /**
+             * \brief column minimum values.
+             */
+            int64_t min[COLUMN_COUNT];
+
+            /**
+             * \brief column maximum values.
+             */
+            int64_t max[COLUMN_COUNT];
+        };
+
+        /**
+         * \typedef DictionaryIndex
+         * \brief Map from dictionary item to index.
+         */
+        using DictionaryIndex = std::unordered_map<byte_string, uint32_t, boost::hash<byte_string>>;
+
+        /**
+         * \brief Get the dictionary index for an item.
+         *
+         * \param dict  the dictionary.
+         * \param index the dictionary index.
+         * \param item  the item.
+         * \returns the index.
+         */
+        static uint32_t dictionary_index(std::vector<byte_string>& dict,
+                                         DictionaryIndex& index,
+                                         const byte_string& item);
+
+        /**
+         * \brief Write the current chunk.
+         */
+        void write_chunk();
+
+        /**
+         * \brief Write a dictionary.
+         *
+         * \param dict the dictionary.
+         */
+        void write_dictionary(const std::vector<byte_string>& dict);
+
+        /**
+         * \brief Write to the output.
+         *
+         * \param buf the data to write.
+         */
+        void write(const std::string& buf);
+
+        /**
+         * \brief Pad the output to an 8 byte boundary.
+         */
+        void align();
+
+        /**
+         * \brief the output writer.
+         */
+        std::unique_ptr<StreamWriter> writer_;
+
+        /**
+         * \brief the number of records in a chunk.
+         */
+        uint32_t chunk_rows_;
+
+        /**
+         * \brief the current chunk records.
+         */
+        std::vector<Row> rows_;
+
+        /**
+         * \brief the written chunks.
+         */
+        std::vector<ChunkInfo> chunks_;
+
+        /**
+         * \brief the address dictionary.
+         */
+        std::vector<byte_string> addresses_;
+
+        /**
+         * \brief the address dictionary index.
+         */
+        DictionaryIndex address_index_;
+
+        /**
+         * \brief the name dictionary.
+         */
+        std::vector<byte_string> names_;
+
+        /**
+         * \brief the name dictionary index.
+         */
+        DictionaryIndex name_index_;
+
+        /**
+         * \brief the current output offset.
+         */
+        uint64_t offset_;
+
+        /**
+         * \brief has the file been closed?
+         */
+        bool closed_;
+    };
+
+    /**
+     * \class Reader
+     * \brief Read a columnar file via `mmap()`.
+     */
+    class Reader
+    {
+    public:
+        /**
+         * \brief Constructor.
+         *
+         * \param path the file path.
+         * \throws columnar_error if the file can't be read or is invalid.
+         */
+        explicit Reader(const std::string& path);
+
+        /**
+         * \brief Destructor.
+         */
+        ~Reader();
+
+        /**
+         * \brief Readers hold a mapping, and so can't be copied.
+         */
+        Reader(const Reader&) = delete;
+
+        /**
+         * \brief Readers hold a mapping, and so can't be copied.
+         */
+        Reader& operator=(const Reader&) = delete;
+
+        /**
+         * \brief Get the number of chunks.
+         *
+         * \returns the number of chunks.
+         */
+        std::size_t chunks() const
+        {
+            return chunk_count_;
+        }
+
+        /**
+         * \brief Get the number of records in a chunk.
+         *
+         * \param chunk the chunk.
+         * \returns the number of records.
+         */
+        std::size_t rows(std::size_t chunk) const;
+
+        /**
+         * \brief Get a column of a chunk.
+         *
+         * \param chunk the chunk.
+         * \param col   the column.
+         * \returns pointer to the column values.
+         * \throws columnar_error if `T` is not the column width.
+         */
+        template<typename T>
+        const T* column(std::size_t chunk, Column col) const
+        {
+            if ( sizeof(T) != column_width(col) )
+                throw columnar_error("Bad column type");
+            return reinterpret_cast<const T*>(column_data(chunk, col));
+        }
+
+        /**
+         * \brief Get the data of a column in a chunk.
+         *
+         * \param chunk the chunk.
+         * \param col   the column.
+         * \returns pointer to the column values, of the column width.
+         */
+        const uint8_t* column_data(std::size_t chunk, Column col) const;
+
+        /**
+         * \brief Get the minimum value of a column in a chunk.
+         *
+         * \param chunk the chunk.
+         * \param col   the column.
+         * \returns the minimum non-null value, or the null value if none.
+         */
+        int64_t min(std::size_t chunk, Column col) const;
+
+        /**
+         * \brief Get the maximum value of a column in a chunk.
+         *
+         * \param chunk the chunk.
+         * \param col   the column.
+         * \returns the maximum non-null value, or the null value if none.
+         */
+        int64_t max(std::size_t chunk, Column col) const;
+
+        /**
+         * \brief Get the number of addresses in the address dictionary.
+         *
+         * \returns the number of addresses.
+         */
+        std::size_t address_count() const
+        {
+            return dictionary_size(address_dict_);
+        }
+
+        /**
+         * \brief Get an address from the address dictionary.
+         *
+         * \param index the address index.
+         * \returns the address in network binary format.
+         */
+        byte_string address(uint32_t index) const
+        {
+            return dictionary_item(address_dict_, index);
+        }
+
+        /**
+         * \brief Get the number of names in the name dictionary.
+         *
+         * \returns the number of names.
+         */
+        std::size_t name_count() const
+        {
+            return dictionary_size(name_dict_);
+        }
+
+        /**
+         * \brief Get a name from the name dictionary.
+         *
+         * \param index the name index.
+         * \returns the name in label format.
+         */
+        byte_string name(uint32_t index) const
+        {
+            return dictionary_item(name_dict_, index);
+        }
+
+    private:
+        /**
+         * \brief Get a pointer into the file.
+         *
+         * \param offset the file offset.
+         * \param len    the number of bytes required at the offset.
+         * \returns the pointer.
+         * \throws columnar_error if the range is outside the file.
+         */
+        const uint8_t* at(uint64_t offset, uint64_t len) const;
+
+        /**
+         * \brief Get a 64 bit value from the file.
+         *
+         * \param offset the file offset.
+         * \returns the value.
+         */
+        uint64_t u64(uint64_t offset) const;
+
+        /**
+         * \brief Get the footer offset of a chunk's information.
+         *
+         * \param chunk the chunk.
+         * \returns the offset.
+         */
+        uint64_t chunk_info(std::size_t chunk) const;
+
+        /**
+         * \brief Get the number of items in a dictionary.
+         *
+         * \param dict the dictionary offset.
+         * \returns the number of items.
+         */
+        std::size_t dictionary_size(uint64_t dict) const;
+
+        /**
+         * \brief Get an item from a dictionary.
+         *
+         * \param dict  the dictionary offset.
+         * \param index the item index.
+         * \returns the item.
+         */
+        byte_string dictionary_item(uint64_t dict, uint32_t index) const;
+
+        /**
+         * \brief the mapped file.
+         */
+        const uint8_t* data_;
+
+        /**
+         * \brief the mapped file size.
+         */
+        uint64_t size_;
+
+        /**
+         * \brief the number of chunks.
+         */
+        std::size_t chunk_count_;
+
+        /**
+         * \brief the offset of the chunk information in the footer.
+         */
+        uint64_t chunk_info_;
+
+        /**
+         * \brief the offset of the address dictionary.
+         */
+        uint64_t address_dict_;
+
+        /**
+         * \brief the offset of the name dictionary.
+         */
+        uint64_t name_dict_;
+    };
+}
+
+#endif
@@ -11,16 +11,18 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <csignal>
 #include <exception>
 #include <fstream>
+#include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <iomanip>
 
-#include <pthread.h>
-
 #include <boost/asio.hpp>
 #include <boost/variant.hpp>
 
@@ -43,12 +45,17 @@
 #include "log.hpp"
 #include "makeunique.hpp"
 #include "matcher.hpp"
+#include "memorybudget.hpp"
+#include "metrics.hpp"
 #include "packetstream.hpp"
 #include "pcapwriter.hpp"
 #include "queryresponse.hpp"
+#include "sampler.hpp"
 #include "signalhandler.hpp"
 #include "sniffers.hpp"
+#include "stagetimes.hpp"
 #include "streamwriter.hpp"
+#include "threadplacement.hpp"
 #include "util.hpp"
 
 const std::string PROGNAME = "compactor";
@@ -57,15 +64,6 @@ namespace al = boost::asio::local;
 namespace po = boost::program_options;
 namespace cno = std::chrono;
 
-/**
- * \brief A do-nothing signal handler.
- *
- * \param sig   the signal.
- */
-static void sighandler_empty(int /* sig */)
-{
-}
-
 /**
  * \typedef CborItemPayload
  * \brief A varient type for the different items to be written to C-DNS.
@@ -83,18 +81,20 @@ struct CborItem
      * \brief Constructor for query/response.
      */
     CborItem(const std::shared_ptr<QueryResponse>& qr, const PacketStatistics& stats)
-        : payload(qr), stats(stats) {}
+        : payload(qr), stats(stats),
+          queued(StageTimes::enabled() ? StageTimes::now() : 0) {}
 
     /**
      * \brief Constructor for address event.
      */
     CborItem(const std::shared_ptr<AddressEvent>& ae, const PacketStatistics& stats)
-        : payload(ae), stats(stats) {}
+        : payload(ae), stats(stats),
+          queued(StageTimes::enabled() ? StageTimes::now() : 0) {}
 
     /**
      * \brief Empty constructor.
      */
-    CborItem() {}
+    CborItem() : queued(0) {}
 
     /**
      * \brief the item data.
@@ -105,8 +105,38 @@ struct CborItem
      * \brief the statistics as at the time of the item.
      */
     PacketStatistics stats;
+
+    /**
+     * \brief when the item was queued, if stage timing is enabled.
+     */
+    uint64_t queued;
 };
 
+/**
+ * \brief Return the approximate memory used by a C-DNS output item.
+ *
+ * \param cbi the item.
+ * \returns the approximate size in bytes.
+ */
+static std::size_t cbor_item_size(const CborItem& cbi)
+{
+    const std::shared_ptr<QueryResponse>* qr = boost::get<std::shared_ptr<QueryResponse>>(&cbi.payload);
+    if ( qr && *qr )
+        return sizeof(CborItem) + (*qr)->memory_size();
+    return sizeof(CborItem) + sizeof(AddressEvent);
+}
+
+/**
+ * \brief Return the approximate memory used by a PCAP output item.
+ *
+ * \param pcap the item.
+ * \returns the approximate size in bytes.
+ */
+static std::size_t pcap_item_size(const std::shared_ptr<PcapItem>& pcap)
+{
+    return pcap->memory_size();
+}
+
 /**
  * \struct OutputChannels
  * \brief Shared pointers to output channels for a run.
@@ -114,6 +144,10 @@ struct CborItem
  * The channels are created in the main thread. Shared pointers are
  * passed to the output threads, and the channel is deleted when the
  * last of the output thread or the main thread exits.
+ *
+ * All channels charge the items they hold to the run's memory budget.
+ * A packet queued for both raw and ignored PCAP output is charged to
+ * both.
  */
 struct OutputChannels
 {
@@ -123,8 +157,12 @@ struct OutputChannels
     OutputChannels()
         :raw_pcap(std::make_shared<Channel<std::shared_ptr<PcapItem>>>()),
          ignored_pcap(std::make_shared<Channel<std::shared_ptr<PcapItem>>>()),
-         cbor(std::make_shared<Channel<CborItem>>())
+         cbor(std::make_shared<Channel<CborItem>>()),
+         memory(std::make_shared<MemoryBudget>())
     {
+        raw_pcap->set_memory_budget(memory, MemoryBudget::Stage::RAW_PCAP, pcap_item_size);
+        ignored_pcap->set_memory_budget(memory, MemoryBudget::Stage::IGNORED_PCAP, pcap_item_size);
+        cbor->set_memory_budget(memory, MemoryBudget::Stage::CDNS, cbor_item_size);
     }
 
     /**
@@ -141,6 +179,179 @@ struct OutputChannels
      * \brief Channel for sending items to be written to C-DNS output thread.
      */
     std::shared_ptr<Channel<CborItem>> cbor;
+
+    /**
+     * \brief Memory budget for the channels, matcher and sniffer.
+     */
+    std::shared_ptr<MemoryBudget> memory;
+};
+
+/**
+ * \class MetricsCollector
+ * \brief Gather the state of a run and publish it as metrics.
+ *
+ * The statistics belong to the thread processing packets, so that
+ * thread gathers them, at most once a second, and passes them to
+ * the metrics server.
+ */
+class MetricsCollector
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * Metrics are only published during live capture.
+     *
+     * \param config       the current configuration.
+     * \param output       the output channels.
+     * \param writer_pool  pool of compression threads, if any.
+     * \param live_capture is this a live capture?
+     */
+    MetricsCollector(const Configuration& config,
+                     OutputChannels& output,
+                     std::shared_ptr<BaseParallelWriterPool> writer_pool,
+                     bool live_capture)
+        : output_(output), writer_pool_(writer_pool)
+    {
+        if ( live_capture &&
+             ( !config.metrics_socket.empty() ||
+               config.metrics_tcp_port != 0 ||
+               !config.metrics_file.empty() ) )
+            server_ = make_unique<MetricsServer>(config.metrics_socket,
+                                                 config.metrics_tcp_address,
+                                                 config.metrics_tcp_port,
+                                                 config.metrics_file);
+    }
+
+    /**
+     * \brief Publish metrics, if due.
+     *
+     * \param stats         the packet statistics.
+     * \param matcher_queue the number of items held by the matcher.
+     * \param sampling      is sampling active?
+     * \param sniffer_stats the sniffer statistics, if capturing packets.
+     */
+    void publish(const PacketStatistics& stats,
+                 unsigned matcher_queue,
+                 bool sampling,
+                 const BaseSniffers::Stats* sniffer_stats = nullptr)
+    {
+        if ( !server_ )
+            return;
+
+        cno::steady_clock::time_point now = cno::steady_clock::now();
+        if ( now < next_publish_ )
+            return;
+        next_publish_ = now + cno::seconds(1);
+
+        MetricsText mt;
+        mt.counter("compactor_packets_total",
+                   "Packets received for processing.", stats.raw_packet_count);
+        mt.counter("compactor_out_of_order_packets_total",
+                   "Packets received out of time order.", stats.out_of_order_packet_count);
+        mt.counter("compactor_non_dns_packets_total",
+                   "Packets ignored as not DNS.", stats.unhandled_packet_count);
+        mt.counter("compactor_dns_messages_total",
+                   "DNS messages processed.", stats.processed_message_count);
+        mt.counter("compactor_malformed_messages_total",
+                   "Malformed DNS messages.", stats.malformed_message_count);
+        mt.counter("compactor_discarded_opcode_messages_total",
+                   "DNS messages discarded because of their OPCODE.", stats.discarded_opcode_count);
+        mt.counter("compactor_query_response_pairs_total",
+                   "Matched DNS query/response pairs.", stats.qr_pair_count);
+        mt.counter("compactor_unmatched_queries_total",
+                   "DNS queries without a response.", stats.query_without_response_count);
+        mt.counter("compactor_unmatched_responses_total",
+                   "DNS responses without a query.", stats.response_without_query_count);
+        if ( sniffer_stats )
+        {
+            mt.counter("compactor_pcap_received_total",
+                       "Packets received, as reported by libpcap.", stats.pcap_recv_count);
+            mt.counter("compactor_pcap_dropped_total",
+                       "Packets dropped in the kernel, as reported by libpcap.", stats.pcap_drop_count);
+            mt.counter("compactor_pcap_interface_dropped_total",
+                       "Packets dropped by the interface, as reported by libpcap.", stats.pcap_ifdrop_count);
+        }
+
+        mt.family("compactor_dropped_total", "counter",
+                  "Items dropped because a stage was overloaded.");
+        if ( sniffer_stats )
+            mt.sample("compactor_dropped_total", {{"stage", "sniffer"}}, sniffer_stats->pkts_dropped);
+        mt.sample("compactor_dropped_total", {{"stage", "matcher"}}, stats.matcher_drop_count);
+        mt.sample("compactor_dropped_total", {{"stage", "cdns"}}, stats.output_cbor_drop_count);
+        mt.sample("compactor_dropped_total", {{"stage", "raw_pcap"}}, stats.output_raw_pcap_drop_count);
+        mt.sample("compactor_dropped_total", {{"stage", "ignored_pcap"}}, stats.output_ignored_pcap_drop_count);
+
+        mt.counter("compactor_sampling_discarded_total",
+                   "Items discarded by sampling.", stats.discarded_sampling_count);
+        mt.gauge("compactor_sampling_active",
+                 "1 if sampling is active, 0 otherwise.", sampling ? 1 : 0);
+        mt.gauge("compactor_sampling_rate",
+                 "Sampling keeps 1 in this many items, 0 if not sampling.", stats.sampling_rate);
+
+        mt.family("compactor_queue_length", "gauge",
+                  "Items waiting between processing stages.");
+        if ( sniffer_stats )
+            mt.sample("compactor_queue_length", {{"queue", "sniffer"}},
+                      static_cast<uint64_t>(sniffer_stats->channel_length));
+        mt.sample("compactor_queue_length", {{"queue", "matcher"}},
+                  static_cast<uint64_t>(matcher_queue));
+        mt.sample("compactor_queue_length", {{"queue", "cdns"}},
+                  static_cast<uint64_t>(output_.cbor->get_length()));
+        mt.sample("compactor_queue_length", {{"queue", "raw_pcap"}},
+                  static_cast<uint64_t>(output_.raw_pcap->get_length()));
+        mt.sample("compactor_queue_length", {{"queue", "ignored_pcap"}},
+                  static_cast<uint64_t>(output_.ignored_pcap->get_length()));
+
+        mt.family("compactor_memory_bytes", "gauge",
+                  "Approximate memory held by each processing stage.");
+        const std::pair<MemoryBudget::Stage, const char*> stages[] = {
+            { MemoryBudget::Stage::SNIFFER, "sniffer" },
+            { MemoryBudget::Stage::MATCHER, "matcher" },
+            { MemoryBudget::Stage::CDNS, "cdns" },
+            { MemoryBudget::Stage::RAW_PCAP, "raw_pcap" },
+            { MemoryBudget::Stage::IGNORED_PCAP, "ignored_pcap" },
+        };
+        for ( const auto& st : stages )
+            mt.sample("compactor_memory_bytes", {{"stage", st.second}},
+                      static_cast<uint64_t>(output_.memory->usage(st.first)));
+
+        if ( writer_pool_ )
+        {
+            mt.gauge("compactor_compression_threads",
+                     "C-DNS files being compressed.", writer_pool_->active_threads());
+            mt.gauge("compactor_compression_threads_max",
+                     "Maximum C-DNS files compressed at once.", writer_pool_->max_threads());
+        }
+
+        mt.gauge("compactor_last_update_timestamp_seconds",
+                 "When these metrics were gathered, in seconds since the epoch.",
+                 cno::duration_cast<cno::duration<double>>(
+                     cno::system_clock::now().time_since_epoch()).count());
+
+        server_->publish(mt.str());
+    }
+
+private:
+    /**
+     * \brief the output channels.
+     */
+    OutputChannels& output_;
+
+    /**
+     * \brief the pool of compression threads, if any.
+     */
+    std::shared_ptr<BaseParallelWriterPool> writer_pool_;
+
+    /**
+     * \brief the metrics server, if publishing metrics.
+     */
+    std::unique_ptr<MetricsServer> server_;
+
+    /**
+     * \brief when metrics are next due.
+     */
+    cno::steady_clock::time_point next_publish_;
 };
 
 /**
@@ -162,11 +373,14 @@ static void packet_writer(const char* name,
     {
         try
         {
-            out->write_packet(*(pcap->pdu), pcap->timestamp, config);
+            if ( pcap->frame )
+                out->write_frame(*(pcap->frame), pcap->timestamp, config);
+            else
+                out->write_packet(*(pcap->pdu), pcap->timestamp, config);
         }
         catch (const std::exception& err)
         {
-            LOG_ERROR << err.what();
+            LOG_ERROR_LIMITED << err.what();
         }
     }
 }
@@ -241,6 +455,9 @@ static void cbor_writer(std::unique_ptr<BlockCborWriter> out,
     CborItem cbi;
     while ( chan->get(cbi) )
     {
+        if ( cbi.queued )
+            StageTimes::record_between(StageTimes::Stage::CDNS_QUEUE, cbi.queued, StageTimes::now());
+
         try
         {
             cbiv.set_stats(&cbi.stats);
@@ -248,11 +465,29 @@ static void cbor_writer(std::unique_ptr<BlockCborWriter> out,
         }
         catch (const std::exception& err)
         {
-            LOG_ERROR << err.what();
+            LOG_ERROR_LIMITED << err.what();
         }
     }
 }
 
+/**
+ * \brief Log stage times for the latest stats interval.
+ *
+ * \param last the stage times at the start of the interval. Updated
+ *             to the current stage times.
+ */
+static void log_stage_times(StageTimes::Snapshot& last)
+{
+    StageTimes::Snapshot current = StageTimes::snapshot();
+    StageTimes::Snapshot interval = current;
+    for ( std::size_t i = 0; i < StageTimes::STAGES; ++i )
+        interval[i] -= last[i];
+
+    for ( const auto& line : StageTimes::format(interval) )
+        LOG_INFO << " Timing  : " << line;
+    last = current;
+}
+
 /**
  * \brief The main network capture loop. Read packets from the sniffer
  * and process them.
@@ -266,12 +501,14 @@ static void cbor_writer(std::unique_ptr<BlockCborWriter> out,
  * \param output  the output channels.
  * \param config  the current configuration.
  * \param stats   collect packet statistics here.
+ * \param metrics publish metrics here.
  */
 static void sniff_loop(BaseSniffers* sniffer,
                        QueryResponseMatcher& matcher,
                        OutputChannels& output,
                        const Configuration& config,
-                       PacketStatistics& stats)
+                       PacketStatistics& stats,
+                       MetricsCollector& metrics)
 {
     bool seen_raw_overflow = false;
     bool seen_ignored_overflow = false;
@@ -300,6 +537,14 @@ static void sniff_loop(BaseSniffers* sniffer,
 
     bool drops_last_check = false;
     bool sampling = false;
+    Sampler sampler(Sampler::find_method(config.sampling_method),
+                    config.sampling_prefix_ipv4, config.sampling_prefix_ipv6);
+
+    bool timing = StageTimes::enabled();
+    StageTimes::Snapshot last_stage_times;
+    if ( timing )
+        last_stage_times = StageTimes::snapshot();
+    uint64_t match_ticks = 0;   // time matching during the current packet
 
     auto dns_sink =
         [&](std::unique_ptr<DNSMessage>& dns)
@@ -310,7 +555,18 @@ static void sniff_loop(BaseSniffers* sniffer,
                 std::cout << *dns;
 
             if ( do_match )
-                matcher.add(std::move(dns));
+            {
+                if ( timing )
+                {
+                    uint64_t start = StageTimes::now();
+                    matcher.add(std::move(dns));
+                    uint64_t ticks = StageTimes::now() - start;
+                    StageTimes::record(StageTimes::Stage::MATCH, ticks);
+                    match_ticks += ticks;
+                }
+                else
+                    matcher.add(std::move(dns));
+            }
         };
 
     auto address_event_sink =
@@ -343,17 +599,34 @@ static void sniff_loop(BaseSniffers* sniffer,
             }
         };
 
-    PacketStream packet_stream(config, dns_sink, address_event_sink);
+    auto discard_sink =
+        [&](PacketStream::DiscardReason reason)
+        {
+            switch ( reason )
+            {
+            case PacketStream::DiscardReason::OPCODE:
+                ++stats.processed_message_count;
+                ++stats.discarded_opcode_count;
+                break;
+
+            case PacketStream::DiscardReason::SAMPLING:
+                ++stats.discarded_sampling_count;
+                break;
+            }
+        };
+
+    PacketStream packet_stream(config, dns_sink, address_event_sink, discard_sink, &sampler);
 
     for (;;)
     {
-        Tins::Packet pkt(sniffer->next_packet());
+        std::shared_ptr<PcapFrame> frame;
+        Tins::Packet pkt(sniffer->next_packet(frame));
         if ( !pkt.pdu() )
             break;
 
         // Get the PDU controlled by a shared_ptr. This will avoid the need
         // to copy it.
-        std::shared_ptr<PcapItem> pcap = std::make_shared<PcapItem>(pkt);
+        std::shared_ptr<PcapItem> pcap = std::make_shared<PcapItem>(pkt, std::move(frame));
 
         ++stats.raw_packet_count;
 
@@ -375,18 +648,21 @@ static void sniff_loop(BaseSniffers* sniffer,
         }
 
 
-        if (matcher.get_length() > (config.max_channel_size * 2)) {
+        if ( matcher.get_length() > (config.max_channel_size * 2) ||
+             output.memory->exhausted(MemoryBudget::Stage::MATCHER) ) {
             ++stats.matcher_drop_count;
             matcher.poke(pcap->timestamp);
         }
         // If we're dropping packets, respond by sampling. 
-        else if ( sampling && (stats.raw_packet_count % config.sampling_rate) != 0 ) {
+        else if ( sampler.by_packet() && !sampler.keep(stats.raw_packet_count) ) {
             ++stats.discarded_sampling_count;
         } 
         else {
             if ( do_decode )
             {
                 bool ignored = false;
+                uint64_t start = timing ? StageTimes::now() : 0;
+                match_ticks = 0;
 
                 try
                 {
@@ -403,6 +679,9 @@ static void sniff_loop(BaseSniffers* sniffer,
                     ++stats.malformed_message_count;
                 }
 
+                if ( timing )
+                    StageTimes::record(StageTimes::Stage::PARSE, StageTimes::now() - start - match_ticks);
+
                 if ( ignored )
                     ignored_sink(pcap);
             }
@@ -428,9 +707,9 @@ static void sniff_loop(BaseSniffers* sniffer,
             // If seeing drops, only trigger off these two queues and the matcher
             if ( new_sniff_drops > 0 || new_cbor_drops > 0 || new_match_drops > 0 )
             {             
-                LOG_ERROR << "Dropping on these channels: " << (new_sniff_drops!=0?"Sniffer ":"")
-                                                            << (new_match_drops!=0?"Matcher ":"")
-                                                            << (new_cbor_drops!=0?"C-DNS":"");
+                LOG_ERROR_LIMITED << "Dropping on these channels: " << (new_sniff_drops!=0?"Sniffer ":"")
+                                                                    << (new_match_drops!=0?"Matcher ":"")
+                                                                    << (new_cbor_drops!=0?"C-DNS":"");
             }
             if ( sniff_dropping || cbor_dropping || match_dropping) {
                 if (config.sampling_rate > 0) {
@@ -440,9 +719,12 @@ static void sniff_loop(BaseSniffers* sniffer,
                             drops_last_check = true;
                         } else {
                             sampling = true;
+                            sampler.set_rate(config.sampling_rate);
+                            stats.sampling_rate = config.sampling_rate;
                             sampling_end_timestamp = last_recv_timestamp + std::chrono::seconds(config.sampling_time);
                             LOG_WARN << "Sampling mode switched on for " << config.sampling_time 
-                                     << "s with rate of 1 in " << config.sampling_rate << " as dropping above threshold % of "
+                                     << "s with rate of 1 in " << config.sampling_rate << " by "
+                                     << config.sampling_method << " as dropping above threshold % of "
                                      << config.sampling_threshold;
                         }
                     }
@@ -454,6 +736,8 @@ static void sniff_loop(BaseSniffers* sniffer,
                 }
             } else if ( sampling && sampling_end_timestamp <= last_recv_timestamp ) {
                 sampling = false;
+                sampler.set_rate(0);
+                stats.sampling_rate = 0;
                 drops_last_check = false;
                 LOG_WARN << "Sampling mode switched off because time limit expired and not dropping above threshold.";
             }
@@ -470,6 +754,8 @@ static void sniff_loop(BaseSniffers* sniffer,
             stats.sniffer_drop_count += new_sniff_drops;
             last_drop_check_sniffer_stats = sniffer_stats;
             last_drop_check_stats = last_stats;
+
+            metrics.publish(stats, matcher.get_length(), sampling, &sniffer_stats);
         }
 
 
@@ -497,6 +783,16 @@ static void sniff_loop(BaseSniffers* sniffer,
                          << pcap_stats.ps_recv   - last_pcap_stats.ps_recv << "/" << std::setw(w)
                          << pcap_stats.ps_drop   - last_pcap_stats.ps_drop << "/" << std::setw(w)
                          << pcap_stats.ps_ifdrop - last_pcap_stats.ps_ifdrop;
+                // Packets received only to be ignored are candidates
+                // for discarding at capture with a filter. libpcap
+                // doesn't count packets rejected by a filter.
+                uint64_t ignored = (stats.unhandled_packet_count  - last_stats.unhandled_packet_count) +
+                                   (stats.malformed_message_count - last_stats.malformed_message_count);
+                uint64_t recv = pcap_stats.ps_recv - last_pcap_stats.ps_recv;
+                int ip = ( recv > 0 ) ? std::lround(ignored * 100.0 / recv) : 0;
+                LOG_INFO << " Ignored : count/% recv           "                 << std::setw(w)
+                         << ignored                                        << "/" << std::setw(w)
+                         << std::min(ip, 100);
                 // Output info from PacketStatists and the sniffer for this interval
                 sniffer->sniffer_stats(sniffer_stats);
                 LOG_INFO << " Sniffer : recv/dropped/queue     "                                 << std::setw(w)
@@ -528,6 +824,16 @@ static void sniff_loop(BaseSniffers* sniffer,
                 LOG_INFO << " PCAP out: raw drop/ignored drop  "                                                     << std::setw(w)
                          << stats.output_raw_pcap_drop_count     - last_stats.output_raw_pcap_drop_count     << "/"  << std::setw(w)
                          << stats.output_ignored_pcap_drop_count - last_stats.output_ignored_pcap_drop_count << "/"  << std::setw(w);
+                LOG_INFO << " Memory  : sniffer/matcher/cdns   "                                 << std::setw(w)
+                         << output.memory->usage(MemoryBudget::Stage::SNIFFER)           << "/"  << std::setw(w)
+                         << output.memory->usage(MemoryBudget::Stage::MATCHER)           << "/"  << std::setw(w)
+                         << output.memory->usage(MemoryBudget::Stage::CDNS);
+                LOG_INFO << " Memory  : raw/ignored/total      "                                 << std::setw(w)
+                         << output.memory->usage(MemoryBudget::Stage::RAW_PCAP)          << "/"  << std::setw(w)
+                         << output.memory->usage(MemoryBudget::Stage::IGNORED_PCAP)      << "/"  << std::setw(w)
+                         << output.memory->total();
+                if ( timing )
+                    log_stage_times(last_stage_times);
                 LOG_INFO << "";
 
                 // Update time/state
@@ -544,87 +850,572 @@ static void sniff_loop(BaseSniffers* sniffer,
 
 #if ENABLE_DNSTAP
 /**
- * \brief The main DNSTAP loop. Read packets from the input stream
- * and process them.
- *
- * Received DNS messages are sent to the matcher.
- *
- * The loop continues until the stream reports EOF.
+ * \struct DnsTapStreamStats
+ * \brief Statistics for a single DNSTAP stream.
+ */
+struct DnsTapStreamStats
+{
+    /**
+     * \brief the number of DNS messages received.
+     */
+    uint64_t message_count{0};
+
+    /**
+     * \brief the number of malformed DNS messages received.
+     */
+    uint64_t malformed_message_count{0};
+
+    /**
+     * \brief the number of DNS messages received out of time order.
+     */
+    uint64_t out_of_order_count{0};
+};
+
+/**
+ * \class DnsTapCollector
+ * \brief Collect DNS messages from DNSTAP streams.
  *
- * \param dnstap  the DNSTAP processor.
- * \param stream  the input stream to read.
- * \param matcher the query/response matcher to use.
- * \param config  the current configuration.
- * \param stats   collect packet statistics here.
- * \param output  the output channels.
+ * Received DNS messages are sent to a matcher. Any number of
+ * streams may be processed at once, each on its own thread. Message
+ * timestamps are only in order within a stream, so concurrent
+ * streams must each have their own matcher. Access to matchers and
+ * statistics is serialised, so the matcher outputs are too.
  */
-static void tap_loop(DnsTap& dnstap,
-                     std::iostream& stream,
-                     QueryResponseMatcher& matcher,
-                     const Configuration& config,
-                     PacketStatistics& stats,
-                     OutputChannels& output)
+class DnsTapCollector
 {
-    cno::system_clock::time_point last_recv_timestamp;
-    cno::system_clock::time_point next_statslog_timestamp;
-    cno::system_clock::time_point last_statslog_timestamp;
-    PacketStatistics last_stats = stats;
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param config  the current configuration.
+     * \param stats   collect packet statistics here.
+     * \param output  the output channels.
+     * \param metrics publish metrics here.
+     */
+    DnsTapCollector(const Configuration& config,
+                    PacketStatistics& stats,
+                    OutputChannels& output,
+                    MetricsCollector& metrics)
+        : config_(config), stats_(stats), output_(output),
+          metrics_(metrics),
+          last_stats_(stats),
+          last_stage_times_(StageTimes::enabled() ? StageTimes::snapshot() : StageTimes::Snapshot()) {}
 
-    auto sink = [&](std::unique_ptr<DNSMessage>& dns)
+    /**
+     * \brief Read messages from a stream and process them.
+     *
+     * The loop continues until the stream reports EOF or the
+     * DNSTAP processor is told to stop.
+     *
+     * \param dnstap  the DNSTAP processor for the stream.
+     * \param stream  the input stream to read.
+     * \param matcher the query/response matcher for the stream.
+     * \returns statistics for the stream.
+     */
+    DnsTapStreamStats process_stream(DnsTap& dnstap, std::iostream& stream,
+                                     QueryResponseMatcher& matcher)
     {
-        ++stats.raw_packet_count;
-        ++stats.processed_message_count;
-        if ( last_recv_timestamp > dns->timestamp )
-            ++stats.out_of_order_packet_count;
-        stats.malformed_message_count = dnstap.malformed_message_count();
-        last_recv_timestamp = dns->timestamp;
-        if ( config.debug_dns )
-            std::cout << *dns;
-        matcher.add(std::move(dns));
+        DnsTapStreamStats res;
+        cno::system_clock::time_point last_recv_timestamp;
+        ActiveMatcher active(*this, matcher);
 
-        if ( config.log_network_stats_period > 0 )
+        auto sink = [&](std::unique_ptr<DNSMessage>& dns)
         {
-            if ( next_statslog_timestamp.time_since_epoch().count() == 0 )
+            // Messages are only expected to be in order within a stream.
+            bool out_of_order = ( last_recv_timestamp > dns->timestamp );
+            last_recv_timestamp = dns->timestamp;
+            ++res.message_count;
+            if ( out_of_order )
+                ++res.out_of_order_count;
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.raw_packet_count;
+            ++stats_.processed_message_count;
+            if ( out_of_order )
+                ++stats_.out_of_order_packet_count;
+            update_malformed(dnstap, res);
+            if ( dns->timestamp > last_timestamp_ )
+                last_timestamp_ = dns->timestamp;
+            if ( config_.debug_dns )
+                std::cout << *dns;
+            if ( StageTimes::enabled() )
             {
-                next_statslog_timestamp = last_recv_timestamp + std::chrono::seconds(config.log_network_stats_period);
-                last_statslog_timestamp = last_recv_timestamp;
+                uint64_t start = StageTimes::now();
+                matcher.add(std::move(dns));
+                StageTimes::record(StageTimes::Stage::MATCH, StageTimes::now() - start);
             }
-            else if ( next_statslog_timestamp <= last_recv_timestamp )
+            else
+                matcher.add(std::move(dns));
+            log_stats();
+            metrics_.publish(stats_, matcher_length(), false);
+        };
+
+        try
+        {
+            dnstap.process_stream(stream, sink);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            update_malformed(dnstap, res);
+            throw;
+        }
+
+        // In case last message was malformed, ensure count is correct.
+        std::lock_guard<std::mutex> lock(mutex_);
+        update_malformed(dnstap, res);
+        return res;
+    }
+
+    /**
+     * \brief Flush a stream's matcher once the stream has finished.
+     *
+     * \param matcher the query/response matcher.
+     */
+    void flush(QueryResponseMatcher& matcher)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        matcher.flush();
+    }
+
+private:
+    /**
+     * \struct ActiveMatcher
+     * \brief Record a matcher as in use while a stream is processed.
+     */
+    struct ActiveMatcher
+    {
+        /**
+         * \brief Constructor.
+         *
+         * \param collector the collector.
+         * \param matcher   the matcher.
+         */
+        ActiveMatcher(DnsTapCollector& collector, QueryResponseMatcher& matcher)
+            : collector_(collector), matcher_(matcher)
+        {
+            std::lock_guard<std::mutex> lock(collector_.mutex_);
+            collector_.matchers_.push_back(&matcher_);
+        }
+
+        /**
+         * \brief Destructor.
+         */
+        ~ActiveMatcher()
+        {
+            std::lock_guard<std::mutex> lock(collector_.mutex_);
+            auto& m = collector_.matchers_;
+            m.erase(std::find(m.begin(), m.end(), &matcher_));
+        }
+
+        /**
+         * \brief the collector.
+         */
+        DnsTapCollector& collector_;
+
+        /**
+         * \brief the matcher.
+         */
+        QueryResponseMatcher& matcher_;
+    };
+
+    /**
+     * \brief Return the number of items held by all active matchers.
+     *
+     * Call with the mutex held.
+     *
+     * \returns the number of items.
+     */
+    unsigned matcher_length()
+    {
+        unsigned res = 0;
+        for ( auto m : matchers_ )
+            res += m->get_length();
+        return res;
+    }
+
+    /**
+     * \brief Add any new malformed messages in a stream to the statistics.
+     *
+     * Call with the mutex held.
+     *
+     * \param dnstap the DNSTAP processor for the stream.
+     * \param res    the stream statistics.
+     */
+    void update_malformed(DnsTap& dnstap, DnsTapStreamStats& res)
+    {
+        uint64_t malformed = dnstap.malformed_message_count();
+        stats_.malformed_message_count += malformed - res.malformed_message_count;
+        res.malformed_message_count = malformed;
+    }
+
+    /**
+     * \brief Log network statistics if the logging period has elapsed.
+     *
+     * Call with the mutex held.
+     */
+    void log_stats()
+    {
+        if ( config_.log_network_stats_period == 0 )
+            return;
+
+        if ( next_statslog_timestamp_.time_since_epoch().count() == 0 )
+        {
+            next_statslog_timestamp_ = last_timestamp_ + std::chrono::seconds(config_.log_network_stats_period);
+            last_statslog_timestamp_ = last_timestamp_;
+        }
+        else if ( next_statslog_timestamp_ <= last_timestamp_ )
+        {
+            int w = 10; //output width, big enough for interval numbers up to 5 billion pps
+            cno::seconds period = cno::duration_cast<cno::seconds>(last_timestamp_ - last_statslog_timestamp_);
+
+            LOG_INFO << "*Stats interval: average rate     " << std::setw(w)
+                     << stats_.raw_packet_count        - last_stats_.raw_packet_count / period.count() << " pps  over  "
+                     << config_.log_network_stats_period << "s";
+            LOG_INFO << " Matcher : recv/dropped/queue     "                         << std::setw(w)
+                     << stats_.raw_packet_count   - last_stats_.raw_packet_count       << "/" << std::setw(w)
+                     << stats_.matcher_drop_count - last_stats_.matcher_drop_count     << "/" << std::setw(w)
+                     << matcher_length();
+            LOG_INFO << " CDNS    : recv/dropped/queue     "                                       << std::setw(w)
+                     << stats_.processed_message_count - last_stats_.processed_message_count  << "/" << std::setw(w)
+                     << stats_.output_cbor_drop_count  - last_stats_.output_cbor_drop_count   << "/" << std::setw(w)
+                     << output_.cbor->get_length();
+            uint64_t cdns_written = (stats_.processed_message_count - last_stats_.processed_message_count) -
+                                    (stats_.output_cbor_drop_count  - last_stats_.output_cbor_drop_count);
+            int tp = std::lround(cdns_written * 100.0 / (stats_.processed_message_count - last_stats_.processed_message_count));
+            LOG_INFO << " CDNS out: writ/% traffic         "                                       << std::setw(w)
+                     << cdns_written        << "/" << std::setw(w)
+                     << std::min(tp, 100)   << "/" << std::setw(w)
+                     << "";
+            LOG_INFO << " Memory  : matcher/cdns/total     "                             << std::setw(w)
+                     << output_.memory->usage(MemoryBudget::Stage::MATCHER)      << "/"  << std::setw(w)
+                     << output_.memory->usage(MemoryBudget::Stage::CDNS)         << "/"  << std::setw(w)
+                     << output_.memory->total();
+            if ( StageTimes::enabled() )
+                log_stage_times(last_stage_times_);
+
+            next_statslog_timestamp_ = last_timestamp_ + cno::seconds(config_.log_network_stats_period);
+            last_statslog_timestamp_ = last_timestamp_;
+            last_stats_ = stats_;
+        }
+    }
+
+    /**
+     * \brief the current configuration.
+     */
+    const Configuration& config_;
+
+    /**
+     * \brief the packet statistics.
+     */
+    PacketStatistics& stats_;
+
+    /**
+     * \brief the output channels.
+     */
+    OutputChannels& output_;
+
+    /**
+     * \brief the metrics collector.
+     */
+    MetricsCollector& metrics_;
+
+    /**
+     * \brief serialise access to the matchers and statistics.
+     */
+    std::mutex mutex_;
+
+    /**
+     * \brief the matchers of streams being processed.
+     */
+    std::vector<QueryResponseMatcher*> matchers_;
+
+    /**
+     * \brief the latest message timestamp seen on any stream.
+     */
+    cno::system_clock::time_point last_timestamp_;
+
+    /**
+     * \brief when next to log statistics.
+     */
+    cno::system_clock::time_point next_statslog_timestamp_;
+
+    /**
+     * \brief when statistics were last logged.
+     */
+    cno::system_clock::time_point last_statslog_timestamp_;
+
+    /**
+     * \brief the statistics when last logged.
+     */
+    PacketStatistics last_stats_;
+
+    /**
+     * \brief the stage times when last logged.
+     */
+    StageTimes::Snapshot last_stage_times_;
+};
+
+/**
+ * \class DnsTapServer
+ * \brief Accept DNSTAP connections on Unix and TCP sockets.
+ *
+ * Each connection is read on its own thread, so any number of
+ * DNSTAP senders can be connected at once. Each connection has its
+ * own matcher, so that timestamps from different senders are never
+ * mixed in one matcher.
+ */
+class DnsTapServer
+{
+public:
+    /**
+     * \typedef MatcherFactory
+     * \brief Function making a new query/response matcher.
+     */
+    using MatcherFactory = std::function<std::unique_ptr<QueryResponseMatcher> ()>;
+
+    /**
+     * \brief Constructor.
+     *
+     * \param service      the I/O service to run acceptors on.
+     * \param collector    the collector for received messages.
+     * \param make_matcher make a matcher for each connection.
+     */
+    DnsTapServer(boost::asio::io_service& service, DnsTapCollector& collector,
+                 MatcherFactory make_matcher)
+        : service_(service), collector_(collector),
+          make_matcher_(make_matcher), next_id_(0), stopped_(false) {}
+
+    /**
+     * \brief Destructor.
+     *
+     * Stop and wait for all connections to finish.
+     */
+    ~DnsTapServer()
+    {
+        stop();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for ( auto& c : connections_ )
+            c->thread.join();
+    }
+
+    /**
+     * \brief Listen on a Unix socket.
+     *
+     * \param endpoint the socket endpoint.
+     */
+    void listen(const al::stream_protocol::endpoint& endpoint)
+    {
+        unix_acceptor_ = make_unique<al::stream_protocol::acceptor>(service_, endpoint);
+        accept<al::stream_protocol>(*unix_acceptor_, "unix");
+    }
+
+    /**
+     * \brief Listen on a TCP socket.
+     *
+     * \param endpoint the socket endpoint.
+     */
+    void listen(const boost::asio::ip::tcp::endpoint& endpoint)
+    {
+        tcp_acceptor_ = make_unique<boost::asio::ip::tcp::acceptor>(service_, endpoint);
+        accept<boost::asio::ip::tcp>(*tcp_acceptor_, "tcp");
+    }
+
+    /**
+     * \brief Stop accepting connections and stop all current connections.
+     *
+     * This may be called from any thread.
+     */
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if ( stopped_ )
+            return;
+        stopped_ = true;
+
+        boost::system::error_code ec;
+        if ( unix_acceptor_ )
+            unix_acceptor_->cancel(ec);
+        if ( tcp_acceptor_ )
+            tcp_acceptor_->cancel(ec);
+        for ( auto& c : connections_ )
+        {
+            c->dnstap.breakloop();
+            c->stop();
+        }
+    }
+
+private:
+    /**
+     * \struct Connection
+     * \brief A DNSTAP connection.
+     */
+    struct Connection
+    {
+        /**
+         * \brief the connection name, for logging.
+         */
+        std::string name;
+
+        /**
+         * \brief the DNSTAP processor for the connection.
+         */
+        DnsTap dnstap;
+
+        /**
+         * \brief the connection stream.
+         */
+        std::shared_ptr<std::iostream> stream;
+
+        /**
+         * \brief shut down the connection socket.
+         */
+        std::function<void ()> stop;
+
+        /**
+         * \brief the thread reading the connection.
+         */
+        std::thread thread;
+
+        /**
+         * \brief has the connection finished?
+         */
+        std::atomic<bool> done{false};
+    };
+
+    /**
+     * \brief Start accepting a connection.
+     *
+     * \param acceptor the acceptor.
+     * \param kind     the kind of connection, for logging.
+     */
+    template<typename Protocol>
+    void accept(typename Protocol::acceptor& acceptor, const std::string& kind)
+    {
+        auto stream = std::make_shared<typename Protocol::iostream>();
+        acceptor.async_accept(*stream->rdbuf(),
+            [this, &acceptor, kind, stream](const boost::system::error_code& err)
             {
-                int w = 10; //output width, big enough for interval numbers up to 5 billion pps
-                cno::seconds period = cno::duration_cast<cno::seconds>(last_recv_timestamp - last_statslog_timestamp);
+                if ( err )
+                {
+                    if ( err != boost::asio::error::operation_aborted )
+                        LOG_ERROR << "DNSTAP " << kind << " accept failed: " << err.message();
+                    return;
+                }
 
-                LOG_INFO << "*Stats interval: average rate     " << std::setw(w) 
-                     << stats.raw_packet_count        - last_stats.raw_packet_count / period.count() << " pps  over  "
-                     << config.log_network_stats_period << "s";
-                LOG_INFO << " Matcher : recv/dropped/queue     "                         << std::setw(w)
-                         << stats.raw_packet_count   - last_stats.raw_packet_count       << "/" << std::setw(w)
-                         << stats.matcher_drop_count - last_stats.matcher_drop_count     << "/" << std::setw(w)
-                         << matcher.get_length();
-                LOG_INFO << " CDNS    : recv/dropped/queue     "                                       << std::setw(w)
-                         << stats.processed_message_count - last_stats.processed_message_count  << "/" << std::setw(w)
-                         << stats.output_cbor_drop_count  - last_stats.output_cbor_drop_count   << "/" << std::setw(w)
-                         << output.cbor->get_length();
-                uint64_t cdns_written = (stats.processed_message_count - last_stats.processed_message_count) -
-                                        (stats.output_cbor_drop_count  - last_stats.output_cbor_drop_count);
-                int tp = std::lround(cdns_written * 100.0 / (stats.processed_message_count - last_stats.processed_message_count));
-                LOG_INFO << " CDNS out: writ/% traffic         "                                       << std::setw(w)
-                         << cdns_written        << "/" << std::setw(w)
-                         << std::min(tp, 100)   << "/" << std::setw(w)
-                         << "";
+                std::lock_guard<std::mutex> lock(mutex_);
+                if ( stopped_ )
+                    return;
+                reap();
 
-                next_statslog_timestamp = last_recv_timestamp + cno::seconds(config.log_network_stats_period);
-                last_statslog_timestamp = last_recv_timestamp;
-                last_stats = stats;
+                auto conn = std::make_shared<Connection>();
+                conn->name = kind + "#" + std::to_string(++next_id_);
+                conn->stop = [stream]()
+                {
+                    boost::system::error_code ec;
+                    stream->rdbuf()->shutdown(Protocol::socket::shutdown_both, ec);
+                };
+                LOG_INFO << "DNSTAP connection " << conn->name << " opened";
+                conn->stream = stream;
+                conn->thread = std::thread([this, conn]()
+                {
+                    set_thread_name("comp:dnstap");
+                    serve(*conn);
+                });
+                connections_.push_back(conn);
+
+                accept<Protocol>(acceptor, kind);
+            });
+    }
+
+    /**
+     * \brief Process a connection until it closes.
+     *
+     * \param conn the connection.
+     */
+    void serve(Connection& conn)
+    {
+        std::unique_ptr<QueryResponseMatcher> matcher = make_matcher_();
+        try
+        {
+            DnsTapStreamStats cs = collector_.process_stream(conn.dnstap, *conn.stream, *matcher);
+            LOG_INFO << "DNSTAP connection " << conn.name << " closed: "
+                     << cs.message_count << " messages, "
+                     << cs.malformed_message_count << " malformed, "
+                     << cs.out_of_order_count << " out of order";
+        }
+        catch (const std::exception& err)
+        {
+            LOG_ERROR_LIMITED << "DNSTAP connection " << conn.name << " failed: " << err.what();
+        }
+        collector_.flush(*matcher);
+        conn.done = true;
+    }
+
+    /**
+     * \brief Remove finished connections.
+     *
+     * Call with the mutex held.
+     */
+    void reap()
+    {
+        for ( auto it = connections_.begin(); it != connections_.end(); )
+        {
+            if ( (*it)->done )
+            {
+                (*it)->thread.join();
+                it = connections_.erase(it);
             }
+            else
+                ++it;
         }
-    };
+    }
 
-    dnstap.process_stream(stream, sink);
+    /**
+     * \brief the I/O service.
+     */
+    boost::asio::io_service& service_;
 
-    // In case last message was malformed, ensure count is correct.
-    stats.malformed_message_count = dnstap.malformed_message_count();
-}
+    /**
+     * \brief the message collector.
+     */
+    DnsTapCollector& collector_;
+
+    /**
+     * \brief make a matcher for each connection.
+     */
+    MatcherFactory make_matcher_;
+
+    /**
+     * \brief the Unix socket acceptor, if any.
+     */
+    std::unique_ptr<al::stream_protocol::acceptor> unix_acceptor_;
+
+    /**
+     * \brief the TCP socket acceptor, if any.
+     */
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> tcp_acceptor_;
+
+    /**
+     * \brief serialise access to the connection list.
+     */
+    std::mutex mutex_;
+
+    /**
+     * \brief the current connections.
+     */
+    std::list<std::shared_ptr<Connection>> connections_;
+
+    /**
+     * \brief the number of the last connection.
+     */
+    unsigned next_id_;
+
+    /**
+     * \brief has the server been stopped?
+     */
+    bool stopped_;
+};
 #endif
 
 /**
@@ -670,6 +1461,18 @@ static int run_configuration(const po::variables_map& vm,
                              std::vector<std::thread>& threads,
                              std::shared_ptr<BaseParallelWriterPool> writer_pool)
 {
+    // Threads started for this run apply the configured placement.
+    ThreadPlacement::configure(config.thread_placement);
+    ThreadPlacement::place_current_thread("main");
+
+#if ENABLE_IO_URING
+    // Output files opened from now on use the configured output mode.
+    StreamWriter::set_output_mode(config.output_io_uring,
+                                  config.output_direct_io,
+                                  config.output_sync);
+#endif
+    StreamWriter::set_compression_threads(config.compression_threads_per_file);
+
     // Output channels for this run.
     OutputChannels output;
     bool live_capture = false;
@@ -688,6 +1491,13 @@ static int run_configuration(const po::variables_map& vm,
         output.raw_pcap->set_max_items(config.max_channel_size);
         output.ignored_pcap->set_max_items(config.max_channel_size);
         output.cbor->set_max_items(config.max_channel_size);
+
+        output.memory->set_total_limit(config.max_memory.size);
+        output.memory->set_limit(MemoryBudget::Stage::SNIFFER, config.max_channel_memory.size);
+        output.memory->set_limit(MemoryBudget::Stage::RAW_PCAP, config.max_channel_memory.size);
+        output.memory->set_limit(MemoryBudget::Stage::IGNORED_PCAP, config.max_channel_memory.size);
+        output.memory->set_limit(MemoryBudget::Stage::CDNS, config.max_channel_memory.size);
+        output.memory->set_limit(MemoryBudget::Stage::MATCHER, config.max_matcher_memory.size);
     }
 
 
@@ -722,13 +1532,19 @@ static int run_configuration(const po::variables_map& vm,
     sniff_config.set_snap_len(config.snaplen);
     sniff_config.set_promisc_mode(config.promisc_mode);
     sniff_config.set_timeout(1);                // Copy DSC Collector.
-    if ( vm.count("filter") )
-        sniff_config.set_filter(config.filter);
+    if ( vm.count("filter") || config.auto_filter )
+        sniff_config.set_filter(config.capture_filter());
     sniff_config.set_chan_max_size(config.max_channel_size);
+    sniff_config.set_memory_budget(output.memory);
+    sniff_config.set_keep_frames(!config.raw_pcap_pattern.empty() ||
+                                 !config.ignored_pcap_pattern.empty());
+#if ENABLE_XDP
+    sniff_config.set_xdp(config.xdp_interfaces, config.dns_port, config.xdp_generic);
+#endif
 
     PacketStatistics stats{};
 
-    QueryResponseMatcher matcher(
+    QueryResponseMatcher::Sink qr_sink =
         [&](std::shared_ptr<QueryResponse> qr)
         {
             if ( qr->has_query() )
@@ -751,9 +1567,17 @@ static int run_configuration(const po::variables_map& vm,
                     ++stats.output_cbor_drop_count;
                 }
             }
-        });
-    matcher.set_query_timeout(config.query_timeout);
-    matcher.set_skew_timeout(config.skew_timeout);
+        };
+    auto make_matcher = [&]()
+        {
+            auto res = make_unique<QueryResponseMatcher>(qr_sink);
+            res->set_query_timeout(config.query_timeout);
+            res->set_skew_timeout(config.skew_timeout);
+            res->set_memory_budget(output.memory);
+            return res;
+        };
+    std::unique_ptr<QueryResponseMatcher> matcher_ptr = make_matcher();
+    QueryResponseMatcher& matcher = *matcher_ptr;
 
     // We assume that network or DNSTAP capture is typically a daemon
     // process, and log errors. File conversion, on the other hand,
@@ -766,37 +1590,39 @@ static int run_configuration(const po::variables_map& vm,
 
     try
     {
+        MetricsCollector metrics(config, output, writer_pool, live_capture);
+
         if ( !vm.count("capture-file") )
         {
 #if ENABLE_DNSTAP
-            if ( vm.count("dnstap-socket") )
+            if ( vm.count("dnstap-socket") || vm.count("dnstap-tcp-port") )
             {
                 LOG_INFO << "Starting DNSTAP capture";
-                std::remove(config.dnstap_socket.c_str());
                 boost::asio::io_service service;
-                al::stream_protocol::endpoint endpoint(config.dnstap_socket);
-                al::stream_protocol::acceptor acceptor(service, endpoint);
-                set_file_owner_perms(config.dnstap_socket,
-                                     config.dnstap_socket_owner,
-                                     config.dnstap_socket_group,
-                                     config.dnstap_socket_write);
-                al::stream_protocol::iostream stream;
-
-                // To stop any ongoing reads blocked waiting for the network,
-                // signal this thread with SIGUSR2, handled with an empty
-                // handler.
-                pthread_t my_thread = ::pthread_self();
-                std::signal(SIGUSR2, sighandler_empty);
+                DnsTapCollector collector(config, stats, output, metrics);
+                DnsTapServer server(service, collector, make_matcher);
+
+                if ( vm.count("dnstap-socket") )
+                {
+                    std::remove(config.dnstap_socket.c_str());
+                    server.listen(al::stream_protocol::endpoint(config.dnstap_socket));
+                    set_file_owner_perms(config.dnstap_socket,
+                                         config.dnstap_socket_owner,
+                                         config.dnstap_socket_group,
+                                         config.dnstap_socket_write);
+                }
+                if ( vm.count("dnstap-tcp-port") )
+                    server.listen(boost::asio::ip::tcp::endpoint(
+                                      boost::asio::ip::address::from_string(config.dnstap_tcp_address),
+                                      config.dnstap_tcp_port));
 
                 signal_handler.add_handler(
                     [&](int signal)
                     {
                         signal_received = signal;
                         if (signal_received != SIGUSR1) {
-                          dnstap.breakloop();
-                          acceptor.cancel();
+                          server.stop();
                           service.stop();
-                          ::pthread_kill(my_thread, SIGUSR2);
                         } else if ( collect_cbor ) {
                             LOG_INFO << "Forcing C-DNS file rotation on SIGUSR1";
                             CborItem empty_cbi;
@@ -804,13 +1630,6 @@ static int run_configuration(const po::variables_map& vm,
                         }
                     });
 
-                std::function<void (const boost::system::error_code&)> handle_accept = [&](const boost::system::error_code&)
-                {
-                    if ( signal_received == 0 )
-                        tap_loop(dnstap, stream, matcher, config, stats, output);
-                    acceptor.async_accept(*stream.rdbuf(), handle_accept);
-                };
-                acceptor.async_accept(*stream.rdbuf(), handle_accept);
                 while ( signal_received == 0 )
                     service.run_one();
             }
@@ -832,7 +1651,7 @@ static int run_configuration(const po::variables_map& vm,
                             output.cbor->put(empty_cbi, true);
                         }
                     });
-                sniff_loop(&sniffer, matcher, output, config, stats);
+                sniff_loop(&sniffer, matcher, output, config, stats, metrics);
             }
         }
         else
@@ -851,7 +1670,8 @@ static int run_configuration(const po::variables_map& vm,
                                 signal_received = signal;
                                 dnstap.breakloop();
                             });
-                        tap_loop(dnstap, stream, matcher, config, stats, output);
+                        DnsTapCollector collector(config, stats, output, metrics);
+                        collector.process_stream(dnstap, stream, matcher);
                     }
                     else
                         std::cerr << "Failed to open " << fname << std::endl;
@@ -866,7 +1686,7 @@ static int run_configuration(const po::variables_map& vm,
                             signal_received = signal;
                             sniffer.breakloop();
                         });
-                    sniff_loop(&sniffer, matcher, output, config, stats);
+                    sniff_loop(&sniffer, matcher, output, config, stats, metrics);
                 }
                 if ( signal_received != 0 )
                     break;
@@ -898,6 +1718,16 @@ static int run_configuration(const po::variables_map& vm,
             std::cerr << "Invalid DNSTAP: " << err.what() << std::endl;
         res = 3;
     }
+#endif
+#if ENABLE_XDP
+    catch (const xdp_error& err)
+    {
+        if ( log_errs )
+            LOG_ERROR << "AF_XDP Error: " << err.what();
+        else
+            std::cerr << "AF_XDP Error: " << err.what() << std::endl;
+        res = 3;
+    }
 #endif
     catch (const std::system_error& err)
     {
@@ -1004,7 +1834,7 @@ int main(int ac, char *av[])
 
         if ( !!vm.count("interface") +
 #if ENABLE_DNSTAP
-             !!vm.count("dnstap-socket") +
+             !!( vm.count("dnstap-socket") || vm.count("dnstap-tcp-port") ) +
 #endif
              !!vm.count("capture-file") != 1 )
         {
@@ -1084,8 +1914,12 @@ int main(int ac, char *av[])
 
         std::vector<std::thread> threads;
         int res;
+        StageTimes::enable(configuration.stage_timing);
         while ( ( res = run_configuration(vm, configuration, threads, writer_pool) ) == 1 )
+        {
             configuration.reread_config_file();
+            StageTimes::enable(configuration.stage_timing);
+        }
 
         // On interrupt, abort ongoing compressions.
         if ( res == 2 && writer_pool )
@@ -1096,6 +1930,15 @@ int main(int ac, char *av[])
             if ( thread.joinable() )
                 thread.join();
 
+        // Stage times cover all runs, so report them once output
+        // including compression is complete.
+        if ( configuration.report_info && configuration.stage_timing )
+        {
+            if ( res != 2 && writer_pool )
+                writer_pool->wait();
+            StageTimes::dump(std::cout, StageTimes::snapshot());
+        }
+
         LOG_INFO << "Compactor main thread shutdown complete. Other threads shutting down.";
         if ( res != 0 )
             return 1;
@@ -14,6 +14,7 @@
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
 #include <unordered_map>
 
 #include <boost/algorithm/string.hpp>
@@ -189,6 +190,36 @@ namespace {
         }
     }
 
+    /**
+     * \brief Look up a name in a value map, accepting numeric values too.
+     *
+     * \param map  the name to value map.
+     * \param name the name or numeric value.
+     * \param res  the value, if found.
+     * \returns `true` if the name is known or is a number.
+     */
+    bool find_value(const std::unordered_map<std::string, unsigned>& map,
+                    const std::string& name, unsigned& res)
+    {
+        auto item = map.find(boost::to_upper_copy(name));
+        if ( item != map.end() )
+        {
+            res = item->second;
+            return true;
+        }
+
+        if ( name.empty() ||
+             name.find_first_not_of("0123456789") != std::string::npos ||
+             name.size() > 5 )
+            return false;
+
+        unsigned long val = std::stoul(name);
+        if ( val > 0xffff )
+            return false;
+        res = val;
+        return true;
+    }
+
     /**
      * \brief Check a network interface exists.
      *
@@ -291,21 +322,30 @@ Configuration::Configuration()
       xz_output(false), xz_preset(6),
       gzip_pcap(false), gzip_level_pcap(6),
       xz_pcap(false), xz_preset_pcap(6),
-      max_compression_threads(2),
+      max_compression_threads(2), compression_threads_per_file(1),
+#if ENABLE_IO_URING
+      output_io_uring(false), output_direct_io(false), output_sync(false),
+#endif
       rotation_period(300),
       dns_port(53),
       query_timeout(5000), skew_timeout(10),
       snaplen(65535),
       promisc_mode(false),
+#if ENABLE_XDP
+      xdp_generic(false),
+#endif
 #if ENABLE_DNSTAP
-      dnstap(false),
+      dnstap(false), dnstap_tcp_port(0),
 #endif
+      auto_filter(false),
       output_options_queries(0), output_options_responses(0),
       max_block_items(5000),
       max_output_size(0),
       report_info(false), relaxed_mode(false), log_network_stats_period(0),
-      log_file_handling(false),
+      log_file_handling(false), stage_timing(false), metrics_tcp_port(0),
       sampling_threshold(10), sampling_rate(0), sampling_time(100),
+      sampling_method("packet"), sampling_prefix_ipv4(24), sampling_prefix_ipv6(48),
+      max_channel_memory(0), max_matcher_memory(0), max_memory(0),
       debug_dns(false), debug_qr(false),
       omit_hostid(false), omit_sysid(false), start_end_times_from_data(false),
       max_channel_size(30000),
@@ -384,6 +424,14 @@ Configuration::Configuration()
         ("interface,i",
          po::value<std::vector<std::string>>(&network_interfaces),
          "network interface from which to capture.")
+#if ENABLE_XDP
+        ("xdp-interface",
+         po::value<std::vector<std::string>>(&xdp_interfaces),
+         "capture from this network interface using AF_XDP.")
+        ("xdp-generic",
+         po::value<bool>(&xdp_generic)->implicit_value(true),
+         "use generic mode XDP for AF_XDP capture.")
+#endif
 #if ENABLE_DNSTAP
         ("dnstap,T",
          po::value<bool>(&dnstap)->implicit_value(true),
@@ -400,6 +448,12 @@ Configuration::Configuration()
         ("dnstap-socket-write",
          po::value<std::string>(&dnstap_socket_write),
          "Unix socket write permissions for DNSTAP.")
+        ("dnstap-tcp-address",
+         po::value<std::string>(&dnstap_tcp_address)->default_value("127.0.0.1"),
+         "address on which to listen for DNSTAP over TCP.")
+        ("dnstap-tcp-port",
+         po::value<unsigned>(&dnstap_tcp_port),
+         "TCP port on which to listen for DNSTAP.")
 #endif
         ("server-address-hint,S",
          po::value<std::vector<std::string>>(),
@@ -410,6 +464,9 @@ Configuration::Configuration()
         ("filter,f",
          po::value<std::string>(&filter),
          "discard packets that don't match the filter.")
+        ("auto-filter",
+         po::value<bool>(&auto_filter)->implicit_value(true),
+         "discard at capture packets the configuration would ignore.")
         ("include,n",
          po::value<std::vector<std::string>>(),
          "specify optional sections for output, (query|response)-(questions|answers|authorities|all) or all. Default none.")
@@ -479,12 +536,41 @@ Configuration::Configuration()
         ("max-compression-threads",
          po::value<unsigned int>(&max_compression_threads)->default_value(2),
          "maximum number of compression threads.")
+        ("compression-threads-per-file",
+         po::value<unsigned int>(&compression_threads_per_file)->default_value(1),
+         "number of threads compressing each output file.")
+#if ENABLE_IO_URING
+        ("output-io-uring",
+         po::value<bool>(&output_io_uring)->implicit_value(true),
+         "write output files using io_uring.")
+        ("output-direct-io",
+         po::value<bool>(&output_direct_io)->implicit_value(true),
+         "with io_uring, write output files bypassing the page cache.")
+        ("output-sync",
+         po::value<bool>(&output_sync)->implicit_value(true),
+         "with io_uring, synchronise output file data to storage before rename.")
+#endif
         ("log-network-stats-period,L",
          po::value<unsigned int>(&log_network_stats_period)->default_value(0),
          "log network collection stats period.")
          ("log-file-handling,F",
           po::value<bool>(&log_file_handling)->implicit_value(true),
           "log details of file handling on rotation.")
+         ("stage-timing",
+          po::value<bool>(&stage_timing)->implicit_value(true),
+          "record time spent in each processing stage and report it with network stats and report info.")
+         ("metrics-socket",
+          po::value<std::string>(&metrics_socket),
+          "Unix socket path on which to serve live metrics.")
+         ("metrics-tcp-address",
+          po::value<std::string>(&metrics_tcp_address)->default_value("127.0.0.1"),
+          "address on which to serve live metrics over HTTP.")
+         ("metrics-tcp-port",
+          po::value<unsigned>(&metrics_tcp_port),
+          "TCP port on which to serve live metrics over HTTP.")
+         ("metrics-file",
+          po::value<std::string>(&metrics_file),
+          "file to which to write live metrics.")
          ("sampling-threshold",
          po::value<unsigned int>(&sampling_threshold)->default_value(10),
          "sampling threshold - percentage of traffic dropped.")
@@ -494,6 +580,30 @@ Configuration::Configuration()
          ("sampling-time",
          po::value<unsigned int>(&sampling_time)->default_value(100),
          "time to sample for before checking for drops.")
+         ("sampling-method",
+         po::value<std::string>(&sampling_method)->default_value("packet"),
+         "sampling method - packet, transaction or client.")
+         ("sampling-prefix-ipv4",
+         po::value<unsigned int>(&sampling_prefix_ipv4)->default_value(24),
+         "client IPv4 prefix length for client sampling.")
+         ("sampling-prefix-ipv6",
+         po::value<unsigned int>(&sampling_prefix_ipv6)->default_value(48),
+         "client IPv6 prefix length for client sampling.")
+        ("max-channel-memory",
+         po::value<Size>(&max_channel_memory),
+         "maximum memory held by each inter-thread queue.")
+        ("max-matcher-memory",
+         po::value<Size>(&max_matcher_memory),
+         "maximum memory held by the query/response matcher.")
+        ("max-memory",
+         po::value<Size>(&max_memory),
+         "maximum memory held by all inter-thread queues and the matcher.")
+        ("thread-cpus",
+         po::value<std::vector<std::string>>(),
+         "CPUs for a thread class, class:cpu-list.")
+        ("thread-nice",
+         po::value<std::vector<std::string>>(),
+         "nice value for a thread class, class:nice.")
         ;
 }
 
@@ -640,8 +750,10 @@ void Configuration::dump_config(std::ostream& os) const
         os << v;
     }
     os << "\n"
-       << "  Filter               : " << filter << "\n"
-       << "  Query options        : ";
+       << "  Filter               : " << filter << "\n";
+    if ( auto_filter )
+        os << "  Capture filter       : " << capture_filter() << "\n";
+    os       << "  Query options        : ";
     dump_output_option(os, true);
     os << "  Response options     : ";
     dump_output_option(os, false);
@@ -659,6 +771,23 @@ void Configuration::dump_config(std::ostream& os) const
         os << "  Ignore RR types      : ";
         dump_RR_types(os, false);
     }
+#if ENABLE_IO_URING
+    if ( output_io_uring )
+        os << "  Output I/O           : io_uring"
+           << ( output_direct_io ? ", direct" : "" )
+           << ( output_sync ? ", sync" : "" ) << "\n";
+#endif
+    if ( compression_threads_per_file > 1 )
+        os << "  Compression threads  : " << compression_threads_per_file << " per file\n";
+    if ( stage_timing )
+        os << "  Stage timing         : On\n";
+    if ( !metrics_socket.empty() )
+        os << "  Metrics socket       : " << metrics_socket << "\n";
+    if ( metrics_tcp_port != 0 )
+        os << "  Metrics HTTP         : " << metrics_tcp_address << ":" << metrics_tcp_port << "\n";
+    if ( !metrics_file.empty() )
+        os << "  Metrics file         : " << metrics_file << "\n";
+    thread_placement.dump(os);
 }
 
 void Configuration::set_config_items(const po::variables_map& vm)
@@ -707,6 +836,17 @@ void Configuration::set_config_items(const po::variables_map& vm)
     if ( max_compression_threads < 1 )
         throw po::error("number of compression threads must be at least 1.");
 
+    if ( compression_threads_per_file < 1 )
+        throw po::error("number of compression threads per file must be at least 1.");
+
+    if ( metrics_tcp_port > 65535 )
+        throw po::error("metrics-tcp-port must be in the range 0-65535.");
+
+#if ENABLE_IO_URING
+    if ( ( output_direct_io || output_sync ) && !output_io_uring )
+        throw po::error("output-direct-io and output-sync require output-io-uring.");
+#endif
+
     if ( snaplen == 0 )
         snaplen = 65535;
 
@@ -719,9 +859,41 @@ void Configuration::set_config_items(const po::variables_map& vm)
     if ( vm.count("ignore-opcode") && vm.count("accept-opcode") )
         throw po::error("You can specify only accept-opcode or ignore-opcode, not both.");
 
+    // The generated filter would discard at capture traffic these
+    // outputs are expected to contain.
+    if ( auto_filter && ( !raw_pcap_pattern.empty() || !ignored_pcap_pattern.empty() ) )
+        throw po::error("auto-filter cannot be used with raw-pcap or ignored-pcap output.");
+
+    if ( sampling_method != "packet" &&
+         sampling_method != "transaction" &&
+         sampling_method != "client" )
+        throw po::error("invalid sampling-method value " + sampling_method + ". Valid options are:\n"
+                        "  packet, transaction, client");
+
+    if ( sampling_prefix_ipv4 > 32 )
+        throw po::error("sampling-prefix-ipv4 must be in the range 0-32.");
+
+    if ( sampling_prefix_ipv6 > 128 )
+        throw po::error("sampling-prefix-ipv6 must be in the range 0-128.");
+
     if ( vm.count("ignore-rr-type") && vm.count("accept-rr-type") )
         throw po::error("You can specify only accept-rr-type or ignore-rr-type, not both.");
 
+    thread_placement = ThreadPlacement();
+    try
+    {
+        if ( vm.count("thread-cpus") )
+            for ( const auto& s : vm["thread-cpus"].as<std::vector<std::string>>() )
+                thread_placement.set_cpus(s);
+        if ( vm.count("thread-nice") )
+            for ( const auto& s : vm["thread-nice"].as<std::vector<std::string>>() )
+                thread_placement.set_nice(s);
+    }
+    catch (const std::invalid_argument& e)
+    {
+        throw po::error(e.what());
+    }
+
     ignore_opcodes.clear();
     if ( vm.count("ignore-opcode") )
         set_opcode_config(ignore_opcodes, vm["ignore-opcode"].as<std::vector<std::string>>());
@@ -747,6 +919,11 @@ void Configuration::set_config_items(const po::variables_map& vm)
 
     for ( const auto& ifname : network_interfaces )
         check_network_interface(ifname);
+#if ENABLE_XDP
+    for ( const auto& ifname : xdp_interfaces )
+        if ( std::find(network_interfaces.begin(), network_interfaces.end(), ifname) == network_interfaces.end() )
+            throw po::error("xdp-interface " + ifname + " is not a capture interface.");
+#endif
 
     server_addresses.clear();
     if ( vm.count("server-address-hint") )
@@ -829,6 +1006,23 @@ const std::string Configuration::find_rrtype_string(unsigned rrtype)
         return std::to_string(rrtype);
 }
 
+unsigned Configuration::find_rcode_value(const std::string& name)
+{
+    unsigned res;
+    if ( !find_value(RCODES, name, res) )
+        throw po::error("unknown RCODE " + name);
+    return res;
+}
+
+unsigned Configuration::find_rrtype_value(const std::string& name)
+{
+    unsigned res;
+    if ( !find_value(RR_TYPES, name, res) &&
+         !find_value(RR_TYPES_ALT, name, res) )
+        throw po::error("unknown RR type " + name);
+    return res;
+}
+
 void Configuration::dump_OPCODEs(std::ostream& os, bool accept) const
 {
     const std::vector<unsigned>& opcodes = accept ? accept_opcodes : ignore_opcodes;
@@ -888,6 +1082,56 @@ bool Configuration::output_rr_type(CaptureDNS::QueryType rr_type) const
                          rr_type) == std::end(ignore_rr_types);
 }
 
+std::string Configuration::capture_filter() const
+{
+    if ( !auto_filter )
+        return filter;
+
+    std::string port = std::to_string(dns_port);
+
+    // OPCODE is in the DNS header, so can only be checked on UDP.
+    // libpcap only computes UDP payload offsets for IPv4.
+    std::string opcode_cond;
+    const std::vector<unsigned>& opcodes =
+        accept_opcodes.empty() ? ignore_opcodes : accept_opcodes;
+    for ( auto op : opcodes )
+    {
+        opcode_cond += opcode_cond.empty() ? "(" : " or ";
+        opcode_cond += "udp[10] & 0x78 = " + std::to_string((op & 0xf) << 3);
+    }
+    if ( !opcode_cond.empty() )
+    {
+        opcode_cond += ")";
+        if ( accept_opcodes.empty() )
+            opcode_cond = "not " + opcode_cond;
+    }
+
+    std::ostringstream oss;
+    if ( opcode_cond.empty() )
+        oss << "udp port " << port;
+    else
+        oss << "(ip and udp port " << port << " and " << opcode_cond << ")"
+            << " or (ip6 and udp port " << port << ")";
+    oss << " or tcp port " << port
+        // Non-initial IPv4 fragments carry no port, so must be kept
+        // for reassembly.
+        << " or (ip[6:2] & 0x1fff) != 0"
+        << " or icmp[icmptype] = icmp-unreach"
+        << " or icmp[icmptype] = icmp-timxceed"
+        << " or (icmp6 and ip6[40] >= 1 and ip6[40] <= 3)";
+
+    // Accept the same traffic when 802.1Q tagged. VLAN IDs are
+    // checked on decode. The vlan keyword changes the offsets used by
+    // the rest of the expression, so it must come last.
+    std::string dns_filter = oss.str();
+    std::string res = "(" + dns_filter + ") or (vlan and (" + dns_filter + "))";
+
+    if ( !filter.empty() )
+        res = "(" + filter + ") and (" + res + ")";
+
+    return res;
+}
+
 void Configuration::populate_block_parameters(block_cbor::BlockParameters& bp) const
 {
     block_cbor::StorageParameters& sp = bp.storage_parameters;
@@ -942,7 +1186,7 @@ void Configuration::populate_block_parameters(block_cbor::BlockParameters& bp) c
     for ( const auto& v : vlan_ids )
         cp.vlan_ids.push_back(v);
 
-    cp.filter = filter;
+    cp.filter = capture_filter();
 
     // These don't come from configuration, but ensure they are set.
     if ( !omit_sysid )
@@ -25,6 +25,7 @@
 
 #include "blockcbordata.hpp"
 #include "ipaddress.hpp"
+#include "threadplacement.hpp"
 
 class Configuration;
 
@@ -707,6 +708,28 @@ public:
      */
     unsigned int max_compression_threads;
 
+    /**
+     * \brief number of threads compressing each output file.
+     */
+    unsigned int compression_threads_per_file;
+
+#if ENABLE_IO_URING
+    /**
+     * \brief write output files using io_uring?
+     */
+    bool output_io_uring;
+
+    /**
+     * \brief write io_uring output files with <code>O_DIRECT</code>?
+     */
+    bool output_direct_io;
+
+    /**
+     * \brief synchronise io_uring output file data before rename?
+     */
+    bool output_sync;
+#endif
+
     /**
      * \brief rotation period for all output files.
      */
@@ -749,6 +772,20 @@ public:
      */
     std::vector<std::string> network_interfaces;
 
+#if ENABLE_XDP
+    /**
+     * \brief the network interfaces to capture from using AF_XDP.
+     *
+     * Each must also be in `network_interfaces`.
+     */
+    std::vector<std::string> xdp_interfaces;
+
+    /**
+     * \brief use generic (SKB) mode XDP rather than native?
+     */
+    bool xdp_generic;
+#endif
+
 #if ENABLE_DNSTAP
     /**
      * \brief treat input files as DNSTAP.
@@ -774,6 +811,16 @@ public:
      * \brief DNSTAP Unix socket write permissions.
      */
     std::string dnstap_socket_write;
+
+    /**
+     * \brief address on which to listen for DNSTAP over TCP.
+     */
+    std::string dnstap_tcp_address;
+
+    /**
+     * \brief port on which to listen for DNSTAP over TCP.
+     */
+    unsigned dnstap_tcp_port;
 #endif
 
     /**
@@ -792,6 +839,15 @@ public:
      */
     std::string filter;
 
+    /**
+     * \brief generate a packet filter from the configuration?
+     *
+     * If set, a `libpcap` filter selecting only traffic the compactor
+     * can use is generated from the configuration and combined with
+     * any user packet filter. See capture_filter().
+     */
+    bool auto_filter;
+
     /**
      * \brief what sections of query messages are to be output.
      *
@@ -862,6 +918,31 @@ public:
     */
    bool log_file_handling;
 
+   /**
+    * \brief record and report time spent in each processing stage
+    */
+   bool stage_timing;
+
+   /**
+    * \brief Unix socket on which to serve live metrics.
+    */
+   std::string metrics_socket;
+
+   /**
+    * \brief address on which to serve live metrics over HTTP.
+    */
+   std::string metrics_tcp_address;
+
+   /**
+    * \brief port on which to serve live metrics over HTTP.
+    */
+   unsigned metrics_tcp_port;
+
+   /**
+    * \brief file to which to write live metrics.
+    */
+   std::string metrics_file;
+
    /**
     * \brief sampling threshold above which to enable sampling
     */
@@ -877,6 +958,41 @@ public:
      */
     unsigned int sampling_time;
 
+    /**
+     * \brief sampling method: packet, transaction or client.
+     */
+    std::string sampling_method;
+
+    /**
+     * \brief client IPv4 prefix length for client sampling.
+     */
+    unsigned int sampling_prefix_ipv4;
+
+    /**
+     * \brief client IPv6 prefix length for client sampling.
+     */
+    unsigned int sampling_prefix_ipv6;
+
+    /**
+     * \brief maximum memory held by each inter-thread channel, 0 if no limit.
+     */
+    Size max_channel_memory;
+
+    /**
+     * \brief maximum memory held by the query/response matcher, 0 if no limit.
+     */
+    Size max_matcher_memory;
+
+    /**
+     * \brief maximum memory held by the channels and matcher together, 0 if no limit.
+     */
+    Size max_memory;
+
+    /**
+     * \brief CPU affinity and nice values for thread classes.
+     */
+    ThreadPlacement thread_placement;
+
     /**
      * \brief output text summary of individual DNS messages.
      */
@@ -1013,6 +1129,18 @@ public:
      */
     bool output_rr_type(CaptureDNS::QueryType rr_type) const;
 
+    /**
+     * \brief Return the packet filter to apply at capture.
+     *
+     * If automatic filter generation is not enabled, this is the user
+     * packet filter. Otherwise it is a filter generated from the
+     * configured DNS port, accepted OPCODEs, and the ICMP messages the
+     * compactor records, combined with any user packet filter.
+     *
+     * \returns the filter expression, empty if no filtering.
+     */
+    std::string capture_filter() const;
+
     /**
      * \brief Populate BlockParameters instance from config.
      *
@@ -1054,6 +1182,24 @@ public:
     */
     static const std::string find_rrtype_string(unsigned rrtype);
 
+   /**
+    * \brief Return the value for an RCODE name.
+    *
+    * \param name          RCODE name or numeric value
+    * \returns the RCODE value
+    * \throws boost::program_options::error if the name is not recognised
+    */
+    static unsigned find_rcode_value(const std::string& name);
+
+   /**
+    * \brief Return the value for an RRTYPE name.
+    *
+    * \param name          RRTYPE name or numeric value
+    * \returns the RRTYPE value
+    * \throws boost::program_options::error if the name is not recognised
+    */
+    static unsigned find_rrtype_value(const std::string& name);
+
 protected:
     /**
      * \brief Set configuration items that aren't directly set by Boost.
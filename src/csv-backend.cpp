@@ -0,0 +1,655 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <locale>
+#include <string>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "config.h"
+
+#include "capturedns.hpp"
+#include "log.hpp"
+#include "makeunique.hpp"
+
+#include "csv-backend.hpp"
+
+namespace
+{
+    /**
+     * \brief Output buffer size at which to write to the output.
+     */
+    const std::size_t OUTPUT_BUFFER_FLUSH_SIZE = 1024 * 1024;
+
+    void append_uint(std::string& out, uint64_t val)
+    {
+        char buf[20];
+        char* p = buf + sizeof(buf);
+
+        do
+        {
+            *--p = '0' + val % 10;
+            val /= 10;
+        } while ( val != 0 );
+        out.append(p, buf + sizeof(buf) - p);
+    }
+
+    void append_int(std::string& out, int64_t val)
+    {
+        if ( val < 0 )
+        {
+            out.push_back('-');
+            append_uint(out, -static_cast<uint64_t>(val));
+        }
+        else
+            append_uint(out, val);
+    }
+
+    void append_bool(std::string& out, bool val)
+    {
+        out.push_back(val ? '1' : '0');
+    }
+
+    void append_hex(std::string& out, unsigned char c)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        out.append("\\x");
+        out.push_back(hex[(c >> 4) & 0xf]);
+        out.push_back(hex[c & 0xf]);
+    }
+
+    template<typename T>
+    std::size_t list_size(const boost::optional<std::vector<T>>& list)
+    {
+        return ( list ) ? (*list).size() : 0;
+    }
+
+    /**
+     ** Field writers
+     **/
+
+    template<typename T>
+    CsvBackend::FieldWriter int_field(boost::optional<T> QueryResponseData::* member)
+    {
+        return [member](const QueryResponseData& qr, std::string& out)
+        {
+            if ( qr.*member )
+                append_int(out, static_cast<int64_t>(*(qr.*member)));
+        };
+    }
+
+    CsvBackend::FieldWriter address_field(boost::optional<IPAddress> QueryResponseData::* member)
+    {
+        return [member](const QueryResponseData& qr, std::string& out)
+        {
+            if ( qr.*member )
+            {
+                byte_string b = (*(qr.*member)).asNetworkBinary();
+                out.append(reinterpret_cast<const char*>(b.data()), b.size());
+            }
+        };
+    }
+
+    CsvBackend::FieldWriter qr_flag_field(uint8_t section, uint8_t flag, bool set)
+    {
+        return [section, flag, set](const QueryResponseData& qr, std::string& out)
+        {
+            if ( qr.qr_flags & section )
+                append_bool(out, !!(qr.qr_flags & flag) == set);
+        };
+    }
+
+    CsvBackend::FieldWriter dns_flag_field(uint8_t section, uint16_t flag)
+    {
+        return [section, flag](const QueryResponseData& qr, std::string& out)
+        {
+            if ( ( qr.qr_flags & section ) && qr.dns_flags )
+                append_bool(out, !!(*qr.dns_flags & flag));
+        };
+    }
+
+    CsvBackend::FieldWriter transport_flag_field(uint8_t flag)
+    {
+        return [flag](const QueryResponseData& qr, std::string& out)
+        {
+            if ( qr.qr_transport_flags )
+                append_bool(out, !!(*qr.qr_transport_flags & flag));
+        };
+    }
+
+    template<typename Duration>
+    CsvBackend::FieldWriter timestamp_field()
+    {
+        return [](const QueryResponseData& qr, std::string& out)
+        {
+            if ( qr.timestamp )
+                append_int(out, std::chrono::duration_cast<Duration>((*qr.timestamp).time_since_epoch()).count());
+        };
+    }
+
+    /**
+     * \brief The fields available, with the same names and values
+     * as the template backend.
+     */
+    const std::unordered_map<std::string, CsvBackend::FieldWriter>& fields()
+    {
+        static const std::unordered_map<std::string, CsvBackend::FieldWriter> res =
+        {
+            { "query_response_has_query",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  append_bool(out, qr.qr_flags & block_cbor::HAS_QUERY);
+              } },
+            { "query_response_has_response",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  append_bool(out, qr.qr_flags & block_cbor::HAS_RESPONSE);
+              } },
+            { "query_response_query_has_opt",
+              qr_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_HAS_OPT, true) },
+            { "query_response_query_has_question",
+              qr_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_HAS_NO_QUESTION, false) },
+            { "query_response_query_has_no_question",
+              qr_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_HAS_NO_QUESTION, true) },
+            // As in the template backend, this reflects whether the
+            // response additional section contains an OPT.
+            { "query_response_response_has_opt",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( !(qr.qr_flags & block_cbor::HAS_RESPONSE) )
+                      return;
+                  bool response_opt = false;
+                  if ( qr.response_additionals )
+                      response_opt = std::any_of((*qr.response_additionals).begin(),
+                                                 (*qr.response_additionals).end(),
+                                                 [](const QueryResponseData::RR& r)
+                                                 {
+                                                     return r.rtype && *r.rtype == CaptureDNS::OPT;
+                                                 });
+                  append_bool(out, response_opt);
+              } },
+            { "query_response_response_has_question",
+              qr_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_HAS_NO_QUESTION, false) },
+            { "query_response_response_has_no_question",
+              qr_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_HAS_NO_QUESTION, true) },
+            { "transport_tcp", transport_flag_field(block_cbor::TCP) },
+            { "transport_ipv6", transport_flag_field(block_cbor::IPV6) },
+            { "transaction_type", int_field(&QueryResponseData::qr_type) },
+            { "query_checking_disabled", dns_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_CD) },
+            { "query_authenticated_data", dns_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_AD) },
+            { "query_z", dns_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_Z) },
+            { "query_recursion_available", dns_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_RA) },
+            { "query_recursion_desired", dns_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_RD) },
+            { "query_truncated", dns_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_TC) },
+            { "query_authoritative_answer", dns_flag_field(block_cbor::HAS_QUERY, block_cbor::QUERY_AA) },
+            { "query_edns_version", int_field(&QueryResponseData::query_edns_version) },
+            { "query_do",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.query_edns_version &&
+                       ( qr.qr_flags & block_cbor::HAS_QUERY ) && qr.dns_flags )
+                      append_bool(out, *qr.dns_flags & block_cbor::QUERY_DO);
+              } },
+            { "query_edns_udp_payload_size", int_field(&QueryResponseData::query_edns_payload_size) },
+            { "client_hoplimit", int_field(&QueryResponseData::client_hoplimit) },
+            { "query_len", int_field(&QueryResponseData::query_size) },
+            { "opcode", int_field(&QueryResponseData::query_opcode) },
+            { "query_opcode", int_field(&QueryResponseData::query_opcode) },
+            { "query_rcode", int_field(&QueryResponseData::query_rcode) },
+            { "query_qdcount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( !(qr.qr_flags & block_cbor::HAS_QUERY) )
+                      return;
+                  std::size_t count = 0;
+                  if ( !(qr.qr_flags & block_cbor::QUERY_HAS_NO_QUESTION) )
+                      count = 1 + list_size(qr.query_questions);
+                  append_uint(out, count);
+              } },
+            { "query_ancount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.qr_flags & block_cbor::HAS_QUERY )
+                      append_uint(out, list_size(qr.query_answers));
+              } },
+            { "query_nscount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.qr_flags & block_cbor::HAS_QUERY )
+                      append_uint(out, list_size(qr.query_authorities));
+              } },
+            { "query_arcount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.qr_flags & block_cbor::HAS_QUERY )
+                      append_uint(out,
+                                  !!(qr.qr_flags & block_cbor::QUERY_HAS_OPT) +
+                                  list_size(qr.query_additionals));
+              } },
+            { "timestamp_secs", timestamp_field<std::chrono::seconds>() },
+            { "timestamp_microsecs", timestamp_field<std::chrono::microseconds>() },
+            { "timestamp_nanosecs", timestamp_field<std::chrono::nanoseconds>() },
+            { "response_delay_nanosecs",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.response_delay )
+                      append_int(out, (*qr.response_delay).count());
+              } },
+            { "id", int_field(&QueryResponseData::id) },
+            { "client_address", address_field(&QueryResponseData::client_address) },
+            { "server_address", address_field(&QueryResponseData::server_address) },
+            { "client_port", int_field(&QueryResponseData::client_port) },
+            { "server_port", int_field(&QueryResponseData::server_port) },
+            { "query_name",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.qname )
+                      out.append(CaptureDNS::decode_domain_name(*qr.qname));
+              } },
+            { "query_type", int_field(&QueryResponseData::query_type) },
+            { "query_class", int_field(&QueryResponseData::query_class) },
+            { "response_checking_disabled", dns_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_CD) },
+            { "response_authenticated_data", dns_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_AD) },
+            { "response_z", dns_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_Z) },
+            { "response_recursion_available", dns_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_RA) },
+            { "response_recursion_desired", dns_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_RD) },
+            { "response_truncated", dns_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_TC) },
+            { "response_authoritative_answer", dns_flag_field(block_cbor::HAS_RESPONSE, block_cbor::RESPONSE_AA) },
+            { "response_qdcount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( !(qr.qr_flags & block_cbor::HAS_RESPONSE) )
+                      return;
+                  std::size_t count = 0;
+                  if ( !(qr.qr_flags & block_cbor::RESPONSE_HAS_NO_QUESTION) )
+                      count = 1 + list_size(qr.response_questions);
+                  append_uint(out, count);
+              } },
+            { "response_ancount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.qr_flags & block_cbor::HAS_RESPONSE )
+                      append_uint(out, list_size(qr.response_answers));
+              } },
+            { "response_nscount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.qr_flags & block_cbor::HAS_RESPONSE )
+                      append_uint(out, list_size(qr.response_authorities));
+              } },
+            { "response_arcount",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( qr.qr_flags & block_cbor::HAS_RESPONSE )
+                      append_uint(out, list_size(qr.response_additionals));
+              } },
+            { "response_len", int_field(&QueryResponseData::response_size) },
+            { "response_rcode", int_field(&QueryResponseData::response_rcode) },
+            { "query_response_flags",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  append_uint(out, qr.qr_flags);
+              } },
+            { "transport_flags", int_field(&QueryResponseData::qr_transport_flags) },
+            { "dns_flags", int_field(&QueryResponseData::dns_flags) },
+            { "query_opt_codes",
+              [](const QueryResponseData& qr, std::string& out)
+              {
+                  if ( ( qr.qr_flags & block_cbor::QUERY_HAS_OPT ) && qr.query_opt_rdata )
+                  {
+                      CaptureDNS::EDNS0 e0(CaptureDNS::INTERNET, 0, *qr.query_opt_rdata);
+                      for ( auto& opt : e0.options() )
+                      {
+                          append_uint(out, opt.code());
+                          out.push_back(',');
+                      }
+                  }
+              } },
+        };
+
+        return res;
+    }
+
+    /**
+     ** Modifiers
+     **/
+
+    void cstring_modifier(const std::string& in, std::string& out)
+    {
+        static const std::locale loc;
+        const std::ctype<char>& ct = std::use_facet<std::ctype<char>>(loc);
+
+        for ( char c : in )
+        {
+            switch (c)
+            {
+            case '\0': out.append("\\0"); break;
+            case '\b': out.append("\\b"); break;
+            case '\t': out.append("\\t"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\\': out.append("\\\\"); break;
+            case '"':  out.append("\\\""); break;
+            case '\'': out.append("\\'"); break;
+
+            default:
+                if ( ct.is(std::ctype<char>::print, c) )
+                    out.push_back(c);
+                else
+                    append_hex(out, c);
+                break;
+            }
+        }
+    }
+
+    void hexstring_modifier(const std::string& in, std::string& out)
+    {
+        for ( char c : in )
+        {
+            if ( c == '\0' )
+                out.append("\\0");
+            else
+                append_hex(out, c);
+        }
+    }
+
+    // CSV escaping as per RFC4180.
+    void csvescape_modifier(const std::string& in, std::string& out)
+    {
+        if ( in.find_first_of("\",\r\n") == std::string::npos )
+        {
+            out.append(in);
+            return;
+        }
+
+        out.push_back('"');
+        for ( char c : in )
+        {
+            if ( c == '"' )
+                out.push_back('"');
+            out.push_back(c);
+        }
+        out.push_back('"');
+    }
+
+    void array_modifier(const std::string& in, std::string& out)
+    {
+        out.push_back('[');
+        out.append(in);
+        out.push_back(']');
+    }
+
+    // Conversion modifiers leave empty (absent) values empty.
+    void ipaddr_modifier(const std::string& in, std::string& out)
+    {
+        char buf[INET6_ADDRSTRLEN];
+        int af;
+
+        if ( in.empty() )
+            return;
+        else if ( in.size() == 4 )
+            af = AF_INET;
+        else if ( in.size() == 16 )
+            af = AF_INET6;
+        else
+            throw Tins::invalid_address();
+
+        if ( inet_ntop(af, in.data(), buf, sizeof(buf)) )
+            out.append(buf);
+    }
+
+    Tins::IPv6Address to_ipv6(const std::string& in)
+    {
+        byte_string b(reinterpret_cast<const unsigned char*>(in.data()), in.size());
+        IPAddress addr(b);
+        return addr;
+    }
+
+    void ip6addr_modifier(const std::string& in, std::string& out)
+    {
+        if ( !in.empty() )
+            out.append(to_ipv6(in).to_string());
+    }
+
+    void ip6addr_bin_modifier(const std::string& in, std::string& out)
+    {
+        if ( !in.empty() )
+            for ( auto addrbyte : to_ipv6(in) )
+                out.push_back(addrbyte);
+    }
+
+    void date_modifier(const char* fmt, const std::string& in, std::string& out)
+    {
+        if ( in.empty() )
+            return;
+
+        std::time_t t = static_cast<std::time_t>(std::strtoll(in.c_str(), nullptr, 10));
+        std::tm tm;
+        gmtime_r(&t, &tm);
+        char buf[40];
+        out.append(buf, std::strftime(buf, sizeof(buf), fmt, &tm));
+    }
+}
+
+CsvBackend::CsvBackend(const CsvBackendOptions& opts, const std::string& fname)
+    : OutputBackend(opts.baseopts), opts_(opts)
+{
+    for ( const auto& spec : opts.columns )
+        columns_.push_back(compile_column(spec));
+    if ( columns_.empty() )
+        throw CsvException("list", "no columns specified");
+
+    output_path_ = output_name(fname);
+
+    if ( opts.baseopts.xz_output )
+        writer_ = make_unique<XzStreamWriter>(output_path_, opts.baseopts.xz_preset);
+    else if ( opts.baseopts.gzip_output )
+        writer_ = make_unique<GzipStreamWriter>(output_path_, opts.baseopts.gzip_level);
+    else
+        writer_ = make_unique<StreamWriter>(output_path_, 0);
+
+    buffer_.reserve(OUTPUT_BUFFER_FLUSH_SIZE + OUTPUT_BUFFER_FLUSH_SIZE / 4);
+}
+
+CsvBackend::~CsvBackend()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR << "Error writing " << output_path_ << ": " << e.what();
+    }
+}
+
+CsvBackend::Column CsvBackend::compile_column(const std::string& spec)
+{
+    Column res;
+    std::string::size_type pos = spec.find(':');
+    std::string name = spec.substr(0, pos);
+
+    res.field = compile_field(name);
+    if ( !res.field )
+        throw CsvException(spec, "unknown field " + name);
+
+    while ( pos != std::string::npos )
+    {
+        std::string::size_type next = spec.find(':', pos + 1);
+        std::string modname = spec.substr(pos + 1, next - pos - 1);
+        Modifier modifier = compile_modifier(modname);
+        if ( !modifier )
+            throw CsvException(spec, "unknown modifier " + modname);
+        res.modifiers.push_back(modifier);
+        pos = next;
+    }
+
+    return res;
+}
+
+CsvBackend::FieldWriter CsvBackend::compile_field(const std::string& name)
+{
+    // Values given on the command line override fields.
+    for ( auto it = opts_.values.rbegin(); it != opts_.values.rend(); ++it )
+        if ( it->first == name )
+        {
+            std::string val = it->second;
+            return [val](const QueryResponseData&, std::string& out)
+            {
+                out.append(val);
+            };
+        }
+
+    auto it = fields().find(name);
+    if ( it != fields().end() )
+        return it->second;
+    return FieldWriter();
+}
+
+CsvBackend::Modifier CsvBackend::compile_modifier(const std::string& name)
+{
+    if ( name == "x-cstring" )
+        return cstring_modifier;
+    else if ( name == "x-hexstring" )
+        return hexstring_modifier;
+    else if ( name == "x-csvescape" )
+        return csvescape_modifier;
+    else if ( name == "x-array" )
+        return array_modifier;
+    else if ( name == "x-ipaddr" )
+        return ipaddr_modifier;
+    else if ( name == "x-ip6addr" )
+        return ip6addr_modifier;
+    else if ( name == "x-ip6addr-bin" )
+        return ip6addr_bin_modifier;
+    else if ( name == "x-date" )
+        return [](const std::string& in, std::string& out)
+        {
+            date_modifier("%F", in, out);
+        };
+    else if ( name == "x-datetime" )
+        return [](const std::string& in, std::string& out)
+        {
+            date_modifier("%F %T", in, out);
+        };
+    else if ( name.compare(0, 10, "x-datefmt=") == 0 )
+    {
+        std::string fmt = name.substr(10);
+        return [fmt](const std::string& in, std::string& out)
+        {
+            date_modifier(fmt.c_str(), in, out);
+        };
+    }
+    else if ( name.compare(0, 12, "x-ipaddr-geo") != 0 )
+        return Modifier();
+
+    if ( !geoip_ )
+        geoip_ = make_unique<GeoIPContext>(opts_.geoip_db_dir_path);
+    GeoIPContext* geoip = geoip_.get();
+
+    if ( name == "x-ipaddr-geo-location" )
+        return [geoip](const std::string& in, std::string& out)
+        {
+            if ( !in.empty() )
+                append_uint(out, geoip->location_code(IPAddress(byte_string(reinterpret_cast<const unsigned char*>(in.data()), in.size()))));
+        };
+    else if ( name == "x-ipaddr-geo-asn" )
+        return [geoip](const std::string& in, std::string& out)
+        {
+            if ( !in.empty() )
+                append_uint(out, geoip->as_number(IPAddress(byte_string(reinterpret_cast<const unsigned char*>(in.data()), in.size()))));
+        };
+    else if ( name == "x-ipaddr-geo-as-netmask" )
+        return [geoip](const std::string& in, std::string& out)
+        {
+            if ( !in.empty() )
+                append_uint(out, geoip->as_netmask(IPAddress(byte_string(reinterpret_cast<const unsigned char*>(in.data()), in.size()))));
+        };
+    return Modifier();
+}
+
+void CsvBackend::output(const QueryResponseData& qr, const Configuration& /* config */)
+{
+    if ( first_line_ )
+    {
+        if ( opts_.header )
+        {
+            for ( std::size_t i = 0; i < opts_.columns.size(); ++i )
+            {
+                if ( i > 0 )
+                    buffer_.push_back(opts_.separator);
+                buffer_.append(opts_.columns[i].substr(0, opts_.columns[i].find(':')));
+            }
+            buffer_.push_back('\n');
+        }
+        first_line_ = false;
+    }
+
+    for ( std::size_t i = 0; i < columns_.size(); ++i )
+    {
+        const Column& col = columns_[i];
+
+        if ( i > 0 )
+            buffer_.push_back(opts_.separator);
+
+        if ( col.modifiers.empty() )
+        {
+            col.field(qr, buffer_);
+            continue;
+        }
+
+        // Apply modifiers via the scratch buffers, with the final
+        // modifier writing directly to the output buffer.
+        std::string* in = &scratch_[0];
+        std::string* out = &scratch_[1];
+        in->clear();
+        col.field(qr, *in);
+        for ( std::size_t m = 0; m < col.modifiers.size(); ++m )
+        {
+            if ( m + 1 == col.modifiers.size() )
+                col.modifiers[m](*in, buffer_);
+            else
+            {
+                out->clear();
+                col.modifiers[m](*in, *out);
+                std::swap(in, out);
+            }
+        }
+    }
+    buffer_.push_back('\n');
+
+    if ( buffer_.size() >= OUTPUT_BUFFER_FLUSH_SIZE )
+        flush();
+}
+
+void CsvBackend::flush()
+{
+    if ( !buffer_.empty() && writer_ )
+    {
+        writer_->writeBytes(buffer_);
+        buffer_.clear();
+    }
+}
+
+std::string CsvBackend::output_file()
+{
+    if ( output_path_ == StreamWriter::STDOUT_FILE_NAME )
+        return "";
+    return output_path_;
+}
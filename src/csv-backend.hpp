@@ -0,0 +1,229 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef CSV_BACKEND_HPP
+#define CSV_BACKEND_HPP
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "geoip.hpp"
+#include "streamwriter.hpp"
+
+#include "backend.hpp"
+
+/**
+ * \class CsvException
+ * \brief Exception thrown for CSV column specification errors.
+ */
+class CsvException : public std::runtime_error
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param column    the column specification.
+     * \param msg       the message.
+     */
+    explicit CsvException(const std::string& column, const std::string& msg)
+        : std::runtime_error("Column " + column + ": " + msg + ".") {}
+};
+
+/**
+ * \struct CsvBackendOptions
+ * \brief Options for the CSV/TSV backend.
+ */
+struct CsvBackendOptions
+{
+    /**
+     * \brief base options.
+     */
+    OutputBackendOptions baseopts;
+
+    /**
+     * \brief the column specifications.
+     *
+     * Each is a template field name optionally followed by
+     * template modifiers, e.g. `client_address:x-ipaddr`.
+     */
+    std::vector<std::string> columns;
+
+    /**
+     * \brief the field separator.
+     */
+    char separator{','};
+
+    /**
+     * \brief write a header line with the column names?
+     */
+    bool header{false};
+
+    /**
+     * \brief values to include in output.
+     */
+    std::vector<std::pair<std::string, std::string>> values;
+
+    /**
+     * \brief path to GeoIP database directory.
+     */
+    std::string geoip_db_dir_path;
+};
+
+/**
+ * \class CsvBackend
+ * \brief Delimited text backend for inspector.
+ *
+ * This produces the same field values as the template backend,
+ * using the same field and modifier names, but without ctemplate.
+ * The column list is compiled once into a list of field writers,
+ * and each record is formatted directly into an output buffer.
+ */
+class CsvBackend : public OutputBackend
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param opts              options information.
+     * \param fname             output file path.
+     * \throws CsvException if a column specification is invalid.
+     * \throws geoip_error if a GeoIP modifier is used and no GeoIP
+     * data is available.
+     */
+    CsvBackend(const CsvBackendOptions& opts, const std::string& fname);
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~CsvBackend();
+
+    /**
+     * \brief Output a QueryResponse.
+     *
+     * \param qr        the QueryResponse.
+     * \param config    the configuration applying when recording the QR.
+     */
+    virtual void output(const QueryResponseData& qr, const Configuration& config);
+
+    /**
+     * \brief the output file path.
+     *
+     * \return the output file path. "" if unnamed stream, e.g. stdout.
+     */
+    virtual std::string output_file();
+
+    /**
+     * \typedef FieldWriter
+     * \brief Append the value of a field to a buffer.
+     */
+    using FieldWriter = std::function<void (const QueryResponseData& qr, std::string& out)>;
+
+    /**
+     * \typedef Modifier
+     * \brief Append a modified value to a buffer.
+     */
+    using Modifier = std::function<void (const std::string& in, std::string& out)>;
+
+private:
+    /**
+     * \struct Column
+     * \brief A compiled output column.
+     */
+    struct Column
+    {
+        /**
+         * \brief write the field value.
+         */
+        FieldWriter field;
+
+        /**
+         * \brief modifiers to apply to the field value, in order.
+         */
+        std::vector<Modifier> modifiers;
+    };
+
+    /**
+     * \brief Compile a column specification.
+     *
+     * \param spec      the column specification.
+     * \returns the column.
+     * \throws CsvException if the specification is invalid.
+     */
+    Column compile_column(const std::string& spec);
+
+    /**
+     * \brief Find the field writer for a field name.
+     *
+     * \param name      the field name.
+     * \returns the field writer, or an empty function if not found.
+     */
+    FieldWriter compile_field(const std::string& name);
+
+    /**
+     * \brief Find a modifier.
+     *
+     * \param name      the modifier name.
+     * \returns the modifier, or an empty function if not found.
+     */
+    Modifier compile_modifier(const std::string& name);
+
+    /**
+     * \brief Write the output buffer to the output.
+     */
+    void flush();
+
+    /**
+     * \brief the options.
+     */
+    CsvBackendOptions opts_;
+
+    /**
+     * \brief the output file path.
+     */
+    std::string output_path_;
+
+    /**
+     * \brief the output writer.
+     */
+    std::unique_ptr<StreamWriter> writer_;
+
+    /**
+     * \brief the compiled columns.
+     */
+    std::vector<Column> columns_;
+
+    /**
+     * \brief the output buffer.
+     */
+    std::string buffer_;
+
+    /**
+     * \brief scratch buffers for applying modifiers.
+     */
+    std::string scratch_[2];
+
+    /**
+     * \brief GeoIP context, if GeoIP modifiers are used.
+     */
+    std::unique_ptr<GeoIPContext> geoip_;
+
+    /**
+     * \brief first line of output.
+     */
+    bool first_line_{true};
+};
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/program_options.hpp>
+
+#include <pcap/pcap.h>
+
+#include "config.h"
+
+#include "configuration.hpp"
+#include "log.hpp"
+#include "makeunique.hpp"
+#include "pcapframe.hpp"
+#include "pcapwriter.hpp"
+#include "streamwriter.hpp"
+#include "trafficgen.hpp"
+
+const std::string PROGNAME = "dns-loadgen";
+
+namespace po = boost::program_options;
+
+namespace {
+    /**
+     * \brief Parse a query type mix.
+     *
+     * The mix is a comma separated list of <code>TYPE:WEIGHT</code>.
+     *
+     * \param mix the mix specification.
+     * \returns the query types and weights.
+     * \throws po::error if the specification is invalid.
+     */
+    std::vector<std::pair<CaptureDNS::QueryType, double>> parse_qtype_mix(const std::string& mix)
+    {
+        std::vector<std::pair<CaptureDNS::QueryType, double>> res;
+        std::istringstream iss(mix);
+        std::string item;
+
+        while ( std::getline(iss, item, ',') )
+        {
+            auto colon = item.find(':');
+            if ( colon == std::string::npos )
+                throw po::error("query type mix item " + item + " must be TYPE:WEIGHT");
+
+            unsigned qtype = Configuration::find_rrtype_value(item.substr(0, colon));
+            double weight;
+            try
+            {
+                std::size_t pos;
+                weight = std::stod(item.substr(colon + 1), &pos);
+                if ( pos != item.size() - colon - 1 )
+                    throw std::invalid_argument(item);
+            }
+            catch (const std::logic_error&)
+            {
+                throw po::error("invalid query type weight in " + item);
+            }
+            res.emplace_back(static_cast<CaptureDNS::QueryType>(qtype), weight);
+        }
+
+        if ( res.empty() )
+            throw po::error("empty query type mix");
+        return res;
+    }
+
+    /**
+     * \brief Write generated traffic to a PCAP file.
+     *
+     * \param gen   the traffic generator.
+     * \param fname the output file name.
+     */
+    template<typename Writer>
+    void write_pcap(TrafficGenerator& gen, const std::string& fname)
+    {
+        PcapWriter<Writer> writer(fname, 6, 65535);
+        PcapFrame frame;
+
+        while ( gen.next(frame) )
+            writer.write_frame(frame);
+        writer.close();
+    }
+
+    /**
+     * \brief Send generated traffic on a network interface.
+     *
+     * Frames are sent with their original spacing, scaled by the
+     * speed factor. A speed factor of 0 sends as fast as possible.
+     *
+     * \param gen     the traffic generator.
+     * \param iface   the network interface.
+     * \param speed   the speed factor.
+     * \param preload generate all frames before sending any.
+     */
+    void replay(TrafficGenerator& gen, const std::string& iface,
+                double speed, bool preload)
+    {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        pcap_t* handle = pcap_create(iface.c_str(), errbuf);
+        if ( !handle )
+            throw std::runtime_error(errbuf);
+        if ( pcap_activate(handle) < 0 )
+        {
+            std::string err = pcap_geterr(handle);
+            pcap_close(handle);
+            throw std::runtime_error(iface + ": " + err);
+        }
+
+        std::vector<PcapFrame> frames;
+        if ( preload )
+        {
+            PcapFrame frame;
+            while ( gen.next(frame) )
+                frames.push_back(frame);
+        }
+
+        uint64_t sent = 0, send_errors = 0, late = 0;
+        std::chrono::steady_clock::duration max_late(0);
+        std::chrono::system_clock::time_point first_ts;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::size_t next_frame = 0;
+        PcapFrame frame;
+
+        for (;;)
+        {
+            if ( preload )
+            {
+                if ( next_frame == frames.size() )
+                    break;
+                frame = std::move(frames[next_frame++]);
+            }
+            else if ( !gen.next(frame) )
+                break;
+
+            if ( sent + send_errors == 0 )
+                first_ts = frame.timestamp();
+
+            if ( speed > 0.0 )
+            {
+                auto offset = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(frame.timestamp() - first_ts) / speed);
+                auto due = start + offset;
+                auto now = std::chrono::steady_clock::now();
+
+                // Sleeping is coarse, so only sleep for longer gaps.
+                if ( due - now > std::chrono::microseconds(100) )
+                    std::this_thread::sleep_until(due);
+                else if ( now - due > std::chrono::milliseconds(1) )
+                {
+                    ++late;
+                    if ( now - due > max_late )
+                        max_late = now - due;
+                }
+            }
+
+            if ( pcap_inject(handle, frame.data(), frame.size()) < 0 )
+                ++send_errors;
+            else
+                ++sent;
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        pcap_close(handle);
+
+        std::cout << "Sent " << sent << " packets in " << elapsed.count() << "s";
+        if ( elapsed.count() > 0 )
+            std::cout << " (" << static_cast<uint64_t>(sent / elapsed.count()) << " packets/s)";
+        std::cout << ".\n"
+                  << "Send errors: " << send_errors << ".\n"
+                  << "Late packets: " << late << ", at most "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(max_late).count()
+                  << "us late.\n";
+    }
+}
+
+int main(int ac, char *av[])
+{
+    init_logging();
+
+    TrafficProfile profile;
+    double duration;
+    unsigned delay_median, tcp_rtt, reorder_window;
+    std::string qtypes;
+    std::string output;
+    std::string iface;
+    double speed;
+
+    po::options_description visible("Options");
+    visible.add_options()
+        ("help,h", "show this help message.")
+        ("version,v", "show version information.")
+        ("output,o",
+         po::value<std::string>(&output),
+         "write traffic to this PCAP file. Files ending .gz or .xz are compressed.")
+        ("interface,i",
+         po::value<std::string>(&iface),
+         "send traffic on this network interface.")
+        ("speed",
+         po::value<double>(&speed)->default_value(1.0),
+         "replay speed factor when sending. 0 sends as fast as possible.")
+        ("preload",
+         "generate all traffic before sending any.")
+        ("rate,r",
+         po::value<double>(&profile.rate)->default_value(profile.rate),
+         "mean query rate, queries per second.")
+        ("queries,n",
+         po::value<uint64_t>(&profile.queries)->default_value(0),
+         "number of queries to generate, 0 for no limit.")
+        ("duration,d",
+         po::value<double>(&duration)->default_value(0),
+         "period over which to generate queries, seconds, 0 for no limit.")
+        ("start",
+         po::value<int64_t>(),
+         "timestamp of the first query, in seconds since the epoch. Default is the current time.")
+        ("clients",
+         po::value<unsigned>(&profile.clients)->default_value(profile.clients),
+         "number of clients.")
+        ("client-zipf",
+         po::value<double>(&profile.client_zipf_exponent)->default_value(profile.client_zipf_exponent),
+         "Zipf exponent of client popularity, 0 for equal popularity.")
+        ("ipv6-share",
+         po::value<double>(&profile.ipv6_share)->default_value(profile.ipv6_share),
+         "fraction of clients using IPv6.")
+        ("names",
+         po::value<unsigned>(&profile.names)->default_value(profile.names),
+         "number of distinct query names.")
+        ("name-zipf",
+         po::value<double>(&profile.name_zipf_exponent)->default_value(profile.name_zipf_exponent),
+         "Zipf exponent of query name popularity.")
+        ("zone",
+         po::value<std::string>(&profile.zone)->default_value(profile.zone),
+         "zone containing the query names.")
+        ("qtypes",
+         po::value<std::string>(&qtypes)->default_value("A:60,AAAA:25,MX:5,TXT:5,NS:5"),
+         "query type mix, comma separated TYPE:WEIGHT.")
+        ("tcp-share",
+         po::value<double>(&profile.tcp_share)->default_value(profile.tcp_share),
+         "fraction of queries made over TCP.")
+        ("nxdomain-share",
+         po::value<double>(&profile.nxdomain_share)->default_value(profile.nxdomain_share),
+         "fraction of queries answered with NXDOMAIN.")
+        ("delay-median",
+         po::value<unsigned>(&delay_median)->default_value(profile.delay_median.count()),
+         "median response delay, microseconds.")
+        ("delay-sigma",
+         po::value<double>(&profile.delay_sigma)->default_value(profile.delay_sigma),
+         "standard deviation of the log of the response delay.")
+        ("tcp-rtt",
+         po::value<unsigned>(&tcp_rtt)->default_value(profile.tcp_rtt.count()),
+         "TCP round trip time, microseconds.")
+        ("loss",
+         po::value<double>(&profile.loss)->default_value(profile.loss),
+         "fraction of packets lost before capture.")
+        ("reorder",
+         po::value<double>(&profile.reorder)->default_value(profile.reorder),
+         "fraction of packets captured late.")
+        ("reorder-window",
+         po::value<unsigned>(&reorder_window)->default_value(profile.reorder_window.count()),
+         "maximum lateness of late packets, microseconds.")
+        ("seed",
+         po::value<uint32_t>(&profile.seed)->default_value(profile.seed),
+         "random number generator seed.")
+        ("stats,S",
+         "report traffic statistics.");
+
+    po::variables_map vm;
+
+    try {
+        po::store(po::command_line_parser(ac, av).options(visible).run(), vm);
+
+        if ( vm.count("help") )
+        {
+            std::cerr
+                << "Usage: " << PROGNAME << " [options]\n"
+                << visible;
+            return 1;
+        }
+
+        if ( vm.count("version") )
+        {
+            std::cout << PROGNAME << " " PACKAGE_VERSION "\n";
+            return 1;
+        }
+
+        po::notify(vm);
+
+        if ( output.empty() == iface.empty() )
+            throw po::error("specify one of an output file or a network interface");
+        if ( profile.queries == 0 && duration <= 0 )
+            throw po::error("specify a number of queries or a duration");
+        if ( speed < 0 )
+            throw po::error("speed factor must not be negative");
+
+        profile.duration = std::chrono::microseconds(static_cast<int64_t>(duration * 1000000));
+        profile.delay_median = std::chrono::microseconds(delay_median);
+        profile.tcp_rtt = std::chrono::microseconds(tcp_rtt);
+        profile.reorder_window = std::chrono::microseconds(reorder_window);
+        profile.qtype_mix = parse_qtype_mix(qtypes);
+        if ( vm.count("start") )
+            profile.start = std::chrono::system_clock::time_point(std::chrono::seconds(vm["start"].as<int64_t>()));
+        else
+            profile.start = std::chrono::system_clock::now();
+    }
+    catch (po::error& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        TrafficGenerator gen(profile);
+
+        if ( !iface.empty() )
+            replay(gen, iface, speed, vm.count("preload") > 0);
+        else if ( boost::algorithm::ends_with(output, ".gz") )
+            write_pcap<GzipStreamWriter>(gen, output);
+        else if ( boost::algorithm::ends_with(output, ".xz") )
+            write_pcap<XzStreamWriter>(gen, output);
+        else
+            write_pcap<StreamWriter>(gen, output);
+
+        if ( vm.count("stats") )
+        {
+            const TrafficStatistics& stats = gen.stats();
+            std::cerr << "Queries: " << stats.queries
+                      << " (" << stats.tcp_queries << " TCP, "
+                      << stats.nxdomain_responses << " NXDOMAIN).\n"
+                      << "Packets: " << stats.packets
+                      << " (" << stats.lost_packets << " lost, "
+                      << stats.reordered_packets << " late).\n";
+        }
+    }
+    catch (const std::exception& err)
+    {
+        std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
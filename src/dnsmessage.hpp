@@ -14,6 +14,7 @@
 #define DNSMESSAGE_HPP
 
 #include <chrono>
+#include <cstddef>
 #include <iostream>
 
 #include <boost/optional.hpp>
@@ -92,6 +93,23 @@ struct DNSMessage
      * \return the output stream.
      */
     friend std::ostream& operator<<(std::ostream& output, const DNSMessage& msg);
+
+    /**
+     * \brief Return the approximate memory used by the message.
+     *
+     * This is an estimate for memory accounting, based on the wire
+     * size and the number of records. It does not change once the
+     * message is constructed.
+     *
+     * \returns the approximate size in bytes.
+     */
+    std::size_t memory_size() const {
+        return sizeof(DNSMessage) + ( wire_size ? *wire_size : 0 ) +
+            dns.questions_count() * sizeof(CaptureDNS::query) +
+            ( dns.answers_count() + dns.authority_count() + dns.additional_count() ) *
+            sizeof(CaptureDNS::resource);
+    }
+
     /**
      * \brief Message reception timestamp.
      */
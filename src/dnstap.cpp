@@ -10,7 +10,9 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <system_error>
 
 #include <tins/tins.h>
@@ -131,6 +133,9 @@ namespace {
     const unsigned FSTRM_CONTENT_TYPE_LENGTH_MAX= 256;
     const std::string CONTENT_TYPE_DNSTAP("protobuf:dnstap.Dnstap");
 
+    // Initial receive buffer size. It grows if a larger frame arrives.
+    const std::size_t RECEIVE_BUFFER_SIZE = 64 * 1024;
+
     TransactionType convert_message_type(::dnstap::Message_Type t)
     {
         switch(t)
@@ -203,7 +208,13 @@ namespace {
 }
 
 DnsTap::DnsTap()
-    : bidirectional_(false), state_(WAIT), malformed_message_count_(0)
+    : bidirectional_(false), state_(WAIT), malformed_message_count_(0),
+      buffer_(RECEIVE_BUFFER_SIZE), buffer_start_(0), buffer_end_(0),
+      dnstap_(make_unique<dnstap::Dnstap>())
+{
+}
+
+DnsTap::~DnsTap()
 {
 }
 
@@ -217,11 +228,19 @@ void DnsTap::process_stream(std::iostream& stream, DNSSink sink)
     state_ = WAIT;
     break_ = false;
     malformed_message_count_ = 0;
+    buffer_start_ = buffer_end_ = 0;
 
     while ( !break_.load() )
     {
         try
         {
+            // A sender may close the stream without sending STOP.
+            // End of input between frames is a normal close.
+            if ( buffer_start_ == buffer_end_ &&
+                 std::iostream::traits_type::eq_int_type(stream.rdbuf()->sgetc(),
+                                                         std::iostream::traits_type::eof()) )
+                break;
+
             uint32_t len = get_value(stream);
 
             if ( len == 0 )
@@ -317,9 +336,10 @@ uint32_t DnsTap::read_control_frame(std::iostream& stream)
              control_len != field_len )
             throw dnstap_invalid("Bad field type or length");
 
-        std::string content_type = get_buffer(stream, field_len);
+        const char* content_type = get_buffer(stream, field_len);
 
-        if ( content_type != CONTENT_TYPE_DNSTAP )
+        if ( field_len != CONTENT_TYPE_DNSTAP.size() ||
+             CONTENT_TYPE_DNSTAP.compare(0, field_len, content_type, field_len) != 0 )
             throw dnstap_invalid("unknown field");
     }
 
@@ -328,10 +348,11 @@ uint32_t DnsTap::read_control_frame(std::iostream& stream)
 
 std::unique_ptr<DNSMessage> DnsTap::read_data_frame(std::iostream& stream, uint32_t len)
 {
-    std::string data = get_buffer(stream, len);
+    // Parse in place from the receive buffer into the reused message.
+    const char* data = get_buffer(stream, len);
+    dnstap::Dnstap& dnstap = *dnstap_;
 
-    dnstap::Dnstap dnstap;
-    if ( !dnstap.ParseFromString(data) )
+    if ( !dnstap.ParseFromArray(data, len) )
         throw dnstap_invalid("Data parse failed");
 
     if ( !dnstap.has_type() )
@@ -363,7 +384,8 @@ std::unique_ptr<DNSMessage> DnsTap::read_data_frame(std::iostream& stream, uint3
                     std::chrono::system_clock::time_point t(std::chrono::duration_cast<std::chrono::system_clock::duration>(s + ns));
 
                     dns = make_unique<DNSMessage>(
-                        Tins::RawPDU(message.query_message()),
+                        Tins::RawPDU(reinterpret_cast<const uint8_t*>(message.query_message().data()),
+                                     message.query_message().size()),
                         t, transport_type, transaction_type);
                 }
             }
@@ -377,7 +399,8 @@ std::unique_ptr<DNSMessage> DnsTap::read_data_frame(std::iostream& stream, uint3
                     std::chrono::system_clock::time_point t(std::chrono::duration_cast<std::chrono::system_clock::duration>(s + ns));
 
                     dns = make_unique<DNSMessage>(
-                        Tins::RawPDU(message.response_message()),
+                        Tins::RawPDU(reinterpret_cast<const uint8_t*>(message.response_message().data()),
+                                     message.response_message().size()),
                         t, transport_type, transaction_type);
                 }
             }
@@ -424,9 +447,7 @@ void DnsTap::send_control(std::iostream& stream, const std::string& msg, bool ig
 
 uint32_t DnsTap::get_value(std::iostream& stream)
 {
-    char buf[4];
-
-    stream.read(buf, sizeof(buf));
+    const char* buf = get_buffer(stream, 4);
 
     return
         static_cast<uint8_t>(buf[0]) << 24 |
@@ -435,10 +456,42 @@ uint32_t DnsTap::get_value(std::iostream& stream)
         static_cast<uint8_t>(buf[3]);
 }
 
-std::string DnsTap::get_buffer(std::iostream& stream, uint32_t len)
+const char* DnsTap::get_buffer(std::iostream& stream, uint32_t len)
 {
-    std::string res(len, '\0');
-    stream.read(&res[0], len);
+    std::size_t avail = buffer_end_ - buffer_start_;
+
+    if ( avail < len )
+    {
+        // Move any remaining data to the start of the buffer, and
+        // make sure the buffer is big enough for the frame.
+        if ( avail > 0 && buffer_start_ > 0 )
+            std::memmove(buffer_.data(), buffer_.data() + buffer_start_, avail);
+        buffer_start_ = 0;
+        buffer_end_ = avail;
+        if ( buffer_.size() < len )
+            buffer_.resize(len);
+
+        // Read what is needed, blocking if necessary, and then
+        // anything else the stream already has buffered.
+        std::streambuf* sb = stream.rdbuf();
+        std::streamsize want = len - avail;
+        std::streamsize got = sb->sgetn(buffer_.data() + buffer_end_, want);
+        buffer_end_ += std::max<std::streamsize>(got, 0);
+
+        if ( got < want )
+        {
+            stream.setstate(std::ios::eofbit | std::ios::failbit);
+            throw std::ios_base::failure("DNSTAP input truncated");
+        }
+
+        std::streamsize extra = std::min<std::streamsize>(
+            sb->in_avail(), buffer_.size() - buffer_end_);
+        if ( extra > 0 )
+            buffer_end_ += std::max<std::streamsize>(sb->sgetn(buffer_.data() + buffer_end_, extra), 0);
+    }
+
+    const char* res = buffer_.data() + buffer_start_;
+    buffer_start_ += len;
     return res;
 }
 
@@ -18,7 +18,9 @@
 #include <exception>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "config.h"
 
@@ -26,6 +28,10 @@
 
 #if ENABLE_DNSTAP
 
+namespace dnstap {
+    class Dnstap;
+}
+
 /**
  * \exception dnstap_invalid
  * \brief Signals uncompliant DNSTAP input.
@@ -70,10 +76,16 @@ public:
      */
     explicit DnsTap();
 
+    /**
+     * \brief Destructor.
+     */
+    virtual ~DnsTap();
+
     /**
      * \brief Process input.
      *
-     * Receive and process DNSTAP until end of file.
+     * Receive and process DNSTAP until a STOP frame or end of file.
+     * End of file part way through a frame is an error.
      *
      * \param stream            DNSTAP data source.
      * \param dns_sink          sink for DNS messages.
@@ -146,11 +158,15 @@ protected:
     /**
      * \brief receive buffer of given size.
      *
+     * The data is received into the receive buffer, along with any
+     * further input already available from the stream. The returned
+     * pointer is valid until the next receive.
+     *
      * \param stream    DNSTAP data source.
      * \param len       length of buffer to receive.
-     * \returns the data buffer.
+     * \returns pointer to the data in the receive buffer.
      */
-    std::string get_buffer(std::iostream& stream, uint32_t len);
+    const char* get_buffer(std::iostream& stream, uint32_t len);
 
     /**
      * \brief make an ACCEPT frame.
@@ -186,6 +202,26 @@ private:
      * \brief count of malformed DNS messages received
      */
     uint64_t malformed_message_count_;
+
+    /**
+     * \brief receive buffer.
+     */
+    std::vector<char> buffer_;
+
+    /**
+     * \brief offset of first unconsumed byte in receive buffer.
+     */
+    std::size_t buffer_start_;
+
+    /**
+     * \brief offset of end of received data in receive buffer.
+     */
+    std::size_t buffer_end_;
+
+    /**
+     * \brief DNSTAP message, reused for each data frame.
+     */
+    std::unique_ptr<dnstap::Dnstap> dnstap_;
 };
 
 #endif
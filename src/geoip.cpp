@@ -10,7 +10,11 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
-#include <sstream>
+#include <algorithm>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
 
 #include "geoip.hpp"
 
@@ -37,66 +41,51 @@ GeoIPContext::~GeoIPContext()
         MMDB_close(&city_db);
 }
 
-static MMDB_lookup_result_s lookup(MMDB_s * const db, IPAddress const & addr)
-{
-    int gai_error, mmdb_error;
-    MMDB_lookup_result_s res =
-        MMDB_lookup_string(db, addr.str().c_str(), &gai_error, &mmdb_error);
-    if ( gai_error != 0 )
-        throw geoip_error("getaddrinfo() error");
-    if ( mmdb_error != MMDB_SUCCESS )
-        throw geoip_error("MMDB lookup failure");
-    return res;
-}
-
-uint32_t GeoIPContext::location_code(IPAddress const & addr)
-{
-    MMDB_lookup_result_s res = lookup(&city_db, addr);
-    if ( !res.found_entry )
-        return 0;
+namespace {
+    /**
+     * \brief Prefix length of the cache key for IPv4 addresses.
+     */
+    const unsigned IPV4_CACHE_PREFIX = 24;
 
-    /* Look first for city, country if not there, otherwise continent. */
-    MMDB_entry_data_s entry_data;
-    int status = MMDB_get_value(&res.entry, &entry_data, "city", "geoname_id", NULL);
-    if ( status == MMDB_SUCCESS && entry_data.has_data && entry_data.type == MMDB_DATA_TYPE_UINT32 )
-        return entry_data.uint32;
-    if ( status != MMDB_SUCCESS && status != MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR )
-        throw geoip_error("MMDB entry error");
-
-    status = MMDB_get_value(&res.entry, &entry_data, "country", "geoname_id", NULL);
-    if ( status == MMDB_SUCCESS && entry_data.has_data && entry_data.type == MMDB_DATA_TYPE_UINT32 )
-        return entry_data.uint32;
-    if ( status != MMDB_SUCCESS && status != MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR )
-        throw geoip_error("MMDB entry error");
-
-    status = MMDB_get_value(&res.entry, &entry_data, "continent", "geoname_id", NULL);
-    if ( status == MMDB_SUCCESS && entry_data.has_data && entry_data.type == MMDB_DATA_TYPE_UINT32 )
-        return entry_data.uint32;
-    if ( status != MMDB_SUCCESS && status != MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR )
-        throw geoip_error("MMDB entry error");
-    return 0;
-}
+    /**
+     * \brief Prefix length of the cache key for IPv6 addresses.
+     */
+    const unsigned IPV6_CACHE_PREFIX = 48;
 
-uint32_t GeoIPContext::as_number(IPAddress const & addr)
-{
-    MMDB_lookup_result_s res = lookup(&as_db, addr);
-    if ( !res.found_entry )
-        return 0;
+    /**
+     * \brief Look up a binary address in a database.
+     *
+     * \param db      the database.
+     * \param addr    the address.
+     * \param netmask set to the matching prefix length in the
+     *                address family of the address.
+     * \returns the lookup result.
+     * \throws geoip_error on error
+     */
+    MMDB_lookup_result_s mmdb_lookup(MMDB_s * const db, IPAddress const & addr, unsigned& netmask)
+    {
+        byte_string b = addr.asNetworkBinary();
+        sockaddr_storage ss;
+        std::memset(&ss, 0, sizeof(ss));
+        if ( addr.is_ipv6() )
+        {
+            sockaddr_in6* sin6 = reinterpret_cast<sockaddr_in6*>(&ss);
+            sin6->sin6_family = AF_INET6;
+            std::memcpy(&sin6->sin6_addr, b.data(), sizeof(sin6->sin6_addr));
+        }
+        else
+        {
+            sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&ss);
+            sin->sin_family = AF_INET;
+            std::memcpy(&sin->sin_addr, b.data(), sizeof(sin->sin_addr));
+        }
 
-    MMDB_entry_data_s entry_data;
-    int status = MMDB_get_value(&res.entry, &entry_data, "autonomous_system_number", NULL);
-    if ( status == MMDB_SUCCESS && entry_data.has_data && entry_data.type == MMDB_DATA_TYPE_UINT32 )
-        return entry_data.uint32;
-    if ( status != MMDB_SUCCESS && status != MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR )
-        throw geoip_error("MMDB entry error");
-    return 0;
-}
+        int mmdb_error;
+        MMDB_lookup_result_s res =
+            MMDB_lookup_sockaddr(db, reinterpret_cast<const sockaddr*>(&ss), &mmdb_error);
+        if ( mmdb_error != MMDB_SUCCESS )
+            throw geoip_error("MMDB lookup failure");
 
-uint16_t GeoIPContext::as_netmask(IPAddress const & addr)
-{
-    MMDB_lookup_result_s res = lookup(&as_db, addr);
-    if ( res.found_entry )
-    {
         /*
          * If the database is IPv6, then the netmask returned for
          * IPv4 addresses is the IPv6 netmask appropriate for the
@@ -104,17 +93,112 @@ uint16_t GeoIPContext::as_netmask(IPAddress const & addr)
          * expected IPv4 netmask, we need to subtract 96. See
          * https://github.com/maxmind/libmaxminddb/issues/105.
          */
-        if ( addr.is_ipv6() )
-            return res.netmask;
-        else
+        netmask = res.netmask;
+        if ( !addr.is_ipv6() )
         {
-            if ( res.netmask >= 96 )
-                res.netmask -= 96;
-            if ( res.netmask > 32 )
+            if ( netmask >= 96 )
+                netmask -= 96;
+            if ( netmask > 32 )
                 throw geoip_error("MMDB netmask error");
-            return res.netmask;
         }
+        return res;
     }
-    else
+
+    /**
+     * \brief Get a UINT32 value from an entry.
+     *
+     * \param entry the entry.
+     * \param name1 the first element of the path to the value.
+     * \param name2 the second element of the path, if any.
+     * \returns the value, or 0 if not present.
+     * \throws geoip_error on error
+     */
+    uint32_t get_uint32(MMDB_entry_s& entry, const char* name1, const char* name2 = NULL)
+    {
+        MMDB_entry_data_s entry_data;
+        int status = MMDB_get_value(&entry, &entry_data, name1, name2, NULL);
+        if ( status == MMDB_SUCCESS && entry_data.has_data && entry_data.type == MMDB_DATA_TYPE_UINT32 )
+            return entry_data.uint32;
+        if ( status != MMDB_SUCCESS && status != MMDB_LOOKUP_PATH_DOES_NOT_MATCH_DATA_ERROR )
+            throw geoip_error("MMDB entry error");
         return 0;
+    }
+}
+
+GeoIPInfo GeoIPContext::db_lookup(IPAddress const & addr, unsigned& prefix_length)
+{
+    GeoIPInfo res;
+    unsigned city_netmask, as_netmask;
+
+    MMDB_lookup_result_s city = mmdb_lookup(&city_db, addr, city_netmask);
+    if ( city.found_entry )
+    {
+        /* Look first for city, country if not there, otherwise continent. */
+        res.location_code = get_uint32(city.entry, "city", "geoname_id");
+        if ( res.location_code == 0 )
+            res.location_code = get_uint32(city.entry, "country", "geoname_id");
+        if ( res.location_code == 0 )
+            res.location_code = get_uint32(city.entry, "continent", "geoname_id");
+    }
+
+    MMDB_lookup_result_s as = mmdb_lookup(&as_db, addr, as_netmask);
+    if ( as.found_entry )
+    {
+        res.as_number = get_uint32(as.entry, "autonomous_system_number");
+        res.as_netmask = as_netmask;
+    }
+
+    // The info applies to the more specific of the two networks.
+    prefix_length = std::max(city_netmask, as_netmask);
+    return res;
+}
+
+const GeoIPInfo& GeoIPContext::lookup(IPAddress const & addr)
+{
+    byte_string b = addr.asNetworkBinary();
+    unsigned cache_prefix = ( addr.is_ipv6() ) ? IPV6_CACHE_PREFIX : IPV4_CACHE_PREFIX;
+    byte_string prefix = b.substr(0, cache_prefix / 8);
+
+    auto pit = prefix_cache_.find(prefix);
+    if ( pit != prefix_cache_.end() )
+    {
+        if ( pit->second )
+            return *pit->second;
+
+        auto ait = address_cache_.find(b);
+        if ( ait != address_cache_.end() )
+            return ait->second;
+    }
+
+    unsigned prefix_length;
+    GeoIPInfo info = db_lookup(addr, prefix_length);
+
+    if ( prefix_cache_.size() >= MAX_CACHE_ENTRIES )
+    {
+        prefix_cache_.clear();
+        address_cache_.clear();
+    }
+
+    if ( prefix_length <= cache_prefix )
+        return *(prefix_cache_[prefix] = info);
+
+    prefix_cache_[prefix] = boost::none;
+    if ( address_cache_.size() >= MAX_CACHE_ENTRIES )
+        address_cache_.clear();
+    return address_cache_[b] = info;
+}
+
+uint32_t GeoIPContext::location_code(IPAddress const & addr)
+{
+    return lookup(addr).location_code;
+}
+
+uint32_t GeoIPContext::as_number(IPAddress const & addr)
+{
+    return lookup(addr).as_number;
+}
+
+uint16_t GeoIPContext::as_netmask(IPAddress const & addr)
+{
+    return lookup(addr).as_netmask;
 }
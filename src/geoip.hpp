@@ -16,9 +16,15 @@
 #include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
+#include <boost/optional.hpp>
 
 #include <maxminddb.h>
 
+#include "bytestring.hpp"
+
 #include "configuration.hpp"
 
 /**
@@ -45,9 +51,38 @@ public:
         : std::runtime_error(what) {}
 };
 
+/**
+ * \struct GeoIPInfo
+ * \brief Geographic info for an IP address.
+ */
+struct GeoIPInfo
+{
+    /**
+     * \brief location code, or 0 if none available.
+     */
+    uint32_t location_code{0};
+
+    /**
+     * \brief AS number, or 0 if none available.
+     */
+    uint32_t as_number{0};
+
+    /**
+     * \brief netmask of the matching AS subnet, or 0 if no match.
+     */
+    uint16_t as_netmask{0};
+};
+
 /**
  * \class GeoIPContext
  * \brief Context for obtaining geographic info for IP addresses.
+ *
+ * Lookups are done on the binary address, and all the info for an
+ * address obtained at once. Results are cached. The databases
+ * report the network prefix each result applies to, so if that
+ * prefix covers the whole /24 (IPv4) or /48 (IPv6) containing the
+ * address, the result is cached for that /24 or /48. Otherwise
+ * it is cached for the individual address.
  */
 class GeoIPContext
 {
@@ -80,6 +115,15 @@ public:
      */
     virtual ~GeoIPContext();
 
+    /**
+     * \brief Get all geographic info for an IP.
+     *
+     * \param addr the address to look up.
+     * \returns the info.
+     * \throws geoip_error on error
+     */
+    const GeoIPInfo& lookup(IPAddress const & addr);
+
     /**
      * \brief Get an IP's location code.
      *
@@ -109,6 +153,38 @@ public:
     uint16_t as_netmask(IPAddress const & addr);
 
 private:
+    /**
+     * \brief Look up an address in the databases.
+     *
+     * \param addr          the address to look up.
+     * \param prefix_length set to the length of the network prefix
+     *                      to which the info applies.
+     * \returns the info.
+     * \throws geoip_error on error
+     */
+    GeoIPInfo db_lookup(IPAddress const & addr, unsigned& prefix_length);
+
+    /**
+     * \brief Maximum number of entries in each cache.
+     *
+     * A cache is cleared when it reaches this size.
+     */
+    static const std::size_t MAX_CACHE_ENTRIES = 65536;
+
+    /**
+     * \brief Cache of info for /24 or /48 prefixes.
+     *
+     * The key is the prefix bytes. An entry with no value indicates
+     * that the prefix contains addresses with differing info, so
+     * the address cache must be used.
+     */
+    std::unordered_map<byte_string, boost::optional<GeoIPInfo>, boost::hash<byte_string>> prefix_cache_;
+
+    /**
+     * \brief Cache of info for individual addresses.
+     */
+    std::unordered_map<byte_string, GeoIPInfo, boost::hash<byte_string>> address_cache_;
+
     /**
      * \brief the city database.
      */
@@ -16,6 +16,7 @@
 #include <cstdio>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
 
 #include <boost/filesystem.hpp>
@@ -23,23 +24,45 @@
 
 #include "config.h"
 
+#include "aggregate.hpp"
 #include "backend.hpp"
 #include "bytestring.hpp"
 #include "cbordecoder.hpp"
 #include "blockcborreader.hpp"
+#include "clickhouse-backend.hpp"
+#include "columnar-backend.hpp"
+#include "csv-backend.hpp"
 #include "log.hpp"
 #include "makeunique.hpp"
 #include "pseudoanonymise.hpp"
+#include "qrfilter.hpp"
 #include "template-backend.hpp"
 
 const std::string PROGNAME = "inspector";
 const std::string PCAP_EXT = ".pcap";
 const std::string TEMPLATE_EXT = ".txt";
+const std::string CSV_EXT = ".csv";
+const std::string TSV_EXT = ".tsv";
+const std::string CLICKHOUSE_EXT = ".rowbinary";
+const std::string COLUMNAR_EXT = ".cdcol";
 const std::string INFO_EXT = ".info";
 const std::string EXCLUDEHINTS_EXT = ".excludesfile";
 
 namespace po = boost::program_options;
 
+/**
+ * \brief Inspector output formats.
+ */
+enum class OutputFormat
+{
+    PCAP,
+    TEMPLATE,
+    CSV,
+    TSV,
+    CLICKHOUSE,
+    COLUMNAR
+};
+
 /**
  * \struct Options
  *
@@ -92,6 +115,11 @@ struct Options
      */
     boost::optional<PseudoAnonymise> pseudo_anon;
 
+    /**
+     * \brief query/response filter, if to use.
+     */
+    boost::optional<QueryResponseFilter> filter;
+
     /**
      * \brief output defaults.
      */
@@ -115,7 +143,7 @@ static int convert_stream_to_backend(const std::string& fname, std::istream& is,
 {
     Configuration config;
     CborStreamDecoder dec(is);
-    BlockCborReader cbr(dec, config, options.defaults, options.pseudo_anon);
+    BlockCborReader cbr(dec, config, options.defaults, options.pseudo_anon, options.filter);
 
     backend->check_exclude_hints(config.exclude_hints);
 
@@ -162,6 +190,7 @@ static int convert_stream_to_backend(const std::string& fname, std::istream& is,
             auto end = std::chrono::system_clock::now();
             std::chrono::duration<double> elapsed = end - start;
             std::cerr << "Converted " << nrecs << " q/r pairs in " << elapsed.count() << "s (" << nrecs/elapsed.count() << "rec/s)\n";
+            cbr.dump_filter_stats(std::cerr);
         }
     }
     catch (const std::exception& e)
@@ -178,6 +207,80 @@ static int convert_stream_to_backend(const std::string& fname, std::istream& is,
     return 0;
 }
 
+static int aggregate_stream(const std::string& fname, std::istream& is, Aggregator& aggregator, unsigned threads, Options& options)
+{
+    try
+    {
+        Configuration config;
+        CborStreamDecoder dec(is);
+        BlockCborReader cbr(dec, config, options.defaults, options.pseudo_anon);
+
+        aggregator.aggregate(cbr, threads);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << PROGNAME << ":  Aggregation error while processing: "
+                  << fname << " Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int aggregate_files(const po::variables_map& vm, const std::string& output_file_name, Aggregator& aggregator, bool json, unsigned threads, Options& options)
+{
+    auto start = std::chrono::system_clock::now();
+
+    if ( !vm.count("cdns-file") )
+    {
+        if ( aggregate_stream("(stdin)", std::cin, aggregator, threads, options) != 0 )
+            return 1;
+    }
+    else
+    {
+        for ( auto& fname : vm["cdns-file"].as<std::vector<std::string>>() )
+        {
+            std::ifstream ifs;
+            ifs.open(fname, std::ifstream::binary);
+            if ( !ifs.is_open() )
+            {
+                std::cerr << PROGNAME << ":  Can't open input: " << fname << std::endl;
+                return 1;
+            }
+
+            if ( aggregate_stream(fname, ifs, aggregator, threads, options) != 0 )
+                return 1;
+        }
+    }
+
+    std::ofstream ofs;
+    bool to_stdout = ( output_file_name.empty() || output_file_name == StreamWriter::STDOUT_FILE_NAME );
+    if ( !to_stdout )
+    {
+        ofs.open(output_file_name);
+        if ( !ofs.is_open() )
+        {
+            std::cerr << PROGNAME << ":  Can't create " << output_file_name << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& os = ( to_stdout ) ? std::cout : ofs;
+
+    if ( json )
+        aggregator.write_json(os);
+    else
+        aggregator.write_csv(os);
+
+    if ( options.generate_stats )
+    {
+        auto end = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        std::cerr << "Aggregated " << aggregator.items() << " q/r pairs in " << elapsed.count() << "s (" << aggregator.items()/elapsed.count() << "rec/s)\n";
+    }
+
+    return 0;
+}
+
 static bool open_info_file(const std::string& fname, std::ofstream& info, Options& options)
 {
     if ( !options.generate_info )
@@ -213,9 +316,24 @@ int main(int ac, char *av[])
     Options options;
     PcapBackendOptions pcap_options;
     TemplateBackendOptions template_options;
-    bool template_backend = false;
+    CsvBackendOptions csv_options;
+    ClickHouseBackendOptions clickhouse_options;
+    ColumnarBackendOptions columnar_options;
+    OutputFormat output_format = OutputFormat::PCAP;
     std::string backend;
     std::vector<std::string> vals;
+    std::vector<std::string> column_lists;
+    std::vector<std::string> aggregate_lists;
+    std::vector<Aggregator::Key> aggregate_keys;
+    std::string aggregate_format;
+    unsigned threads;
+    unsigned compression_threads;
+    std::vector<std::string> filter_client_prefixes;
+    std::vector<std::string> filter_server_prefixes;
+    std::vector<std::string> filter_qname_suffixes;
+    std::vector<std::string> filter_qtypes;
+    std::vector<std::string> filter_rcodes;
+    std::vector<std::string> filter_transports;
 
     po::options_description visible("Options");
     visible.add_options()
@@ -229,13 +347,29 @@ int main(int ac, char *av[])
          "output file name.")
         ("output-format,F",
          po::value<std::string>(&backend),
-         "output format. 'pcap' (default) or 'template'.")
+         "output format. 'pcap' (default), 'template', 'csv', 'tsv', 'clickhouse' or 'columnar'.")
         ("template,t",
          po::value<std::string>(&template_options.template_name),
          "name of template to use for template output.")
+        ("columns,C",
+         po::value<std::vector<std::string>>(&column_lists),
+         "comma-separated list of <field>[:<modifier>...] columns for CSV or TSV output. This argument can be repeated.")
+        ("column-headers",
+         "write a line of column names before CSV or TSV output.")
+        ("clickhouse-structure",
+         "print the ClickHouse table structure of clickhouse output and exit.")
+        ("aggregate,A",
+         po::value<std::vector<std::string>>(&aggregate_lists),
+         "instead of converting, count records grouped by a comma-separated list of qtype, qclass, rcode, opcode, transport, server-address or server-port. This argument can be repeated.")
+        ("aggregate-format",
+         po::value<std::string>(&aggregate_format)->default_value("csv"),
+         "aggregate output format, 'csv' or 'json'.")
+        ("threads",
+         po::value<unsigned>(&threads)->default_value(std::thread::hardware_concurrency()),
+         "number of threads to use for decoding and counting when aggregating.")
         ("value,V",
          po::value<std::vector<std::string>>(&vals),
-         "<key>=<value> to substitute in the template. This argument can be repeated.")
+         "<key>=<value> to substitute in the template or columns. This argument can be repeated.")
         ("geoip-db-dir,g",
          po::value<std::string>(&template_options.geoip_db_dir_path)->default_value(GEOIPDIR),
          "path of directory with the GeoIP databases.")
@@ -249,6 +383,9 @@ int main(int ac, char *av[])
         ("xz-preset,u",
          po::value<unsigned int>(&pcap_options.baseopts.xz_preset)->default_value(6),
          "xz compression preset level.")
+        ("compression-threads",
+         po::value<unsigned>(&compression_threads)->default_value(1),
+         "number of threads compressing the output file.")
         ("query-only,q",
          "write only query messages to output.")
         ("report-info,r",
@@ -263,6 +400,24 @@ int main(int ac, char *av[])
          "generate excluded fields file for each input.")
         ("stats,S",
          "report conversion statistics.")
+        ("filter-client-prefix",
+         po::value<std::vector<std::string>>(&filter_client_prefixes),
+         "only output records with client address in <address>/<length>. This argument can be repeated.")
+        ("filter-server-prefix",
+         po::value<std::vector<std::string>>(&filter_server_prefixes),
+         "only output records with server address in <address>/<length>. This argument can be repeated.")
+        ("filter-qname-suffix",
+         po::value<std::vector<std::string>>(&filter_qname_suffixes),
+         "only output records with query name ending in this domain. This argument can be repeated.")
+        ("filter-qtype",
+         po::value<std::vector<std::string>>(&filter_qtypes),
+         "only output records with this query type. This argument can be repeated.")
+        ("filter-rcode",
+         po::value<std::vector<std::string>>(&filter_rcodes),
+         "only output records with this response RCODE. This argument can be repeated.")
+        ("filter-transport",
+         po::value<std::vector<std::string>>(&filter_transports),
+         "only output records with this transport (udp, tcp, tls, dtls, doh). This argument can be repeated.")
 #if ENABLE_PSEUDOANONYMISATION
         ("pseudo-anonymisation-key,k",
          po::value<std::string>(&pseudo_anon_key),
@@ -322,6 +477,12 @@ int main(int ac, char *av[])
             return 1;
         }
 
+        if ( vm.count("clickhouse-structure") )
+        {
+            std::cout << ClickHouseBackend::structure() << "\n";
+            return 0;
+        }
+
         if ( !vm.count("cdns-file") && !vm.count("output") )
         {
             std::cerr << PROGNAME
@@ -342,21 +503,114 @@ int main(int ac, char *av[])
 #endif
         po::notify(vm);
 
+        if ( compression_threads < 1 )
+        {
+            std::cerr << PROGNAME
+                      << ":  Error:\tNumber of compression threads must be at least 1.\n";
+            return 1;
+        }
+        StreamWriter::set_compression_threads(compression_threads);
+
+        if ( vm.count("aggregate") != 0 )
+        {
+            std::string conversion_args[] = { "output-format", "template", "columns", "column-headers", "value", "query-only", "gzip-output", "xz-output", "debug-qr", "excludesfile" };
+            for ( const std::string& arg : conversion_args )
+                if ( vm.count(arg) != 0 )
+                {
+                    std::cerr << PROGNAME
+                              << ":  Error:\t" << arg << " option does not apply when aggregating.\n";
+                    return 1;
+                }
+            if ( aggregate_format != "csv" && aggregate_format != "json" )
+            {
+                std::cerr << PROGNAME
+                          << ":  Error:\tAggregate format must be 'csv' or 'json'.\n";
+                return 1;
+            }
+            for ( const auto& list : aggregate_lists )
+            {
+                std::string::size_type start = 0;
+                for (;;)
+                {
+                    std::string::size_type end = list.find(',', start);
+                    std::string key = list.substr(start, end - start);
+                    if ( !key.empty() )
+                    {
+                        try
+                        {
+                            aggregate_keys.push_back(Aggregator::find_key(key));
+                        }
+                        catch (const aggregate_error& e)
+                        {
+                            throw po::error(e.what());
+                        }
+                    }
+                    if ( end == std::string::npos )
+                        break;
+                    start = end + 1;
+                }
+            }
+            if ( aggregate_keys.empty() )
+            {
+                std::cerr << PROGNAME
+                          << ":  Error:\tSpecify at least one aggregation key.\n";
+                return 1;
+            }
+        }
+
         if ( vm.count("output-format") != 0 )
         {
             if ( backend == "pcap" )
-                template_backend = false;
+                output_format = OutputFormat::PCAP;
             else if ( backend == "template" )
-                template_backend = true;
+                output_format = OutputFormat::TEMPLATE;
+            else if ( backend == "csv" )
+                output_format = OutputFormat::CSV;
+            else if ( backend == "tsv" )
+                output_format = OutputFormat::TSV;
+            else if ( backend == "clickhouse" )
+                output_format = OutputFormat::CLICKHOUSE;
+            else if ( backend == "columnar" )
+                output_format = OutputFormat::COLUMNAR;
             else
             {
                 std::cerr << PROGNAME
-                          << ":  Error:\tOutput format must be 'pcap' or 'template'.\n";
+                          << ":  Error:\tOutput format must be 'pcap', 'template', 'csv', 'tsv', 'clickhouse' or 'columnar'.\n";
+                return 1;
+            }
+        }
+
+        if ( output_format == OutputFormat::CSV ||
+             output_format == OutputFormat::TSV )
+        {
+            if ( vm.count("columns") == 0 )
+            {
+                std::cerr << PROGNAME
+                          << ":  Error:\tCSV and TSV output formats require columns to be specified.\n";
                 return 1;
             }
+            std::string csv_args[] = { "template", "query-only" };
+            for ( const std::string& arg : csv_args )
+                if ( vm.count(arg) != 0 )
+                {
+                    std::cerr << PROGNAME
+                              << ":  Error:\t" << arg << " option does not apply when using CSV or TSV output format.\n";
+                    return 1;
+                }
+        }
+        else
+        {
+            std::string csv_args[] = { "columns", "column-headers" };
+            for ( const std::string& arg : csv_args )
+                if ( vm.count(arg) != 0 )
+                {
+                    std::cerr << PROGNAME
+                              << ":  Error:\t" << arg << " option only applies when using CSV or TSV output format.\n";
+                    return 1;
+                }
         }
 
-        if ( template_backend  )
+        if ( output_format == OutputFormat::TEMPLATE )
         {
             if ( vm.count("template") == 0 )
             {
@@ -371,7 +625,19 @@ int main(int ac, char *av[])
                 return 1;
             }
         }
-        else
+        else if ( output_format == OutputFormat::CLICKHOUSE ||
+                  output_format == OutputFormat::COLUMNAR )
+        {
+            std::string fixed_args[] = { "template", "value", "query-only" };
+            for ( const std::string& arg : fixed_args )
+                if ( vm.count(arg) != 0 )
+                {
+                    std::cerr << PROGNAME
+                              << ":  Error:\t" << arg << " option does not apply when using " << backend << " output format.\n";
+                    return 1;
+                }
+        }
+        else if ( output_format == OutputFormat::PCAP )
         {
             std::string template_args[] = { "template", "value" };
             for ( const std::string& arg : template_args )
@@ -436,7 +702,44 @@ int main(int ac, char *av[])
         if ( !options.generate_output )
             pcap_options.baseopts.write_output = false;
 
+        QueryResponseFilter filter;
+        for ( const auto& f : filter_client_prefixes )
+            filter.add_client_prefix(f);
+        for ( const auto& f : filter_server_prefixes )
+            filter.add_server_prefix(f);
+        for ( const auto& f : filter_qname_suffixes )
+            filter.add_qname_suffix(f);
+        for ( const auto& f : filter_qtypes )
+            filter.add_qtype(f);
+        for ( const auto& f : filter_rcodes )
+            filter.add_rcode(f);
+        for ( const auto& f : filter_transports )
+            filter.add_transport(f);
+        if ( !filter.empty() )
+            options.filter = filter;
+
         template_options.baseopts = pcap_options.baseopts;
+
+        csv_options.baseopts = pcap_options.baseopts;
+        clickhouse_options.baseopts = pcap_options.baseopts;
+        columnar_options.baseopts = pcap_options.baseopts;
+        csv_options.separator = ( output_format == OutputFormat::TSV ) ? '\t' : ',';
+        csv_options.header = ( vm.count("column-headers") != 0 );
+        csv_options.geoip_db_dir_path = template_options.geoip_db_dir_path;
+        for ( const auto& list : column_lists )
+        {
+            std::string::size_type start = 0;
+            for (;;)
+            {
+                std::string::size_type end = list.find(',', start);
+                std::string column = list.substr(start, end - start);
+                if ( !column.empty() )
+                    csv_options.columns.push_back(column);
+                if ( end == std::string::npos )
+                    break;
+                start = end + 1;
+            }
+        }
     }
     catch (po::error& err)
     {
@@ -489,6 +792,43 @@ int main(int ac, char *av[])
         std::string keyval = val.substr(eq_pos + 1);
         template_options.values.push_back(std::make_pair(key, keyval));
     }
+    csv_options.values = template_options.values;
+
+    auto make_backend = [&](const std::string& fname) -> std::unique_ptr<OutputBackend>
+    {
+        switch ( output_format )
+        {
+        case OutputFormat::TEMPLATE:
+            return make_unique<TemplateBackend>(template_options, fname);
+
+        case OutputFormat::CSV:
+        case OutputFormat::TSV:
+            return make_unique<CsvBackend>(csv_options, fname);
+
+        case OutputFormat::CLICKHOUSE:
+            return make_unique<ClickHouseBackend>(clickhouse_options, fname);
+
+        case OutputFormat::COLUMNAR:
+            return make_unique<ColumnarBackend>(columnar_options, fname);
+
+        default:
+            return make_unique<PcapBackend>(pcap_options, fname);
+        }
+    };
+
+    if ( !aggregate_keys.empty() )
+    {
+        try
+        {
+            Aggregator aggregator(aggregate_keys, options.defaults, options.pseudo_anon, options.filter);
+            return aggregate_files(vm, output_file_name, aggregator, ( aggregate_format == "json" ), threads, options);
+        }
+        catch (const std::runtime_error& err)
+        {
+            std::cerr << PROGNAME << ": Error: " << err.what() << std::endl;
+            return 1;
+        }
+    }
 
     try
     {
@@ -526,10 +866,7 @@ int main(int ac, char *av[])
 
             options.excludesfile_file_name = output_file_name + EXCLUDEHINTS_EXT;
 
-            if ( template_backend )
-                output_backend = make_unique<TemplateBackend>(template_options, output_file_name);
-            else
-                output_backend = make_unique<PcapBackend>(pcap_options, output_file_name);
+            output_backend = make_backend(output_file_name);
         }
 
         if ( !vm.count("cdns-file") )
@@ -548,20 +885,39 @@ int main(int ac, char *av[])
             {
                 std::string out_fname;
 
-                if ( template_backend )
+                switch ( output_format )
+                {
+                case OutputFormat::TEMPLATE:
                     out_fname = fname + TEMPLATE_EXT;
-                else
+                    break;
+
+                case OutputFormat::CSV:
+                    out_fname = fname + CSV_EXT;
+                    break;
+
+                case OutputFormat::TSV:
+                    out_fname = fname + TSV_EXT;
+                    break;
+
+                case OutputFormat::CLICKHOUSE:
+                    out_fname = fname + CLICKHOUSE_EXT;
+                    break;
+
+                case OutputFormat::COLUMNAR:
+                    out_fname = fname + COLUMNAR_EXT;
+                    break;
+
+                default:
                     out_fname = fname + PCAP_EXT;
+                    break;
+                }
 
                 if ( !open_info_file(out_fname, info, options) )
                     return 1;
 
                 options.excludesfile_file_name = fname + EXCLUDEHINTS_EXT;
 
-                if ( template_backend )
-                    output_backend = make_unique<TemplateBackend>(template_options, out_fname);
-                else
-                    output_backend = make_unique<PcapBackend>(pcap_options, out_fname);
+                output_backend = make_backend(out_fname);
             }
 
             if ( options.report_info )
@@ -12,15 +12,22 @@
 
 #define BOOST_LOG_USE_NATIVE_SYSLOG 1
 
+#include <chrono>
+#include <csignal>
+#include <thread>
+
 #include "no-register-warning.hpp"
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
-#include <boost/log/sinks/sync_frontend.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
 #include <boost/log/sinks/syslog_backend.hpp>
+#include <boost/log/sinks/unbounded_fifo_queue.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/log/expressions.hpp>
 #include <boost/variant.hpp>
 
+#include "util.hpp"
+
 #include "log.hpp"
 
 namespace logging = boost::log;
@@ -29,13 +36,89 @@ namespace sinks = boost::log::sinks;
 namespace keywords = boost::log::keywords;
 namespace expr = boost::log::expressions;
 
+namespace {
+    /**
+     * \brief the sink type. The unbounded FIFO queue is lock-free.
+     */
+    using sink_t = sinks::asynchronous_sink<sinks::syslog_backend, sinks::unbounded_fifo_queue>;
+
+    /**
+     * \struct AsyncLogging
+     * \brief The asynchronous sink and its thread.
+     *
+     * On program exit, stop the thread and write any queued messages.
+     */
+    struct AsyncLogging
+    {
+        /**
+         * \brief Destructor.
+         */
+        ~AsyncLogging()
+        {
+            if ( !frontend )
+                return;
+
+            frontend->stop();
+            thread.join();
+            frontend->flush();
+            core->remove_sink(frontend);
+        }
+
+        /**
+         * \brief the logging core, kept until the sink is removed.
+         */
+        logging::core_ptr core;
+
+        /**
+         * \brief the sink.
+         */
+        boost::shared_ptr<sink_t> frontend;
+
+        /**
+         * \brief the thread writing messages to syslog.
+         */
+        std::thread thread;
+    };
+
+    /**
+     * \brief the asynchronous logging state.
+     */
+    AsyncLogging async_logging;
+}
+
+constexpr unsigned LogRateLimiter::BURST;
+constexpr int64_t LogRateLimiter::INTERVAL_SECONDS;
+
+bool LogRateLimiter::allow(uint64_t& suppressed)
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return allow(std::chrono::duration_cast<std::chrono::seconds>(now).count(), suppressed);
+}
+
+bool LogRateLimiter::allow(int64_t now, uint64_t& suppressed)
+{
+    // Only one thread starts a new interval. Others racing with it
+    // may count against either interval, which is good enough here.
+    int64_t start = window_start_.load(std::memory_order_relaxed);
+    if ( now >= start + INTERVAL_SECONDS &&
+         window_start_.compare_exchange_strong(start, now, std::memory_order_relaxed) )
+        count_.store(0, std::memory_order_relaxed);
+
+    if ( count_.fetch_add(1, std::memory_order_relaxed) < BURST )
+    {
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
 // #ifdef __APPLE__
 // void init_logging() {}
 // #else
 void init_logging()
 {
-    using sink_t = sinks::synchronous_sink<sinks::syslog_backend>;
-
     auto core = logging::core::get();
 
     // Create a backend
@@ -48,7 +131,9 @@ void init_logging()
     // Set the straightforward level translator for the "Severity" attribute of type int
     backend->set_severity_mapper(sinks::syslog::direct_severity_mapping<int>("Severity"));
 
-    boost::shared_ptr< sink_t > frontend(new sink_t(backend));
+    // Records are queued by the frontend, and written to the
+    // backend by our own thread, so the thread can be named.
+    boost::shared_ptr< sink_t > frontend(new sink_t(backend, false));
 
     // This makes the sink to write log records that look like this:
     // 1: [info] An info severity message
@@ -60,8 +145,26 @@ void init_logging()
             % expr::smessage
      );
 
+    async_logging.core = core;
+    async_logging.frontend = frontend;
+
+    // Signals must only be handled by the signal handler thread, but
+    // logging starts before the signal handler blocks them. So start
+    // the logging thread with all signals blocked; it inherits the
+    // mask, so there is no window where it can take a signal.
+    sigset_t all_signals, old_signals;
+    sigfillset(&all_signals);
+    ::pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+    async_logging.thread = std::thread([frontend]()
+    {
+        // Logging starts before the configuration is read, so there
+        // is no placement to apply to this thread.
+        set_thread_name("comp:log", false);
+        frontend->run();
+    });
+    ::pthread_sigmask(SIG_SETMASK, &old_signals, nullptr);
+
     // Wrap it into the frontend and register in the core.
-    // The backend requires synchronization in the frontend.
     core->add_sink(frontend);
  
 }
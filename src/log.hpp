@@ -13,6 +13,11 @@
 #ifndef LOG_HPP
 #define LOG_HPP
 
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+
 #include "no-register-warning.hpp"
 #include <boost/log/trivial.hpp>
 
@@ -20,6 +25,152 @@
 #define LOG_WARN        BOOST_LOG_TRIVIAL(warning)
 #define LOG_INFO        BOOST_LOG_TRIVIAL(info)
 
+/**
+ * \brief Log a message, limiting the rate of messages from this call site.
+ *
+ * Use where a fault may repeat at packet rate. The lambda gives each
+ * call site its own limiter.
+ */
+#define LOG_LIMITED(severity) \
+    for ( LogPermit log_permit_([]() -> LogRateLimiter& { static LogRateLimiter limiter; return limiter; }()); \
+          log_permit_; log_permit_.done() ) \
+        BOOST_LOG_TRIVIAL(severity) << log_permit_
+
+#define LOG_ERROR_LIMITED       LOG_LIMITED(error)
+#define LOG_WARN_LIMITED        LOG_LIMITED(warning)
+#define LOG_INFO_LIMITED        LOG_LIMITED(info)
+
+/**
+ * \class LogRateLimiter
+ * \brief Limit the rate of messages from a single log call site.
+ *
+ * Up to BURST messages are allowed in each interval of
+ * INTERVAL_SECONDS. Further messages in the interval are suppressed
+ * and counted, and the count is reported with the next message
+ * allowed. Checking is lock-free, so a suppressed message costs
+ * little more than reading the clock.
+ */
+class LogRateLimiter
+{
+public:
+    /**
+     * \brief the number of messages allowed in each interval.
+     */
+    static constexpr unsigned BURST = 10;
+
+    /**
+     * \brief the interval length in seconds.
+     */
+    static constexpr int64_t INTERVAL_SECONDS = 1;
+
+    /**
+     * \brief Constructor.
+     */
+    LogRateLimiter() : window_start_(std::numeric_limits<int64_t>::min()), count_(0), suppressed_(0) {}
+
+    /**
+     * \brief Check whether a message may be logged.
+     *
+     * \param suppressed set to the number of messages suppressed since
+     *                   the last message allowed, if allowed.
+     * \returns <code>true</code> if the message may be logged.
+     */
+    bool allow(uint64_t& suppressed);
+
+    /**
+     * \brief Check whether a message may be logged at a given time.
+     *
+     * \param now        the current time in seconds.
+     * \param suppressed set to the number of messages suppressed since
+     *                   the last message allowed, if allowed.
+     * \returns <code>true</code> if the message may be logged.
+     */
+    bool allow(int64_t now, uint64_t& suppressed);
+
+private:
+    /**
+     * \brief the start of the current interval.
+     */
+    std::atomic<int64_t> window_start_;
+
+    /**
+     * \brief the number of messages in the current interval.
+     */
+    std::atomic<unsigned> count_;
+
+    /**
+     * \brief the number of messages suppressed.
+     */
+    std::atomic<uint64_t> suppressed_;
+};
+
+/**
+ * \class LogPermit
+ * \brief Permission to log a single rate limited message.
+ *
+ * Written to a log stream, the permit reports the number of
+ * messages suppressed before this one, if any.
+ */
+class LogPermit
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param limiter the call site limiter.
+     */
+    explicit LogPermit(LogRateLimiter& limiter)
+        : suppressed_(0), allowed_(limiter.allow(suppressed_)) {}
+
+    /**
+     * \brief Is the message allowed?
+     */
+    explicit operator bool() const
+    {
+        return allowed_;
+    }
+
+    /**
+     * \brief Mark the message logged.
+     */
+    void done()
+    {
+        allowed_ = false;
+    }
+
+    /**
+     * \brief Write the number of messages suppressed, if any.
+     *
+     * \param os     the output stream.
+     * \param permit the permit.
+     * \returns the output stream.
+     */
+    friend std::ostream& operator<<(std::ostream& os, const LogPermit& permit)
+    {
+        if ( permit.suppressed_ > 0 )
+            os << "(" << permit.suppressed_ << " similar messages suppressed) ";
+        return os;
+    }
+
+private:
+    /**
+     * \brief the number of messages suppressed before this one.
+     */
+    uint64_t suppressed_;
+
+    /**
+     * \brief is the message allowed?
+     */
+    bool allowed_;
+};
+
+/**
+ * \brief Start logging to syslog.
+ *
+ * Messages are queued on a lock-free queue and written to syslog by
+ * a dedicated thread, so a slow syslog never holds up the caller.
+ * Queued messages are written before the program exits.
+ */
 void init_logging();
 
 #endif
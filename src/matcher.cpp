@@ -315,6 +315,11 @@ void QueryResponseMatcher::set_skew_timeout(std::chrono::microseconds timeout)
     skew_timeout_ = timeout;
 }
 
+void QueryResponseMatcher::set_memory_budget(std::shared_ptr<MemoryBudget> budget)
+{
+    budget_ = budget;
+}
+
 void QueryResponseMatcher::flush()
 {
     for ( auto& r : data_->response_queue )
@@ -332,6 +337,9 @@ void QueryResponseMatcher::add(std::unique_ptr<DNSMessage> m)
     timeout_queries(m->timestamp);
     timeout_responses(m->timestamp);
 
+    if ( budget_ )
+        budget_->charge_always(MemoryBudget::Stage::MATCHER, m->memory_size());
+
     if ( m->dns.type() == CaptureDNS::QUERY )
         add_query(m);
     else
@@ -444,6 +452,8 @@ void QueryResponseMatcher::write(bool complete_only)
             break;
 
         data_->output.pop_front();
+        if ( budget_ )
+            budget_->release(MemoryBudget::Stage::MATCHER, front->query_response()->memory_size());
         sink_(front->query_response());
     }
 }
@@ -18,6 +18,7 @@
 #include <memory>
 
 #include "dnsmessage.hpp"
+#include "memorybudget.hpp"
 #include "queryresponse.hpp"
 
 /**
@@ -97,6 +98,17 @@ public:
      */
     void set_skew_timeout(std::chrono::microseconds t);
 
+    /**
+     * \brief Charge messages held by the matcher to a memory budget.
+     *
+     * Messages are charged to the <code>MATCHER</code> stage when
+     * added, and released when output to the sink. This must be set
+     * before any messages are added.
+     *
+     * \param budget the memory budget.
+     */
+    void set_memory_budget(std::shared_ptr<MemoryBudget> budget);
+
     unsigned get_length();
     void poke(std::chrono::system_clock::time_point now);
 
@@ -178,6 +190,11 @@ private:
      * \brief PIMPL for data used internally by the matcher.
      */
     std::unique_ptr<QRMData> data_;
+
+    /**
+     * \brief the memory budget, if any.
+     */
+    std::shared_ptr<MemoryBudget> budget_;
 };
 
 #endif
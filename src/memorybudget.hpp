@@ -0,0 +1,209 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef MEMORYBUDGET_HPP
+#define MEMORYBUDGET_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * \class MemoryBudget
+ * \brief Account for the memory held by each processing stage.
+ *
+ * Each stage holding data between threads charges the approximate
+ * size of every item it holds against its own limit and against
+ * an overall limit, and releases the charge when the item moves on.
+ * A charge that would take a stage or the total over its limit
+ * fails, and the item is expected to be dropped.
+ *
+ * A limit of 0 means no limit. Usage is tracked whether or not
+ * limits are set, so it can be reported.
+ *
+ * Charges and releases may be made from any thread. Limits must be
+ * set before any charges are made.
+ */
+class MemoryBudget
+{
+public:
+    /**
+     * \enum Stage
+     * \brief The processing stages.
+     */
+    enum class Stage
+    {
+        SNIFFER,
+        MATCHER,
+        CDNS,
+        RAW_PCAP,
+        IGNORED_PCAP,
+    };
+
+    /**
+     * \brief the number of stages.
+     */
+    static constexpr std::size_t STAGES = 5;
+
+    /**
+     * \brief Constructor.
+     *
+     * \param total_limit the limit for all stages together.
+     */
+    explicit MemoryBudget(std::size_t total_limit = 0)
+        : total_limit_(total_limit), total_(0)
+    {
+        limits_.fill(0);
+        for ( auto& u : usage_ )
+            u = 0;
+    }
+
+    /**
+     * \brief Set the limit for all stages together.
+     *
+     * \param limit the limit in bytes, or 0 for no limit.
+     */
+    void set_total_limit(std::size_t limit)
+    {
+        total_limit_ = limit;
+    }
+
+    /**
+     * \brief Set the limit for a stage.
+     *
+     * \param stage the stage.
+     * \param limit the limit in bytes, or 0 for no limit.
+     */
+    void set_limit(Stage stage, std::size_t limit)
+    {
+        limits_[index(stage)] = limit;
+    }
+
+    /**
+     * \brief Charge a stage for an item, if within the limits.
+     *
+     * An item is always accepted by an empty stage, so that an item
+     * larger than the stage limit does not block the stage forever.
+     *
+     * \param stage the stage.
+     * \param bytes the item size.
+     * \returns <code>false</code> if the charge would exceed a limit.
+     * The stage is not charged.
+     */
+    bool charge(Stage stage, std::size_t bytes)
+    {
+        std::size_t i = index(stage);
+        std::size_t used = usage_[i].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        std::size_t total = total_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+        if ( ( limits_[i] > 0 && used > limits_[i] && used != bytes ) ||
+             ( total_limit_ > 0 && total > total_limit_ ) )
+        {
+            release(stage, bytes);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * \brief Charge a stage for an item regardless of limits.
+     *
+     * \param stage the stage.
+     * \param bytes the item size.
+     */
+    void charge_always(Stage stage, std::size_t bytes)
+    {
+        usage_[index(stage)].fetch_add(bytes, std::memory_order_relaxed);
+        total_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Release a charge.
+     *
+     * \param stage the stage.
+     * \param bytes the item size.
+     */
+    void release(Stage stage, std::size_t bytes)
+    {
+        usage_[index(stage)].fetch_sub(bytes, std::memory_order_relaxed);
+        total_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Determine if a stage or the total is at or over its limit.
+     *
+     * \param stage the stage.
+     * \returns <code>true</code> if no more should be charged to the stage.
+     */
+    bool exhausted(Stage stage) const
+    {
+        std::size_t i = index(stage);
+        return
+            ( limits_[i] > 0 && usage_[i].load(std::memory_order_relaxed) >= limits_[i] ) ||
+            ( total_limit_ > 0 && total_.load(std::memory_order_relaxed) >= total_limit_ );
+    }
+
+    /**
+     * \brief Return the current usage of a stage.
+     *
+     * \param stage the stage.
+     * \returns the bytes charged to the stage.
+     */
+    std::size_t usage(Stage stage) const
+    {
+        return usage_[index(stage)].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Return the current usage of all stages.
+     *
+     * \returns the bytes charged to all stages.
+     */
+    std::size_t total() const
+    {
+        return total_.load(std::memory_order_relaxed);
+    }
+
+private:
+    /**
+     * \brief Return the array index for a stage.
+     *
+     * \param stage the stage.
+     * \returns the index.
+     */
+    static std::size_t index(Stage stage)
+    {
+        return static_cast<std::size_t>(stage);
+    }
+
+    /**
+     * \brief the limit for each stage.
+     */
+    std::array<std::size_t, STAGES> limits_;
+
+    /**
+     * \brief the limit for all stages.
+     */
+    std::size_t total_limit_;
+
+    /**
+     * \brief the current usage of each stage.
+     */
+    std::array<std::atomic<std::size_t>, STAGES> usage_;
+
+    /**
+     * \brief the current usage of all stages.
+     */
+    std::atomic<std::size_t> total_;
+};
+
+#endif
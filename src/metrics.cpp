@@ -0,0 +1,308 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <istream>
+
+#include "config.h"
+
+#include "log.hpp"
+#include "makeunique.hpp"
+#include "util.hpp"
+
+#include "metrics.hpp"
+
+namespace al = boost::asio::local;
+
+namespace {
+    /**
+     * \brief the largest HTTP request header accepted.
+     */
+    const std::size_t MAX_REQUEST_SIZE = 8192;
+
+    /**
+     * \brief the time allowed for a client to send its HTTP request.
+     */
+    const long REQUEST_TIMEOUT_SECONDS = 5;
+
+    /**
+     * \brief Escape help text.
+     *
+     * \param s the text.
+     * \returns the escaped text.
+     */
+    std::string escape_help(const std::string& s)
+    {
+        std::string res;
+        for ( char c : s )
+        {
+            if ( c == '\\' )
+                res += "\\\\";
+            else if ( c == '\n' )
+                res += "\\n";
+            else
+                res += c;
+        }
+        return res;
+    }
+
+    /**
+     * \brief Escape a label value.
+     *
+     * \param s the value.
+     * \returns the escaped value.
+     */
+    std::string escape_label(const std::string& s)
+    {
+        std::string res;
+        for ( char c : s )
+        {
+            if ( c == '"' )
+                res += "\\\"";
+            else if ( c == '\\' )
+                res += "\\\\";
+            else if ( c == '\n' )
+                res += "\\n";
+            else
+                res += c;
+        }
+        return res;
+    }
+
+    /**
+     * \brief Build an HTTP response.
+     *
+     * \param status the status line text.
+     * \param body   the response body.
+     * \returns the response.
+     */
+    std::string http_response(const std::string& status, const std::string& body)
+    {
+        std::ostringstream oss;
+        oss << "HTTP/1.0 " << status << "\r\n"
+            << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+            << "Content-Length: " << body.size() << "\r\n"
+            << "Connection: close\r\n"
+            << "\r\n"
+            << body;
+        return oss.str();
+    }
+}
+
+void MetricsText::family(const std::string& name, const char* type, const std::string& help)
+{
+    os_ << "# HELP " << name << " " << escape_help(help) << "\n"
+        << "# TYPE " << name << " " << type << "\n";
+}
+
+void MetricsText::sample(const std::string& name, const Labels& labels, uint64_t value)
+{
+    write_name(name, labels);
+    os_ << " " << value << "\n";
+}
+
+void MetricsText::sample(const std::string& name, const Labels& labels, double value)
+{
+    write_name(name, labels);
+    os_ << " " << std::setprecision(15) << value << "\n";
+}
+
+void MetricsText::write_name(const std::string& name, const Labels& labels)
+{
+    os_ << name;
+    if ( labels.empty() )
+        return;
+
+    bool first = true;
+    os_ << "{";
+    for ( const auto& l : labels )
+    {
+        if ( !first )
+            os_ << ",";
+        os_ << l.first << "=\"" << escape_label(l.second) << "\"";
+        first = false;
+    }
+    os_ << "}";
+}
+
+MetricsServer::MetricsServer(const std::string& socket_path,
+                             const std::string& tcp_address, unsigned tcp_port,
+                             const std::string& file)
+    : work_(make_unique<boost::asio::io_service::work>(service_)),
+      socket_path_(socket_path), file_(file), file_failed_(false),
+      file_write_pending_(false)
+{
+    if ( !socket_path_.empty() )
+    {
+        std::remove(socket_path_.c_str());
+        unix_acceptor_ = make_unique<al::stream_protocol::acceptor>(
+            service_, al::stream_protocol::endpoint(socket_path_));
+        accept_unix();
+    }
+
+    if ( tcp_port != 0 )
+    {
+        tcp_acceptor_ = make_unique<boost::asio::ip::tcp::acceptor>(
+            service_, boost::asio::ip::tcp::endpoint(
+                boost::asio::ip::address::from_string(tcp_address), tcp_port));
+        accept_tcp();
+    }
+
+    thread_ = std::thread([this]()
+    {
+        set_thread_name("comp:metrics");
+        service_.run();
+    });
+}
+
+MetricsServer::~MetricsServer()
+{
+    service_.stop();
+    thread_.join();
+    if ( !socket_path_.empty() )
+        std::remove(socket_path_.c_str());
+}
+
+void MetricsServer::publish(std::string text)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    text_ = std::move(text);
+
+    // Publishing faster than the file can be written just replaces
+    // the text to write next; only one write is ever queued.
+    if ( !file_.empty() && !file_write_pending_ )
+    {
+        file_write_pending_ = true;
+        service_.post([this]() { write_file(); });
+    }
+}
+
+std::string MetricsServer::text() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return text_;
+}
+
+void MetricsServer::accept_unix()
+{
+    auto socket = std::make_shared<al::stream_protocol::socket>(service_);
+    unix_acceptor_->async_accept(*socket,
+        [this, socket](const boost::system::error_code& err)
+        {
+            if ( err )
+            {
+                if ( err != boost::asio::error::operation_aborted )
+                    LOG_ERROR << "Metrics unix accept failed: " << err.message();
+                return;
+            }
+
+            auto body = std::make_shared<std::string>(text());
+            boost::asio::async_write(*socket, boost::asio::buffer(*body),
+                [socket, body](const boost::system::error_code&, std::size_t) {});
+            accept_unix();
+        });
+}
+
+void MetricsServer::accept_tcp()
+{
+    auto socket = std::make_shared<boost::asio::ip::tcp::socket>(service_);
+    tcp_acceptor_->async_accept(*socket,
+        [this, socket](const boost::system::error_code& err)
+        {
+            if ( err )
+            {
+                if ( err != boost::asio::error::operation_aborted )
+                    LOG_ERROR << "Metrics tcp accept failed: " << err.message();
+                return;
+            }
+
+            // Don't let a client that never completes its request
+            // hold the connection open.
+            auto timer = std::make_shared<boost::asio::deadline_timer>(service_);
+            timer->expires_from_now(boost::posix_time::seconds(REQUEST_TIMEOUT_SECONDS));
+            timer->async_wait(
+                [socket](const boost::system::error_code& err)
+                {
+                    boost::system::error_code ec;
+                    if ( !err )
+                        socket->close(ec);
+                });
+
+            auto request = std::make_shared<boost::asio::streambuf>(MAX_REQUEST_SIZE);
+            boost::asio::async_read_until(*socket, *request, "\r\n\r\n",
+                [this, socket, request, timer](const boost::system::error_code& err, std::size_t)
+                {
+                    timer->cancel();
+                    if ( !err )
+                        respond_http(socket, request);
+                });
+            accept_tcp();
+        });
+}
+
+void MetricsServer::respond_http(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+                                 std::shared_ptr<boost::asio::streambuf> request)
+{
+    std::istream is(request.get());
+    std::string method, target;
+    is >> method >> target;
+
+    std::shared_ptr<std::string> response;
+    if ( method != "GET" && method != "HEAD" )
+        response = std::make_shared<std::string>(http_response("405 Method Not Allowed", ""));
+    else if ( target != "/metrics" && target != "/" )
+        response = std::make_shared<std::string>(http_response("404 Not Found", ""));
+    else
+    {
+        response = std::make_shared<std::string>(http_response("200 OK", text()));
+        if ( method == "HEAD" )
+            response->resize(response->find("\r\n\r\n") + 4);
+    }
+
+    boost::asio::async_write(*socket, boost::asio::buffer(*response),
+        [socket, response](const boost::system::error_code&, std::size_t)
+        {
+            boost::system::error_code ec;
+            socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        });
+}
+
+void MetricsServer::write_file()
+{
+    std::string text;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        text = text_;
+        file_write_pending_ = false;
+    }
+
+    std::string tmp = file_ + ".tmp";
+    bool ok;
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        ofs << text;
+        ofs.close();
+        ok = !ofs.fail();
+    }
+    ok = ok && ( std::rename(tmp.c_str(), file_.c_str()) == 0 );
+
+    // Only log a change of state, as the file is rewritten frequently.
+    if ( !ok && !file_failed_ )
+        LOG_ERROR << "Can't write metrics file " << file_ << ": " << std::strerror(errno);
+    else if ( ok && file_failed_ )
+        LOG_INFO << "Writing metrics file " << file_ << " resumed";
+    file_failed_ = !ok;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+/**
+ * \class MetricsText
+ * \brief Build metrics in Prometheus text exposition format.
+ *
+ * Each metric family is started with its type and help text,
+ * followed by one or more samples.
+ */
+class MetricsText
+{
+public:
+    /**
+     * \typedef Labels
+     * \brief Label names and values for a sample.
+     */
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    /**
+     * \brief Start a metric family.
+     *
+     * \param name the metric name.
+     * \param type the metric type, <code>counter</code> or <code>gauge</code>.
+     * \param help the help text.
+     */
+    void family(const std::string& name, const char* type, const std::string& help);
+
+    /**
+     * \brief Add a sample to the current family.
+     *
+     * \param name   the metric name.
+     * \param labels the sample labels.
+     * \param value  the sample value.
+     */
+    void sample(const std::string& name, const Labels& labels, uint64_t value);
+
+    /**
+     * \brief Add a sample to the current family.
+     *
+     * \param name   the metric name.
+     * \param labels the sample labels.
+     * \param value  the sample value.
+     */
+    void sample(const std::string& name, const Labels& labels, double value);
+
+    /**
+     * \brief Add a counter with a single unlabelled sample.
+     *
+     * \param name  the metric name.
+     * \param help  the help text.
+     * \param value the counter value.
+     */
+    void counter(const std::string& name, const std::string& help, uint64_t value)
+    {
+        family(name, "counter", help);
+        sample(name, {}, value);
+    }
+
+    /**
+     * \brief Add a gauge with a single unlabelled sample.
+     *
+     * \param name  the metric name.
+     * \param help  the help text.
+     * \param value the gauge value.
+     */
+    void gauge(const std::string& name, const std::string& help, double value)
+    {
+        family(name, "gauge", help);
+        sample(name, {}, value);
+    }
+
+    /**
+     * \brief Return the metrics text.
+     *
+     * \returns the text.
+     */
+    std::string str() const
+    {
+        return os_.str();
+    }
+
+private:
+    /**
+     * \brief Write a sample name and labels.
+     *
+     * \param name   the metric name.
+     * \param labels the sample labels.
+     */
+    void write_name(const std::string& name, const Labels& labels);
+
+    /**
+     * \brief the text so far.
+     */
+    std::ostringstream os_;
+};
+
+/**
+ * \class MetricsServer
+ * \brief Make the latest metrics available to other processes.
+ *
+ * Metrics may be served on a Unix socket, where each connection
+ * receives the metrics text and is closed, and over HTTP on a TCP
+ * socket. They may also be written to a file. The file is replaced
+ * with a rename, so readers never see a partial file.
+ *
+ * Connections are served, and the file written, on a separate
+ * thread, so publishing never waits on a slow client or storage.
+ * At most one file write is queued at a time, and it writes the
+ * latest metrics. An HTTP client must send its request within a
+ * few seconds or the connection is closed.
+ */
+class MetricsServer
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param socket_path the Unix socket path, empty for none.
+     * \param tcp_address the TCP address to listen on.
+     * \param tcp_port    the TCP port to listen on, 0 for none.
+     * \param file        the file to write, empty for none.
+     * \throws boost::system::system_error if a socket can't be opened.
+     */
+    MetricsServer(const std::string& socket_path,
+                  const std::string& tcp_address, unsigned tcp_port,
+                  const std::string& file);
+
+    /**
+     * \brief Destructor.
+     *
+     * Stop serving and remove the Unix socket.
+     */
+    ~MetricsServer();
+
+    /**
+     * \brief Publish new metrics.
+     *
+     * \param text the metrics text.
+     */
+    void publish(std::string text);
+
+    /**
+     * \brief Return the latest metrics.
+     *
+     * \returns the metrics text.
+     */
+    std::string text() const;
+
+private:
+    /**
+     * \brief Accept the next Unix socket connection.
+     */
+    void accept_unix();
+
+    /**
+     * \brief Accept the next TCP connection.
+     */
+    void accept_tcp();
+
+    /**
+     * \brief Respond to an HTTP request.
+     *
+     * \param socket  the connection.
+     * \param request the request buffer.
+     */
+    void respond_http(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+                      std::shared_ptr<boost::asio::streambuf> request);
+
+    /**
+     * \brief Replace the metrics file with the latest metrics.
+     */
+    void write_file();
+
+    /**
+     * \brief the I/O service for connections and file writes.
+     */
+    boost::asio::io_service service_;
+
+    /**
+     * \brief keep the I/O service running while idle.
+     */
+    std::unique_ptr<boost::asio::io_service::work> work_;
+
+    /**
+     * \brief the Unix socket acceptor, if any.
+     */
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> unix_acceptor_;
+
+    /**
+     * \brief the TCP socket acceptor, if any.
+     */
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> tcp_acceptor_;
+
+    /**
+     * \brief the Unix socket path.
+     */
+    std::string socket_path_;
+
+    /**
+     * \brief the metrics file path.
+     */
+    std::string file_;
+
+    /**
+     * \brief has writing the metrics file failed?
+     */
+    bool file_failed_;
+
+    /**
+     * \brief protect the metrics text.
+     */
+    mutable std::mutex mutex_;
+
+    /**
+     * \brief the latest metrics text.
+     */
+    std::string text_;
+
+    /**
+     * \brief is a write of the metrics file queued?
+     */
+    bool file_write_pending_;
+
+    /**
+     * \brief the thread serving connections.
+     */
+    std::thread thread_;
+};
+
+#endif
@@ -129,6 +129,13 @@ using PacketStatistics = struct PacketStatistics_s
 
    uint64_t matcher_drop_count;
 
+    /**
+     * \brief sampling rate (1 in N) currently applied, or 0 if not sampling.
+     *
+     * Unlike the other items, this is not a count.
+     */
+    uint64_t sampling_rate;
+
     /**
      * \brief Dump the stats to the stream provided
      *
@@ -20,8 +20,20 @@
 
 #include "packetstream.hpp"
 
-PacketStream::PacketStream(const Configuration& config, DNSSink dns_sink, AddressEventSink address_event_sink)
-    : config_(config), dns_sink_(dns_sink), address_event_sink_(address_event_sink)
+namespace {
+    /**
+     * \brief the size of a DNS message header.
+     */
+    const std::size_t DNS_HEADER_SIZE = 12;
+}
+
+PacketStream::PacketStream(const Configuration& config, DNSSink dns_sink,
+                           AddressEventSink address_event_sink,
+                           DiscardSink discard_sink,
+                           const Sampler* sampler)
+    : config_(config), dns_sink_(dns_sink),
+      address_event_sink_(address_event_sink), discard_sink_(discard_sink),
+      sampler_(sampler)
 {
     tcp_stream_follower_.new_stream_callback(std::bind(&PacketStream::on_new_stream, this, std::placeholders::_1));
 }
@@ -153,13 +165,22 @@ void PacketStream::tcp_packet(Tins::TCP* tcp, Tins::PDU* ip_pdu,
     }
 
     // It looks like the TCP stream follower stuff *modifies* the
-    // PDU data fed into it. Since we're sharing the packet with the
+    // PDU data fed into it. If we're sharing the packet with the
     // PCAP output queues, they can end up writing a modified version
     // of the packet. What we see especially is zero length TCP packets
-    // at the first data packet in a transaction. So copy the packet before
-    // feeding the copy into the stream follower.
-    Tins::Packet pkt(ip_pdu, NoCopyPacket::tsToTins(pkt_data.timestamp));
-    tcp_stream_follower_.process_packet(pkt);
+    // at the first data packet in a transaction. So in that case copy
+    // the packet before feeding the copy into the stream follower.
+    // PCAP output from the captured frame is unaffected.
+    if ( pkt_data.pdu_shared )
+    {
+        Tins::Packet pkt(ip_pdu, NoCopyPacket::tsToTins(pkt_data.timestamp));
+        tcp_stream_follower_.process_packet(pkt);
+    }
+    else
+    {
+        NoCopyPacket pkt(ip_pdu, pkt_data.timestamp);
+        tcp_stream_follower_.process_packet(pkt.packet());
+    }
 }
 
 void PacketStream::icmp_packet(Tins::ICMP* icmp, Tins::PDU* /* ip_pdu */,
@@ -260,6 +281,39 @@ void PacketStream::icmpv6_packet(Tins::ICMPv6* icmp, Tins::PDU* /* ip_pdu */,
 
 void PacketStream::dispatch_dns(Tins::RawPDU* pdu, PktData& pkt_data)
 {
+    // Check sampling and the OPCODE before going to the expense of
+    // decoding the whole message. The ID is header bytes 0-1, QR is
+    // bit 0 of header byte 2 and the OPCODE bits 1-4. RR type
+    // filtering applies only to individual RRs, so it can't be used
+    // to discard a whole message here.
+    if ( pdu->payload_size() >= DNS_HEADER_SIZE )
+    {
+        const uint8_t* header = pdu->payload().data();
+
+        if ( sampler_ && sampler_->by_message() )
+        {
+            uint16_t id = (header[0] << 8) | header[1];
+            bool query = !(header[2] & 0x80);
+            bool keep = query
+                ? sampler_->keep(pkt_data.srcIP, pkt_data.srcPort, id)
+                : sampler_->keep(pkt_data.dstIP, pkt_data.dstPort, id);
+            if ( !keep )
+            {
+                if ( discard_sink_ )
+                    discard_sink_(DiscardReason::SAMPLING);
+                return;
+            }
+        }
+
+        unsigned opcode = (header[2] >> 3) & 0xf;
+        if ( !config_.output_opcode(static_cast<CaptureDNS::Opcode>(opcode)) )
+        {
+            if ( discard_sink_ )
+                discard_sink_(DiscardReason::OPCODE);
+            return;
+        }
+    }
+
     auto dns =
         make_unique<DNSMessage>(*pdu,
                                 pkt_data.timestamp,
@@ -310,6 +364,8 @@ void PacketStream::process_packet(std::shared_ptr<PcapItem>& pcap)
 
     struct PacketStream::PktData pkt_data;
     pkt_data.timestamp = pcap->timestamp;
+    pkt_data.pdu_shared = !pcap->frame &&
+        ( !config_.raw_pcap_pattern.empty() || !config_.ignored_pcap_pattern.empty() );
 
     Tins::PDU* ip_pdu = pdu;
 
@@ -24,6 +24,8 @@
 #include "channel.hpp"
 #include "configuration.hpp"
 #include "matcher.hpp"
+#include "pcapframe.hpp"
+#include "sampler.hpp"
 #include "sniffers.hpp"
 #include "transporttype.hpp"
 
@@ -76,18 +78,35 @@ public:
 /**
  * \struct PcapItem
  * \brief A packet, with timestamp and taking ownership of the data.
+ *
+ * If available, the frame as captured is kept alongside the decoded
+ * packet. PCAP output is then written from the captured frame, so the
+ * decoded packet need not be re-serialised and may be modified
+ * during processing.
  */
 struct PcapItem
 {
     /**
      * \brief Constructor
      *
-     * \param pkt a packet from the underlying library.
+     * \param pkt   a packet from the underlying library.
+     * \param frame the captured frame, if available.
      */
-    explicit PcapItem(Tins::Packet& pkt)
+    explicit PcapItem(Tins::Packet& pkt, std::shared_ptr<PcapFrame> frame = nullptr)
         : timestamp(std::chrono::microseconds(pkt.timestamp())),
-          pdu(pkt.release_pdu())
+          pdu(pkt.release_pdu()), frame(std::move(frame))
+    {
+    }
+
+    /**
+     * \brief Return the approximate memory used by the packet.
+     *
+     * \returns the approximate size in bytes.
+     */
+    std::size_t memory_size() const
     {
+        return sizeof(PcapItem) + ( pdu ? pdu->size() : 0 ) +
+            ( frame ? frame->memory_size() : 0 );
     }
 
     /**
@@ -99,6 +118,11 @@ struct PcapItem
      * \brief the packet data.
      */
     std::unique_ptr<Tins::PDU> pdu;
+
+    /**
+     * \brief the captured frame, if available.
+     */
+    std::shared_ptr<PcapFrame> frame;
 };
 
 /**
@@ -120,14 +144,35 @@ public:
      */
     using AddressEventSink = std::function<void (std::shared_ptr<AddressEvent>&)>;
 
+    /**
+     * \enum DiscardReason
+     * \brief Why a DNS message was discarded without being decoded.
+     */
+    enum class DiscardReason
+    {
+        OPCODE,
+        SAMPLING,
+    };
+
+    /**
+     * \typedef DiscardSink
+     * \brief Sink function for DNS messages discarded without decoding.
+     */
+    using DiscardSink = std::function<void (DiscardReason reason)>;
+
     /**
      * \brief Constructor.
      *
      * \param config             configuration information.
      * \param dns_sink           sink for DNS messages.
      * \param address_event_sink sink for Address Event messages.
+     * \param discard_sink       sink for messages discarded without decoding.
+     * \param sampler            sampler for DNS messages, if any.
      */
-    PacketStream(const Configuration& config, DNSSink dns_sink, AddressEventSink address_event_sink);
+    PacketStream(const Configuration& config, DNSSink dns_sink,
+                 AddressEventSink address_event_sink,
+                 DiscardSink discard_sink = nullptr,
+                 const Sampler* sampler = nullptr);
 
     /**
      * \brief Process an incoming packet.
@@ -179,6 +224,12 @@ protected:
          * \brief transport the packet arrived over.
          */
         TransportType transport_type;
+
+        /**
+         * \brief the decoded packet may be written to PCAP output,
+         * so must not be modified.
+         */
+        bool pdu_shared;
     };
 
     /**
@@ -286,8 +337,16 @@ protected:
     /**
      * \brief Dispatch a DNS message.
      *
+     * The ID, QR flag and OPCODE are read directly from the message
+     * header. If the message is not selected by the sampler, or the
+     * configuration does not output messages with that OPCODE, the
+     * message is passed to the discard sink without being decoded.
+     * Messages too short to hold a DNS header are always decoded,
+     * so they are reported as malformed.
+     *
      * \param pdu   the message data.
      * \param pkt_data basic packet data so far.
+     * \throws malformed_packet if the message cannot be decoded.
      */
     void dispatch_dns(Tins::RawPDU* pdu, PktData& pkt_data);
 
@@ -320,6 +379,16 @@ private:
      */
     AddressEventSink address_event_sink_;
 
+    /**
+     * \brief sink function for messages discarded by OPCODE.
+     */
+    DiscardSink discard_sink_;
+
+    /**
+     * \brief DNS message sampler, if any.
+     */
+    const Sampler* sampler_;
+
     /**
      * \brief IPv4 fragment reassembly.
      */
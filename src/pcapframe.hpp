@@ -0,0 +1,218 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef PCAPFRAME_HPP
+#define PCAPFRAME_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * \struct PcapFrame
+ * \brief A captured frame, held as a ready to write PCAP record.
+ *
+ * The record is the PCAP record header, in host byte order, followed
+ * by the captured frame data exactly as received.
+ */
+struct PcapFrame
+{
+    /**
+     * \brief the size of a PCAP record header.
+     */
+    static constexpr std::size_t RECORD_HEADER_SIZE = 16;
+
+    /**
+     * \brief Constructor.
+     */
+    PcapFrame() : linktype(0) {}
+
+    /**
+     * \brief Return the captured frame data.
+     *
+     * \returns pointer to the frame data.
+     */
+    const uint8_t* data() const
+    {
+        return record.data() + RECORD_HEADER_SIZE;
+    }
+
+    /**
+     * \brief Return the captured frame length.
+     *
+     * \returns the length of the frame data.
+     */
+    std::size_t size() const
+    {
+        return record.size() - RECORD_HEADER_SIZE;
+    }
+
+    /**
+     * \brief Return the frame timestamp.
+     *
+     * \returns the timestamp from the record header.
+     */
+    std::chrono::system_clock::time_point timestamp() const
+    {
+        uint32_t header[2];
+        std::memcpy(header, record.data(), sizeof(header));
+        return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(header[0]) + std::chrono::microseconds(header[1])));
+    }
+
+    /**
+     * \brief Return the approximate memory used by the frame.
+     *
+     * \returns the approximate size in bytes.
+     */
+    std::size_t memory_size() const
+    {
+        return sizeof(PcapFrame) + record.capacity();
+    }
+
+    /**
+     * \brief the PCAP link type of the frame.
+     */
+    int linktype;
+
+    /**
+     * \brief the PCAP record header and frame data.
+     */
+    std::vector<uint8_t> record;
+};
+
+/**
+ * \class PcapFramePool
+ * \brief A pool of frame buffers.
+ *
+ * Frames are typically filled by the capture thread and released
+ * by a PCAP output thread. A released frame returns its buffer to
+ * the pool for reuse, so in steady state capturing a frame costs a
+ * copy of the frame data and no allocation.
+ *
+ * Frames hold a reference to the pool, so may outlive the pool's
+ * creator.
+ */
+class PcapFramePool : public std::enable_shared_from_this<PcapFramePool>
+{
+public:
+    /**
+     * \brief the default maximum memory held in unused buffers.
+     */
+    static constexpr std::size_t DEFAULT_MAX_FREE_BYTES = 16 * 1024 * 1024;
+
+    /**
+     * \brief Create a pool.
+     *
+     * \param max_free_bytes maximum memory held in unused buffers.
+     * \returns the new pool.
+     */
+    static std::shared_ptr<PcapFramePool> create(std::size_t max_free_bytes = DEFAULT_MAX_FREE_BYTES)
+    {
+        return std::shared_ptr<PcapFramePool>(new PcapFramePool(max_free_bytes));
+    }
+
+    /**
+     * \brief Make a frame.
+     *
+     * \param linktype the PCAP link type.
+     * \param ts_sec   the capture timestamp seconds.
+     * \param ts_usec  the capture timestamp microseconds.
+     * \param caplen   the length of data captured.
+     * \param len      the length of the frame on the wire.
+     * \param data     the captured data.
+     * \returns the frame.
+     */
+    std::shared_ptr<PcapFrame> make_frame(int linktype,
+                                          uint32_t ts_sec, uint32_t ts_usec,
+                                          uint32_t caplen, uint32_t len,
+                                          const uint8_t* data)
+    {
+        std::unique_ptr<PcapFrame> frame;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            if ( !free_.empty() )
+            {
+                frame = std::move(free_.back());
+                free_.pop_back();
+                free_bytes_ -= frame->record.capacity();
+            }
+        }
+        if ( !frame )
+            frame.reset(new PcapFrame);
+
+        uint32_t header[4] = { ts_sec, ts_usec, caplen, len };
+        frame->linktype = linktype;
+        frame->record.resize(PcapFrame::RECORD_HEADER_SIZE + caplen);
+        std::memcpy(frame->record.data(), header, sizeof(header));
+        std::memcpy(frame->record.data() + PcapFrame::RECORD_HEADER_SIZE, data, caplen);
+
+        std::shared_ptr<PcapFramePool> pool = shared_from_this();
+        return std::shared_ptr<PcapFrame>(
+            frame.release(),
+            [pool](PcapFrame* f) { pool->recycle(f); });
+    }
+
+private:
+    /**
+     * \brief Constructor.
+     *
+     * \param max_free_bytes maximum memory held in unused buffers.
+     */
+    explicit PcapFramePool(std::size_t max_free_bytes)
+        : max_free_bytes_(max_free_bytes), free_bytes_(0)
+    {
+    }
+
+    /**
+     * \brief Return a frame to the pool, or free it if the pool is full.
+     *
+     * \param f the frame.
+     */
+    void recycle(PcapFrame* f)
+    {
+        std::unique_ptr<PcapFrame> frame(f);
+        std::lock_guard<std::mutex> lock(m_);
+        if ( free_bytes_ + frame->record.capacity() <= max_free_bytes_ )
+        {
+            free_bytes_ += frame->record.capacity();
+            free_.push_back(std::move(frame));
+        }
+    }
+
+    /**
+     * \brief maximum memory held in unused buffers.
+     */
+    std::size_t max_free_bytes_;
+
+    /**
+     * \brief memory currently held in unused buffers.
+     */
+    std::size_t free_bytes_;
+
+    /**
+     * \brief unused frames.
+     */
+    std::vector<std::unique_ptr<PcapFrame>> free_;
+
+    /**
+     * \brief protect the unused frames.
+     */
+    std::mutex m_;
+};
+
+#endif
@@ -14,8 +14,11 @@
 #define PCAPWRITER_HPP
 
 #include <chrono>
+#include <cstdint>
+#include <exception>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <pcap/pcap.h>
 #include <tins/tins.h>
@@ -23,6 +26,7 @@
 #include "configuration.hpp"
 #include "makeunique.hpp"
 #include "nocopypacket.hpp"
+#include "pcapframe.hpp"
 #include "rotatingfilename.hpp"
 #include "log.hpp"
 
@@ -58,6 +62,13 @@ public:
      */
     virtual void write_packet(Tins::PDU& pdu,
                               const std::chrono::system_clock::time_point& timestamp) = 0;
+
+    /**
+     * \brief Write a captured frame to the output file.
+     *
+     * \param frame the captured frame.
+     */
+    virtual void write_frame(const PcapFrame& frame) = 0;
 };
 
 /**
@@ -94,6 +105,17 @@ public:
     virtual void write_packet(Tins::PDU& pdu,
                               const std::chrono::system_clock::time_point& timestamp,
                               const Configuration& config) = 0;
+
+    /**
+     * \brief Write a captured frame to the output file.
+     *
+     * \param frame     the captured frame.
+     * \param timestamp the frame timestamp.
+     * \param config    the current configuration.
+     */
+    virtual void write_frame(const PcapFrame& frame,
+                             const std::chrono::system_clock::time_point& timestamp,
+                             const Configuration& config) = 0;
 };
 
 /**
@@ -105,6 +127,14 @@ class PcapWriter : public PcapBaseWriter
 {
     const unsigned NO_LINK_TYPE = 0xffffffffu;
 
+    /**
+     * \brief the size of output batches.
+     *
+     * Records are collected and passed to the output writer in
+     * batches of about this size.
+     */
+    static constexpr std::size_t BATCH_SIZE = 64 * 1024;
+
 public:
     /**
      * \brief Constructor.
@@ -117,6 +147,22 @@ public:
         : filename_(filename), level_(level),
           linktype_(NO_LINK_TYPE), snaplen_(snaplen), logging_(logging)
     {
+        batch_.reserve(BATCH_SIZE);
+    }
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~PcapWriter()
+    {
+        try
+        {
+            close();
+        }
+        catch (const std::exception& err)
+        {
+            LOG_ERROR << err.what();
+        }
     }
 
     /**
@@ -125,7 +171,10 @@ public:
     virtual void close()
     {
         if ( writer_ )
+        {
+            flush();
             writer_.reset(nullptr);
+        }
     }
 
     /**
@@ -139,10 +188,9 @@ public:
     {
         if ( !writer_ )
         {
-            writer_ = make_unique<Writer>(filename_, level_, logging_);
             if ( linktype_ == NO_LINK_TYPE )
                 set_link_type(pdu);
-            write_file_header();
+            open();
         }
 
         Tins::PDU::serialization_type buffer = pdu.serialize();
@@ -163,8 +211,27 @@ public:
             static_cast<uint32_t>(buffer.size())
         };
 
-        writer_->writeBytes(reinterpret_cast<uint8_t*>(&packet_header), sizeof(packet_header));
-        writer_->writeBytes(&buffer[0], buffer.size());
+        append(reinterpret_cast<uint8_t*>(&packet_header), sizeof(packet_header));
+        append(&buffer[0], buffer.size());
+    }
+
+    /**
+     * \brief Write a captured frame to the output file.
+     *
+     * The frame is written exactly as captured.
+     *
+     * \param frame the captured frame.
+     */
+    virtual void write_frame(const PcapFrame& frame)
+    {
+        if ( !writer_ )
+        {
+            if ( linktype_ == NO_LINK_TYPE )
+                linktype_ = frame.linktype;
+            open();
+        }
+
+        append(frame.record.data(), frame.record.size());
     }
 
     /**
@@ -190,6 +257,46 @@ public:
     }
 
 private:
+    /**
+     * \brief Open the output file and write the file header.
+     */
+    void open()
+    {
+        writer_ = make_unique<Writer>(filename_, level_, logging_);
+        write_file_header();
+    }
+
+    /**
+     * \brief Add data to the current output batch.
+     *
+     * If the batch is full, write it to the output first. Data larger
+     * than a batch is written directly.
+     *
+     * \param data the data.
+     * \param len  the data length.
+     */
+    void append(const uint8_t* data, std::size_t len)
+    {
+        if ( batch_.size() + len > BATCH_SIZE )
+            flush();
+        if ( len >= BATCH_SIZE )
+            writer_->writeBytes(data, len);
+        else
+            batch_.insert(batch_.end(), data, data + len);
+    }
+
+    /**
+     * \brief Write the current output batch.
+     */
+    void flush()
+    {
+        if ( !batch_.empty() )
+        {
+            writer_->writeBytes(batch_.data(), batch_.size());
+            batch_.clear();
+        }
+    }
+
     /**
      * \brief Set the output link type from the capture data.
      *
@@ -266,7 +373,7 @@ private:
             linktype_
         };
 
-        writer_->writeBytes(reinterpret_cast<uint8_t*>(&file_header), sizeof(file_header));
+        append(reinterpret_cast<uint8_t*>(&file_header), sizeof(file_header));
     }
 
     /**
@@ -299,6 +406,11 @@ private:
     */
    unsigned logging_;
 
+    /**
+     * \brief records waiting to be written.
+     */
+    std::vector<uint8_t> batch_;
+
 };
 
 /**
@@ -356,6 +468,25 @@ public:
         writer_.write_packet(pdu, timestamp);
     }
 
+    /**
+     * \brief Write a captured frame to the output file.
+     *
+     * Use the timestamp to see if the output file needs rotating, and then
+     * write the frame out to the file.
+     *
+     * \param frame     the captured frame.
+     * \param timestamp the frame timestamp.
+     * \param config    the current configuration.
+     */
+    virtual void write_frame(const PcapFrame& frame,
+                             const std::chrono::system_clock::time_point& timestamp,
+                             const Configuration& config)
+    {
+        if ( fname_->need_rotate(timestamp, config) )
+            writer_.set_filename(fname_->filename(timestamp, config));
+        writer_.write_frame(frame);
+    }
+
 private:
     /**
      * \brief the output file details.
@@ -0,0 +1,439 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cctype>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include "capturedns.hpp"
+
+#include "qrfilter.hpp"
+
+namespace po = boost::program_options;
+
+namespace {
+    /**
+     * \brief Mask for the transport type in the transport flags.
+     */
+    const uint8_t TRANSPORT_MASK = (0xf << 1);
+
+    /**
+     * \brief Check if a value is present in a list of values.
+     *
+     * \param values the list of values.
+     * \param val    the value to look for.
+     * \returns `true` if present.
+     */
+    bool contains(const std::vector<unsigned>& values, unsigned val)
+    {
+        return std::find(values.begin(), values.end(), val) != values.end();
+    }
+
+    /**
+     * \brief Look up a table match, checking the position is valid.
+     *
+     * \param matches the table matches.
+     * \param pos     the table position.
+     * \returns the match value.
+     * \throws cbor_file_format_error if the position is out of range.
+     */
+    template<typename T>
+    T match_at(const std::vector<T>& matches, std::size_t pos)
+    {
+        if ( pos >= matches.size() )
+            throw cbor_file_format_error("Block index out of range");
+        return matches[pos];
+    }
+}
+
+QueryResponseFilter::AddressPrefix QueryResponseFilter::parse_prefix(const std::string& prefix)
+{
+    AddressPrefix res;
+    std::string addr = prefix;
+    std::string len;
+
+    std::size_t slash = prefix.find('/');
+    if ( slash != std::string::npos )
+    {
+        addr = prefix.substr(0, slash);
+        len = prefix.substr(slash + 1);
+    }
+
+    try
+    {
+        res.addr = IPAddress(addr).asNetworkBinary();
+    }
+    catch (const std::exception&)
+    {
+        throw po::error("invalid address prefix " + prefix);
+    }
+
+    unsigned max_len = res.addr.size() * 8;
+    if ( len.empty() )
+        res.len = max_len;
+    else
+    {
+        if ( len.size() > 3 ||
+             len.find_first_not_of("0123456789") != std::string::npos )
+            throw po::error("invalid address prefix " + prefix);
+        res.len = std::stoul(len);
+        if ( res.len > max_len )
+            throw po::error("invalid address prefix " + prefix);
+    }
+
+    return res;
+}
+
+void QueryResponseFilter::add_client_prefix(const std::string& prefix)
+{
+    client_prefixes_.push_back(parse_prefix(prefix));
+}
+
+void QueryResponseFilter::add_server_prefix(const std::string& prefix)
+{
+    server_prefixes_.push_back(parse_prefix(prefix));
+}
+
+void QueryResponseFilter::add_qname_suffix(const std::string& suffix)
+{
+    std::string name = boost::to_lower_copy(suffix);
+    while ( !name.empty() && name.back() == '.' )
+        name.pop_back();
+    qname_suffixes_.push_back(CaptureDNS::encode_domain_name(name));
+}
+
+void QueryResponseFilter::add_qtype(const std::string& qtype)
+{
+    qtypes_.push_back(Configuration::find_rrtype_value(qtype));
+}
+
+void QueryResponseFilter::add_rcode(const std::string& rcode)
+{
+    rcodes_.push_back(Configuration::find_rcode_value(rcode));
+}
+
+void QueryResponseFilter::add_transport(const std::string& transport)
+{
+    std::string t = boost::to_lower_copy(transport);
+
+    if ( t == "udp" )
+        transports_.push_back(block_cbor::UDP);
+    else if ( t == "tcp" )
+        transports_.push_back(block_cbor::TCP);
+    else if ( t == "tls" )
+        transports_.push_back(block_cbor::TLS);
+    else if ( t == "dtls" )
+        transports_.push_back(block_cbor::DTLS);
+    else if ( t == "doh" )
+        transports_.push_back(block_cbor::DOH);
+    else
+        throw po::error("unknown transport " + transport);
+}
+
+bool QueryResponseFilter::match_address(const byte_string& addr, bool ipv6,
+                                        const std::vector<AddressPrefix>& prefixes)
+{
+    std::size_t addr_size = ( ipv6 ) ? 16 : 4;
+
+    for ( const auto& p : prefixes )
+    {
+        if ( p.addr.size() != addr_size )
+            continue;
+
+        // Addresses may be stored truncated. Compare as if padded
+        // with zeros, as when the address is read.
+        bool match = true;
+        unsigned bits = p.len;
+        for ( std::size_t i = 0; bits > 0 && match; ++i )
+        {
+            uint8_t a = ( i < addr.size() ) ? addr[i] : 0;
+            uint8_t mask = ( bits >= 8 ) ? 0xff : static_cast<uint8_t>(0xff << (8 - bits));
+            match = ( ( a ^ p.addr[i] ) & mask ) == 0;
+            bits = ( bits >= 8 ) ? bits - 8 : 0;
+        }
+
+        if ( match )
+            return true;
+    }
+
+    return false;
+}
+
+uint8_t QueryResponseFilter::match_stored_address(const byte_string& addr,
+                                                  unsigned ipv4_prefix,
+                                                  unsigned ipv6_prefix,
+                                                  const std::vector<AddressPrefix>& prefixes)
+{
+    uint8_t res = 0;
+
+    if ( addr.size() <= 4 && match_address(addr, false, prefixes) )
+        res |= MATCH_IPV4;
+    if ( addr.size() <= 16 && match_address(addr, true, prefixes) )
+        res |= MATCH_IPV6;
+
+    // Where the address family does not depend on the transport
+    // flags, the result holds whatever the flags say.
+    if ( ipv4_prefix == 32 && addr.size() == 4 )
+        res = ( res & MATCH_IPV4 ) ? MATCH_IPV4 | MATCH_IPV6 : 0;
+    else if ( addr.size() > 4 || ( ipv6_prefix == 128 && addr.size() == 16 ) )
+        res = ( res & MATCH_IPV6 ) ? MATCH_IPV4 | MATCH_IPV6 : 0;
+
+    return res;
+}
+
+uint8_t QueryResponseFilter::match_default_address(const boost::optional<IPAddress>& addr,
+                                                   const std::vector<AddressPrefix>& prefixes)
+{
+    if ( !addr )
+        return 0;
+
+    if ( match_address(addr->asNetworkBinary(), addr->is_ipv6(), prefixes) )
+        return MATCH_IPV4 | MATCH_IPV6;
+    else
+        return 0;
+}
+
+bool QueryResponseFilter::match_qname(const byte_string& name) const
+{
+    for ( const auto& suffix : qname_suffixes_ )
+    {
+        std::size_t pos = 0;
+
+        // Step through the name a label at a time, so the suffix
+        // only matches whole labels.
+        while ( pos < name.size() && name.size() - pos >= suffix.size() )
+        {
+            if ( name.size() - pos == suffix.size() )
+            {
+                if ( std::equal(suffix.begin(), suffix.end(), name.begin() + pos,
+                                [](unsigned char a, unsigned char b)
+                                {
+                                    return a == std::tolower(b);
+                                }) )
+                    return true;
+                break;
+            }
+
+            if ( name[pos] == 0 )
+                break;
+            pos += name[pos] + 1;
+        }
+    }
+
+    return false;
+}
+
+uint8_t QueryResponseFilter::match_signature(const block_cbor::QueryResponseSignature& sig) const
+{
+    boost::optional<uint8_t> transport_flags;
+    if ( sig.qr_transport_flags )
+        transport_flags = block_cbor::convert_transport_flags(*sig.qr_transport_flags, file_format_version_);
+    else
+        transport_flags = defaults_->transport;
+
+    uint8_t family = ( transport_flags && ( *transport_flags & block_cbor::IPV6 ) )
+        ? MATCH_IPV6 : MATCH_IPV4;
+
+    if ( !transports_.empty() &&
+         ( !transport_flags ||
+           !contains(transports_, *transport_flags & TRANSPORT_MASK) ) )
+        return 0;
+
+    if ( !rcodes_.empty() )
+    {
+        boost::optional<uint16_t> rcode;
+        if ( sig.response_rcode )
+            rcode = *sig.response_rcode;
+        else if ( defaults_->response_rcode )
+            rcode = *defaults_->response_rcode;
+
+        if ( !rcode || !contains(rcodes_, *rcode) )
+            return 0;
+    }
+
+    if ( !qtypes_.empty() )
+    {
+        bool match = ( sig.query_classtype )
+            ? match_at(qtype_matches_, position(*sig.query_classtype))
+            : default_qtype_;
+        if ( !match )
+            return 0;
+    }
+
+    if ( !server_prefixes_.empty() )
+    {
+        uint8_t match = ( sig.server_address )
+            ? match_at(server_matches_, position(*sig.server_address))
+            : default_server_;
+        if ( !( match & family ) )
+            return 0;
+    }
+
+    return family;
+}
+
+bool QueryResponseFilter::select_block(const block_cbor::BlockData& block,
+                                       const block_cbor::StorageParameters& sp,
+                                       const Defaults& defaults,
+                                       block_cbor::FileFormatVersion file_version)
+{
+    defaults_ = &defaults;
+    file_format_version_ = file_version;
+    blocks_read_++;
+
+    // Indexes in older formats are 1-based.
+    std::size_t base = ( file_version < block_cbor::FileFormatVersion::format_10 ) ? 1 : 0;
+    bool any;
+
+    client_matches_.clear();
+    server_matches_.clear();
+    if ( !client_prefixes_.empty() || !server_prefixes_.empty() )
+    {
+        bool any_client = false;
+        bool any_server = false;
+
+        default_client_ = match_default_address(defaults.client_address, client_prefixes_);
+        default_server_ = match_default_address(defaults.server_address, server_prefixes_);
+
+        for ( std::size_t i = 0; i < block.ip_addresses.size(); ++i )
+        {
+            const byte_string& addr = block.ip_addresses[i + base].str;
+
+            if ( !client_prefixes_.empty() )
+            {
+                uint8_t m = match_stored_address(addr,
+                                                 sp.client_address_prefix_ipv4,
+                                                 sp.client_address_prefix_ipv6,
+                                                 client_prefixes_);
+                client_matches_.push_back(m);
+                any_client = any_client || m != 0;
+            }
+
+            if ( !server_prefixes_.empty() )
+            {
+                uint8_t m = match_stored_address(addr,
+                                                 sp.server_address_prefix_ipv4,
+                                                 sp.server_address_prefix_ipv6,
+                                                 server_prefixes_);
+                server_matches_.push_back(m);
+                any_server = any_server || m != 0;
+            }
+        }
+
+        if ( ( !client_prefixes_.empty() && !any_client && !default_client_ ) ||
+             ( !server_prefixes_.empty() && !any_server && !default_server_ ) )
+        {
+            blocks_skipped_++;
+            return false;
+        }
+    }
+
+    qname_matches_.clear();
+    if ( !qname_suffixes_.empty() )
+    {
+        default_qname_ = defaults.query_name && match_qname(*defaults.query_name);
+        any = default_qname_;
+
+        for ( std::size_t i = 0; i < block.names_rdatas.size(); ++i )
+        {
+            bool m = match_qname(block.names_rdatas[i + base].str);
+            qname_matches_.push_back(m);
+            any = any || m;
+        }
+
+        if ( !any )
+        {
+            blocks_skipped_++;
+            return false;
+        }
+    }
+
+    qtype_matches_.clear();
+    if ( !qtypes_.empty() )
+    {
+        default_qtype_ = defaults.query_type && contains(qtypes_, *defaults.query_type);
+        any = default_qtype_;
+
+        for ( std::size_t i = 0; i < block.class_types.size(); ++i )
+        {
+            const block_cbor::ClassType& ct = block.class_types[i + base];
+            bool m = ct.qtype && contains(qtypes_, *ct.qtype);
+            qtype_matches_.push_back(m);
+            any = any || m;
+        }
+
+        if ( !any )
+        {
+            blocks_skipped_++;
+            return false;
+        }
+    }
+
+    signature_matches_.clear();
+    default_signature_ = match_signature(block_cbor::QueryResponseSignature());
+    any = ( default_signature_ != 0 );
+    for ( std::size_t i = 0; i < block.query_response_signatures.size(); ++i )
+    {
+        uint8_t m = match_signature(block.query_response_signatures[i + base]);
+        signature_matches_.push_back(m);
+        any = any || m != 0;
+    }
+
+    if ( !any )
+    {
+        blocks_skipped_++;
+        return false;
+    }
+
+    return true;
+}
+
+bool QueryResponseFilter::accept(const block_cbor::QueryResponseItem& qri)
+{
+    items_read_++;
+
+    uint8_t family = ( qri.signature )
+        ? match_at(signature_matches_, position(*qri.signature))
+        : default_signature_;
+    if ( !family )
+        return false;
+
+    if ( !client_prefixes_.empty() )
+    {
+        uint8_t match = ( qri.client_address )
+            ? match_at(client_matches_, position(*qri.client_address))
+            : default_client_;
+        if ( !( match & family ) )
+            return false;
+    }
+
+    if ( !qname_suffixes_.empty() )
+    {
+        bool match = ( qri.qname )
+            ? match_at(qname_matches_, position(*qri.qname))
+            : default_qname_;
+        if ( !match )
+            return false;
+    }
+
+    items_accepted_++;
+    return true;
+}
+
+void QueryResponseFilter::dump_stats(std::ostream& os) const
+{
+    os << "Filter: " << blocks_skipped_ << " of " << blocks_read_
+       << " blocks skipped, " << items_accepted_ << " of " << items_read_
+       << " q/r pairs in remaining blocks selected.\n";
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef QRFILTER_HPP
+#define QRFILTER_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "blockcbor.hpp"
+#include "blockcbordata.hpp"
+#include "bytestring.hpp"
+#include "configuration.hpp"
+#include "ipaddress.hpp"
+
+/**
+ * \class QueryResponseFilter
+ * \brief Select query/response items from C-DNS blocks.
+ *
+ * Filter criteria are not evaluated against individual query/response
+ * items. Instead, when a block is read, each criterion is evaluated
+ * once against the relevant block table (addresses, names, class/types
+ * and query/response signatures), giving a vector of flags indexed by
+ * table index. An item is then accepted or rejected by looking up
+ * its table indexes. If no table entry can match, the whole block
+ * is skipped.
+ *
+ * Multiple values given for a single criterion are alternatives; an
+ * item must match all criteria given.
+ */
+class QueryResponseFilter
+{
+public:
+    /**
+     * \brief Default constructor.
+     */
+    QueryResponseFilter()
+        : blocks_read_(0), blocks_skipped_(0),
+          items_read_(0), items_accepted_(0),
+          defaults_(nullptr),
+          file_format_version_(block_cbor::FileFormatVersion::format_10),
+          default_client_(0), default_server_(0),
+          default_qname_(false), default_qtype_(false),
+          default_signature_(0) {}
+
+    /**
+     * \brief Add a client address prefix.
+     *
+     * \param prefix the prefix, as `<address>[/<length>]`.
+     * \throws boost::program_options::error if the prefix is invalid.
+     */
+    void add_client_prefix(const std::string& prefix);
+
+    /**
+     * \brief Add a server address prefix.
+     *
+     * \param prefix the prefix, as `<address>[/<length>]`.
+     * \throws boost::program_options::error if the prefix is invalid.
+     */
+    void add_server_prefix(const std::string& prefix);
+
+    /**
+     * \brief Add a query name suffix.
+     *
+     * The suffix matches whole labels only, ignoring case.
+     *
+     * \param suffix the name suffix, e.g. `example.com`.
+     */
+    void add_qname_suffix(const std::string& suffix);
+
+    /**
+     * \brief Add a query type.
+     *
+     * \param qtype the query type name or value.
+     * \throws boost::program_options::error if the type is not recognised.
+     */
+    void add_qtype(const std::string& qtype);
+
+    /**
+     * \brief Add a response RCODE.
+     *
+     * \param rcode the RCODE name or value.
+     * \throws boost::program_options::error if the RCODE is not recognised.
+     */
+    void add_rcode(const std::string& rcode);
+
+    /**
+     * \brief Add a transport.
+     *
+     * \param transport `udp`, `tcp`, `tls`, `dtls` or `doh`.
+     * \throws boost::program_options::error if the transport is not recognised.
+     */
+    void add_transport(const std::string& transport);
+
+    /**
+     * \brief Are there any filter criteria?
+     *
+     * \returns `true` if no criteria are set, and so everything matches.
+     */
+    bool empty() const
+    {
+        return client_prefixes_.empty() && server_prefixes_.empty() &&
+            qname_suffixes_.empty() && qtypes_.empty() &&
+            rcodes_.empty() && transports_.empty();
+    }
+
+    /**
+     * \brief Evaluate the filter against the tables of a new block.
+     *
+     * \param block            the block.
+     * \param sp               storage parameters for the block.
+     * \param defaults         default values for items not in the block.
+     * \param file_version     the file format version.
+     * \returns `false` if no item in the block can match.
+     */
+    bool select_block(const block_cbor::BlockData& block,
+                      const block_cbor::StorageParameters& sp,
+                      const Defaults& defaults,
+                      block_cbor::FileFormatVersion file_version);
+
+    /**
+     * \brief Determine if an item in the current block matches.
+     *
+     * \param qri the query/response item.
+     * \returns `true` if the item matches.
+     */
+    bool accept(const block_cbor::QueryResponseItem& qri);
+
+    /**
+     * \brief Dump filter statistics to the stream provided.
+     *
+     * \param os output stream.
+     */
+    void dump_stats(std::ostream& os) const;
+
+private:
+    /**
+     * \struct AddressPrefix
+     * \brief An address prefix to match.
+     */
+    struct AddressPrefix
+    {
+        /**
+         * \brief the address in network binary format.
+         */
+        byte_string addr;
+
+        /**
+         * \brief the prefix length in bits.
+         */
+        unsigned len;
+    };
+
+    /**
+     * \brief Address match flags.
+     *
+     * Addresses in the block may be truncated, and so whether they
+     * are IPv4 or IPv6 may only be known via the transport flags
+     * in the signature. So record matches for each possibility.
+     */
+    enum AddressMatch
+    {
+        MATCH_IPV4 = (1 << 0),
+        MATCH_IPV6 = (1 << 1)
+    };
+
+    /**
+     * \brief Parse an address prefix.
+     *
+     * \param prefix the prefix, as `<address>[/<length>]`.
+     * \returns the prefix.
+     * \throws boost::program_options::error if the prefix is invalid.
+     */
+    static AddressPrefix parse_prefix(const std::string& prefix);
+
+    /**
+     * \brief Match an address against a list of prefixes.
+     *
+     * \param addr     the address, possibly truncated.
+     * \param ipv6     `true` if the address is to be treated as IPv6.
+     * \param prefixes the prefixes.
+     * \returns `true` if the address is in any of the prefixes.
+     */
+    static bool match_address(const byte_string& addr, bool ipv6,
+                              const std::vector<AddressPrefix>& prefixes);
+
+    /**
+     * \brief Match a stored address against a list of prefixes.
+     *
+     * \param addr       the address, possibly truncated.
+     * \param ipv4_prefix address prefix length stored for IPv4.
+     * \param ipv6_prefix address prefix length stored for IPv6.
+     * \param prefixes   the prefixes.
+     * \returns a combination of AddressMatch flags.
+     */
+    static uint8_t match_stored_address(const byte_string& addr,
+                                        unsigned ipv4_prefix,
+                                        unsigned ipv6_prefix,
+                                        const std::vector<AddressPrefix>& prefixes);
+
+    /**
+     * \brief Match an address supplied as a default value.
+     *
+     * \param addr     the address.
+     * \param prefixes the prefixes.
+     * \returns a combination of AddressMatch flags.
+     */
+    static uint8_t match_default_address(const boost::optional<IPAddress>& addr,
+                                         const std::vector<AddressPrefix>& prefixes);
+
+    /**
+     * \brief Match a name against the list of suffixes.
+     *
+     * \param name the name in label format.
+     * \returns `true` if the name ends with any suffix.
+     */
+    bool match_qname(const byte_string& name) const;
+
+    /**
+     * \brief Match a signature against the signature criteria.
+     *
+     * \param sig the query/response signature.
+     * \returns a combination of AddressMatch flags, giving the
+     * client address family if the signature matches, or 0 if not.
+     */
+    uint8_t match_signature(const block_cbor::QueryResponseSignature& sig) const;
+
+    /**
+     * \brief Convert a raw table index to a position in a match vector.
+     *
+     * \param index the raw table index.
+     * \returns the position.
+     */
+    std::size_t position(std::size_t index) const
+    {
+        return ( file_format_version_ < block_cbor::FileFormatVersion::format_10 )
+            ? index - 1 : index;
+    }
+
+    /**
+     * \brief client address prefixes.
+     */
+    std::vector<AddressPrefix> client_prefixes_;
+
+    /**
+     * \brief server address prefixes.
+     */
+    std::vector<AddressPrefix> server_prefixes_;
+
+    /**
+     * \brief query name suffixes, in lower case label format.
+     */
+    std::vector<byte_string> qname_suffixes_;
+
+    /**
+     * \brief query types.
+     */
+    std::vector<unsigned> qtypes_;
+
+    /**
+     * \brief response RCODEs.
+     */
+    std::vector<unsigned> rcodes_;
+
+    /**
+     * \brief transports, as transport flag values.
+     */
+    std::vector<unsigned> transports_;
+
+    /**
+     * \brief number of blocks examined.
+     */
+    uint64_t blocks_read_;
+
+    /**
+     * \brief number of blocks skipped.
+     */
+    uint64_t blocks_skipped_;
+
+    /**
+     * \brief number of items examined.
+     */
+    uint64_t items_read_;
+
+    /**
+     * \brief number of items accepted.
+     */
+    uint64_t items_accepted_;
+
+    /**
+     * \brief the defaults for the current block.
+     */
+    const Defaults* defaults_;
+
+    /**
+     * \brief the file format version.
+     */
+    block_cbor::FileFormatVersion file_format_version_;
+
+    /**
+     * \brief client address matches, by address table position.
+     */
+    std::vector<uint8_t> client_matches_;
+
+    /**
+     * \brief server address matches, by address table position.
+     */
+    std::vector<uint8_t> server_matches_;
+
+    /**
+     * \brief query name matches, by name table position.
+     */
+    std::vector<bool> qname_matches_;
+
+    /**
+     * \brief query type matches, by class/type table position.
+     */
+    std::vector<bool> qtype_matches_;
+
+    /**
+     * \brief signature matches, by signature table position.
+     */
+    std::vector<uint8_t> signature_matches_;
+
+    /**
+     * \brief match of default client address.
+     */
+    uint8_t default_client_;
+
+    /**
+     * \brief match of default server address.
+     */
+    uint8_t default_server_;
+
+    /**
+     * \brief match of default query name.
+     */
+    bool default_qname_;
+
+    /**
+     * \brief match of default query type.
+     */
+    bool default_qtype_;
+
+    /**
+     * \brief match of items with no signature.
+     */
+    uint8_t default_signature_;
+};
+
+#endif
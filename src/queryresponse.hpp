@@ -120,6 +120,17 @@ public:
             throw queryresponse_match_error();
     }
 
+    /**
+     * \brief Return the approximate memory used by the pair's messages.
+     *
+     * \returns the approximate size in bytes.
+     */
+    std::size_t memory_size() const
+    {
+        return ( query_ ? query_->memory_size() : 0 ) +
+            ( response_ ? response_->memory_size() : 0 );
+    }
+
     /**
      * \brief Write basic information on the pair to the output stream.
      *
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+
+#include "sampler.hpp"
+
+namespace {
+    /**
+     * \brief FNV-1a 64 bit offset basis.
+     */
+    const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+
+    /**
+     * \brief FNV-1a 64 bit prime.
+     */
+    const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+    /**
+     * \brief Add bytes to a FNV-1a hash.
+     *
+     * \param h    the hash so far.
+     * \param data the data.
+     * \param len  the data length.
+     * \returns the updated hash.
+     */
+    uint64_t hash_bytes(uint64_t h, const uint8_t* data, std::size_t len)
+    {
+        for ( std::size_t i = 0; i < len; ++i )
+        {
+            h ^= data[i];
+            h *= FNV_PRIME;
+        }
+        return h;
+    }
+
+    /**
+     * \brief Finalise a hash.
+     *
+     * FNV-1a low bits are poorly distributed for short inputs, and
+     * the rate is applied as a modulus, so mix all bits into the
+     * low bits.
+     *
+     * \param h the hash.
+     * \returns the finalised hash.
+     */
+    uint64_t finalise(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+}
+
+Sampler::Method Sampler::find_method(const std::string& name)
+{
+    if ( name == "packet" )
+        return Method::PACKET;
+    else if ( name == "transaction" )
+        return Method::TRANSACTION;
+    else if ( name == "client" )
+        return Method::CLIENT;
+    throw std::invalid_argument("unknown sampling method " + name);
+}
+
+Sampler::Sampler(Method method, unsigned ipv4_prefix, unsigned ipv6_prefix)
+    : method_(method),
+      ipv4_prefix_(std::min(ipv4_prefix, 32u)),
+      ipv6_prefix_(std::min(ipv6_prefix, 128u)),
+      rate_(0)
+{
+}
+
+bool Sampler::keep(const IPAddress& client, uint16_t client_port, uint16_t id) const
+{
+    if ( rate_ == 0 )
+        return true;
+
+    bool whole_address = ( method_ != Method::CLIENT );
+    uint64_t h = FNV_OFFSET;
+
+    if ( client.is_ipv6() )
+    {
+        Tins::IPv6Address addr6(client);
+        uint8_t addr[Tins::IPv6Address::address_size];
+        std::copy(addr6.begin(), addr6.end(), addr);
+
+        if ( !whole_address )
+        {
+            unsigned nbytes = (ipv6_prefix_ + 7) / 8;
+            std::fill(addr + nbytes, addr + sizeof(addr), 0);
+            if ( nbytes > 0 )
+                addr[nbytes - 1] &= 0xff << (nbytes * 8 - ipv6_prefix_);
+        }
+        h = hash_bytes(h, addr, sizeof(addr));
+    }
+    else
+    {
+        uint32_t a4 = ntohl(static_cast<uint32_t>(Tins::IPv4Address(client)));
+        if ( !whole_address )
+            a4 = ( ipv4_prefix_ == 0 ) ? 0 : a4 & (0xffffffffU << (32 - ipv4_prefix_));
+        uint8_t addr[4] = {
+            static_cast<uint8_t>(a4 >> 24), static_cast<uint8_t>(a4 >> 16),
+            static_cast<uint8_t>(a4 >> 8), static_cast<uint8_t>(a4)
+        };
+        h = hash_bytes(h, addr, sizeof(addr));
+    }
+
+    if ( whole_address )
+    {
+        uint8_t port_id[4] = {
+            static_cast<uint8_t>(client_port >> 8), static_cast<uint8_t>(client_port),
+            static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id)
+        };
+        h = hash_bytes(h, port_id, sizeof(port_id));
+    }
+
+    return finalise(h) % rate_ == 0;
+}
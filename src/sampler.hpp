@@ -0,0 +1,154 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "ipaddress.hpp"
+
+/**
+ * \class Sampler
+ * \brief Decide which traffic to keep when sampling is active.
+ *
+ * Sampling keeps 1 in <i>rate</i> of the traffic. With the
+ * <code>PACKET</code> method, every <i>rate</i>th packet is kept
+ * regardless of content. The other methods decide on a hash of
+ * the DNS message, so that a query and its response are always
+ * kept or discarded together. <code>TRANSACTION</code> hashes the
+ * client address, client port and DNS message ID. <code>CLIENT</code>
+ * hashes the client address prefix, so all traffic from a sampled
+ * client network is kept.
+ */
+class Sampler
+{
+public:
+    /**
+     * \enum Method
+     * \brief The sampling methods.
+     */
+    enum class Method
+    {
+        PACKET,
+        TRANSACTION,
+        CLIENT,
+    };
+
+    /**
+     * \brief Find a sampling method by name.
+     *
+     * \param name the method name.
+     * \returns the method.
+     * \throws std::invalid_argument if the name is not recognised.
+     */
+    static Method find_method(const std::string& name);
+
+    /**
+     * \brief Constructor.
+     *
+     * Sampling is initially inactive.
+     *
+     * \param method      the sampling method.
+     * \param ipv4_prefix prefix length of client IPv4 addresses for
+     *                    the <code>CLIENT</code> method.
+     * \param ipv6_prefix prefix length of client IPv6 addresses for
+     *                    the <code>CLIENT</code> method.
+     */
+    Sampler(Method method, unsigned ipv4_prefix, unsigned ipv6_prefix);
+
+    /**
+     * \brief Set the sampling rate.
+     *
+     * \param rate keep 1 in <code>rate</code>, or 0 to stop sampling.
+     */
+    void set_rate(unsigned rate)
+    {
+        rate_ = rate;
+    }
+
+    /**
+     * \brief Return the sampling rate.
+     *
+     * \returns the sampling rate, or 0 if sampling is not active.
+     */
+    unsigned rate() const
+    {
+        return rate_;
+    }
+
+    /**
+     * \brief Determine if sampling is active and applied to packets.
+     *
+     * \returns <code>true</code> if packets are to be sampled.
+     */
+    bool by_packet() const
+    {
+        return rate_ > 0 && method_ == Method::PACKET;
+    }
+
+    /**
+     * \brief Determine if sampling is active and applied to DNS messages.
+     *
+     * \returns <code>true</code> if DNS messages are to be sampled.
+     */
+    bool by_message() const
+    {
+        return rate_ > 0 && method_ != Method::PACKET;
+    }
+
+    /**
+     * \brief Determine whether to keep a packet.
+     *
+     * \param packet_count the number of packets received so far.
+     * \returns <code>true</code> if the packet is to be kept.
+     */
+    bool keep(uint64_t packet_count) const
+    {
+        return rate_ == 0 || packet_count % rate_ == 0;
+    }
+
+    /**
+     * \brief Determine whether to keep a DNS message.
+     *
+     * \param client      the client address.
+     * \param client_port the client port.
+     * \param id          the DNS message ID.
+     * \returns <code>true</code> if the message is to be kept.
+     */
+    bool keep(const IPAddress& client, uint16_t client_port, uint16_t id) const;
+
+private:
+    /**
+     * \brief the sampling method.
+     */
+    Method method_;
+
+    /**
+     * \brief client IPv4 address prefix length.
+     */
+    unsigned ipv4_prefix_;
+
+    /**
+     * \brief client IPv6 address prefix length.
+     */
+    unsigned ipv6_prefix_;
+
+    /**
+     * \brief the current sampling rate, or 0 if not sampling.
+     */
+    unsigned rate_;
+};
+
+#endif
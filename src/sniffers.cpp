@@ -11,6 +11,7 @@
  */
 
 #include <errno.h>
+#include <sys/time.h>
 
 #include <tins/loopback.h>
 #include <tins/pktap.h>
@@ -21,13 +22,18 @@
 #endif
 
 #include "log.hpp"
+#include "makeunique.hpp"
+#include "stagetimes.hpp"
 #include "util.hpp"
 
 #include "sniffers.hpp"
 
 SniffersConfiguration::SniffersConfiguration()
     : flags_(0), snap_len_(65535), promisc_(false),
-      timeout_(1000), chan_max_size_(1000)
+      timeout_(1000), chan_max_size_(1000), keep_frames_(false)
+#if ENABLE_XDP
+    , xdp_dns_port_(53), xdp_generic_mode_(false)
+#endif
 {
 }
 
@@ -56,7 +62,7 @@ void SniffersConfiguration::apply_filter(pcap_t* handle, bpf_u_int32 netmask) co
     {
         bpf_program prog;
 
-        if ( pcap_compile(handle, &prog, filter_.c_str(), 0, netmask) != 0 )
+        if ( pcap_compile(handle, &prog, filter_.c_str(), 1, netmask) != 0 )
             throw Tins::invalid_pcap_filter(pcap_geterr(handle));
 
         int set_res = pcap_setfilter(handle, &prog);
@@ -69,6 +75,12 @@ void SniffersConfiguration::apply_filter(pcap_t* handle, bpf_u_int32 netmask) co
 namespace {
     const Tins::Packet::own_pdu DONT_COPY_PDU = {};
 
+#if ENABLE_XDP
+    // Maximum frames to take from each AF_XDP queue before
+    // checking other inputs.
+    const unsigned XDP_BATCH_SIZE = 64;
+#endif
+
     template<typename T>
     Tins::Packet make_generic_packet(const struct pcap_pkthdr* hdr,
                                         const u_char* data)
@@ -85,11 +97,11 @@ namespace {
             return Tins::Packet(new Tins::EthernetII(reinterpret_cast<const uint8_t*>(data), hdr->caplen), hdr->ts, DONT_COPY_PDU);
     }
 
-    Tins::Packet make_packet(pcap_t* handle,
+    Tins::Packet make_packet(int linktype,
                              const struct pcap_pkthdr* hdr,
                              const u_char* data)
     {
-        switch(pcap_datalink(handle))
+        switch(linktype)
         {
         case DLT_EN10MB:
             return make_eth_packet(hdr, data);
@@ -131,11 +143,24 @@ namespace {
     }
 }
 
-BaseSniffers::BaseSniffers(unsigned chan_max_size, bool block)
+BaseSniffers::BaseSniffers(unsigned chan_max_size, bool block,
+                           std::shared_ptr<MemoryBudget> budget,
+                           bool keep_frames)
     : max_fd_(0), select_timeout_(1000), packets_(chan_max_size),
-      block_put_(block), packets_sniffed_(0), packets_dropped_(0)
+      block_put_(block), break_(false), packets_sniffed_(0), packets_dropped_(0)
 {
     FD_ZERO(&fdset_);
+    if ( keep_frames )
+        frame_pool_ = PcapFramePool::create();
+    if ( budget )
+        packets_.set_memory_budget(
+            budget, MemoryBudget::Stage::SNIFFER,
+            [](const SniffedPacket& p)
+            {
+                return sizeof(SniffedPacket) +
+                    ( p.packet.pdu() ? p.packet.pdu()->size() : 0 ) +
+                    ( p.frame ? p.frame->memory_size() : 0 );
+            });
 }
 
 BaseSniffers::~BaseSniffers()
@@ -150,12 +175,26 @@ BaseSniffers::~BaseSniffers()
 
 Tins::Packet BaseSniffers::next_packet()
 {
-    Tins::Packet p;
+    std::shared_ptr<PcapFrame> frame;
+    return next_packet(frame);
+}
+
+Tins::Packet BaseSniffers::next_packet(std::shared_ptr<PcapFrame>& frame)
+{
+    SniffedPacket p;
 
     if ( packets_.get(p) )
-        return p;
+    {
+        if ( p.queued )
+            StageTimes::record_between(StageTimes::Stage::SNIFFER_QUEUE, p.queued, StageTimes::now());
+        frame = std::move(p.frame);
+        return std::move(p.packet);
+    }
     else
+    {
+        frame.reset();
         return Tins::Packet();
+    }
 }
 
 void BaseSniffers::sniffer_stats(struct Stats& stats)
@@ -186,11 +225,22 @@ bool BaseSniffers::pcap_stats(struct pcap_stat& stats)
             res = false;
     }
 
+#if ENABLE_XDP
+    for ( const auto& x : xdp_ )
+    {
+        uint64_t recv, drop;
+        x->stats(recv, drop);
+        stats.ps_recv += recv;
+        stats.ps_drop += drop;
+    }
+#endif
+
     return res;
 }
 
 void BaseSniffers::breakloop()
 {
+    break_ = true;
     std::unique_lock<std::mutex> lock(m_);
     for ( auto h : handles_ )
         pcap_breakloop(h);
@@ -209,6 +259,20 @@ void BaseSniffers::add_handle(pcap_t* handle)
         max_fd_ = fd;
 }
 
+#if ENABLE_XDP
+void BaseSniffers::add_xdp(std::unique_ptr<XdpCapture> xdp)
+{
+    for ( int fd : xdp->fds() )
+    {
+        FD_SET(fd, &fdset_);
+        if ( fd > max_fd_ )
+            max_fd_ = fd;
+    }
+
+    xdp_.push_back(std::move(xdp));
+}
+#endif
+
 void BaseSniffers::notify_read_timeout(unsigned timeout)
 {
     if ( select_timeout_ < timeout )
@@ -240,21 +304,7 @@ void BaseSniffers::packet_read_thread()
                 {
                 case 1:
                     read_one = true;
-                    ++packets_sniffed_;
-                    try
-                    {
-                        if ( !packets_.put(make_packet(h, hdr, data), block_put_) )
-                            ++packets_dropped_;
-                    }
-                    catch (Tins::exception_base&)
-                    {
-                        // Unlike libtins, which just ignores them, pass malformed
-                        // packets - packets where transport level decode fails -
-                        // back to the application as RawPDU. There they will be
-                        // treated as ignored and logged if appropriate.
-                        if ( !packets_.put(Tins::Packet(new Tins::RawPDU(reinterpret_cast<const uint8_t*>(data), hdr->caplen), hdr->ts, DONT_COPY_PDU), block_put_) )
-                            ++packets_dropped_;
-                    }
+                    put_packet(pcap_datalink(h), hdr, data);
                     break;
 
                 case 0:
@@ -272,9 +322,29 @@ void BaseSniffers::packet_read_thread()
                     break;
                 }
             }
+
+#if ENABLE_XDP
+            for ( auto& x : xdp_ )
+            {
+                // AF_XDP gives no timestamp, so use time of receipt.
+                struct pcap_pkthdr hdr;
+                gettimeofday(&hdr.ts, nullptr);
+
+                if ( x->receive(
+                         [&](const uint8_t* data, uint32_t len)
+                         {
+                             hdr.caplen = hdr.len = len;
+                             put_packet(DLT_EN10MB, &hdr, data);
+                         }, XDP_BATCH_SIZE) > 0 )
+                    read_one = true;
+            }
+#endif
         }
         while ( read_one && !finished );
 
+        if ( break_ )
+            finished = true;
+
         if ( finished )
             continue;
 
@@ -317,6 +387,44 @@ void BaseSniffers::packet_read_thread()
     packets_.close();
 }
 
+void BaseSniffers::put_packet(int linktype, const struct pcap_pkthdr* hdr, const u_char* data)
+{
+    ++packets_sniffed_;
+
+    SniffedPacket p;
+    uint64_t start = StageTimes::enabled() ? StageTimes::now() : 0;
+    try
+    {
+        p.packet = make_packet(linktype, hdr, data);
+    }
+    catch (Tins::exception_base&)
+    {
+        // Unlike libtins, which just ignores them, pass malformed
+        // packets - packets where transport level decode fails -
+        // back to the application as RawPDU. There they will be
+        // treated as ignored and logged if appropriate.
+        p.packet = Tins::Packet(new Tins::RawPDU(reinterpret_cast<const uint8_t*>(data), hdr->caplen), hdr->ts, DONT_COPY_PDU);
+    }
+
+    // Keep the frame as captured, so PCAP output doesn't have to
+    // re-serialise the decoded packet.
+    if ( frame_pool_ )
+        p.frame = frame_pool_->make_frame(linktype,
+                                          static_cast<uint32_t>(hdr->ts.tv_sec),
+                                          static_cast<uint32_t>(hdr->ts.tv_usec),
+                                          hdr->caplen, hdr->len,
+                                          reinterpret_cast<const uint8_t*>(data));
+
+    if ( start )
+    {
+        p.queued = StageTimes::now();
+        StageTimes::record(StageTimes::Stage::DECODE, p.queued - start);
+    }
+
+    if ( !packets_.put(std::move(p), block_put_) )
+        ++packets_dropped_;
+}
+
 void BaseSniffers::capture_init_done()
 {
     t_ = std::thread([=]{ packet_read_thread(); });
@@ -324,12 +432,23 @@ void BaseSniffers::capture_init_done()
 
 NetworkSniffers::NetworkSniffers(const std::vector<std::string>& interfaces,
                                  const SniffersConfiguration& config)
-    : BaseSniffers(config.chan_max_size())
+    : BaseSniffers(config.chan_max_size(), false, config.memory_budget(),
+                   config.keep_frames())
 {
     notify_read_timeout(config.timeout_);
 
     for ( const auto& i : interfaces )
     {
+#if ENABLE_XDP
+        if ( config.use_xdp(i) )
+        {
+            if ( config.flags_ & SniffersConfiguration::PACKET_FILTER )
+                LOG_WARN << "Packet filter not applied to AF_XDP interface " << i;
+            add_xdp(make_unique<XdpCapture>(i, config.xdp_dns_port_, config.xdp_generic_mode_));
+            continue;
+        }
+#endif
+
         char errbuf[PCAP_ERRBUF_SIZE];
         bpf_u_int32 ip, netmask;
         if ( pcap_lookupnet(i.c_str(), &ip, &netmask, errbuf) == -1 )
@@ -359,7 +478,8 @@ NetworkSniffers::NetworkSniffers(const std::vector<std::string>& interfaces,
 
 FileSniffer::FileSniffer(const std::string& fname,
                          const SniffersConfiguration& config)
-    : BaseSniffers(config.chan_max_size(), true)
+    : BaseSniffers(config.chan_max_size(), true, config.memory_budget(),
+                   config.keep_frames())
 {
     char errbuf[PCAP_ERRBUF_SIZE];
     pcap_t* handle = pcap_open_offline(fname.c_str(), errbuf);
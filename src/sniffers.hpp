@@ -13,6 +13,9 @@
 #ifndef SNIFFERS_HPP
 #define SNIFFERS_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -26,6 +29,9 @@
 
 #include "channel.hpp"
 #include "configuration.hpp"
+#include "memorybudget.hpp"
+#include "pcapframe.hpp"
+#include "xdpcapture.hpp"
 
 /**
  * \class SniffersConfiguration
@@ -121,6 +127,35 @@ public:
         return filter_;
     }
 
+#if ENABLE_XDP
+    /**
+     * \brief Set AF_XDP capture.
+     *
+     * \param interfaces   the interfaces to capture with AF_XDP.
+     * \param dns_port     the DNS port.
+     * \param generic_mode use generic (SKB) XDP rather than native.
+     */
+    void set_xdp(const std::vector<std::string>& interfaces,
+                 unsigned dns_port, bool generic_mode)
+    {
+        xdp_interfaces_ = interfaces;
+        xdp_dns_port_ = dns_port;
+        xdp_generic_mode_ = generic_mode;
+    }
+
+    /**
+     * \brief Should the interface be captured with AF_XDP?
+     *
+     * \param interface the interface.
+     * \returns `true` if the interface should use AF_XDP.
+     */
+    bool use_xdp(const std::string& interface) const
+    {
+        return std::find(xdp_interfaces_.begin(), xdp_interfaces_.end(),
+                         interface) != xdp_interfaces_.end();
+    }
+#endif
+
     /**
      * \brief Set the channel maximum size
      *
@@ -141,6 +176,46 @@ public:
         return chan_max_size_;
     }
 
+    /**
+     * \brief Set the memory budget for the channel.
+     *
+     * \param budget the memory budget.
+     */
+    void set_memory_budget(std::shared_ptr<MemoryBudget> budget)
+    {
+        memory_budget_ = budget;
+    }
+
+    /**
+     * \brief Return the memory budget for the channel.
+     *
+     * \returns the memory budget, if any.
+     */
+    std::shared_ptr<MemoryBudget> memory_budget() const
+    {
+        return memory_budget_;
+    }
+
+    /**
+     * \brief Set whether to keep the captured frame of each packet.
+     *
+     * \param keep `true` if captured frames are to be kept.
+     */
+    void set_keep_frames(bool keep)
+    {
+        keep_frames_ = keep;
+    }
+
+    /**
+     * \brief Return whether to keep the captured frame of each packet.
+     *
+     * \returns `true` if captured frames are to be kept.
+     */
+    bool keep_frames() const
+    {
+        return keep_frames_;
+    }
+
 protected:
     friend class NetworkSniffers;
     friend class FileSniffer;
@@ -213,6 +288,33 @@ private:
      * \brief Channel maximum size.
      */
     unsigned chan_max_size_;
+
+    /**
+     * \brief Channel memory budget.
+     */
+    std::shared_ptr<MemoryBudget> memory_budget_;
+
+    /**
+     * \brief Keep captured frames?
+     */
+    bool keep_frames_;
+
+#if ENABLE_XDP
+    /**
+     * \brief Interfaces to capture with AF_XDP.
+     */
+    std::vector<std::string> xdp_interfaces_;
+
+    /**
+     * \brief DNS port for AF_XDP capture.
+     */
+    unsigned xdp_dns_port_;
+
+    /**
+     * \brief Use generic XDP for AF_XDP capture?
+     */
+    bool xdp_generic_mode_;
+#endif
 };
 
 /**
@@ -252,9 +354,13 @@ public:
      *
      * \param chan_max_size maximum size of channel delivering packets.
      * \param block block when adding packets to processing queue.
+     * \param budget memory budget for channel delivering packets, if any.
+     * \param keep_frames keep the captured frame of each packet.
      */
     // SAMPLING
-    explicit BaseSniffers(unsigned chan_max_size = 1000, bool block = false);
+    explicit BaseSniffers(unsigned chan_max_size = 1000, bool block = false,
+                          std::shared_ptr<MemoryBudget> budget = nullptr,
+                          bool keep_frames = false);
     /**
      * \brief Destructor.
      */
@@ -268,6 +374,15 @@ public:
      */
     Tins::Packet next_packet();
 
+    /**
+     * \brief Get the next packet and its captured frame from the sniffers.
+     *
+     * \param frame set to the captured frame, or null if frames are not kept.
+     * \returns the next packet, or if EOF or collection interrupted
+     * a packet with a null PDU.
+     */
+    Tins::Packet next_packet(std::shared_ptr<PcapFrame>& frame);
+
     /**
      * \brief Get sniffer stats.
      *
@@ -298,6 +413,15 @@ protected:
      */
     void add_handle(pcap_t* handle);
 
+#if ENABLE_XDP
+    /**
+     * \brief Add a new AF_XDP capture to those being monitored.
+     *
+     * \param xdp capture to add.
+     */
+    void add_xdp(std::unique_ptr<XdpCapture> xdp);
+#endif
+
     /**
      * \brief Update the select timeout.
      *
@@ -320,11 +444,27 @@ private:
      */
     void packet_read_thread();
 
+    /**
+     * \brief Add a captured packet to the channel.
+     *
+     * \param linktype the packet link type.
+     * \param hdr      the packet header.
+     * \param data     the packet data.
+     */
+    void put_packet(int linktype, const struct pcap_pkthdr* hdr, const u_char* data);
+
     /**
      * \brief PCAP handles of all input sources.
      */
     std::vector<pcap_t*> handles_;
 
+#if ENABLE_XDP
+    /**
+     * \brief AF_XDP captures.
+     */
+    std::vector<std::unique_ptr<XdpCapture>> xdp_;
+#endif
+
     /**
      * \brief fdset for selecting on all input sources.
      */
@@ -340,10 +480,37 @@ private:
      */
     unsigned select_timeout_;
 
+    /**
+     * \struct SniffedPacket
+     * \brief A decoded packet and, if kept, its captured frame.
+     */
+    struct SniffedPacket
+    {
+        /**
+         * \brief the decoded packet.
+         */
+        Tins::Packet packet;
+
+        /**
+         * \brief the captured frame, if kept.
+         */
+        std::shared_ptr<PcapFrame> frame;
+
+        /**
+         * \brief when the packet was queued, if stage timing is enabled.
+         */
+        uint64_t queued = 0;
+    };
+
     /**
      * \brief delivery channel for packets.
      */
-    Channel<Tins::Packet> packets_;
+    Channel<SniffedPacket> packets_;
+
+    /**
+     * \brief pool of captured frame buffers, if frames are kept.
+     */
+    std::shared_ptr<PcapFramePool> frame_pool_;
 
     /**
      * \brief mutex guarding PCAP handles.
@@ -360,6 +527,11 @@ private:
      */
     bool block_put_;
 
+    /**
+     * \brief break out of the collection loop?
+     */
+    std::atomic<bool> break_;
+
     /**
      * \brief count of packets sniffed.
      */
@@ -0,0 +1,356 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "config.h"
+
+#include "stagetimes.hpp"
+
+namespace {
+    /**
+     * \brief the size of a cache line.
+     */
+    constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+    /**
+     * \struct ThreadTimes
+     * \brief The histograms recorded by a single thread.
+     *
+     * Only the owning thread writes the counts, so they are updated
+     * with plain loads and stores. Other threads may read them at
+     * any time. Padding keeps the counts off cache lines used by
+     * any other data.
+     */
+    struct ThreadTimes
+    {
+        /**
+         * \brief Constructor.
+         */
+        ThreadTimes()
+        {
+            for ( auto& stage : counts )
+                for ( auto& c : stage )
+                    c.store(0, std::memory_order_relaxed);
+            for ( auto& s : sums )
+                s.store(0, std::memory_order_relaxed);
+        }
+
+        /**
+         * \brief Increment a count.
+         *
+         * \param c   the count.
+         * \param val the increment.
+         */
+        static void bump(std::atomic<uint64_t>& c, uint64_t val)
+        {
+            c.store(c.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+        }
+
+        /**
+         * \brief Add the counts into histograms.
+         *
+         * \param snapshot the histograms.
+         */
+        void add_to(StageTimes::Snapshot& snapshot) const
+        {
+            for ( std::size_t s = 0; s < StageTimes::STAGES; ++s )
+            {
+                snapshot[s].add(0, 0, sums[s].load(std::memory_order_relaxed));
+                for ( std::size_t b = 0; b < LatencyHistogram::BUCKETS; ++b )
+                {
+                    uint64_t n = counts[s][b].load(std::memory_order_relaxed);
+                    if ( n > 0 )
+                        snapshot[s].add(b, n, 0);
+                }
+            }
+        }
+
+        /**
+         * \brief padding before the counts.
+         */
+        char pad_before[CACHE_LINE_SIZE];
+
+        /**
+         * \brief the bucket counts for each stage.
+         */
+        std::array<std::array<std::atomic<uint64_t>, LatencyHistogram::BUCKETS>, StageTimes::STAGES> counts;
+
+        /**
+         * \brief the sum of values for each stage.
+         */
+        std::array<std::atomic<uint64_t>, StageTimes::STAGES> sums;
+
+        /**
+         * \brief padding after the counts.
+         */
+        char pad_after[CACHE_LINE_SIZE];
+    };
+
+    /**
+     * \brief protect the thread registry.
+     */
+    std::mutex registry_mutex;
+
+    /**
+     * \brief the histograms of running threads.
+     */
+    std::vector<std::shared_ptr<ThreadTimes>> running_threads;
+
+    /**
+     * \brief the combined histograms of threads that have exited.
+     */
+    StageTimes::Snapshot exited_threads;
+
+    /**
+     * \struct ThreadRegistration
+     * \brief Registers a thread's histograms while the thread runs.
+     *
+     * On thread exit, the histograms are folded into those of exited
+     * threads, so short lived threads don't accumulate.
+     */
+    struct ThreadRegistration
+    {
+        /**
+         * \brief Destructor.
+         */
+        ~ThreadRegistration()
+        {
+            if ( !times )
+                return;
+
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            times->add_to(exited_threads);
+            running_threads.erase(std::remove(running_threads.begin(), running_threads.end(), times),
+                                  running_threads.end());
+        }
+
+        /**
+         * \brief the thread's histograms.
+         */
+        std::shared_ptr<ThreadTimes> times;
+    };
+
+    /**
+     * \brief the current thread's registration.
+     */
+    thread_local ThreadRegistration registration;
+
+    /**
+     * \brief Return the current thread's histograms.
+     *
+     * \returns the histograms.
+     */
+    ThreadTimes& thread_times()
+    {
+        if ( !registration.times )
+        {
+            registration.times = std::make_shared<ThreadTimes>();
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            running_threads.push_back(registration.times);
+        }
+        return *registration.times;
+    }
+
+    /**
+     * \brief Format a time in microseconds.
+     *
+     * \param ns the time in nanoseconds.
+     * \returns the formatted time.
+     */
+    std::string format_us(uint64_t ns)
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << ns / 1000.0;
+        return oss.str();
+    }
+}
+
+constexpr unsigned LatencyHistogram::SUB_BUCKET_BITS;
+constexpr std::size_t LatencyHistogram::SUB_BUCKETS;
+constexpr std::size_t LatencyHistogram::BUCKETS;
+constexpr std::size_t StageTimes::STAGES;
+
+std::atomic<bool> StageTimes::enabled_(false);
+std::atomic<double> StageTimes::ns_per_tick_(1.0);
+
+uint64_t LatencyHistogram::count() const
+{
+    uint64_t res = 0;
+    for ( auto c : counts_ )
+        res += c;
+    return res;
+}
+
+double LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return ( n > 0 ) ? static_cast<double>(sum_) / n : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+    uint64_t n = count();
+    if ( n == 0 )
+        return 0;
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(n * percent / 100.0)));
+    uint64_t seen = 0;
+    for ( std::size_t b = 0; b < BUCKETS; ++b )
+    {
+        seen += counts_[b];
+        if ( seen >= rank )
+            return highest_value(b);
+    }
+    return max();
+}
+
+uint64_t LatencyHistogram::max() const
+{
+    for ( std::size_t b = BUCKETS; b > 0; --b )
+        if ( counts_[b - 1] > 0 )
+            return highest_value(b - 1);
+    return 0;
+}
+
+LatencyHistogram& LatencyHistogram::operator+=(const LatencyHistogram& rhs)
+{
+    for ( std::size_t b = 0; b < BUCKETS; ++b )
+        counts_[b] += rhs.counts_[b];
+    sum_ += rhs.sum_;
+    return *this;
+}
+
+LatencyHistogram& LatencyHistogram::operator-=(const LatencyHistogram& rhs)
+{
+    // Counts read from a running thread may be slightly behind, so
+    // never go below zero.
+    for ( std::size_t b = 0; b < BUCKETS; ++b )
+        counts_[b] -= std::min(counts_[b], rhs.counts_[b]);
+    sum_ -= std::min(sum_, rhs.sum_);
+    return *this;
+}
+
+void StageTimes::enable(bool enable)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // Calibrate once only. Other threads may be recording, for
+    // example after a reload.
+    static std::once_flag calibrated;
+    if ( enable )
+        std::call_once(calibrated, []()
+        {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t start_ticks = now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            auto end = std::chrono::steady_clock::now();
+            uint64_t end_ticks = now();
+
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            if ( end_ticks > start_ticks )
+                ns_per_tick_.store(static_cast<double>(ns) / ( end_ticks - start_ticks ),
+                                   std::memory_order_relaxed);
+        });
+#endif
+    enabled_.store(enable, std::memory_order_relaxed);
+}
+
+void StageTimes::record_ns(Stage stage, uint64_t ns)
+{
+    ThreadTimes& t = thread_times();
+    std::size_t s = static_cast<std::size_t>(stage);
+    ThreadTimes::bump(t.counts[s][LatencyHistogram::bucket(ns)], 1);
+    ThreadTimes::bump(t.sums[s], ns);
+}
+
+void StageTimes::record_since(Stage stage, const std::chrono::system_clock::time_point& timestamp)
+{
+    auto elapsed = std::chrono::system_clock::now() - timestamp;
+    if ( elapsed.count() >= 0 )
+        record_ns(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+StageTimes::Snapshot StageTimes::snapshot()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    Snapshot res = exited_threads;
+    for ( const auto& t : running_threads )
+        t->add_to(res);
+    return res;
+}
+
+const char* StageTimes::stage_name(Stage stage)
+{
+    switch ( stage )
+    {
+    case Stage::DECODE:         return "decode";
+    case Stage::SNIFFER_QUEUE:  return "sniffer-queue";
+    case Stage::PARSE:          return "parse";
+    case Stage::MATCH:          return "match";
+    case Stage::CDNS_QUEUE:     return "cdns-queue";
+    case Stage::BLOCK_BUILD:    return "block-build";
+    case Stage::ENCODE:         return "encode";
+    case Stage::WRITE:          return "write";
+    case Stage::COMPRESS:       return "compress";
+    case Stage::END_TO_END:     return "end-to-end";
+    }
+    return "unknown";
+}
+
+std::vector<std::string> StageTimes::format(const Snapshot& snapshot)
+{
+    const int w = 10;
+    std::vector<std::string> res;
+    std::ostringstream oss;
+
+    oss << std::left << std::setw(14) << "stage (us)" << std::right
+        << std::setw(w) << "count" << std::setw(w) << "mean"
+        << std::setw(w) << "p50" << std::setw(w) << "p90"
+        << std::setw(w) << "p99" << std::setw(w) << "p99.9"
+        << std::setw(w) << "max";
+    res.push_back(oss.str());
+
+    for ( std::size_t s = 0; s < STAGES; ++s )
+    {
+        const LatencyHistogram& h = snapshot[s];
+        uint64_t n = h.count();
+        if ( n == 0 )
+            continue;
+
+        oss.str("");
+        oss << std::left << std::setw(14) << stage_name(static_cast<Stage>(s)) << std::right
+            << std::setw(w) << n
+            << std::setw(w) << format_us(static_cast<uint64_t>(h.mean()))
+            << std::setw(w) << format_us(h.percentile(50))
+            << std::setw(w) << format_us(h.percentile(90))
+            << std::setw(w) << format_us(h.percentile(99))
+            << std::setw(w) << format_us(h.percentile(99.9))
+            << std::setw(w) << format_us(h.max());
+        res.push_back(oss.str());
+    }
+
+    return res;
+}
+
+void StageTimes::dump(std::ostream& os, const Snapshot& snapshot)
+{
+    os << "STAGE TIMES:\n";
+    for ( const auto& line : format(snapshot) )
+        os << "  " << line << "\n";
+    os << "\n";
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef STAGETIMES_HPP
+#define STAGETIMES_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * \class LatencyHistogram
+ * \brief A histogram of durations with bounded relative error.
+ *
+ * As with an HDR histogram, each power of two range of values is
+ * divided into a fixed number of equal sub-buckets. Values are held
+ * to within about 6% over the whole 64 bit range, in constant space.
+ */
+class LatencyHistogram
+{
+public:
+    /**
+     * \brief the number of bits of value resolved within each power of two.
+     */
+    static constexpr unsigned SUB_BUCKET_BITS = 4;
+
+    /**
+     * \brief the number of sub-buckets in each power of two.
+     */
+    static constexpr std::size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+    /**
+     * \brief the number of buckets.
+     */
+    static constexpr std::size_t BUCKETS = SUB_BUCKETS * ( 64 - SUB_BUCKET_BITS + 1 );
+
+    /**
+     * \brief Constructor.
+     */
+    LatencyHistogram() : counts_(BUCKETS), sum_(0) {}
+
+    /**
+     * \brief Return the bucket for a value.
+     *
+     * \param value the value.
+     * \returns the bucket index.
+     */
+    static std::size_t bucket(uint64_t value)
+    {
+        if ( value < SUB_BUCKETS )
+            return value;
+        unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return ( ( shift + 1 ) << SUB_BUCKET_BITS ) + ( value >> shift ) - SUB_BUCKETS;
+    }
+
+    /**
+     * \brief Return the highest value counted in a bucket.
+     *
+     * \param bucket the bucket index.
+     * \returns the highest value.
+     */
+    static uint64_t highest_value(std::size_t bucket)
+    {
+        if ( bucket < SUB_BUCKETS )
+            return bucket;
+        unsigned shift = ( bucket >> SUB_BUCKET_BITS ) - 1;
+        uint64_t sub = SUB_BUCKETS + ( bucket & ( SUB_BUCKETS - 1 ) );
+        return ( sub << shift ) + ( ( uint64_t(1) << shift ) - 1 );
+    }
+
+    /**
+     * \brief Record a value.
+     *
+     * \param value the value.
+     */
+    void record(uint64_t value)
+    {
+        add(bucket(value), 1, value);
+    }
+
+    /**
+     * \brief Add counts to a bucket.
+     *
+     * \param bucket the bucket index.
+     * \param count  the number of values.
+     * \param sum    the sum of the values.
+     */
+    void add(std::size_t bucket, uint64_t count, uint64_t sum)
+    {
+        counts_[bucket] += count;
+        sum_ += sum;
+    }
+
+    /**
+     * \brief Return the number of values recorded.
+     *
+     * \returns the number of values.
+     */
+    uint64_t count() const;
+
+    /**
+     * \brief Return the mean of the values recorded.
+     *
+     * \returns the mean, or 0 if no values are recorded.
+     */
+    double mean() const;
+
+    /**
+     * \brief Return a percentile of the values recorded.
+     *
+     * \param percent the percentile, 0 to 100.
+     * \returns the highest value equivalent to the percentile value,
+     *          or 0 if no values are recorded.
+     */
+    uint64_t percentile(double percent) const;
+
+    /**
+     * \brief Return the largest value recorded.
+     *
+     * \returns the highest value equivalent to the largest value,
+     *          or 0 if no values are recorded.
+     */
+    uint64_t max() const;
+
+    /**
+     * \brief Add the values of another histogram.
+     *
+     * \param rhs the other histogram.
+     * \returns this histogram.
+     */
+    LatencyHistogram& operator+=(const LatencyHistogram& rhs);
+
+    /**
+     * \brief Remove the values of an earlier copy of this histogram.
+     *
+     * The result holds only values recorded since the copy was made.
+     *
+     * \param rhs the earlier copy.
+     * \returns this histogram.
+     */
+    LatencyHistogram& operator-=(const LatencyHistogram& rhs);
+
+private:
+    /**
+     * \brief the count of values in each bucket.
+     */
+    std::vector<uint64_t> counts_;
+
+    /**
+     * \brief the sum of the values.
+     */
+    uint64_t sum_;
+};
+
+/**
+ * \class StageTimes
+ * \brief Record the time taken by each processing stage.
+ *
+ * Times are taken with the CPU time stamp counter where available,
+ * which is assumed to run at a constant rate, and are recorded in
+ * nanoseconds. Each thread records into its own histograms, which
+ * share no cache lines with those of other threads, so recording
+ * needs no locking. A snapshot combines the histograms from all
+ * threads.
+ *
+ * Nothing is recorded unless timing is enabled.
+ */
+class StageTimes
+{
+public:
+    /**
+     * \enum Stage
+     * \brief The processing stages.
+     */
+    enum class Stage
+    {
+        DECODE,
+        SNIFFER_QUEUE,
+        PARSE,
+        MATCH,
+        CDNS_QUEUE,
+        BLOCK_BUILD,
+        ENCODE,
+        WRITE,
+        COMPRESS,
+        END_TO_END,
+    };
+
+    /**
+     * \brief the number of stages.
+     */
+    static constexpr std::size_t STAGES = 10;
+
+    /**
+     * \typedef Snapshot
+     * \brief The histograms for all stages.
+     */
+    using Snapshot = std::array<LatencyHistogram, STAGES>;
+
+    /**
+     * \brief Enable or disable timing.
+     *
+     * Enabling timing for the first time calibrates the time stamp
+     * counter, which takes a few milliseconds, so should be done
+     * before processing starts.
+     *
+     * \param enable <code>true</code> to enable timing.
+     */
+    static void enable(bool enable);
+
+    /**
+     * \brief Determine if timing is enabled.
+     *
+     * \returns <code>true</code> if timing is enabled.
+     */
+    static bool enabled()
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \brief Read the current time in ticks.
+     *
+     * \returns the current time.
+     */
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /**
+     * \brief Record the time spent in a stage.
+     *
+     * \param stage the stage.
+     * \param ticks the time spent, in ticks.
+     */
+    static void record(Stage stage, uint64_t ticks)
+    {
+        record_ns(stage, static_cast<uint64_t>(ticks * ns_per_tick_.load(std::memory_order_relaxed)));
+    }
+
+    /**
+     * \brief Record the time between ticks read on different threads.
+     *
+     * The time stamp counters of different CPUs may not be
+     * synchronised, so the end may appear to be before the start.
+     * Such a sample is dropped.
+     *
+     * \param stage the stage.
+     * \param start the start time, in ticks.
+     * \param end   the end time, in ticks.
+     */
+    static void record_between(Stage stage, uint64_t start, uint64_t end)
+    {
+        if ( end >= start )
+            record(stage, end - start);
+    }
+
+    /**
+     * \brief Record the time spent in a stage.
+     *
+     * \param stage the stage.
+     * \param ns    the time spent, in nanoseconds.
+     */
+    static void record_ns(Stage stage, uint64_t ns);
+
+    /**
+     * \brief Record the time since a packet timestamp.
+     *
+     * Only meaningful when capturing live. Timestamps in the future
+     * are ignored.
+     *
+     * \param stage     the stage.
+     * \param timestamp the packet timestamp.
+     */
+    static void record_since(Stage stage, const std::chrono::system_clock::time_point& timestamp);
+
+    /**
+     * \brief Combine the histograms of all threads.
+     *
+     * \returns the histograms for all stages.
+     */
+    static Snapshot snapshot();
+
+    /**
+     * \brief Return the name of a stage.
+     *
+     * \param stage the stage.
+     * \returns the name.
+     */
+    static const char* stage_name(Stage stage);
+
+    /**
+     * \brief Format histograms as a table.
+     *
+     * The first line is a heading. Each following line gives the
+     * count and percentiles for a stage with recorded values. Times
+     * are in microseconds.
+     *
+     * \param snapshot the histograms.
+     * \returns the table lines.
+     */
+    static std::vector<std::string> format(const Snapshot& snapshot);
+
+    /**
+     * \brief Write histograms as a report.
+     *
+     * \param os       the output stream.
+     * \param snapshot the histograms.
+     */
+    static void dump(std::ostream& os, const Snapshot& snapshot);
+
+private:
+    /**
+     * \brief <code>true</code> if timing is enabled.
+     */
+    static std::atomic<bool> enabled_;
+
+    /**
+     * \brief the length of a tick in nanoseconds.
+     */
+    static std::atomic<double> ns_per_tick_;
+};
+
+#endif
@@ -18,40 +18,436 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/iostreams/device/back_inserter.hpp>
 
 #include "config.h"
 
 #include "log.hpp"
+#include "makeunique.hpp"
+#include "util.hpp"
 #include "streamwriter.hpp"
 
+#if ENABLE_IO_URING
+#include "uringfilebuf.hpp"
+#endif
+
 const std::string& StreamWriter::STDOUT_FILE_NAME = "-";
 
+namespace {
+    /**
+     * \brief write files using io_uring.
+     */
+    std::atomic<bool> output_io_uring(false);
+
+    /**
+     * \brief with io_uring, write using O_DIRECT.
+     */
+    std::atomic<bool> output_direct(false);
+
+    /**
+     * \brief with io_uring, synchronise data before rename.
+     */
+    std::atomic<bool> output_sync(false);
+
+#if ENABLE_IO_URING
+    /**
+     * \brief io_uring is not available; don't try again.
+     */
+    std::atomic<bool> io_uring_failed(false);
+#endif
+
+    /**
+     * \brief the number of threads compressing each file.
+     */
+    std::atomic<unsigned> output_compression_threads(1);
+}
+
+/**
+ * \class ParallelGzipCompressor
+ * \brief Compress a stream in chunks, in parallel.
+ *
+ * Input is divided into fixed size chunks. Each chunk is compressed
+ * by a worker thread into a separate gzip member, and the members
+ * are written to the output in input order. Only a limited number
+ * of chunks are held at once, so memory use is bounded.
+ */
+class ParallelGzipCompressor
+{
+public:
+    /**
+     * \brief the size of each chunk.
+     */
+    static constexpr std::size_t CHUNK_SIZE = 1024 * 1024;
+
+    /**
+     * \brief Constructor.
+     *
+     * \param os      the output stream.
+     * \param threads the number of worker threads.
+     * \param params  the compression parameters for the first member.
+     */
+    ParallelGzipCompressor(std::ostream& os, unsigned threads,
+                           const boost::iostreams::gzip_params& params)
+        : os_(os), first_params_(params), params_(params),
+          max_pending_(threads * 2), chunks_(0), stop_(false)
+    {
+        // Only the first member carries the file name and comment.
+        params_.file_name.clear();
+        params_.comment.clear();
+
+        for ( unsigned i = 0; i < threads; ++i )
+            workers_.emplace_back([this]() { worker(); });
+    }
+
+    /**
+     * \brief Destructor.
+     *
+     * Stop the worker threads. Any output not yet written is lost.
+     */
+    ~ParallelGzipCompressor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        for ( auto& t : workers_ )
+            t.join();
+    }
+
+    /**
+     * \brief Add data to the stream.
+     *
+     * \param p       pointer to the data.
+     * \param n_bytes number of bytes of data.
+     */
+    void write(const uint8_t* p, std::ptrdiff_t n_bytes)
+    {
+        while ( n_bytes > 0 )
+        {
+            std::size_t n = std::min(static_cast<std::size_t>(n_bytes), CHUNK_SIZE - current_.size());
+            current_.append(reinterpret_cast<const char*>(p), n);
+            p += n;
+            n_bytes -= n;
+            if ( current_.size() == CHUNK_SIZE )
+                submit();
+        }
+    }
+
+    /**
+     * \brief Compress any remaining data, and write all output.
+     */
+    void finish()
+    {
+        // A gzip file must have at least one member.
+        if ( !current_.empty() || chunks_ == 0 )
+            submit();
+        write_completed(0);
+    }
+
+private:
+    /**
+     * \struct Chunk
+     * \brief A chunk of the stream.
+     */
+    struct Chunk
+    {
+        /**
+         * \brief the uncompressed data.
+         */
+        std::string input;
+
+        /**
+         * \brief the compression parameters.
+         */
+        boost::iostreams::gzip_params params;
+
+        /**
+         * \brief the gzip member.
+         */
+        std::string output;
+
+        /**
+         * \brief has compression finished?
+         */
+        bool done = false;
+
+        /**
+         * \brief the compression error, if any.
+         */
+        std::exception_ptr error;
+    };
+
+    /**
+     * \brief Queue the current chunk for compression.
+     */
+    void submit()
+    {
+        auto chunk = std::make_shared<Chunk>();
+        chunk->input.swap(current_);
+        chunk->params = ( chunks_++ == 0 ) ? first_params_ : params_;
+        current_.reserve(CHUNK_SIZE);
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            pending_.push_back(chunk);
+            queue_.push_back(chunk);
+        }
+        work_cv_.notify_one();
+        write_completed(max_pending_);
+    }
+
+    /**
+     * \brief Write compressed chunks in order.
+     *
+     * Completed chunks at the head of the pending list are always
+     * written. Then wait for and write further chunks until no more
+     * than the given number are pending.
+     *
+     * \param max_pending the maximum number of chunks left pending.
+     */
+    void write_completed(std::size_t max_pending)
+    {
+        for (;;)
+        {
+            std::shared_ptr<Chunk> chunk;
+            {
+                std::unique_lock<std::mutex> lock(m_);
+                if ( pending_.empty() )
+                    return;
+                if ( !pending_.front()->done )
+                {
+                    if ( pending_.size() <= max_pending )
+                        return;
+                    done_cv_.wait(lock, [this]() { return pending_.front()->done; });
+                }
+                chunk = pending_.front();
+                pending_.pop_front();
+            }
+
+            if ( chunk->error )
+                std::rethrow_exception(chunk->error);
+            os_.write(chunk->output.data(), chunk->output.size());
+        }
+    }
+
+    /**
+     * \brief Worker thread function.
+     */
+    void worker()
+    {
+        set_thread_name("comp:compress");
+
+        for (;;)
+        {
+            std::shared_ptr<Chunk> chunk;
+            {
+                std::unique_lock<std::mutex> lock(m_);
+                work_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if ( stop_ )
+                    return;
+                chunk = queue_.front();
+                queue_.pop_front();
+            }
+
+            try
+            {
+                boost::iostreams::filtering_ostream gzout;
+                gzout.push(boost::iostreams::gzip_compressor(chunk->params));
+                gzout.push(boost::iostreams::back_inserter(chunk->output));
+                gzout.write(chunk->input.data(), chunk->input.size());
+                gzout.reset();
+            }
+            catch (...)
+            {
+                chunk->error = std::current_exception();
+            }
+            chunk->input.clear();
+            chunk->input.shrink_to_fit();
+
+            {
+                std::lock_guard<std::mutex> lock(m_);
+                chunk->done = true;
+            }
+            done_cv_.notify_all();
+        }
+    }
+
+    /**
+     * \brief the output stream.
+     */
+    std::ostream& os_;
+
+    /**
+     * \brief the compression parameters for the first member.
+     */
+    boost::iostreams::gzip_params first_params_;
+
+    /**
+     * \brief the compression parameters for other members.
+     */
+    boost::iostreams::gzip_params params_;
+
+    /**
+     * \brief the maximum number of chunks pending output.
+     */
+    std::size_t max_pending_;
+
+    /**
+     * \brief the number of chunks submitted.
+     */
+    uint64_t chunks_;
+
+    /**
+     * \brief the chunk being filled.
+     */
+    std::string current_;
+
+    /**
+     * \brief protect the chunk lists.
+     */
+    std::mutex m_;
+
+    /**
+     * \brief signal a chunk is queued, or the workers should stop.
+     */
+    std::condition_variable work_cv_;
+
+    /**
+     * \brief signal a chunk is compressed.
+     */
+    std::condition_variable done_cv_;
+
+    /**
+     * \brief submitted chunks not yet written, in input order.
+     */
+    std::deque<std::shared_ptr<Chunk>> pending_;
+
+    /**
+     * \brief chunks waiting for a worker.
+     */
+    std::deque<std::shared_ptr<Chunk>> queue_;
+
+    /**
+     * \brief should the workers stop?
+     */
+    bool stop_;
+
+    /**
+     * \brief the worker threads.
+     */
+    std::vector<std::thread> workers_;
+};
+
+constexpr std::size_t ParallelGzipCompressor::CHUNK_SIZE;
+
+void StreamWriter::set_output_mode(bool io_uring, bool direct, bool sync)
+{
+    output_io_uring = io_uring;
+    output_direct = direct;
+    output_sync = sync;
+#if ENABLE_IO_URING
+    io_uring_failed = false;
+#endif
+}
+
+void StreamWriter::set_compression_threads(unsigned threads)
+{
+    output_compression_threads = std::max(threads, 1U);
+}
+
+unsigned StreamWriter::compression_threads()
+{
+    return output_compression_threads;
+}
+
 StreamWriter::StreamWriter(const std::string& name, unsigned level, bool logging)
     : os_(&std::cout), name_(name), temp_name_(name + ".tmp"), logging_(logging)
 {
     if ( name_ != STDOUT_FILE_NAME )
     {
-        ofs_.open(temp_name_, std::ofstream::binary);
+#if ENABLE_IO_URING
+        if ( output_io_uring && !io_uring_failed )
+        {
+            try
+            {
+                uring_buf_ = make_unique<UringFileBuf>(temp_name_, output_direct, output_sync);
+                uring_os_ = make_unique<std::ostream>(uring_buf_.get());
+                os_ = uring_os_.get();
+            }
+            catch (const uring_setup_error& err)
+            {
+                // Fall back to stream output from now on.
+                io_uring_failed = true;
+                uring_os_.reset();
+                uring_buf_.reset();
+                LOG_WARN << err.what() << ", using standard file output";
+            }
+            catch (const uring_error&)
+            {
+                // A problem with this file. Report it as any other
+                // failure to open the file, below.
+                uring_os_.reset();
+                uring_buf_.reset();
+            }
+        }
+#endif
+        if ( !uring_buf_ )
+        {
+            ofs_.open(temp_name_, std::ofstream::binary);
+            if ( ofs_.fail() )
+                throw std::runtime_error("Can't open file " + temp_name_);
+            os_ = &ofs_;
+        }
         if (logging_) {
             if (level == 0 )
                 LOG_INFO << "File handling: Opening tmp file (no compression):  " << temp_name_ ;
             else
                 LOG_INFO << "File handling: Opening tmp file (for compression): " << temp_name_ ;
         }
-        if ( ofs_.fail() )
-            throw std::runtime_error("Can't open file " + temp_name_);
-        os_ = &ofs_;
     }
     os_->exceptions(std::ofstream::badbit);
 }
 
 StreamWriter::~StreamWriter()
 {
-    os_->flush();
-    if ( ofs_.is_open() )
+    try
+    {
+        os_->flush();
+    }
+    catch (const std::exception& err)
     {
+        LOG_ERROR << "write to " << temp_name_ << " failed: " << err.what();
+    }
+
+    bool opened = ofs_.is_open();
+    if ( opened )
         ofs_.close();
+#if ENABLE_IO_URING
+    if ( uring_buf_ )
+    {
+        opened = true;
+        try
+        {
+            static_cast<UringFileBuf*>(uring_buf_.get())->close();
+        }
+        catch (const uring_error& err)
+        {
+            LOG_ERROR << "write to " << temp_name_ << " failed: " << err.what();
+        }
+    }
+#endif
+
+    if ( opened )
+    {
         if (logging_)
             LOG_INFO << "File handling: Closing and renaming:               " << temp_name_.c_str() << " to " << name_.c_str();
         if ( std::rename(temp_name_.c_str(), name_.c_str()) != 0 )
@@ -77,18 +473,41 @@ GzipStreamWriter::GzipStreamWriter(const std::string& name, unsigned level, bool
     gzparams.level = level;
     gzparams.file_name = name;
     gzparams.comment = "Compressed by " PACKAGE_NAME;
-    gzout_.push(boost::iostreams::gzip_compressor(gzparams));
-    gzout_.push(*os_);
+
+    unsigned threads = compression_threads();
+    if ( threads > 1 )
+        parallel_ = make_unique<ParallelGzipCompressor>(*os_, threads, gzparams);
+    else
+    {
+        gzout_.push(boost::iostreams::gzip_compressor(gzparams));
+        gzout_.push(*os_);
+    }
 }
 
 GzipStreamWriter::~GzipStreamWriter()
 {
-    gzout_.reset();
+    if ( parallel_ )
+    {
+        try
+        {
+            parallel_->finish();
+        }
+        catch (const std::exception& err)
+        {
+            LOG_ERROR << err.what();
+        }
+        parallel_.reset();
+    }
+    else
+        gzout_.reset();
 }
 
 void GzipStreamWriter::writeBytes(const uint8_t *p, std::ptrdiff_t n_bytes)
 {
-    gzout_.write(reinterpret_cast<const char *>(p), n_bytes);
+    if ( parallel_ )
+        parallel_->write(p, n_bytes);
+    else
+        gzout_.write(reinterpret_cast<const char *>(p), n_bytes);
 }
 
 XzException::XzException(lzma_ret err)
@@ -126,7 +545,24 @@ const char* XzException::msg(lzma_ret err)
 XzStreamWriter::XzStreamWriter(const std::string& name, unsigned level, bool logging)
     : StreamWriter(name, level, logging), xz_stream_(LZMA_STREAM_INIT)
 {
-    lzma_ret ret = lzma_easy_encoder(&xz_stream_, level, LZMA_CHECK_CRC64);
+    lzma_ret ret;
+#if LZMA_VERSION >= 50020002
+    unsigned threads = compression_threads();
+    if ( threads > 1 )
+    {
+        // Block size 0 lets liblzma choose a size suited to the preset.
+        lzma_mt mt{};
+        mt.threads = threads;
+        mt.block_size = 0;
+        mt.timeout = 0;
+        mt.preset = level;
+        mt.filters = nullptr;
+        mt.check = LZMA_CHECK_CRC64;
+        ret = lzma_stream_encoder_mt(&xz_stream_, &mt);
+    }
+    else
+#endif
+        ret = lzma_easy_encoder(&xz_stream_, level, LZMA_CHECK_CRC64);
     if ( ret != LZMA_OK )
         throw XzException(ret);
 }
@@ -24,6 +24,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <memory>
 #include <string>
 
 #include <boost/iostreams/filtering_stream.hpp>
@@ -84,6 +85,38 @@ public:
         return "";
     }
 
+    /**
+     * \brief Set how subsequently opened output files are written.
+     *
+     * By default, files are written through a standard file stream.
+     * If io_uring can't be set up, files are written through a
+     * standard file stream until the output mode is next set.
+     *
+     * \param io_uring write files using io_uring, if available.
+     * \param direct   with io_uring, write with <code>O_DIRECT</code>.
+     * \param sync     with io_uring, synchronise file data to storage
+     *                 before the file is renamed to its final name.
+     */
+    static void set_output_mode(bool io_uring, bool direct, bool sync);
+
+    /**
+     * \brief Set the number of threads compressing each subsequently
+     * opened compressed output file.
+     *
+     * By default, each file is compressed by a single thread.
+     *
+     * \param threads the number of threads.
+     */
+    static void set_compression_threads(unsigned threads);
+
+    /**
+     * \brief Return the number of threads compressing each compressed
+     * output file.
+     *
+     * \returns the number of threads.
+     */
+    static unsigned compression_threads();
+
 protected:
     /**
      * \brief The output stream.
@@ -97,6 +130,16 @@ private:
      */
     std::ofstream ofs_;
 
+    /**
+     * \brief io_uring output buffer, if required.
+     */
+    std::unique_ptr<std::streambuf> uring_buf_;
+
+    /**
+     * \brief io_uring output stream, if required.
+     */
+    std::unique_ptr<std::ostream> uring_os_;
+
     /**
      * \brief The final output filename.
      */
@@ -114,11 +157,18 @@ private:
 
 };
 
+class ParallelGzipCompressor;
+
 /**
  * \class GzipStreamWriter
  * \brief A stream writer that gzips the output.
  *
  * The output filename has the extension `.gz` appended.
+ *
+ * If more than one compression thread is configured, the output is
+ * divided into chunks that are compressed in parallel, each into a
+ * separate gzip member. Standard gzip decoders read the members as
+ * a single stream.
  */
 class GzipStreamWriter : public StreamWriter
 {
@@ -164,6 +214,11 @@ private:
      * \brief The compression output stream.
      */
     boost::iostreams::filtering_ostream gzout_;
+
+    /**
+     * \brief The parallel compressor, if compressing in parallel.
+     */
+    std::unique_ptr<ParallelGzipCompressor> parallel_;
 };
 
 /**
@@ -195,6 +250,10 @@ protected:
  * \brief A stream writer that xzs the output.
  *
  * The output filename has the extension `.xz` appended.
+ *
+ * If more than one compression thread is configured, and liblzma
+ * supports it, the liblzma multi-threaded encoder is used. This
+ * compresses blocks of input in parallel into a standard xz stream.
  */
 class XzStreamWriter : public StreamWriter
 {
@@ -0,0 +1,342 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "config.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "log.hpp"
+#include "threadplacement.hpp"
+
+namespace bf = boost::filesystem;
+
+namespace {
+    /**
+     * \brief the known thread classes.
+     */
+    const std::set<std::string> THREAD_CLASSES = {
+        "main", "sniffer", "cdns-write", "raw-pcap", "ign-pcap",
+        "compress", "dnstap", "metrics", "signal-handler"
+    };
+
+    /**
+     * \brief the prefix of compactor thread names.
+     */
+    const std::string THREAD_NAME_PREFIX = "comp:";
+
+    /**
+     * \brief protect the installed placement.
+     */
+    std::mutex placement_mutex;
+
+    /**
+     * \brief the installed placement.
+     */
+    ThreadPlacement installed_placement;
+
+    /**
+     * \brief thread classes whose placement has been logged.
+     */
+    std::set<std::string> logged_classes;
+
+    /**
+     * \brief has the placement of the process before any
+     *        configuration been recorded?
+     */
+    bool have_original = false;
+
+#ifdef __linux__
+    /**
+     * \brief the original CPU affinity.
+     */
+    cpu_set_t original_cpus;
+#endif
+
+    /**
+     * \brief the original nice value.
+     */
+    int original_nice = 0;
+
+    /**
+     * \brief Parse an unsigned number.
+     *
+     * \param s the text.
+     * \returns the number.
+     * \throws std::invalid_argument if the text is not a number.
+     */
+    unsigned parse_unsigned(const std::string& s)
+    {
+        if ( s.empty() || s.size() > 5 ||
+             s.find_first_not_of("0123456789") != std::string::npos )
+            throw std::invalid_argument("invalid CPU number " + s);
+        return std::stoul(s);
+    }
+
+    /**
+     * \brief Write a CPU list.
+     *
+     * \param os   the output stream.
+     * \param cpus the CPUs.
+     */
+    void dump_cpus(std::ostream& os, const std::vector<unsigned>& cpus)
+    {
+        bool first = true;
+        for ( auto c : cpus )
+        {
+            if ( first )
+                first = false;
+            else
+                os << ",";
+            os << c;
+        }
+    }
+
+    /**
+     * \brief Find the NUMA nodes of a set of CPUs.
+     *
+     * \param cpus the CPUs.
+     * \returns the NUMA nodes, empty if not known.
+     */
+    std::set<unsigned> numa_nodes(const std::vector<unsigned>& cpus)
+    {
+        std::set<unsigned> res;
+
+        for ( auto c : cpus )
+        {
+            bf::path dir("/sys/devices/system/cpu/cpu" + std::to_string(c));
+            boost::system::error_code ec;
+            for ( bf::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec) )
+            {
+                std::string name = it->path().filename().string();
+                if ( name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                     name.find_first_not_of("0123456789", 4) == std::string::npos )
+                    res.insert(std::stoul(name.substr(4)));
+            }
+        }
+
+        return res;
+    }
+}
+
+std::string ThreadPlacement::split_spec(const std::string& spec, std::string& value)
+{
+    auto colon = spec.find(':');
+    if ( colon == std::string::npos )
+        throw std::invalid_argument("thread placement " + spec + " must be class:value");
+
+    std::string thread_class = spec.substr(0, colon);
+    if ( THREAD_CLASSES.find(thread_class) == THREAD_CLASSES.end() )
+        throw std::invalid_argument("unknown thread class " + thread_class);
+
+    value = spec.substr(colon + 1);
+    return thread_class;
+}
+
+void ThreadPlacement::set_cpus(const std::string& spec)
+{
+    std::string value;
+    std::string thread_class = split_spec(spec, value);
+    placements_[thread_class].cpus = parse_cpu_list(value);
+}
+
+void ThreadPlacement::set_nice(const std::string& spec)
+{
+    std::string value;
+    std::string thread_class = split_spec(spec, value);
+
+    bool negative = ( !value.empty() && value[0] == '-' );
+    std::string digits = value.substr(( negative || ( !value.empty() && value[0] == '+' ) ) ? 1 : 0);
+    if ( digits.empty() || digits.size() > 2 ||
+         digits.find_first_not_of("0123456789") != std::string::npos )
+        throw std::invalid_argument("invalid nice value " + value);
+
+    int nice = std::stoi(digits) * ( negative ? -1 : 1 );
+    if ( nice < -20 || nice > 19 )
+        throw std::invalid_argument("nice value " + value + " must be in the range -20 to 19");
+
+    Placement& p = placements_[thread_class];
+    p.set_nice = true;
+    p.nice = nice;
+}
+
+void ThreadPlacement::dump(std::ostream& os) const
+{
+    for ( const auto& p : placements_ )
+    {
+        std::string label = "Thread " + p.first;
+        label.resize(std::max<std::size_t>(label.size(), 21), ' ');
+        os << "  " << label << ":";
+        if ( !p.second.cpus.empty() )
+        {
+            os << " CPUs ";
+            dump_cpus(os, p.second.cpus);
+        }
+        if ( p.second.set_nice )
+            os << " nice " << p.second.nice;
+        os << "\n";
+    }
+}
+
+std::vector<unsigned> ThreadPlacement::parse_cpu_list(const std::string& list)
+{
+    std::set<unsigned> cpus;
+    std::istringstream iss(list);
+    std::string item;
+
+    while ( std::getline(iss, item, ',') )
+    {
+        auto dash = item.find('-');
+        unsigned first = parse_unsigned(item.substr(0, dash));
+        unsigned last = ( dash == std::string::npos ) ? first : parse_unsigned(item.substr(dash + 1));
+        if ( last < first )
+            throw std::invalid_argument("invalid CPU range " + item);
+        for ( unsigned c = first; c <= last; ++c )
+            cpus.insert(c);
+    }
+
+    if ( cpus.empty() )
+        throw std::invalid_argument("empty CPU list");
+
+    return std::vector<unsigned>(cpus.begin(), cpus.end());
+}
+
+void ThreadPlacement::configure(const ThreadPlacement& placement)
+{
+    std::lock_guard<std::mutex> lock(placement_mutex);
+    installed_placement = placement;
+    logged_classes.clear();
+
+    // Threads inherit the affinity and nice value of the thread that
+    // creates them, so threads of a class with no placement must be
+    // returned to the original values. Record those before anything
+    // is placed.
+    if ( !have_original )
+    {
+#ifdef __linux__
+        if ( pthread_getaffinity_np(pthread_self(), sizeof(original_cpus), &original_cpus) != 0 )
+            return;
+        errno = 0;
+        original_nice = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+        if ( errno != 0 )
+            return;
+#endif
+        have_original = true;
+    }
+}
+
+void ThreadPlacement::place_current_thread(const std::string& thread_name)
+{
+    std::string thread_class = thread_name;
+    if ( thread_class.compare(0, THREAD_NAME_PREFIX.size(), THREAD_NAME_PREFIX) == 0 )
+        thread_class.erase(0, THREAD_NAME_PREFIX.size());
+
+    Placement p;
+    bool log = false;
+    bool restore;
+#ifdef __linux__
+    cpu_set_t original;
+#endif
+    int nice;
+    {
+        std::lock_guard<std::mutex> lock(placement_mutex);
+        auto it = installed_placement.placements_.find(thread_class);
+        restore = have_original;
+        if ( it != installed_placement.placements_.end() )
+        {
+            p = it->second;
+            log = logged_classes.insert(thread_class).second;
+        }
+        else if ( !restore )
+            return;
+#ifdef __linux__
+        original = original_cpus;
+#endif
+        nice = original_nice;
+    }
+
+#ifdef __linux__
+    cpu_set_t set;
+    if ( !p.cpus.empty() )
+    {
+        CPU_ZERO(&set);
+        for ( auto c : p.cpus )
+            if ( c < CPU_SETSIZE )
+                CPU_SET(c, &set);
+    }
+    else
+        set = original;
+    if ( !p.cpus.empty() || restore )
+    {
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if ( err != 0 )
+        {
+            LOG_ERROR_LIMITED << "Can't set CPU affinity of thread " << thread_class << ": " << std::strerror(err);
+            p.cpus.clear();
+        }
+    }
+
+    if ( p.set_nice || restore )
+    {
+        // On Linux, the nice value is a per-thread attribute.
+        if ( setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)),
+                         p.set_nice ? p.nice : nice) != 0 )
+        {
+            LOG_ERROR_LIMITED << "Can't set nice value of thread " << thread_class << ": " << std::strerror(errno);
+            p.set_nice = false;
+        }
+    }
+
+    if ( log )
+    {
+        std::ostringstream oss;
+        oss << "Thread " << thread_class << ":";
+        if ( !p.cpus.empty() )
+        {
+            oss << " CPUs ";
+            dump_cpus(oss, p.cpus);
+
+            std::set<unsigned> nodes = numa_nodes(p.cpus);
+            if ( !nodes.empty() )
+            {
+                oss << " NUMA node";
+                if ( nodes.size() > 1 )
+                    oss << "s";
+                std::vector<unsigned> node_list(nodes.begin(), nodes.end());
+                oss << " ";
+                dump_cpus(oss, node_list);
+            }
+        }
+        if ( p.set_nice )
+            oss << " nice " << p.nice;
+        LOG_INFO << oss.str();
+    }
+#else
+    if ( log )
+        LOG_ERROR << "Thread placement is not supported on this system.";
+#endif
+}
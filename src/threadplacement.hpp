@@ -0,0 +1,153 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef THREADPLACEMENT_HPP
+#define THREADPLACEMENT_HPP
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * \class ThreadPlacement
+ * \brief CPU affinity and scheduling priority for classes of thread.
+ *
+ * A thread class is the thread name without the leading
+ * <code>comp:</code>, for example <code>sniffer</code> for the
+ * thread named <code>comp:sniffer</code>. The main thread, which is
+ * not named, has class <code>main</code>.
+ *
+ * A placement is installed for the process with configure(). Each
+ * thread applies the placement for its class when it starts by
+ * calling place_current_thread(). This is done by set_thread_name().
+ */
+class ThreadPlacement
+{
+public:
+    /**
+     * \brief Set the CPUs for a thread class.
+     *
+     * \param spec <code>class:cpus</code>, where <code>cpus</code> is
+     *             a comma separated list of CPU numbers or ranges, for
+     *             example <code>sniffer:2,4-5</code>.
+     * \throws std::invalid_argument if the spec is not valid.
+     */
+    void set_cpus(const std::string& spec);
+
+    /**
+     * \brief Set the nice value for a thread class.
+     *
+     * \param spec <code>class:nice</code>, for example
+     *             <code>compress:10</code>.
+     * \throws std::invalid_argument if the spec is not valid.
+     */
+    void set_nice(const std::string& spec);
+
+    /**
+     * \brief Determine if any placement is set.
+     *
+     * \returns <code>true</code> if no placement is set for any class.
+     */
+    bool empty() const
+    {
+        return placements_.empty();
+    }
+
+    /**
+     * \brief Write a description of the placement.
+     *
+     * \param os the output stream.
+     */
+    void dump(std::ostream& os) const;
+
+    /**
+     * \brief Install the placement for the process.
+     *
+     * Threads started afterwards apply the installed placement.
+     * The first call records the CPU affinity and nice value of the
+     * calling thread as the original placement of the process.
+     *
+     * \param placement the placement.
+     */
+    static void configure(const ThreadPlacement& placement);
+
+    /**
+     * \brief Apply the installed placement to the current thread.
+     *
+     * A new thread inherits the placement of the thread that created
+     * it, so once a placement has been installed, a thread whose class
+     * has no CPUs or nice value set is returned to the original CPU
+     * affinity or nice value of the process.
+     *
+     * The effective placement of each class is logged the first time
+     * a thread of that class is placed. Failures are logged and
+     * otherwise ignored.
+     *
+     * \param thread_name the thread name.
+     */
+    static void place_current_thread(const std::string& thread_name);
+
+    /**
+     * \brief Parse a CPU list.
+     *
+     * \param list comma separated CPU numbers or ranges.
+     * \returns the CPUs, in ascending order.
+     * \throws std::invalid_argument if the list is not valid.
+     */
+    static std::vector<unsigned> parse_cpu_list(const std::string& list);
+
+private:
+    /**
+     * \struct Placement
+     * \brief The placement of a thread class.
+     */
+    struct Placement
+    {
+        /**
+         * \brief Constructor.
+         */
+        Placement() : set_nice(false), nice(0) {}
+
+        /**
+         * \brief CPUs the thread may run on, empty if any.
+         */
+        std::vector<unsigned> cpus;
+
+        /**
+         * \brief <code>true</code> if the thread nice value is to be set.
+         */
+        bool set_nice;
+
+        /**
+         * \brief the thread nice value.
+         */
+        int nice;
+    };
+
+    /**
+     * \brief Split a spec into a validated class and a value.
+     *
+     * \param spec   the spec.
+     * \param value  the value part of the spec.
+     * \returns the thread class.
+     * \throws std::invalid_argument if the spec is not valid.
+     */
+    static std::string split_spec(const std::string& spec, std::string& value);
+
+    /**
+     * \brief the placements, indexed by thread class.
+     */
+    std::map<std::string, Placement> placements_;
+};
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#include <pcap/pcap.h>
+
+#include "config.h"
+
+#include "bytestring.hpp"
+
+#include "trafficgen.hpp"
+
+namespace {
+    /**
+     * \brief the DNS server port.
+     */
+    const uint16_t DNS_PORT = 53;
+
+    /**
+     * \brief the hop limit of generated packets.
+     */
+    const uint8_t HOP_LIMIT = 64;
+
+    /**
+     * \brief the TCP window advertised in generated segments.
+     */
+    const uint16_t TCP_WINDOW = 65535;
+
+    /**
+     * \brief Check a value is a fraction.
+     *
+     * \param val  the value.
+     * \param name the value name.
+     * \throws std::invalid_argument if the value is not in the range 0 to 1.
+     */
+    void check_fraction(double val, const char* name)
+    {
+        if ( !( val >= 0.0 && val <= 1.0 ) )
+            throw std::invalid_argument(std::string(name) + " must be between 0 and 1");
+    }
+}
+
+ZipfDistribution::ZipfDistribution(std::size_t n, double s)
+{
+    cdf_.reserve(n);
+    double total = 0.0;
+    for ( std::size_t k = 1; k <= n; ++k )
+    {
+        total += 1.0 / std::pow(static_cast<double>(k), s);
+        cdf_.push_back(total);
+    }
+    for ( auto& c : cdf_ )
+        c /= total;
+}
+
+std::size_t ZipfDistribution::operator()(std::mt19937& rng) const
+{
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    auto it = std::upper_bound(cdf_.begin(), cdf_.end(), u);
+    return std::min<std::size_t>(it - cdf_.begin(), cdf_.size() - 1);
+}
+
+TrafficGenerator::TrafficGenerator(const TrafficProfile& profile)
+    : profile_(profile), rng_(profile.seed),
+      client_dist_(std::max(profile.clients, 1u), profile.client_zipf_exponent),
+      name_dist_(std::max(profile.names, 1u), profile.name_zipf_exponent),
+      interval_dist_(profile.rate > 0.0 ? profile.rate : 1.0),
+      delay_dist_(0.0, profile.delay_sigma),
+      uniform_(0.0, 1.0),
+      server_ipv4_("192.0.2.53"), server_ipv6_("2001:db8::53"),
+      next_query_(profile.start),
+      end_(profile.start + profile.duration),
+      queries_done_(false)
+{
+    if ( !( profile.rate > 0.0 ) )
+        throw std::invalid_argument("query rate must be greater than 0");
+    if ( profile.clients == 0 )
+        throw std::invalid_argument("number of clients must be greater than 0");
+    if ( profile.names == 0 )
+        throw std::invalid_argument("number of query names must be greater than 0");
+    if ( profile.delay_sigma < 0.0 )
+        throw std::invalid_argument("response delay sigma must not be negative");
+    check_fraction(profile.ipv6_share, "IPv6 share");
+    check_fraction(profile.tcp_share, "TCP share");
+    check_fraction(profile.nxdomain_share, "NXDOMAIN share");
+    check_fraction(profile.loss, "loss");
+    check_fraction(profile.reorder, "reorder");
+
+    std::vector<double> weights;
+    for ( const auto& q : profile.qtype_mix )
+    {
+        if ( q.second < 0.0 )
+            throw std::invalid_argument("query type weights must not be negative");
+        weights.push_back(q.second);
+    }
+    if ( std::accumulate(weights.begin(), weights.end(), 0.0) <= 0.0 )
+        throw std::invalid_argument("query type mix must contain a positive weight");
+    qtype_dist_ = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+
+    // Clients are IPv4 in 10.0.0.0/8 or IPv6 in fd00::/64. IPv6
+    // clients are spread evenly through the population, so they have
+    // their share of popular clients.
+    unsigned ipv6_clients = 0;
+    for ( unsigned i = 0; i < profile.clients; ++i )
+    {
+        Client c;
+        c.ipv6 = ( ipv6_clients < static_cast<unsigned>(std::llround(( i + 1 ) * profile.ipv6_share)) );
+        if ( c.ipv6 )
+        {
+            ++ipv6_clients;
+            uint8_t addr[Tins::IPv6Address::address_size] = { 0xfd };
+            for ( unsigned b = 0; b < 4; ++b )
+                addr[15 - b] = static_cast<uint8_t>(i >> ( 8 * b ));
+            c.ipv6_address = Tins::IPv6Address(addr);
+        }
+        else
+        {
+            std::ostringstream oss;
+            oss << "10." << ( ( i >> 16 ) & 0xff ) << "." << ( ( i >> 8 ) & 0xff ) << "." << ( i & 0xff );
+            c.ipv4 = Tins::IPv4Address(oss.str());
+        }
+        clients_.push_back(c);
+    }
+}
+
+bool TrafficGenerator::next(PcapFrame& frame)
+{
+    // All frames for a query are no earlier than the query, so a
+    // pending frame can be returned once it is earlier than the next
+    // query.
+    while ( !queries_done_ &&
+            ( pending_.empty() || pending_.begin()->first >= next_query_ ) )
+    {
+        if ( ( profile_.queries > 0 && stats_.queries >= profile_.queries ) ||
+             ( profile_.duration.count() > 0 && next_query_ >= end_ ) )
+        {
+            queries_done_ = true;
+            break;
+        }
+
+        generate_transaction(next_query_);
+        next_query_ += std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::duration<double>(interval_dist_(rng_)));
+    }
+
+    if ( pending_.empty() )
+        return false;
+
+    auto it = pending_.begin();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(it->first.time_since_epoch());
+    uint32_t header[4] = {
+        static_cast<uint32_t>(us.count() / 1000000),
+        static_cast<uint32_t>(us.count() % 1000000),
+        static_cast<uint32_t>(it->second.size()),
+        static_cast<uint32_t>(it->second.size())
+    };
+    frame.linktype = DLT_EN10MB;
+    frame.record.resize(PcapFrame::RECORD_HEADER_SIZE + it->second.size());
+    std::memcpy(frame.record.data(), header, sizeof(header));
+    std::memcpy(frame.record.data() + PcapFrame::RECORD_HEADER_SIZE, it->second.data(), it->second.size());
+    pending_.erase(it);
+    ++stats_.packets;
+    return true;
+}
+
+void TrafficGenerator::generate_transaction(const std::chrono::system_clock::time_point& t)
+{
+    const Client& client = clients_[client_dist_(rng_)];
+    uint16_t sport = static_cast<uint16_t>(1024 + rng_() % 64512);
+    std::size_t name_index = name_dist_(rng_);
+    std::string name = "host" + std::to_string(name_index) + "." + profile_.zone;
+    CaptureDNS::QueryType qtype = profile_.qtype_mix[qtype_dist_(rng_)].first;
+    bool tcp = ( uniform_(rng_) < profile_.tcp_share );
+    bool nxdomain = ( uniform_(rng_) < profile_.nxdomain_share );
+
+    CaptureDNS query;
+    query.type(CaptureDNS::QUERY);
+    query.id(static_cast<uint16_t>(rng_()));
+    query.recursion_desired(1);
+    query.add_query(CaptureDNS::query(name, qtype, CaptureDNS::IN));
+
+    CaptureDNS response = query;
+    response.type(CaptureDNS::RESPONSE);
+    response.recursion_available(1);
+    if ( nxdomain )
+    {
+        response.rcode(CaptureDNS::NXDOMAIN);
+        ++stats_.nxdomain_responses;
+    }
+    else if ( qtype == CaptureDNS::A )
+    {
+        const uint8_t addr[] = {
+            198, 51,
+            static_cast<uint8_t>(name_index >> 8),
+            static_cast<uint8_t>(name_index)
+        };
+        response.add_answer(CaptureDNS::resource(name, byte_string(addr, sizeof(addr)), qtype, CaptureDNS::IN, 300));
+    }
+    else if ( qtype == CaptureDNS::AAAA )
+    {
+        uint8_t addr[16] = { 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01 };
+        for ( unsigned b = 0; b < 4; ++b )
+            addr[15 - b] = static_cast<uint8_t>(name_index >> ( 8 * b ));
+        response.add_answer(CaptureDNS::resource(name, byte_string(addr, sizeof(addr)), qtype, CaptureDNS::IN, 300));
+    }
+
+    ++stats_.queries;
+    std::chrono::microseconds delay = response_delay();
+
+    if ( !tcp )
+    {
+        Tins::UDP udp(DNS_PORT, sport);
+        udp.inner_pdu(query);
+        schedule(t, client, true, udp);
+
+        Tins::UDP udp_response(sport, DNS_PORT);
+        udp_response.inner_pdu(response);
+        schedule(t + delay, client, false, udp_response);
+        return;
+    }
+
+    ++stats_.tcp_queries;
+
+    // DNS over TCP messages have a two byte length prefix.
+    Tins::PDU::serialization_type qdata = query.serialize();
+    Tins::PDU::serialization_type rdata = response.serialize();
+    qdata.insert(qdata.begin(), { static_cast<uint8_t>(qdata.size() >> 8), static_cast<uint8_t>(qdata.size()) });
+    rdata.insert(rdata.begin(), { static_cast<uint8_t>(rdata.size() >> 8), static_cast<uint8_t>(rdata.size()) });
+
+    const Tins::PDU::serialization_type none;
+    const std::chrono::microseconds half_rtt = profile_.tcp_rtt / 2;
+    uint32_t cseq = rng_();
+    uint32_t sseq = rng_();
+    uint32_t qlen = static_cast<uint32_t>(qdata.size());
+    uint32_t rlen = static_cast<uint32_t>(rdata.size());
+
+    // Connection setup, then the query, response and connection close.
+    auto tq = t + profile_.tcp_rtt;
+    auto tr = tq + delay;
+    schedule(t, client, true,
+             tcp_segment(sport, DNS_PORT, Tins::TCP::SYN, cseq, 0, none));
+    schedule(t + half_rtt, client, false,
+             tcp_segment(DNS_PORT, sport, Tins::TCP::SYN | Tins::TCP::ACK, sseq, cseq + 1, none));
+    schedule(tq, client, true,
+             tcp_segment(sport, DNS_PORT, Tins::TCP::ACK, cseq + 1, sseq + 1, none));
+    schedule(tq, client, true,
+             tcp_segment(sport, DNS_PORT, Tins::TCP::PSH | Tins::TCP::ACK, cseq + 1, sseq + 1, qdata));
+    schedule(tr, client, false,
+             tcp_segment(DNS_PORT, sport, Tins::TCP::PSH | Tins::TCP::ACK, sseq + 1, cseq + 1 + qlen, rdata));
+    schedule(tr + half_rtt, client, true,
+             tcp_segment(sport, DNS_PORT, Tins::TCP::FIN | Tins::TCP::ACK, cseq + 1 + qlen, sseq + 1 + rlen, none));
+    schedule(tr + profile_.tcp_rtt, client, false,
+             tcp_segment(DNS_PORT, sport, Tins::TCP::FIN | Tins::TCP::ACK, sseq + 1 + rlen, cseq + 2 + qlen, none));
+    schedule(tr + profile_.tcp_rtt + half_rtt, client, true,
+             tcp_segment(sport, DNS_PORT, Tins::TCP::ACK, cseq + 2 + qlen, sseq + 2 + rlen, none));
+}
+
+void TrafficGenerator::schedule(const std::chrono::system_clock::time_point& t,
+                                const Client& client, bool to_server,
+                                const Tins::PDU& transport)
+{
+    if ( profile_.loss > 0.0 && uniform_(rng_) < profile_.loss )
+    {
+        ++stats_.lost_packets;
+        return;
+    }
+
+    std::chrono::system_clock::time_point ts = t;
+    if ( profile_.reorder > 0.0 && uniform_(rng_) < profile_.reorder )
+    {
+        ts += std::chrono::microseconds(
+            static_cast<int64_t>(uniform_(rng_) * profile_.reorder_window.count()) + 1);
+        ++stats_.reordered_packets;
+    }
+
+    Tins::EthernetII ethernet;
+
+    if ( client.ipv6 )
+    {
+        Tins::IPv6 ipv6 = to_server
+            ? Tins::IPv6(server_ipv6_, client.ipv6_address)
+            : Tins::IPv6(client.ipv6_address, server_ipv6_);
+        ipv6.hop_limit(HOP_LIMIT);
+        ipv6.inner_pdu(transport);
+        ethernet.inner_pdu(ipv6);
+    }
+    else
+    {
+        Tins::IP ip = to_server
+            ? Tins::IP(server_ipv4_, client.ipv4)
+            : Tins::IP(client.ipv4, server_ipv4_);
+        ip.ttl(HOP_LIMIT);
+        ip.inner_pdu(transport);
+        ethernet.inner_pdu(ip);
+    }
+
+    pending_.emplace(ts, ethernet.serialize());
+}
+
+Tins::TCP TrafficGenerator::tcp_segment(uint16_t sport, uint16_t dport,
+                                        uint16_t flags, uint32_t seq, uint32_t ack,
+                                        const Tins::PDU::serialization_type& payload)
+{
+    Tins::TCP tcp(dport, sport);
+    tcp.flags(flags);
+    tcp.seq(seq);
+    tcp.ack_seq(ack);
+    tcp.window(TCP_WINDOW);
+    if ( !payload.empty() )
+        tcp.inner_pdu(Tins::RawPDU(payload.data(), static_cast<uint32_t>(payload.size())));
+    return tcp;
+}
+
+std::chrono::microseconds TrafficGenerator::response_delay()
+{
+    double delay = profile_.delay_median.count() * delay_dist_(rng_);
+    return std::chrono::microseconds(static_cast<int64_t>(std::llround(delay)));
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef TRAFFICGEN_HPP
+#define TRAFFICGEN_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tins/tins.h>
+
+#include "capturedns.hpp"
+#include "pcapframe.hpp"
+
+/**
+ * \struct TrafficProfile
+ * \brief Parameters of generated DNS traffic.
+ */
+struct TrafficProfile
+{
+    /**
+     * \brief Constructor.
+     *
+     * Set a default profile.
+     */
+    TrafficProfile()
+        : rate(1000.0), queries(0), duration(0),
+          start(std::chrono::seconds(1500000000)),
+          clients(1000), client_zipf_exponent(0.0), ipv6_share(0.25),
+          names(10000), name_zipf_exponent(1.0), zone("example.com"),
+          qtype_mix({ { CaptureDNS::A, 60.0 }, { CaptureDNS::AAAA, 25.0 },
+                      { CaptureDNS::MX, 5.0 }, { CaptureDNS::TXT, 5.0 },
+                      { CaptureDNS::NS, 5.0 } }),
+          tcp_share(0.02), nxdomain_share(0.05),
+          delay_median(1000), delay_sigma(1.0), tcp_rtt(200),
+          loss(0.0), reorder(0.0), reorder_window(1000),
+          seed(1) {}
+
+    /**
+     * \brief the mean query rate, in queries per second.
+     *
+     * Queries arrive as a Poisson process.
+     */
+    double rate;
+
+    /**
+     * \brief the number of queries to generate, 0 for no limit.
+     */
+    uint64_t queries;
+
+    /**
+     * \brief the period over which to generate queries, 0 for no limit.
+     */
+    std::chrono::microseconds duration;
+
+    /**
+     * \brief the timestamp of the start of the traffic.
+     */
+    std::chrono::system_clock::time_point start;
+
+    /**
+     * \brief the number of clients.
+     */
+    unsigned clients;
+
+    /**
+     * \brief the Zipf exponent of client popularity.
+     *
+     * 0 gives all clients equal popularity.
+     */
+    double client_zipf_exponent;
+
+    /**
+     * \brief the fraction of clients using IPv6.
+     */
+    double ipv6_share;
+
+    /**
+     * \brief the number of distinct query names.
+     */
+    unsigned names;
+
+    /**
+     * \brief the Zipf exponent of query name popularity.
+     */
+    double name_zipf_exponent;
+
+    /**
+     * \brief the zone containing the query names.
+     */
+    std::string zone;
+
+    /**
+     * \brief the relative weights of query types.
+     */
+    std::vector<std::pair<CaptureDNS::QueryType, double>> qtype_mix;
+
+    /**
+     * \brief the fraction of queries made over TCP.
+     *
+     * Each TCP query uses a new connection.
+     */
+    double tcp_share;
+
+    /**
+     * \brief the fraction of queries answered with NXDOMAIN.
+     */
+    double nxdomain_share;
+
+    /**
+     * \brief the median delay between query and response.
+     *
+     * Delays have a log-normal distribution.
+     */
+    std::chrono::microseconds delay_median;
+
+    /**
+     * \brief the standard deviation of the log of the response delay.
+     */
+    double delay_sigma;
+
+    /**
+     * \brief the round trip time of TCP connections.
+     */
+    std::chrono::microseconds tcp_rtt;
+
+    /**
+     * \brief the fraction of packets not captured.
+     */
+    double loss;
+
+    /**
+     * \brief the fraction of packets captured late.
+     */
+    double reorder;
+
+    /**
+     * \brief the maximum extra delay of a packet captured late.
+     */
+    std::chrono::microseconds reorder_window;
+
+    /**
+     * \brief the random number generator seed.
+     *
+     * The same profile and seed always give the same traffic.
+     */
+    uint32_t seed;
+};
+
+/**
+ * \struct TrafficStatistics
+ * \brief Counts of generated traffic.
+ */
+struct TrafficStatistics
+{
+    /**
+     * \brief Constructor.
+     */
+    TrafficStatistics()
+        : queries(0), tcp_queries(0), nxdomain_responses(0),
+          packets(0), lost_packets(0), reordered_packets(0) {}
+
+    /**
+     * \brief the number of queries generated.
+     */
+    uint64_t queries;
+
+    /**
+     * \brief the number of queries generated over TCP.
+     */
+    uint64_t tcp_queries;
+
+    /**
+     * \brief the number of NXDOMAIN responses generated.
+     */
+    uint64_t nxdomain_responses;
+
+    /**
+     * \brief the number of packets output.
+     */
+    uint64_t packets;
+
+    /**
+     * \brief the number of packets dropped as lost.
+     */
+    uint64_t lost_packets;
+
+    /**
+     * \brief the number of packets delayed.
+     */
+    uint64_t reordered_packets;
+};
+
+/**
+ * \class ZipfDistribution
+ * \brief Choose values with a Zipf distribution.
+ *
+ * Value <code>k</code> in the range 0 to <code>n - 1</code> has
+ * probability proportional to <code>1 / (k + 1)^s</code>.
+ */
+class ZipfDistribution
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param n the number of values.
+     * \param s the exponent.
+     */
+    ZipfDistribution(std::size_t n, double s);
+
+    /**
+     * \brief Choose a value.
+     *
+     * \param rng the random number generator.
+     * \returns a value in the range 0 to <code>n - 1</code>.
+     */
+    std::size_t operator()(std::mt19937& rng) const;
+
+private:
+    /**
+     * \brief the cumulative distribution.
+     */
+    std::vector<double> cdf_;
+};
+
+/**
+ * \class TrafficGenerator
+ * \brief Generate synthetic DNS traffic as captured Ethernet frames.
+ *
+ * Each query is followed by its response after a random delay.
+ * TCP queries are sent on their own connection, complete with
+ * connection setup and teardown. Frames are returned in timestamp
+ * order, except for frames deliberately captured late.
+ */
+class TrafficGenerator
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param profile the traffic profile.
+     * \throws std::invalid_argument if the profile is invalid.
+     */
+    explicit TrafficGenerator(const TrafficProfile& profile);
+
+    /**
+     * \brief Get the next frame.
+     *
+     * \param frame the frame to fill.
+     * \returns <code>false</code> if the traffic is finished.
+     */
+    bool next(PcapFrame& frame);
+
+    /**
+     * \brief Get the traffic statistics so far.
+     *
+     * \returns the statistics.
+     */
+    const TrafficStatistics& stats() const
+    {
+        return stats_;
+    }
+
+private:
+    /**
+     * \struct Client
+     * \brief A client address.
+     */
+    struct Client
+    {
+        /**
+         * \brief <code>true</code> if the client uses IPv6.
+         */
+        bool ipv6;
+
+        /**
+         * \brief the client IPv4 address.
+         */
+        Tins::IPv4Address ipv4;
+
+        /**
+         * \brief the client IPv6 address.
+         */
+        Tins::IPv6Address ipv6_address;
+    };
+
+    /**
+     * \brief Generate a query and its response.
+     *
+     * \param t the query timestamp.
+     */
+    void generate_transaction(const std::chrono::system_clock::time_point& t);
+
+    /**
+     * \brief Schedule a frame for output.
+     *
+     * \param t         the frame timestamp.
+     * \param client    the client.
+     * \param to_server <code>true</code> if sent by the client.
+     * \param transport the transport layer PDU.
+     */
+    void schedule(const std::chrono::system_clock::time_point& t,
+                  const Client& client, bool to_server,
+                  const Tins::PDU& transport);
+
+    /**
+     * \brief Build a TCP segment.
+     *
+     * \param sport   the source port.
+     * \param dport   the destination port.
+     * \param flags   the TCP flags.
+     * \param seq     the sequence number.
+     * \param ack     the acknowledgement number.
+     * \param payload the payload, if any.
+     * \returns the segment.
+     */
+    static Tins::TCP tcp_segment(uint16_t sport, uint16_t dport,
+                                 uint16_t flags, uint32_t seq, uint32_t ack,
+                                 const Tins::PDU::serialization_type& payload);
+
+    /**
+     * \brief Choose a response delay.
+     *
+     * \returns the delay.
+     */
+    std::chrono::microseconds response_delay();
+
+    /**
+     * \brief the traffic profile.
+     */
+    TrafficProfile profile_;
+
+    /**
+     * \brief the random number generator.
+     */
+    std::mt19937 rng_;
+
+    /**
+     * \brief the clients.
+     */
+    std::vector<Client> clients_;
+
+    /**
+     * \brief choose a client.
+     */
+    ZipfDistribution client_dist_;
+
+    /**
+     * \brief choose a query name.
+     */
+    ZipfDistribution name_dist_;
+
+    /**
+     * \brief choose a query type.
+     */
+    std::discrete_distribution<std::size_t> qtype_dist_;
+
+    /**
+     * \brief choose a query inter-arrival time, in seconds.
+     */
+    std::exponential_distribution<double> interval_dist_;
+
+    /**
+     * \brief choose a response delay multiplier.
+     */
+    std::lognormal_distribution<double> delay_dist_;
+
+    /**
+     * \brief choose a probability.
+     */
+    std::uniform_real_distribution<double> uniform_;
+
+    /**
+     * \brief the server IPv4 address.
+     */
+    Tins::IPv4Address server_ipv4_;
+
+    /**
+     * \brief the server IPv6 address.
+     */
+    Tins::IPv6Address server_ipv6_;
+
+    /**
+     * \brief the timestamp of the next query.
+     */
+    std::chrono::system_clock::time_point next_query_;
+
+    /**
+     * \brief the timestamp after which no queries are generated.
+     */
+    std::chrono::system_clock::time_point end_;
+
+    /**
+     * \brief <code>true</code> if all queries have been generated.
+     */
+    bool queries_done_;
+
+    /**
+     * \brief frames generated but not yet returned, by timestamp.
+     */
+    std::multimap<std::chrono::system_clock::time_point, Tins::PDU::serialization_type> pending_;
+
+    /**
+     * \brief the traffic statistics.
+     */
+    TrafficStatistics stats_;
+};
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#include "log.hpp"
+
+#include "uringfilebuf.hpp"
+
+#if ENABLE_IO_URING
+
+namespace {
+    /**
+     * \brief user data marking a synchronisation completion.
+     */
+    const uint64_t SYNC_USER_DATA = UringFileBuf::BUFFERS;
+
+    /**
+     * \brief Make an error message from errno.
+     *
+     * \param what description of the failed operation.
+     * \returns the message.
+     */
+    std::string errno_message(const std::string& what)
+    {
+        return what + ": " + std::strerror(errno);
+    }
+
+    int io_uring_setup(unsigned entries, struct io_uring_params& params)
+    {
+        return syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+}
+
+UringFileBuf::UringFileBuf(const std::string& path, bool direct, bool sync)
+    : fd_(-1), direct_(direct), sync_(sync), ring_fd_(-1),
+      sq_ring_(MAP_FAILED), sq_ring_size_(0),
+      cq_ring_(MAP_FAILED), cq_ring_size_(0),
+      sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_size_(0),
+      sq_tail_(nullptr), sq_mask_(0), sq_array_(nullptr),
+      cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(0), cqes_(nullptr),
+      sync_in_flight_(false), pending_(0), current_(0), offset_(0)
+{
+    buffers_.fill(nullptr);
+    in_flight_.fill(false);
+
+    try
+    {
+        // Room for a write from each buffer plus a synchronisation.
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = io_uring_setup(BUFFERS + 1, params);
+        if ( ring_fd_ < 0 )
+            throw uring_setup_error(errno_message("io_uring setup failed"));
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if ( params.features & IORING_FEAT_SINGLE_MMAP )
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if ( sq_ring_ == MAP_FAILED )
+            throw uring_setup_error(errno_message("io_uring ring map failed"));
+
+        if ( params.features & IORING_FEAT_SINGLE_MMAP )
+        {
+            // Both rings in the one mapping; only unmap it once.
+            cq_ring_ = sq_ring_;
+            cq_ring_size_ = 0;
+        }
+        else
+        {
+            cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            if ( cq_ring_ == MAP_FAILED )
+                throw uring_setup_error(errno_message("io_uring ring map failed"));
+        }
+
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(
+            mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+        if ( sqes_ == MAP_FAILED )
+            throw uring_setup_error(errno_message("io_uring entries map failed"));
+
+        uint8_t* sq = static_cast<uint8_t*>(sq_ring_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        uint8_t* cq = static_cast<uint8_t*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        for ( auto& b : buffers_ )
+        {
+            void* p;
+            if ( posix_memalign(&p, ALIGNMENT, BUFFER_SIZE) != 0 )
+                throw uring_setup_error("io_uring buffer allocation failed");
+            b = static_cast<uint8_t*>(p);
+        }
+
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        if ( direct_ )
+        {
+            fd_ = ::open(path.c_str(), flags | O_DIRECT, 0666);
+            if ( fd_ < 0 && errno == EINVAL )
+            {
+                // File system doesn't do direct I/O.
+                direct_ = false;
+            }
+        }
+        if ( fd_ < 0 )
+            fd_ = ::open(path.c_str(), flags, 0666);
+        if ( fd_ < 0 )
+            throw uring_error(errno_message("Can't open file " + path));
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+
+    setp(reinterpret_cast<char*>(buffers_[current_]),
+         reinterpret_cast<char*>(buffers_[current_] + BUFFER_SIZE));
+}
+
+UringFileBuf::~UringFileBuf()
+{
+    try
+    {
+        close();
+    }
+    catch (const uring_error& err)
+    {
+        LOG_ERROR << err.what();
+    }
+    drain();
+    release();
+}
+
+void UringFileBuf::close()
+{
+    if ( fd_ < 0 )
+        return;
+
+    std::size_t len = pptr() - pbase();
+    setp(nullptr, nullptr);
+
+    if ( len > 0 && error_.empty() )
+    {
+        std::size_t aligned = direct_ ? ( len & ~(ALIGNMENT - 1) ) : len;
+
+        if ( aligned > 0 )
+            submit_write(current_, aligned);
+        drain();
+
+        if ( aligned < len && error_.empty() )
+        {
+            // Direct I/O can't write the unaligned tail.
+            int flags = fcntl(fd_, F_GETFL);
+            if ( flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0 )
+                set_error(errno_message("Can't clear O_DIRECT"));
+            else
+                write_sync(buffers_[current_] + aligned, len - aligned, offset_ + aligned);
+        }
+    }
+    else
+        drain();
+
+    if ( sync_ && error_.empty() )
+    {
+        struct io_uring_sqe sqe;
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_FSYNC;
+        sqe.fd = fd_;
+        sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe.user_data = SYNC_USER_DATA;
+        if ( submit(sqe) )
+            sync_in_flight_ = true;
+        drain();
+    }
+
+    if ( ::close(fd_) != 0 )
+        set_error(errno_message("Close failed"));
+    fd_ = -1;
+
+    if ( !error_.empty() )
+        throw uring_error(error_);
+}
+
+UringFileBuf::int_type UringFileBuf::overflow(int_type ch)
+{
+    if ( fd_ < 0 || !error_.empty() )
+        return traits_type::eof();
+
+    submit_write(current_, pptr() - pbase());
+    offset_ += pptr() - pbase();
+    current_ = ( current_ + 1 ) % BUFFERS;
+    wait_for(current_);
+    if ( !error_.empty() )
+    {
+        LOG_ERROR << error_;
+        setp(nullptr, nullptr);
+        return traits_type::eof();
+    }
+
+    setp(reinterpret_cast<char*>(buffers_[current_]),
+         reinterpret_cast<char*>(buffers_[current_] + BUFFER_SIZE));
+
+    if ( !traits_type::eq_int_type(ch, traits_type::eof()) )
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+void UringFileBuf::submit_write(unsigned i, std::size_t len)
+{
+    iovecs_[i].iov_base = buffers_[i];
+    iovecs_[i].iov_len = len;
+    offsets_[i] = offset_;
+
+    struct io_uring_sqe sqe;
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITEV;
+    sqe.fd = fd_;
+    sqe.addr = reinterpret_cast<uint64_t>(&iovecs_[i]);
+    sqe.len = 1;
+    sqe.off = offset_;
+    sqe.user_data = i;
+    if ( submit(sqe) )
+        in_flight_[i] = true;
+}
+
+bool UringFileBuf::submit(const struct io_uring_sqe& sqe)
+{
+    // This thread is the only producer, so the tail needs no barrier
+    // to read. The kernel consumes entries during io_uring_enter(),
+    // so there is always room.
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & sq_mask_;
+    sqes_[index] = sqe;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+    while ( io_uring_enter(ring_fd_, 1, 0, 0) < 0 )
+    {
+        if ( errno != EINTR && errno != EAGAIN && errno != EBUSY )
+        {
+            set_error(errno_message("io_uring submit failed"));
+            return false;
+        }
+    }
+    ++pending_;
+    return true;
+}
+
+void UringFileBuf::reap(bool wait)
+{
+    unsigned head = *cq_head_;
+
+    if ( wait && head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) )
+    {
+        if ( io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR )
+        {
+            set_error(errno_message("io_uring wait failed"));
+            // Nothing further will complete.
+            in_flight_.fill(false);
+            sync_in_flight_ = false;
+            pending_ = 0;
+            return;
+        }
+    }
+
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for ( ; head != tail; ++head )
+    {
+        const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        --pending_;
+
+        if ( cqe.user_data == SYNC_USER_DATA )
+        {
+            sync_in_flight_ = false;
+            if ( cqe.res < 0 )
+                set_error(std::string("Data sync failed: ") + std::strerror(-cqe.res));
+            continue;
+        }
+
+        unsigned i = static_cast<unsigned>(cqe.user_data);
+        in_flight_[i] = false;
+        if ( cqe.res < 0 )
+            set_error(std::string("Write failed: ") + std::strerror(-cqe.res));
+        else if ( static_cast<std::size_t>(cqe.res) < iovecs_[i].iov_len )
+        {
+            // Short write. Finish it synchronously.
+            std::size_t done = cqe.res;
+            write_sync(buffers_[i] + done, iovecs_[i].iov_len - done, offsets_[i] + done);
+        }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+void UringFileBuf::wait_for(unsigned i)
+{
+    while ( in_flight_[i] )
+        reap(true);
+}
+
+void UringFileBuf::drain()
+{
+    while ( pending_ > 0 )
+        reap(true);
+}
+
+void UringFileBuf::write_sync(const uint8_t* data, std::size_t len, uint64_t offset)
+{
+    while ( len > 0 )
+    {
+        ssize_t res = pwrite(fd_, data, len, offset);
+        if ( res < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            set_error(errno_message("Write failed"));
+            return;
+        }
+        data += res;
+        len -= res;
+        offset += res;
+    }
+}
+
+void UringFileBuf::set_error(const std::string& what)
+{
+    if ( error_.empty() )
+        error_ = what;
+}
+
+void UringFileBuf::release()
+{
+    if ( fd_ >= 0 )
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    for ( auto& b : buffers_ )
+    {
+        std::free(b);
+        b = nullptr;
+    }
+    if ( sqes_ != MAP_FAILED )
+        munmap(sqes_, sqes_size_);
+    if ( cq_ring_ != MAP_FAILED && cq_ring_size_ > 0 )
+        munmap(cq_ring_, cq_ring_size_);
+    if ( sq_ring_ != MAP_FAILED )
+        munmap(sq_ring_, sq_ring_size_);
+    sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    cq_ring_ = sq_ring_ = MAP_FAILED;
+    if ( ring_fd_ >= 0 )
+    {
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+    }
+}
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef URINGFILEBUF_HPP
+#define URINGFILEBUF_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+/**
+ * \exception uring_error
+ * \brief Signals an error setting up or using io_uring output.
+ */
+class uring_error : public std::runtime_error
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param what      message describing the problem.
+     */
+    explicit uring_error(const std::string& what)
+        : std::runtime_error(what){};
+
+    /**
+     * \brief Constructor.
+     *
+     * \param what      message describing the problem.
+     */
+    explicit uring_error(const char* what)
+        : std::runtime_error(what){};
+};
+
+/**
+ * \exception uring_setup_error
+ * \brief Signals that io_uring can't be set up, as opposed to an
+ *        error with a particular file.
+ */
+class uring_setup_error : public uring_error
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param what      message describing the problem.
+     */
+    explicit uring_setup_error(const std::string& what)
+        : uring_error(what){};
+
+    /**
+     * \brief Constructor.
+     *
+     * \param what      message describing the problem.
+     */
+    explicit uring_setup_error(const char* what)
+        : uring_error(what){};
+};
+
+/**
+ * \class UringFileBuf
+ * \brief Stream buffer writing a file with io_uring.
+ *
+ * Output is collected in a set of large aligned buffers. When a
+ * buffer is full, a write of it is queued and output continues into
+ * the next buffer, so several writes may be in progress while the
+ * writing thread carries on. The writing thread only waits if it
+ * needs a buffer whose write has not yet completed.
+ *
+ * The file may optionally be written with <code>O_DIRECT</code>,
+ * bypassing the page cache. The final partial buffer is written
+ * without <code>O_DIRECT</code>. The file may also optionally have
+ * its data synchronised to storage on close. The synchronisation is
+ * queued behind the final writes, and close() waits for it.
+ *
+ * An error in a write is reported by the stream on the next output,
+ * or by close().
+ */
+class UringFileBuf : public std::streambuf
+{
+public:
+    /**
+     * \brief the number of output buffers.
+     */
+    static constexpr unsigned BUFFERS = 4;
+
+    /**
+     * \brief the size of each output buffer.
+     */
+    static constexpr std::size_t BUFFER_SIZE = 1024 * 1024;
+
+    /**
+     * \brief the alignment of output buffers, and so of direct I/O.
+     */
+    static constexpr std::size_t ALIGNMENT = 4096;
+
+    /**
+     * \brief Constructor.
+     *
+     * Creates or truncates the output file.
+     *
+     * \param path   the file path.
+     * \param direct write with <code>O_DIRECT</code> if supported by
+     *               the file system.
+     * \param sync   synchronise file data to storage on close.
+     * \throws uring_setup_error if io_uring is not available.
+     * \throws uring_error if the file can't be opened.
+     */
+    UringFileBuf(const std::string& path, bool direct, bool sync);
+
+    /**
+     * \brief Destructor.
+     *
+     * Close the file if not already closed. Errors are logged.
+     */
+    virtual ~UringFileBuf();
+
+    /**
+     * \brief Write all remaining output and close the file.
+     *
+     * \throws uring_error if any write failed.
+     */
+    void close();
+
+protected:
+    /**
+     * \brief Queue the current buffer for writing and move to the next.
+     *
+     * \param ch a character to add to the output, if not EOF.
+     * \returns EOF on error, otherwise a value other than EOF.
+     */
+    virtual int_type overflow(int_type ch) override;
+
+private:
+    /**
+     * \brief Queue a write of a buffer.
+     *
+     * \param i   the buffer index.
+     * \param len the length to write.
+     */
+    void submit_write(unsigned i, std::size_t len);
+
+    /**
+     * \brief Queue an operation.
+     *
+     * \param sqe the operation. The submission queue entry is filled
+     *            from this.
+     * \returns <code>false</code> if the operation could not be queued.
+     */
+    bool submit(const struct io_uring_sqe& sqe);
+
+    /**
+     * \brief Process completed operations.
+     *
+     * \param wait wait for at least one operation to complete.
+     */
+    void reap(bool wait);
+
+    /**
+     * \brief Wait for a buffer to be available.
+     *
+     * \param i the buffer index.
+     */
+    void wait_for(unsigned i);
+
+    /**
+     * \brief Wait for all queued operations to complete.
+     */
+    void drain();
+
+    /**
+     * \brief Write data synchronously.
+     *
+     * \param data   the data.
+     * \param len    the data length.
+     * \param offset the file offset.
+     */
+    void write_sync(const uint8_t* data, std::size_t len, uint64_t offset);
+
+    /**
+     * \brief Record an error.
+     *
+     * Only the first error is recorded.
+     *
+     * \param what the error.
+     */
+    void set_error(const std::string& what);
+
+    /**
+     * \brief Release the ring and the output buffers.
+     */
+    void release();
+
+    /**
+     * \brief the output file descriptor, or -1 if closed.
+     */
+    int fd_;
+
+    /**
+     * \brief <code>true</code> if writing with <code>O_DIRECT</code>.
+     */
+    bool direct_;
+
+    /**
+     * \brief <code>true</code> if data is to be synchronised on close.
+     */
+    bool sync_;
+
+    /**
+     * \brief the io_uring file descriptor.
+     */
+    int ring_fd_;
+
+    /**
+     * \brief the submission queue ring mapping.
+     */
+    void* sq_ring_;
+
+    /**
+     * \brief the submission queue ring mapping size.
+     */
+    std::size_t sq_ring_size_;
+
+    /**
+     * \brief the completion queue ring mapping.
+     */
+    void* cq_ring_;
+
+    /**
+     * \brief the completion queue ring mapping size.
+     */
+    std::size_t cq_ring_size_;
+
+    /**
+     * \brief the submission queue entries.
+     */
+    struct io_uring_sqe* sqes_;
+
+    /**
+     * \brief the submission queue entries mapping size.
+     */
+    std::size_t sqes_size_;
+
+    /**
+     * \brief submission queue tail.
+     */
+    unsigned* sq_tail_;
+
+    /**
+     * \brief submission queue index mask.
+     */
+    unsigned sq_mask_;
+
+    /**
+     * \brief submission queue index array.
+     */
+    unsigned* sq_array_;
+
+    /**
+     * \brief completion queue head.
+     */
+    unsigned* cq_head_;
+
+    /**
+     * \brief completion queue tail.
+     */
+    unsigned* cq_tail_;
+
+    /**
+     * \brief completion queue index mask.
+     */
+    unsigned cq_mask_;
+
+    /**
+     * \brief the completion queue entries.
+     */
+    struct io_uring_cqe* cqes_;
+
+    /**
+     * \brief the output buffers.
+     */
+    std::array<uint8_t*, BUFFERS> buffers_;
+
+    /**
+     * \brief the I/O vector for each buffer's write.
+     */
+    std::array<struct iovec, BUFFERS> iovecs_;
+
+    /**
+     * \brief the file offset of each buffer's write.
+     */
+    std::array<uint64_t, BUFFERS> offsets_;
+
+    /**
+     * \brief <code>true</code> if a buffer's write is in progress.
+     */
+    std::array<bool, BUFFERS> in_flight_;
+
+    /**
+     * \brief <code>true</code> if a synchronisation is in progress.
+     */
+    bool sync_in_flight_;
+
+    /**
+     * \brief the number of operations in progress.
+     */
+    unsigned pending_;
+
+    /**
+     * \brief the buffer currently being filled.
+     */
+    unsigned current_;
+
+    /**
+     * \brief the file offset of the current buffer.
+     */
+    uint64_t offset_;
+
+    /**
+     * \brief the first error, if any.
+     */
+    std::string error_;
+};
+
+#endif
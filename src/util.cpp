@@ -32,6 +32,7 @@
 
 #include <boost/filesystem.hpp>
 
+#include "threadplacement.hpp"
 #include "util.hpp"
 
 namespace bf = boost::filesystem;
@@ -87,7 +88,7 @@ void set_file_owner_perms(const std::string& path,
     bf::permissions(path, perms | bf::add_perms);
 }
 
-void set_thread_name(const char* name)
+void set_thread_name(const char* name, bool place)
 {
 #if HAVE_PTHREAD_SETNAME_NP
   #ifdef __APPLE__
@@ -95,7 +96,7 @@ void set_thread_name(const char* name)
   #else
     pthread_setname_np(pthread_self(), name);
   #endif
-#else
-    (void) name;
 #endif
+    if ( place )
+        ThreadPlacement::place_current_thread(name);
 }
@@ -39,8 +39,12 @@ void set_file_owner_perms(const std::string& path,
  * The passed name may be truncated, or this may do
  * nothing, depending on the underlying system.
  *
+ * Any placement configured for the thread is applied, unless
+ * \p place is <code>false</code>.
+ *
  * \param name  the name to set.
+ * \param place apply the thread placement?
  */
-void set_thread_name(const char* name);
+void set_thread_name(const char* name, bool place = true);
 
 #endif
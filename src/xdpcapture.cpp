@@ -0,0 +1,554 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+
+#include "config.h"
+
+#include "makeunique.hpp"
+
+#include "xdpcapture.hpp"
+
+#if ENABLE_XDP
+
+namespace {
+    const uint32_t FRAME_SIZE = 4096;
+    const uint32_t NUM_FRAMES = 4096;
+    const uint32_t FILL_RING_SIZE = NUM_FRAMES;
+    const uint32_t COMPLETION_RING_SIZE = 64;
+    const uint32_t RX_RING_SIZE = 2048;
+
+    std::string errno_message(const std::string& what)
+    {
+        return what + ": " + std::strerror(errno);
+    }
+
+    int bpf(enum bpf_cmd cmd, union bpf_attr& attr)
+    {
+        return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+    }
+
+    /**
+     * \class Assembler
+     * \brief Build an eBPF program, resolving forward jumps to labels.
+     */
+    class Assembler
+    {
+    public:
+        enum Reg { R0, R1, R2, R3, R4, R5, R6, R7 };
+
+        void mov(Reg dst, Reg src)
+        {
+            emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+        }
+
+        void mov(Reg dst, int32_t imm)
+        {
+            emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);
+        }
+
+        void add(Reg dst, int32_t imm)
+        {
+            emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm);
+        }
+
+        void add(Reg dst, Reg src)
+        {
+            emit(BPF_ALU64 | BPF_ADD | BPF_X, dst, src, 0, 0);
+        }
+
+        void band(Reg dst, int32_t imm)
+        {
+            emit(BPF_ALU64 | BPF_AND | BPF_K, dst, 0, 0, imm);
+        }
+
+        void lsh(Reg dst, int32_t imm)
+        {
+            emit(BPF_ALU64 | BPF_LSH | BPF_K, dst, 0, 0, imm);
+        }
+
+        // Convert a 16 bit value in network order to host order.
+        void to_host16(Reg dst)
+        {
+            emit(BPF_ALU | BPF_END | BPF_TO_BE, dst, 0, 0, 16);
+        }
+
+        void load(int size, Reg dst, Reg src, int16_t off)
+        {
+            emit(BPF_LDX | BPF_MEM | size, dst, src, off, 0);
+        }
+
+        void load_map_fd(Reg dst, int fd)
+        {
+            emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+            emit(0, 0, 0, 0, 0);
+        }
+
+        void jmp(int op, Reg dst, int32_t imm, const std::string& label)
+        {
+            fixups_.emplace_back(insns_.size(), label);
+            emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+        }
+
+        void jmp(int op, Reg dst, Reg src, const std::string& label)
+        {
+            fixups_.emplace_back(insns_.size(), label);
+            emit(BPF_JMP | op | BPF_X, dst, src, 0, 0);
+        }
+
+        void jmp(const std::string& label)
+        {
+            fixups_.emplace_back(insns_.size(), label);
+            emit(BPF_JMP | BPF_JA, 0, 0, 0, 0);
+        }
+
+        void call(int32_t func)
+        {
+            emit(BPF_JMP | BPF_CALL, 0, 0, 0, func);
+        }
+
+        void exit()
+        {
+            emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+        }
+
+        void label(const std::string& name)
+        {
+            labels_[name] = insns_.size();
+        }
+
+        const std::vector<struct bpf_insn>& program()
+        {
+            for ( const auto& f : fixups_ )
+                insns_[f.first].off = labels_.at(f.second) - f.first - 1;
+            fixups_.clear();
+            return insns_;
+        }
+
+    private:
+        void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+        {
+            struct bpf_insn insn;
+            std::memset(&insn, 0, sizeof(insn));
+            insn.code = code;
+            insn.dst_reg = dst;
+            insn.src_reg = src;
+            insn.off = off;
+            insn.imm = imm;
+            insns_.push_back(insn);
+        }
+
+        std::vector<struct bpf_insn> insns_;
+        std::map<std::string, std::size_t> labels_;
+        std::vector<std::pair<std::size_t, std::string>> fixups_;
+    };
+
+    /**
+     * \struct Ring
+     * \brief A mapped AF_XDP ring.
+     */
+    struct Ring
+    {
+        uint32_t* producer;
+        uint32_t* consumer;
+        uint32_t* flags;
+        void* ring;
+        uint32_t mask;
+        void* map;
+        std::size_t map_len;
+
+        void init(int fd, const struct xdp_ring_offset& off,
+                  uint32_t size, std::size_t desc_size, off_t pgoff)
+        {
+            map_len = off.desc + size * desc_size;
+            map = mmap(nullptr, map_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, pgoff);
+            if ( map == MAP_FAILED )
+            {
+                map = nullptr;
+                throw xdp_error(errno_message("AF_XDP ring map failed"));
+            }
+            uint8_t* base = static_cast<uint8_t*>(map);
+            producer = reinterpret_cast<uint32_t*>(base + off.producer);
+            consumer = reinterpret_cast<uint32_t*>(base + off.consumer);
+            flags = reinterpret_cast<uint32_t*>(base + off.flags);
+            ring = base + off.desc;
+            mask = size - 1;
+        }
+    };
+}
+
+/**
+ * \struct XdpCapture::Queue
+ * \brief An AF_XDP socket and UMEM bound to a single receive queue.
+ */
+struct XdpCapture::Queue
+{
+    Queue()
+        : fd(-1), umem(nullptr), fill(), rx(), received(0)
+    {
+    }
+
+    ~Queue()
+    {
+        if ( rx.map )
+            munmap(rx.map, rx.map_len);
+        if ( fill.map )
+            munmap(fill.map, fill.map_len);
+        if ( fd >= 0 )
+            close(fd);
+        if ( umem )
+            munmap(umem, std::size_t(NUM_FRAMES) * FRAME_SIZE);
+    }
+
+    int fd;
+    uint8_t* umem;
+    Ring fill;
+    Ring rx;
+    std::atomic<uint64_t> received;
+};
+
+XdpCapture::XdpCapture(const std::string& interface, unsigned dns_port, bool generic_mode)
+    : interface_(interface), map_fd_(-1), prog_fd_(-1), link_fd_(-1)
+{
+    unsigned ifindex = if_nametoindex(interface.c_str());
+    if ( ifindex == 0 )
+        throw xdp_error(errno_message("Unknown interface " + interface));
+
+    // Find the number of receive queues.
+    unsigned nqueues = 1;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if ( sock >= 0 )
+    {
+        struct ethtool_channels channels;
+        struct ifreq ifr;
+        std::memset(&channels, 0, sizeof(channels));
+        std::memset(&ifr, 0, sizeof(ifr));
+        channels.cmd = ETHTOOL_GCHANNELS;
+        std::strncpy(ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+        ifr.ifr_data = reinterpret_cast<char*>(&channels);
+        if ( ioctl(sock, SIOCETHTOOL, &ifr) == 0 )
+            nqueues = std::max(channels.combined_count + channels.rx_count, 1U);
+        close(sock);
+    }
+
+    try
+    {
+        union bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(uint32_t);
+        attr.value_size = sizeof(uint32_t);
+        attr.max_entries = nqueues;
+        map_fd_ = bpf(BPF_MAP_CREATE, attr);
+        if ( map_fd_ < 0 )
+            throw xdp_error(errno_message("XSKMAP creation failed"));
+
+        load_program(dns_port);
+
+        for ( uint32_t q = 0; q < nqueues; ++q )
+        {
+            auto queue = make_unique<Queue>();
+
+            queue->fd = socket(AF_XDP, SOCK_RAW, 0);
+            if ( queue->fd < 0 )
+                throw xdp_error(errno_message("AF_XDP socket creation failed"));
+
+            void* umem = mmap(nullptr, std::size_t(NUM_FRAMES) * FRAME_SIZE,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if ( umem == MAP_FAILED )
+                throw xdp_error(errno_message("UMEM allocation failed"));
+            queue->umem = static_cast<uint8_t*>(umem);
+
+            struct xdp_umem_reg reg;
+            std::memset(&reg, 0, sizeof(reg));
+            reg.addr = reinterpret_cast<uint64_t>(umem);
+            reg.len = std::size_t(NUM_FRAMES) * FRAME_SIZE;
+            reg.chunk_size = FRAME_SIZE;
+            if ( setsockopt(queue->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0 )
+                throw xdp_error(errno_message("UMEM registration failed"));
+
+            if ( setsockopt(queue->fd, SOL_XDP, XDP_UMEM_FILL_RING, &FILL_RING_SIZE, sizeof(FILL_RING_SIZE)) != 0 ||
+                 setsockopt(queue->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &COMPLETION_RING_SIZE, sizeof(COMPLETION_RING_SIZE)) != 0 ||
+                 setsockopt(queue->fd, SOL_XDP, XDP_RX_RING, &RX_RING_SIZE, sizeof(RX_RING_SIZE)) != 0 )
+                throw xdp_error(errno_message("AF_XDP ring setup failed"));
+
+            struct xdp_mmap_offsets off;
+            socklen_t optlen = sizeof(off);
+            if ( getsockopt(queue->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0 )
+                throw xdp_error(errno_message("AF_XDP ring offsets unavailable"));
+
+            queue->fill.init(queue->fd, off.fr, FILL_RING_SIZE, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+            queue->rx.init(queue->fd, off.rx, RX_RING_SIZE, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+
+            // Give all frames to the kernel.
+            uint64_t* fill = static_cast<uint64_t*>(queue->fill.ring);
+            for ( uint32_t i = 0; i < NUM_FRAMES; ++i )
+                fill[i & queue->fill.mask] = uint64_t(i) * FRAME_SIZE;
+            __atomic_store_n(queue->fill.producer, NUM_FRAMES, __ATOMIC_RELEASE);
+
+            struct sockaddr_xdp sxdp;
+            std::memset(&sxdp, 0, sizeof(sxdp));
+            sxdp.sxdp_family = AF_XDP;
+            sxdp.sxdp_ifindex = ifindex;
+            sxdp.sxdp_queue_id = q;
+            sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | ( generic_mode ? XDP_COPY : 0 );
+            if ( bind(queue->fd, reinterpret_cast<struct sockaddr*>(&sxdp), sizeof(sxdp)) != 0 )
+                throw xdp_error(errno_message("AF_XDP bind to " + interface + " queue " + std::to_string(q) + " failed"));
+
+            std::memset(&attr, 0, sizeof(attr));
+            attr.map_fd = map_fd_;
+            attr.key = reinterpret_cast<uint64_t>(&q);
+            attr.value = reinterpret_cast<uint64_t>(&queue->fd);
+            attr.flags = BPF_ANY;
+            if ( bpf(BPF_MAP_UPDATE_ELEM, attr) != 0 )
+                throw xdp_error(errno_message("XSKMAP update failed"));
+
+            queues_.push_back(std::move(queue));
+        }
+
+        // Attach the program last, so everything is ready to receive.
+        std::memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = prog_fd_;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = generic_mode ? XDP_FLAGS_SKB_MODE : 0;
+        link_fd_ = bpf(BPF_LINK_CREATE, attr);
+        if ( link_fd_ < 0 )
+            throw xdp_error(errno_message("XDP attach to " + interface + " failed"));
+    }
+    catch (...)
+    {
+        queues_.clear();
+        if ( prog_fd_ >= 0 )
+            close(prog_fd_);
+        if ( map_fd_ >= 0 )
+            close(map_fd_);
+        throw;
+    }
+}
+
+XdpCapture::~XdpCapture()
+{
+    close(link_fd_);
+    queues_.clear();
+    close(prog_fd_);
+    close(map_fd_);
+}
+
+void XdpCapture::load_program(unsigned dns_port)
+{
+    using R = Assembler::Reg;
+    Assembler a;
+    int32_t port = htons(dns_port);
+
+    // R6 = context, R2 = packet start, R3 = packet end.
+    // After any VLAN tag, R2 is adjusted so the network header
+    // is at R2 + 14, and after that the transport header is at R2 + 14.
+    a.mov(R::R6, R::R1);
+    a.load(BPF_W, R::R2, R::R6, offsetof(struct xdp_md, data));
+    a.load(BPF_W, R::R3, R::R6, offsetof(struct xdp_md, data_end));
+    a.mov(R::R4, R::R2);
+    a.add(R::R4, 14);
+    a.jmp(BPF_JGT, R::R4, R::R3, "pass");
+    a.load(BPF_H, R::R5, R::R2, 12);
+    a.jmp(BPF_JEQ, R::R5, htons(0x8100), "vlan");
+    a.jmp(BPF_JNE, R::R5, htons(0x88a8), "l3");
+
+    a.label("vlan");
+    a.mov(R::R4, R::R2);
+    a.add(R::R4, 18);
+    a.jmp(BPF_JGT, R::R4, R::R3, "pass");
+    a.load(BPF_H, R::R5, R::R2, 16);
+    a.add(R::R2, 4);
+
+    a.label("l3");
+    a.jmp(BPF_JEQ, R::R5, htons(0x86dd), "ipv6");
+    a.jmp(BPF_JNE, R::R5, htons(0x0800), "pass");
+
+    // IPv4. Non-initial fragments are needed for reassembly.
+    a.mov(R::R4, R::R2);
+    a.add(R::R4, 14 + 20);
+    a.jmp(BPF_JGT, R::R4, R::R3, "pass");
+    a.load(BPF_H, R::R5, R::R2, 14 + 6);
+    a.to_host16(R::R5);
+    a.band(R::R5, 0x1fff);
+    a.jmp(BPF_JNE, R::R5, 0, "redirect");
+    a.load(BPF_B, R::R7, R::R2, 14 + 9);
+    a.load(BPF_B, R::R5, R::R2, 14);
+    a.band(R::R5, 0xf);
+    a.lsh(R::R5, 2);
+    a.add(R::R2, R::R5);
+    a.jmp("l4");
+
+    // IPv6. Extension headers are not followed.
+    a.label("ipv6");
+    a.mov(R::R4, R::R2);
+    a.add(R::R4, 14 + 40);
+    a.jmp(BPF_JGT, R::R4, R::R3, "pass");
+    a.load(BPF_B, R::R7, R::R2, 14 + 6);
+    a.add(R::R2, 40);
+
+    a.label("l4");
+    a.jmp(BPF_JEQ, R::R7, IPPROTO_UDP, "ports");
+    a.jmp(BPF_JEQ, R::R7, IPPROTO_TCP, "ports");
+    a.jmp(BPF_JEQ, R::R7, IPPROTO_ICMP, "icmp");
+    a.jmp(BPF_JNE, R::R7, IPPROTO_ICMPV6, "pass");
+
+    // ICMPv6 destination unreachable, packet too big, time exceeded.
+    a.mov(R::R4, R::R2);
+    a.add(R::R4, 14 + 1);
+    a.jmp(BPF_JGT, R::R4, R::R3, "pass");
+    a.load(BPF_B, R::R5, R::R2, 14);
+    a.jmp(BPF_JEQ, R::R5, 0, "pass");
+    a.jmp(BPF_JGT, R::R5, 3, "pass");
+    a.jmp("redirect");
+
+    // ICMP destination unreachable, time exceeded.
+    a.label("icmp");
+    a.mov(R::R4, R::R2);
+    a.add(R::R4, 14 + 1);
+    a.jmp(BPF_JGT, R::R4, R::R3, "pass");
+    a.load(BPF_B, R::R5, R::R2, 14);
+    a.jmp(BPF_JEQ, R::R5, 3, "redirect");
+    a.jmp(BPF_JEQ, R::R5, 11, "redirect");
+    a.jmp("pass");
+
+    // UDP or TCP to or from DNS port.
+    a.label("ports");
+    a.mov(R::R4, R::R2);
+    a.add(R::R4, 14 + 4);
+    a.jmp(BPF_JGT, R::R4, R::R3, "pass");
+    a.load(BPF_H, R::R5, R::R2, 14);
+    a.jmp(BPF_JEQ, R::R5, port, "redirect");
+    a.load(BPF_H, R::R5, R::R2, 14 + 2);
+    a.jmp(BPF_JNE, R::R5, port, "pass");
+
+    // Redirect to the socket for this queue, or pass if none.
+    a.label("redirect");
+    a.load_map_fd(R::R1, map_fd_);
+    a.load(BPF_W, R::R2, R::R6, offsetof(struct xdp_md, rx_queue_index));
+    a.mov(R::R3, XDP_PASS);
+    a.call(BPF_FUNC_redirect_map);
+    a.exit();
+
+    a.label("pass");
+    a.mov(R::R0, XDP_PASS);
+    a.exit();
+
+    const std::vector<struct bpf_insn>& prog = a.program();
+    union bpf_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = reinterpret_cast<uint64_t>(prog.data());
+    attr.insn_cnt = prog.size();
+    attr.license = reinterpret_cast<uint64_t>("MPL-2.0");
+    std::strncpy(attr.prog_name, "compactor_dns", sizeof(attr.prog_name) - 1);
+    prog_fd_ = bpf(BPF_PROG_LOAD, attr);
+    if ( prog_fd_ < 0 )
+    {
+        std::string msg = errno_message("XDP program load failed");
+
+        // Load again to get the verifier log.
+        std::vector<char> log(65536);
+        attr.log_buf = reinterpret_cast<uint64_t>(log.data());
+        attr.log_size = log.size();
+        attr.log_level = 1;
+        prog_fd_ = bpf(BPF_PROG_LOAD, attr);
+        if ( prog_fd_ < 0 )
+            throw xdp_error(msg + "\n" + log.data());
+    }
+}
+
+std::vector<int> XdpCapture::fds() const
+{
+    std::vector<int> res;
+    for ( const auto& q : queues_ )
+        res.push_back(q->fd);
+    return res;
+}
+
+unsigned XdpCapture::receive(const Sink& sink, unsigned max)
+{
+    unsigned res = 0;
+
+    for ( auto& q : queues_ )
+    {
+        uint32_t cons = *q->rx.consumer;
+        uint32_t avail = __atomic_load_n(q->rx.producer, __ATOMIC_ACQUIRE) - cons;
+        uint32_t n = std::min(avail, max);
+
+        if ( n == 0 )
+            continue;
+
+        const struct xdp_desc* rx = static_cast<const struct xdp_desc*>(q->rx.ring);
+        uint64_t* fill = static_cast<uint64_t*>(q->fill.ring);
+        uint32_t fill_prod = *q->fill.producer;
+
+        for ( uint32_t i = 0; i < n; ++i )
+        {
+            const struct xdp_desc& desc = rx[(cons + i) & q->rx.mask];
+            sink(q->umem + desc.addr, desc.len);
+
+            // All frames are either in the kernel or being processed
+            // here, so there is always room to return one.
+            fill[(fill_prod + i) & q->fill.mask] = desc.addr & ~uint64_t(FRAME_SIZE - 1);
+        }
+
+        __atomic_store_n(q->fill.producer, fill_prod + n, __ATOMIC_RELEASE);
+        __atomic_store_n(q->rx.consumer, cons + n, __ATOMIC_RELEASE);
+
+        if ( __atomic_load_n(q->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP )
+            recvfrom(q->fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+
+        q->received += n;
+        res += n;
+    }
+
+    return res;
+}
+
+void XdpCapture::stats(uint64_t& received, uint64_t& dropped) const
+{
+    received = dropped = 0;
+
+    for ( const auto& q : queues_ )
+    {
+        struct xdp_statistics st;
+        socklen_t optlen = sizeof(st);
+
+        received += q->received;
+        std::memset(&st, 0, sizeof(st));
+        if ( getsockopt(q->fd, SOL_XDP, XDP_STATISTICS, &st, &optlen) == 0 )
+            dropped += st.rx_dropped + st.rx_ring_full + st.rx_fill_ring_empty_descs;
+    }
+}
+
+#endif
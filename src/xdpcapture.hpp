@@ -0,0 +1,159 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#ifndef XDPCAPTURE_HPP
+#define XDPCAPTURE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+#if ENABLE_XDP
+
+/**
+ * \exception xdp_error
+ * \brief Signals an error setting up or using AF_XDP capture.
+ */
+class xdp_error : public std::runtime_error
+{
+public:
+    /**
+     * \brief Constructor.
+     *
+     * \param what      message describing the problem.
+     */
+    explicit xdp_error(const std::string& what)
+        : std::runtime_error(what){};
+
+    /**
+     * \brief Constructor.
+     *
+     * \param what      message describing the problem.
+     */
+    explicit xdp_error(const char* what)
+        : std::runtime_error(what){};
+};
+
+/**
+ * \class XdpCapture
+ * \brief Capture DNS traffic from a network interface using AF_XDP.
+ *
+ * A minimal XDP program is attached to the interface. It redirects
+ * UDP and TCP traffic to or from the DNS port, IPv4 fragments, and
+ * ICMP and ICMPv6 error messages to an AF_XDP socket bound to the
+ * receive queue, and passes all other traffic to the network stack.
+ * There is one socket per receive queue.
+ *
+ * Note that redirected packets are NOT seen by the network stack, so
+ * this is only suitable for interfaces receiving a copy of the traffic.
+ *
+ * The XDP program is attached via a BPF link, so it is detached when
+ * the capture is destroyed or the process exits.
+ */
+class XdpCapture
+{
+public:
+    /**
+     * \typedef Sink
+     * \brief Sink function for received Ethernet frames.
+     *
+     * The frame data is only valid for the duration of the call.
+     */
+    using Sink = std::function<void (const uint8_t* data, uint32_t len)>;
+
+    /**
+     * \brief Constructor.
+     *
+     * \param interface    the network interface.
+     * \param dns_port     the DNS port.
+     * \param generic_mode use generic (SKB) XDP rather than native.
+     * \throws xdp_error on failure.
+     */
+    XdpCapture(const std::string& interface, unsigned dns_port, bool generic_mode);
+
+    /**
+     * \brief Destructor.
+     */
+    virtual ~XdpCapture();
+
+    /**
+     * \brief Return the file descriptors to wait on for input.
+     *
+     * \returns the socket file descriptors.
+     */
+    std::vector<int> fds() const;
+
+    /**
+     * \brief Receive available frames.
+     *
+     * Frames are returned to the kernel once passed to the sink.
+     *
+     * \param sink the sink for received frames.
+     * \param max  the maximum number of frames to receive from each queue.
+     * \returns the number of frames received.
+     */
+    unsigned receive(const Sink& sink, unsigned max);
+
+    /**
+     * \brief Get capture statistics.
+     *
+     * \param received set to the number of frames received.
+     * \param dropped  set to the number of frames dropped by the kernel.
+     */
+    void stats(uint64_t& received, uint64_t& dropped) const;
+
+private:
+    struct Queue;
+
+    /**
+     * \brief Load the XDP program.
+     *
+     * \param dns_port the DNS port.
+     */
+    void load_program(unsigned dns_port);
+
+    /**
+     * \brief the interface name.
+     */
+    std::string interface_;
+
+    /**
+     * \brief the XSKMAP file descriptor.
+     */
+    int map_fd_;
+
+    /**
+     * \brief the XDP program file descriptor.
+     */
+    int prog_fd_;
+
+    /**
+     * \brief the BPF link file descriptor.
+     */
+    int link_fd_;
+
+    /**
+     * \brief the receive queues.
+     */
+    std::vector<std::unique_ptr<Queue>> queues_;
+};
+
+#endif
+
+#endif
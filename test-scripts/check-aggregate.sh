@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, you can obtain one at https://mozilla.org/MPL/2.0/.
+#
+# Check that aggregate counts match counts of the equivalent CSV output.
+
+COMP=./compactor
+INSP=./inspector
+
+command -v diff > /dev/null 2>&1 || { echo "No diff, skipping test." >&2; exit 77; }
+command -v sort > /dev/null 2>&1 || { echo "No sort, skipping test." >&2; exit 77; }
+command -v uniq > /dev/null 2>&1 || { echo "No uniq, skipping test." >&2; exit 77; }
+command -v awk > /dev/null 2>&1 || { echo "No awk, skipping test." >&2; exit 77; }
+
+tmpdir=`mktemp -d -t "check-aggregate.XXXXXX"`
+
+cleanup()
+{
+    rm -rf $tmpdir
+    exit $1
+}
+
+trap "cleanup 1" HUP INT TERM
+
+error()
+{
+    echo $1
+    cleanup 1
+}
+
+RAW=nsd-live.raw.pcap
+
+if [ ! -r $RAW ]; then
+    error "Missing input file"
+fi
+
+# Convert to C-DNS.
+$COMP -c /dev/null --omit-system-id -n all -o $tmpdir/gold.cdns $RAW
+if [ $? -ne 0 ]; then
+    error "compactor failed"
+fi
+
+# Count the CSV output.
+$INSP -o - -F csv -C query_type,response_rcode,transport_flags $tmpdir/gold.cdns > $tmpdir/gold.csv
+if [ $? -ne 0 ]; then
+    error "CSV dumper failed"
+fi
+sort $tmpdir/gold.csv | uniq -c | awk '{ print $2 "," $1 }' | sort > $tmpdir/expected.csv
+
+# Aggregate, single and multi-threaded.
+for threads in 1 4
+do
+    $INSP --aggregate qtype,rcode --aggregate transport --threads $threads -o $tmpdir/agg.csv $tmpdir/gold.cdns
+    if [ $? -ne 0 ]; then
+        error "aggregate failed"
+    fi
+    if [ "`head -n 1 $tmpdir/agg.csv`" != "qtype,rcode,transport,count" ]; then
+        error "aggregate header failed"
+    fi
+    tail -n +2 $tmpdir/agg.csv | sort > $tmpdir/actual.csv
+
+    diff -q $tmpdir/actual.csv $tmpdir/expected.csv
+    if [ $? -ne 0 ]; then
+        error "aggregate counts failed"
+    fi
+done
+
+# JSON output.
+$INSP --aggregate qtype --aggregate-format json -o $tmpdir/agg.json $tmpdir/gold.cdns
+if [ $? -ne 0 ]; then
+    error "JSON aggregate failed"
+fi
+if [ "`head -n 1 $tmpdir/agg.json`" != "[" ]; then
+    error "JSON aggregate output failed"
+fi
+
+cleanup 0
@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, you can obtain one at https://mozilla.org/MPL/2.0/.
+#
+# Check that ClickHouse RowBinary output read by clickhouse-local
+# matches the equivalent CSV output.
+
+COMP=./compactor
+INSP=./inspector
+
+command -v clickhouse > /dev/null 2>&1 || { echo "No clickhouse, skipping test." >&2; exit 77; }
+command -v diff > /dev/null 2>&1 || { echo "No diff, skipping test." >&2; exit 77; }
+
+tmpdir=`mktemp -d -t "check-clickhouse.XXXXXX"`
+
+cleanup()
+{
+    rm -rf $tmpdir
+    exit $1
+}
+
+trap "cleanup 1" HUP INT TERM
+
+error()
+{
+    echo $1
+    cleanup 1
+}
+
+RAW=nsd-live.raw.pcap
+
+if [ ! -r $RAW ]; then
+    error "Missing input file"
+fi
+
+# Convert to C-DNS.
+$COMP -c /dev/null --omit-system-id -n all -o $tmpdir/gold.cdns $RAW
+if [ $? -ne 0 ]; then
+    error "compactor failed"
+fi
+
+$INSP -o $tmpdir/gold.csv -F csv -C timestamp_nanosecs,client_address:x-ip6addr,client_port,id,query_type,query_name:x-csvescape,response_rcode $tmpdir/gold.cdns
+if [ $? -ne 0 ]; then
+    error "CSV dumper failed"
+fi
+
+$INSP -o $tmpdir/gold.rowbinary -F clickhouse $tmpdir/gold.cdns
+if [ $? -ne 0 ]; then
+    error "ClickHouse dumper failed"
+fi
+
+STRUCTURE=`$INSP --clickhouse-structure`
+if [ $? -ne 0 ]; then
+    error "ClickHouse structure failed"
+fi
+
+clickhouse local --structure "$STRUCTURE" --input-format RowBinary \
+           --format_csv_null_representation '' \
+           --query "SELECT timestamp_nanosecs, IPv6NumToString(client_address), client_port, id, query_type, query_name, response_rcode FROM table FORMAT CSV" \
+           < $tmpdir/gold.rowbinary | sed -e 's/"//g' > $tmpdir/clickhouse.csv
+if [ $? -ne 0 ]; then
+    error "clickhouse local failed"
+fi
+
+sed -e 's/"//g' $tmpdir/gold.csv > $tmpdir/gold-unquoted.csv
+diff -q $tmpdir/gold-unquoted.csv $tmpdir/clickhouse.csv
+if [ $? -ne 0 ]; then
+    error "ClickHouse output differs"
+fi
+
+cleanup 0
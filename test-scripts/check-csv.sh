@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, you can obtain one at https://mozilla.org/MPL/2.0/.
+#
+# Check that CSV output matches the equivalent template output.
+
+COMP=./compactor
+INSP=./inspector
+
+command -v diff > /dev/null 2>&1 || { echo "No diff, skipping test." >&2; exit 77; }
+command -v head > /dev/null 2>&1 || { echo "No head, skipping test." >&2; exit 77; }
+
+tmpdir=`mktemp -d -t "check-csv.XXXXXX"`
+
+cleanup()
+{
+    rm -rf $tmpdir
+    exit $1
+}
+
+trap "cleanup 1" HUP INT TERM
+
+error()
+{
+    echo $1
+    cleanup 1
+}
+
+RAW=nsd-live.raw.pcap
+
+if [ ! -r $RAW ]; then
+    error "Missing input file"
+fi
+
+# The same columns as test-scripts/test-csv.tpl.
+COLUMNS=timestamp_secs:x-date,timestamp_secs,timestamp_nanosecs,node
+COLUMNS=$COLUMNS,client_address:x-ipaddr,client_port,client_hoplimit
+COLUMNS=$COLUMNS,client_address:x-ipaddr-geo-location,client_address:x-ipaddr-geo-asn,client_address:x-ipaddr-geo-as-netmask
+COLUMNS=$COLUMNS,server_address:x-ip6addr-bin:x-hexstring,server_port
+COLUMNS=$COLUMNS,transport_flags,query_response_flags,query_len,response_len
+COLUMNS=$COLUMNS,id,query_opcode,dns_flags,query_rcode,query_class,query_type
+COLUMNS=$COLUMNS,query_name:x-cstring
+COLUMNS=$COLUMNS,query_qdcount,query_ancount,query_arcount,query_nscount
+COLUMNS=$COLUMNS,query_edns_version,query_edns_udp_payload_size
+COLUMNS=$COLUMNS,response_delay_nanosecs,response_rcode
+COLUMNS=$COLUMNS,response_qdcount,response_ancount,response_arcount,response_nscount
+COLUMNS=$COLUMNS,query_opt_codes:x-array
+
+# Convert to C-DNS.
+$COMP -c /dev/null --omit-system-id -n all -o $tmpdir/gold.cdns $RAW
+if [ $? -ne 0 ]; then
+    error "compactor failed"
+fi
+
+# CSV output, first 100 lines.
+$INSP -o - -F csv -g . -C $COLUMNS --value node=42 $tmpdir/gold.cdns > $tmpdir/gold.dump.full
+if [ $? -ne 0 ]; then
+    error "dumper failed"
+fi
+head -n 100 $tmpdir/gold.dump.full > $tmpdir/gold.dump
+if [ $? -ne 0 ]; then
+    error "head failed"
+fi
+
+diff -q $tmpdir/gold.dump nsd-live.dump
+if [ $? -ne 0 ]; then
+    error "CSV dump failed"
+fi
+
+# TSV output with header.
+$INSP -o - -F tsv -C query_name,client_port --column-headers $tmpdir/gold.cdns > $tmpdir/gold.tsv
+if [ $? -ne 0 ]; then
+    error "TSV dumper failed"
+fi
+if [ "`head -n 1 $tmpdir/gold.tsv`" != "`printf 'query_name\tclient_port'`" ]; then
+    error "TSV header failed"
+fi
+
+cleanup 0
@@ -314,3 +314,52 @@ SCENARIO("Check CBOR decoder decodes correct basic values", "[cbor]")
         }
     }
 }
+
+SCENARIO("Check CBOR items can be read undecoded", "[cbor]")
+{
+    GIVEN("A test CBOR decoder")
+    {
+        TestCborDecoder tcbd;
+
+        WHEN("items are read raw")
+        {
+            const std::vector<uint8_t> MAP =
+                {
+                    (5 << 5) | 2,
+                    0, (3 << 5) | 5, 'H', 'e', 'l', 'l', 'o',
+                    1, (4 << 5) | 31, 1, 2, 25, 1, 0, 0xff,
+                };
+            std::vector<uint8_t> input = MAP;
+            input.push_back(23);
+            tcbd.set_bytes(input);
+
+            byte_string raw;
+            tcbd.read_raw(raw);
+
+            THEN("the item encoding is returned and the decoder moves on")
+            {
+                REQUIRE(raw == byte_string(MAP.begin(), MAP.end()));
+                REQUIRE(tcbd.read_unsigned() == 23);
+                REQUIRE_THROWS_AS(tcbd.type(), cbor_end_of_input);
+            }
+
+            AND_THEN("the encoding can be decoded from memory")
+            {
+                CborBufferDecoder bd(raw);
+                bool indef;
+
+                REQUIRE(bd.readMapHeader(indef) == 2);
+                REQUIRE(bd.read_unsigned() == 0);
+                REQUIRE(bd.read_string() == "Hello");
+                REQUIRE(bd.read_unsigned() == 1);
+                REQUIRE(bd.readArrayHeader(indef) == 0);
+                REQUIRE(indef);
+                REQUIRE(bd.read_unsigned() == 1);
+                REQUIRE(bd.read_unsigned() == 2);
+                REQUIRE(bd.read_unsigned() == 256);
+                bd.readBreak();
+                REQUIRE_THROWS_AS(bd.type(), cbor_end_of_input);
+            }
+        }
+    }
+}
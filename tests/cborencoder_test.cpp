@@ -20,34 +20,46 @@ namespace {
     class TestCborEncoder : public CborBaseEncoder
     {
     public:
-        TestCborEncoder() : CborBaseEncoder() {}
+        TestCborEncoder() : CborBaseEncoder(), n_writes_(0) {}
 
         void clear()
         {
-            bytes.clear();
+            bytes_.clear();
         }
 
         bool compareBytes(const uint8_t *buf, std::size_t buflen)
         {
-            if ( buflen != bytes.size() )
+            if ( buflen != bytes_.size() )
                 return false;
 
-            for ( auto b : bytes )
+            for ( auto b : bytes_ )
                 if ( b != *buf++ )
                     return false;
 
             return true;
         }
 
+        const std::vector<uint8_t>& bytes() const
+        {
+            return bytes_;
+        }
+
+        unsigned n_writes() const
+        {
+            return n_writes_;
+        }
+
     protected:
         virtual void writeBytes(const uint8_t *p, std::ptrdiff_t nBytes)
         {
+            ++n_writes_;
             while ( nBytes-- > 0 )
-                bytes.push_back(*p++);
+                bytes_.push_back(*p++);
         }
 
     private:
-        std::vector<uint8_t> bytes;
+        std::vector<uint8_t> bytes_;
+        unsigned n_writes_;
     };
 }
 
@@ -184,3 +196,102 @@ SCENARIO("Check CBOR encoder encodes correct basic values", "[cbor]")
         }
     }
 }
+
+SCENARIO("Check CBOR encoder reserved field writes match checked writes", "[cbor]")
+{
+    GIVEN("Two test CBOR encoders")
+    {
+        TestCborEncoder checked;
+        TestCborEncoder reserved;
+
+        WHEN("fields with constant keys are encoded both ways")
+        {
+            const unsigned long long values[] =
+                {
+                    0, 23, 24, 0xff, 0x100, 0xffff, 0x10000, 0xffffffff,
+                    0x100000000ull, 0xffffffffffffffffull
+                };
+            boost::optional<uint16_t> present(0x1234);
+            boost::optional<uint16_t> absent;
+
+            // Enough fields to cross the internal buffer boundary.
+            for ( int i = 0; i < 200; ++i )
+            {
+                for ( auto v : values )
+                {
+                    checked.write(5, v);
+                    checked.write(-3, static_cast<unsigned>(v));
+                    checked.write(23, -static_cast<long long>(v & 0xffffffffff));
+                    checked.write(0, present);
+                    checked.write(1, absent);
+
+                    reserved.reserve(5 * CborBaseEncoder::MAX_FIELD_SIZE);
+                    reserved.writeReserved<5>(v);
+                    reserved.writeReserved<-3>(static_cast<unsigned>(v));
+                    reserved.writeReserved<23>(-static_cast<long long>(v & 0xffffffffff));
+                    reserved.writeReserved<0>(present);
+                    reserved.writeReserved<1>(absent);
+                }
+                checked.writeBreak();
+                reserved.writeBreak();
+            }
+            checked.flush();
+            reserved.flush();
+
+            THEN("encoder output is identical")
+            {
+                REQUIRE(checked.bytes() == reserved.bytes());
+            }
+        }
+
+        WHEN("constant keys are encoded")
+        {
+            reserved.reserve(3 * CborBaseEncoder::MAX_FIELD_SIZE);
+            reserved.writeReserved<0>(1u);
+            reserved.writeReserved<23>(2u);
+            reserved.writeReserved<-24>(3u);
+            reserved.flush();
+
+            THEN("encoder output is correct")
+            {
+                const uint8_t EXPECTED[] =
+                    {
+                        0, 1,
+                        23, 2,
+                        0x20 | 23, 3,
+                    };
+
+                REQUIRE(reserved.compareBytes(EXPECTED, sizeof(EXPECTED)));
+            }
+        }
+    }
+}
+
+SCENARIO("Check CBOR encoder writes all buffered output at once", "[cbor]")
+{
+    GIVEN("A test CBOR encoder")
+    {
+        TestCborEncoder tcbe;
+
+        WHEN("more than the initial buffer size is encoded and flushed")
+        {
+            std::string str(1000, 'x');
+            std::size_t n_items = 2 * CborBaseEncoder::INITIAL_BUFFER_SIZE / str.size();
+
+            tcbe.writeArrayHeader();
+            for ( std::size_t i = 0; i < n_items; ++i )
+                tcbe.write(str);
+            tcbe.writeBreak();
+            std::size_t buffered = tcbe.bytes_buffered();
+            tcbe.flush();
+
+            THEN("the output is written in a single write")
+            {
+                REQUIRE(tcbe.n_writes() == 1);
+                REQUIRE(tcbe.bytes().size() == buffered);
+                REQUIRE(buffered == 2 + n_items * (3 + str.size()));
+                REQUIRE(tcbe.bytes_buffered() == 0);
+            }
+        }
+    }
+}
@@ -10,6 +10,7 @@
  * Developed by Sinodun IT (www.sinodun.com)
  */
 
+#include <memory>
 #include <string>
 
 #include "catch.hpp"
@@ -102,4 +103,47 @@ SCENARIO("Channels can have data added, removed and closed", "[channel]")
             }
         }
     }
+
+    GIVEN("Integer channel with a memory budget")
+    {
+        std::shared_ptr<MemoryBudget> budget = std::make_shared<MemoryBudget>();
+        budget->set_limit(MemoryBudget::Stage::CDNS, 30);
+        Channel<int> int_chan;
+        int_chan.set_memory_budget(budget, MemoryBudget::Stage::CDNS,
+                                   [](const int& i) { return static_cast<std::size_t>(i); });
+
+        WHEN("data is sent down the channel")
+        {
+            THEN("channel reports it is full when the budget is used")
+            {
+                REQUIRE(int_chan.put(40, false));
+                REQUIRE(budget->exhausted(MemoryBudget::Stage::CDNS));
+                REQUIRE(!int_chan.put(1, false));
+                REQUIRE(budget->usage(MemoryBudget::Stage::CDNS) == 40);
+
+                int i;
+                REQUIRE(int_chan.get(i));
+                REQUIRE(i == 40);
+                REQUIRE(budget->usage(MemoryBudget::Stage::CDNS) == 0);
+
+                REQUIRE(int_chan.put(10, false));
+                REQUIRE(int_chan.put(20, false));
+                REQUIRE(!int_chan.put(1, false));
+                REQUIRE(budget->total() == 30);
+            }
+        }
+
+        WHEN("a total limit is set")
+        {
+            budget->set_total_limit(15);
+
+            THEN("the total limit applies too")
+            {
+                REQUIRE(int_chan.put(10, false));
+                REQUIRE(!int_chan.put(10, false));
+                REQUIRE(int_chan.put(5, false));
+                REQUIRE(budget->total() == 15);
+            }
+        }
+    }
 }
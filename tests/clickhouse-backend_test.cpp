@@ -0,0 +1,123 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+#include "blockcbor.hpp"
+#include "clickhouse-backend.hpp"
+
+namespace {
+    std::vector<uint8_t> encode(const QueryResponseData& qrd)
+    {
+        std::string out;
+        ClickHouseBackend::encode_row(qrd, out);
+        return std::vector<uint8_t>(out.begin(), out.end());
+    }
+}
+
+SCENARIO("ClickHouse rows are encoded in RowBinary format", "[clickhouse]")
+{
+    GIVEN("A query with an IPv4 client and IPv6 server")
+    {
+        const uint8_t qname[] = "\x07" "example" "\x03" "com";
+
+        QueryResponseData qrd;
+        qrd.timestamp = std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::nanoseconds(0x1122334455667788)));
+        qrd.client_address = IPAddress(Tins::IPv4Address("192.0.2.1"));
+        qrd.client_port = 53000;
+        qrd.client_hoplimit = 64;
+        qrd.server_address = IPAddress(Tins::IPv6Address("2001:db8::1"));
+        qrd.server_port = 53;
+        qrd.qr_transport_flags = 1;
+        qrd.qr_flags = block_cbor::HAS_QUERY;
+        qrd.dns_flags = 0x0100;
+        qrd.id = 0x1234;
+        qrd.query_opcode = CaptureDNS::OP_QUERY;
+        qrd.query_class = CaptureDNS::INTERNET;
+        qrd.query_type = CaptureDNS::AAAA;
+        qrd.qname = byte_string(qname, sizeof(qname));
+        qrd.query_size = 40;
+
+        THEN("the row is encoded correctly")
+        {
+            const std::vector<uint8_t> expected = {
+                0x00, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11,   // timestamp_nanosecs
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // client_address
+                0x00, 0x00, 0xff, 0xff, 0xc0, 0x00, 0x02, 0x01,
+                0x00, 0x08, 0xcf,                                       // client_port
+                0x00, 0x40,                                             // client_hoplimit
+                0x00, 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,   // server_address
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+                0x00, 0x35, 0x00,                                       // server_port
+                0x00, 0x01,                                             // transport_flags
+                0x01,                                                   // transaction_type
+                0x01,                                                   // query_response_flags
+                0x00, 0x00, 0x01,                                       // dns_flags
+                0x00, 0x34, 0x12,                                       // id
+                0x00, 0x00,                                             // query_opcode
+                0x01,                                                   // query_rcode
+                0x00, 0x01, 0x00,                                       // query_class
+                0x00, 0x1c, 0x00,                                       // query_type
+                0x00, 0x0b, 'e', 'x', 'a', 'm', 'p', 'l', 'e',          // query_name
+                '.', 'c', 'o', 'm',
+                0x00, 0x28, 0x00, 0x00, 0x00,                           // query_len
+                0x00, 0x01, 0x00,                                       // query_qdcount
+                0x00, 0x00, 0x00,                                       // query_ancount
+                0x00, 0x00, 0x00,                                       // query_nscount
+                0x00, 0x00, 0x00,                                       // query_arcount
+                0x01,                                                   // query_edns_version
+                0x01,                                                   // query_edns_udp_payload_size
+                0x00,                                                   // query_opt_codes
+                0x01,                                                   // response_delay_nanosecs
+                0x01,                                                   // response_rcode
+                0x01,                                                   // response_len
+                0x01,                                                   // response_qdcount
+                0x01,                                                   // response_ancount
+                0x01,                                                   // response_nscount
+                0x01,                                                   // response_arcount
+            };
+            REQUIRE(encode(qrd) == expected);
+        }
+    }
+
+    GIVEN("A response with no question and no other data")
+    {
+        QueryResponseData qrd;
+        qrd.qr_flags = block_cbor::HAS_RESPONSE | block_cbor::RESPONSE_HAS_NO_QUESTION;
+        qrd.response_delay = std::chrono::nanoseconds(-2);
+
+        THEN("absent items are encoded as NULL")
+        {
+            const std::vector<uint8_t> expected = {
+                0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,         // timestamp to transaction_type
+                0x22,                                                   // query_response_flags
+                0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,         // dns_flags to query_len
+                0x01, 0x01, 0x01, 0x01, 0x01, 0x01,                     // query_qdcount to udp_payload_size
+                0x00,                                                   // query_opt_codes
+                0x00, 0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,   // response_delay_nanosecs
+                0x01,                                                   // response_rcode
+                0x01,                                                   // response_len
+                0x00, 0x00, 0x00,                                       // response_qdcount
+                0x00, 0x00, 0x00,                                       // response_ancount
+                0x00, 0x00, 0x00,                                       // response_nscount
+                0x00, 0x00, 0x00,                                       // response_arcount
+            };
+            REQUIRE(encode(qrd) == expected);
+        }
+    }
+}
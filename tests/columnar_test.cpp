@@ -0,0 +1,205 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "catch.hpp"
+
+#include "makeunique.hpp"
+
+#include "columnar.hpp"
+
+using namespace columnar;
+
+SCENARIO("Columnar files can be written and read", "[columnar]")
+{
+    GIVEN("A columnar file with several chunks")
+    {
+        boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("columnar-%%%%-%%%%.cdcol");
+        byte_string addr1 = { 192, 0, 2, 1 };
+        byte_string addr2 = { 192, 0, 2, 2 };
+        byte_string name = { 3, 'w', 'w', 'w', 0 };
+
+        {
+            Writer w(make_unique<StreamWriter>(path.string(), 0), 4);
+            for ( int i = 0; i < 10; ++i )
+            {
+                Row row;
+                row.values[TIMESTAMP] = 1000 + i;
+                row.values[CLIENT_ADDRESS] = w.address_index(( i % 2 ) ? addr2 : addr1);
+                row.values[QUERY_TYPE] = ( i < 4 ) ? 1 : 28;
+                if ( i != 5 )
+                    row.values[QUERY_NAME] = w.name_index(name);
+                w.add(row);
+            }
+        }
+
+        WHEN("the file is read")
+        {
+            Reader r(path.string());
+
+            THEN("the contents are as written")
+            {
+                REQUIRE(r.chunks() == 3);
+                REQUIRE(r.rows(0) == 4);
+                REQUIRE(r.rows(2) == 2);
+
+                const int64_t* ts = r.column<int64_t>(1, TIMESTAMP);
+                REQUIRE(ts[0] == 1004);
+                REQUIRE(ts[3] == 1007);
+                REQUIRE(r.min(1, TIMESTAMP) == 1004);
+                REQUIRE(r.max(1, TIMESTAMP) == 1007);
+
+                REQUIRE(r.min(0, QUERY_TYPE) == 1);
+                REQUIRE(r.max(0, QUERY_TYPE) == 1);
+                REQUIRE(r.min(1, QUERY_TYPE) == 28);
+                REQUIRE(r.min(0, RESPONSE_RCODE) == column_null(RESPONSE_RCODE));
+
+                const uint32_t* clients = r.column<uint32_t>(0, CLIENT_ADDRESS);
+                REQUIRE(r.address_count() == 2);
+                REQUIRE(r.address(clients[0]) == addr1);
+                REQUIRE(r.address(clients[1]) == addr2);
+
+                const uint32_t* names = r.column<uint32_t>(1, QUERY_NAME);
+                REQUIRE(r.name_count() == 1);
+                REQUIRE(r.name(names[0]) == name);
+                REQUIRE(names[1] == NO_INDEX);
+
+                REQUIRE_THROWS_AS(r.column<uint16_t>(0, TIMESTAMP), columnar_error);
+                REQUIRE_THROWS_AS(r.rows(3), columnar_error);
+                REQUIRE_THROWS_AS(r.address(2), columnar_error);
+            }
+        }
+
+        boost::filesystem::remove(path);
+    }
+
+    GIVEN("A columnar file with a corrupt chunk count")
+    {
+        boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("columnar-%%%%-%%%%.cdcol");
+        {
+            Writer w(make_unique<StreamWriter>(path.string(), 0), 4);
+            Row row;
+            row.values[TIMESTAMP] = 1000;
+            w.add(row);
+        }
+
+        {
+            // Choose a count whose size in bytes wraps to a small value.
+            std::fstream fs(path.string(), std::ios::in | std::ios::out | std::ios::binary);
+            uint64_t footer;
+            fs.seekg(-16, std::ios::end);
+            fs.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+            uint64_t count = ~0ULL / ( 8 + 24 * COLUMN_COUNT ) + 1;
+            fs.seekp(footer);
+            fs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        }
+
+        THEN("reading it fails")
+        {
+            REQUIRE_THROWS_AS(Reader(path.string()), columnar_error);
+        }
+
+        boost::filesystem::remove(path);
+    }
+
+    GIVEN("A columnar file with corrupt row and dictionary sizes")
+    {
+        boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("columnar-%%%%-%%%%.cdcol");
+        byte_string addr = { 192, 0, 2, 1 };
+        {
+            Writer w(make_unique<StreamWriter>(path.string(), 0), 4);
+            Row row;
+            row.values[TIMESTAMP] = 1000;
+            row.values[CLIENT_ADDRESS] = w.address_index(addr);
+            w.add(row);
+        }
+
+        uint64_t footer, chunk_info, address_dict;
+        {
+            std::ifstream ifs(path.string(), std::ios::binary);
+            ifs.seekg(-16, std::ios::end);
+            ifs.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+            ifs.seekg(footer + 8);
+            ifs.read(reinterpret_cast<char*>(&address_dict), sizeof(address_dict));
+            chunk_info = footer + 24;
+        }
+
+        // Choose values whose use in offsets or sizes wraps around.
+        auto patch = [&](uint64_t offset, uint64_t val)
+            {
+                std::fstream fs(path.string(), std::ios::in | std::ios::out | std::ios::binary);
+                fs.seekp(offset);
+                fs.write(reinterpret_cast<const char*>(&val), sizeof(val));
+            };
+
+        WHEN("the row count is corrupt")
+        {
+            patch(chunk_info, ~0ULL / 8 + 1);
+            Reader r(path.string());
+
+            THEN("reading a column fails")
+            {
+                REQUIRE_THROWS_AS(r.column<int64_t>(0, TIMESTAMP), columnar_error);
+            }
+        }
+
+        WHEN("the dictionary count is corrupt")
+        {
+            patch(address_dict, ~0ULL / 8);
+            Reader r(path.string());
+
+            THEN("reading a dictionary item fails")
+            {
+                REQUIRE_THROWS_AS(r.address(0), columnar_error);
+            }
+        }
+
+        WHEN("a dictionary item offset is corrupt")
+        {
+            patch(address_dict + 8, ~0ULL - 8);
+            patch(address_dict + 16, ~0ULL - 4);
+            Reader r(path.string());
+
+            THEN("reading a dictionary item fails")
+            {
+                REQUIRE_THROWS_AS(r.address(0), columnar_error);
+            }
+        }
+
+        boost::filesystem::remove(path);
+    }
+
+    GIVEN("A file that is not a columnar file")
+    {
+        boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("columnar-%%%%-%%%%.cdcol");
+        {
+            std::ofstream ofs(path.string());
+            ofs << "Not a columnar file, but long enough to have a header and trailer.";
+        }
+
+        THEN("reading it fails")
+        {
+            REQUIRE_THROWS_AS(Reader(path.string()), columnar_error);
+        }
+
+        boost::filesystem::remove(path);
+    }
+}
@@ -368,3 +368,39 @@ SCENARIO("DnsTap control sequence", "[dnstap]")
         }
     }
 }
+
+SCENARIO("DnsTap streams may end without STOP", "[dnstap]")
+{
+    const char start_raw[] =
+        "\0\0\0\0"   // Control frame escape
+        "\0\0\0\x22" // Overall length
+        "\0\0\0\2"   // control type
+        "\0\0\0\1"   // control field type
+        "\0\0\0\x16" // control field length
+        "protobuf:dnstap.Dnstap";
+    DnsTap::DNSSink dnstap_sink =
+        [&](std::unique_ptr<DNSMessage>& /* dns */)
+        {
+        };
+    DnsTap tap;
+
+    GIVEN("A stream that ends after a complete frame")
+    {
+        std::stringstream str(std::string(start_raw, sizeof(start_raw) - 1));
+
+        THEN("the stream is closed normally")
+        {
+            REQUIRE_NOTHROW(tap.process_stream(str, dnstap_sink));
+        }
+    }
+
+    GIVEN("A stream that ends part way through a frame")
+    {
+        std::stringstream str(std::string(start_raw, sizeof(start_raw) - 5));
+
+        THEN("the stream is in error")
+        {
+            REQUIRE_THROWS_AS(tap.process_stream(str, dnstap_sink), std::system_error);
+        }
+    }
+}
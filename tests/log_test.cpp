@@ -0,0 +1,140 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <csignal>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <dirent.h>
+
+#include "catch.hpp"
+#include "log.hpp"
+
+SCENARIO("Log messages from a call site are rate limited", "[log]")
+{
+    GIVEN("A rate limiter")
+    {
+        LogRateLimiter limiter;
+        uint64_t suppressed = 99;
+
+        WHEN("a burst of messages is logged")
+        {
+            unsigned allowed = 0;
+            for ( unsigned i = 0; i < LogRateLimiter::BURST + 5; ++i )
+                if ( limiter.allow(100, suppressed) )
+                    ++allowed;
+
+            THEN("only the burst is allowed")
+            {
+                REQUIRE(allowed == LogRateLimiter::BURST);
+            }
+
+            AND_WHEN("the interval ends")
+            {
+                bool res = limiter.allow(100 + LogRateLimiter::INTERVAL_SECONDS, suppressed);
+
+                THEN("the next message reports the suppressed messages")
+                {
+                    REQUIRE(res);
+                    REQUIRE(suppressed == 5);
+                    REQUIRE(limiter.allow(100 + LogRateLimiter::INTERVAL_SECONDS, suppressed));
+                    REQUIRE(suppressed == 0);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Log permits report suppressed messages", "[log]")
+{
+    GIVEN("A limiter that has suppressed messages")
+    {
+        LogRateLimiter limiter;
+        uint64_t suppressed;
+        for ( unsigned i = 0; i < LogRateLimiter::BURST + 3; ++i )
+            limiter.allow(0, suppressed);
+
+        WHEN("a permit is written in a later interval")
+        {
+            LogPermit permit(limiter);
+            std::ostringstream oss;
+            oss << permit;
+
+            THEN("the count is shown")
+            {
+                REQUIRE(static_cast<bool>(permit));
+                REQUIRE(oss.str() == "(3 similar messages suppressed) ");
+            }
+        }
+    }
+}
+
+#ifdef __linux__
+namespace {
+    // Return the blocked signal mask of the named thread, from /proc.
+    bool thread_blocked_signals(const std::string& name, unsigned long long& blocked)
+    {
+        DIR* dir = opendir("/proc/self/task");
+        if ( !dir )
+            return false;
+
+        bool found = false;
+        while ( struct dirent* ent = readdir(dir) )
+        {
+            std::string task = std::string("/proc/self/task/") + ent->d_name;
+            std::string comm;
+            std::ifstream(task + "/comm") >> comm;
+            if ( comm != name )
+                continue;
+
+            std::ifstream status(task + "/status");
+            std::string line;
+            while ( std::getline(status, line) )
+                if ( line.compare(0, 7, "SigBlk:") == 0 )
+                {
+                    blocked = std::stoull(line.substr(7), nullptr, 16);
+                    found = true;
+                }
+        }
+        closedir(dir);
+        return found;
+    }
+}
+
+SCENARIO("The logging thread does not take signals", "[log]")
+{
+    GIVEN("Logging is started")
+    {
+        sigset_t before, after;
+        pthread_sigmask(SIG_BLOCK, nullptr, &before);
+        init_logging();
+        pthread_sigmask(SIG_BLOCK, nullptr, &after);
+
+        // init_logging() may only be called once, so there is a
+        // single path through this scenario.
+        THEN("signals are blocked in the logging thread")
+        {
+            unsigned long long blocked = 0;
+            REQUIRE(thread_blocked_signals("comp:log", blocked));
+            for ( int sig : { SIGHUP, SIGINT, SIGTERM, SIGUSR1, SIGPIPE } )
+                REQUIRE((blocked & (1ULL << (sig - 1))) != 0);
+
+            AND_THEN("the mask of the starting thread is unchanged")
+            {
+                for ( int sig = 1; sig < NSIG; ++sig )
+                    REQUIRE(sigismember(&before, sig) == sigismember(&after, sig));
+            }
+        }
+    }
+}
+#endif
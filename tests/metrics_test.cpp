@@ -0,0 +1,169 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+#include "catch.hpp"
+#include "metrics.hpp"
+
+namespace {
+    std::string read_file(const std::string& name)
+    {
+        std::ifstream ifs(name);
+        return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+
+    // Find a free loopback port.
+    unsigned free_port()
+    {
+        boost::asio::io_service service;
+        boost::asio::ip::tcp::acceptor acceptor(
+            service, boost::asio::ip::tcp::endpoint(
+                boost::asio::ip::address::from_string("127.0.0.1"), 0));
+        return acceptor.local_endpoint().port();
+    }
+
+    // Send a request, and return everything received until the
+    // server closes the connection.
+    std::string http_get(unsigned port, const std::string& request)
+    {
+        boost::asio::io_service service;
+        boost::asio::ip::tcp::socket socket(service);
+        socket.connect(boost::asio::ip::tcp::endpoint(
+                           boost::asio::ip::address::from_string("127.0.0.1"), port));
+        boost::asio::write(socket, boost::asio::buffer(request));
+        boost::asio::streambuf buf;
+        boost::system::error_code ec;
+        boost::asio::read(socket, buf, ec);
+        return std::string(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_end(buf.data()));
+    }
+}
+
+SCENARIO("Metrics are written in Prometheus text format", "[metrics]")
+{
+    GIVEN("Some metrics")
+    {
+        MetricsText mt;
+        mt.counter("test_packets_total", "Packets\nreceived.", 12345678901234ULL);
+        mt.family("test_queue_length", "gauge", "Queue length.");
+        mt.sample("test_queue_length", {{"queue", "a\"b"}}, static_cast<uint64_t>(3));
+        mt.sample("test_queue_length", {{"queue", "c"}, {"kind", "d"}}, 0.5);
+
+        THEN("the text is correct")
+        {
+            REQUIRE(mt.str() ==
+                    "# HELP test_packets_total Packets\\nreceived.\n"
+                    "# TYPE test_packets_total counter\n"
+                    "test_packets_total 12345678901234\n"
+                    "# HELP test_queue_length Queue length.\n"
+                    "# TYPE test_queue_length gauge\n"
+                    "test_queue_length{queue=\"a\\\"b\"} 3\n"
+                    "test_queue_length{queue=\"c\",kind=\"d\"} 0.5\n");
+        }
+    }
+}
+
+SCENARIO("Metrics can be read from the server", "[metrics]")
+{
+    GIVEN("A server with a socket and file")
+    {
+        std::string socket_path = "metrics_test.sock";
+        std::string file = "metrics_test.prom";
+        std::remove(file.c_str());
+
+        MetricsServer server(socket_path, "127.0.0.1", 0, file);
+        server.publish("test_value 1\n");
+
+        THEN("the latest metrics are available")
+        {
+            REQUIRE(server.text() == "test_value 1\n");
+        }
+
+        THEN("the socket returns the metrics")
+        {
+            boost::asio::io_service service;
+            boost::asio::local::stream_protocol::socket socket(service);
+            socket.connect(boost::asio::local::stream_protocol::endpoint(socket_path));
+            boost::asio::streambuf buf;
+            boost::system::error_code ec;
+            boost::asio::read(socket, buf, ec);
+            REQUIRE(ec == boost::asio::error::eof);
+            std::string res(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_end(buf.data()));
+            REQUIRE(res == "test_value 1\n");
+        }
+
+        THEN("the file is written")
+        {
+            for ( int i = 0; i < 100 && read_file(file).empty(); ++i )
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(read_file(file) == "test_value 1\n");
+            std::remove(file.c_str());
+        }
+
+        THEN("the file has the latest of several updates")
+        {
+            for ( int i = 2; i <= 1000; ++i )
+                server.publish("test_value " + std::to_string(i) + "\n");
+            for ( int i = 0; i < 100 && read_file(file) != "test_value 1000\n"; ++i )
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            REQUIRE(read_file(file) == "test_value 1000\n");
+            std::remove(file.c_str());
+        }
+    }
+}
+
+SCENARIO("Metrics can be fetched over HTTP", "[metrics]")
+{
+    GIVEN("A server on a TCP port")
+    {
+        unsigned port = free_port();
+        MetricsServer server("", "127.0.0.1", port, "");
+        server.publish("test_value 1\n");
+        const std::string headers =
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+            "Content-Length: 13\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+
+        THEN("GET returns the metrics")
+        {
+            REQUIRE(http_get(port, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n") ==
+                    headers + "test_value 1\n");
+        }
+
+        THEN("HEAD returns the headers only")
+        {
+            REQUIRE(http_get(port, "HEAD /metrics HTTP/1.1\r\n\r\n") == headers);
+        }
+
+        THEN("other paths and methods are rejected")
+        {
+            REQUIRE(http_get(port, "GET /other HTTP/1.1\r\n\r\n").find("HTTP/1.0 404 Not Found\r\n") == 0);
+            REQUIRE(http_get(port, "POST /metrics HTTP/1.1\r\n\r\n").find("HTTP/1.0 405 Method Not Allowed\r\n") == 0);
+        }
+
+        THEN("an incomplete request times out")
+        {
+            auto start = std::chrono::steady_clock::now();
+            REQUIRE(http_get(port, "GET /metrics HTTP/1.1\r\n").empty());
+            REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(30));
+        }
+    }
+}
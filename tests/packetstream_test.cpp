@@ -396,6 +396,55 @@ SCENARIO("PacketStream correctly parses packet", "[parse]")
         }
     }
 
+    GIVEN("A DNS message with an ignored OPCODE")
+    {
+        const uint8_t msg_raw[] =
+            { 0x60,0xEB,0x69,0x8F,0x3C,0xB4,
+              0x00,0x21,0x59,0x00,0xCF,0xF0,
+              0x86,0xDD,
+              0x60,0x00,
+              0x00,0x00,0x00,0x3A,0x11,0x3B,0x20,0x01,
+              0x05,0x78,0x00,0x03,0x11,0x01,0x00,0x00,
+              0x00,0x00,0x00,0xBF,0x00,0x02,0x20,0x01,
+              0x05,0x00,0x00,0x03,0x00,0x00,0x00,0x00,
+              0x00,0x00,0x00,0x00,0x00,0x42,0xB5,0x2A,
+              0x00,0x35,0x00,0x3A,0xE7,0xEC,0x0F,0x93,
+              0x00,0x10,0x00,0x01,0x00,0x00,0x00,0x00,
+              0x00,0x01,0x08,0x72,0x69,0x39,0x35,0x6E,
+              0x73,0x30,0x31,0x08,0x77,0x6B,0x67,0x6C,
+              0x6F,0x62,0x61,0x6C,0x03,0x6E,0x65,0x74,
+              0x00,0x00,0x01,0x00,0x01,0x00,0x00,0x29,
+              0x10,0x00,0x00,0x00,0x80,0x00,0x00,0x00 };
+        Tins::Packet pkt(Tins::EthernetII(msg_raw, sizeof(msg_raw)),
+                         std::chrono::microseconds(2000000));
+        std::vector<PacketStream::DiscardReason> discarded;
+        PacketStream::DiscardSink discard_sink =
+            [&](PacketStream::DiscardReason reason)
+            {
+                discarded.push_back(reason);
+            };
+        PacketStream discard_stream(config, dns_sink, address_event_sink, discard_sink);
+
+        THEN("Message is discarded before decoding")
+        {
+            config.ignore_opcodes = { 0 };
+            std::shared_ptr<PcapItem> pcap = std::make_shared<PcapItem>(pkt);
+            discard_stream.process_packet(pcap);
+            REQUIRE(dns_msgs.size() == 0);
+            REQUIRE(discarded.size() == 1);
+            REQUIRE(discarded[0] == PacketStream::DiscardReason::OPCODE);
+        }
+
+        THEN("Message is decoded if OPCODE is accepted")
+        {
+            config.accept_opcodes = { 0 };
+            std::shared_ptr<PcapItem> pcap = std::make_shared<PcapItem>(pkt);
+            discard_stream.process_packet(pcap);
+            REQUIRE(dns_msgs.size() == 1);
+            REQUIRE(discarded.size() == 0);
+        }
+    }
+
     GIVEN("A DNS message in non-VLAN is processed when VLAN ID set")
     {
         const uint8_t msg_raw[] =
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+#include "pcapframe.hpp"
+#include "pcapwriter.hpp"
+
+namespace {
+    /**
+     * \brief Output written by TestWriter.
+     */
+    std::vector<uint8_t> test_output;
+
+    /**
+     * \brief Number of writes made by TestWriter.
+     */
+    unsigned test_writes;
+
+    class TestWriter
+    {
+    public:
+        TestWriter(const std::string&, unsigned, bool) {}
+
+        void writeBytes(const uint8_t* p, std::streamsize n)
+        {
+            test_output.insert(test_output.end(), p, p + n);
+            ++test_writes;
+        }
+    };
+}
+
+SCENARIO("Captured frames are pooled", "[pcap]")
+{
+    GIVEN("A frame pool")
+    {
+        std::shared_ptr<PcapFramePool> pool = PcapFramePool::create();
+        const uint8_t data[] = { 1, 2, 3, 4, 5 };
+
+        WHEN("a frame is made")
+        {
+            std::shared_ptr<PcapFrame> frame = pool->make_frame(DLT_EN10MB, 10, 20, 5, 60, data);
+
+            THEN("the frame holds a PCAP record")
+            {
+                uint32_t header[4];
+                std::memcpy(header, frame->record.data(), sizeof(header));
+                REQUIRE(header[0] == 10);
+                REQUIRE(header[1] == 20);
+                REQUIRE(header[2] == 5);
+                REQUIRE(header[3] == 60);
+                REQUIRE(frame->linktype == DLT_EN10MB);
+                REQUIRE(frame->size() == 5);
+                REQUIRE(std::memcmp(frame->data(), data, 5) == 0);
+            }
+
+            THEN("a released frame buffer is reused")
+            {
+                const PcapFrame* first = frame.get();
+                frame.reset();
+                frame = pool->make_frame(DLT_RAW, 11, 21, 3, 3, data);
+                REQUIRE(frame.get() == first);
+                REQUIRE(frame->linktype == DLT_RAW);
+                REQUIRE(frame->size() == 3);
+            }
+
+            THEN("frames may outlive the pool")
+            {
+                pool.reset();
+                REQUIRE(frame->size() == 5);
+            }
+        }
+    }
+}
+
+SCENARIO("PCAP writers write captured frames", "[pcap]")
+{
+    GIVEN("A writer and some frames")
+    {
+        std::shared_ptr<PcapFramePool> pool = PcapFramePool::create();
+        std::vector<uint8_t> data(1000, 0x55);
+        test_output.clear();
+        test_writes = 0;
+
+        WHEN("frames are written")
+        {
+            {
+                PcapWriter<TestWriter> writer("test.pcap", 0, 65535);
+                for ( unsigned i = 0; i < 200; ++i )
+                    writer.write_frame(*pool->make_frame(DLT_LINUX_SLL, i, 0, data.size(), data.size(), data.data()));
+            }
+
+            THEN("output is the file header and the frames, written in batches")
+            {
+                REQUIRE(test_output.size() == 24 + 200 * (16 + 1000));
+                uint32_t linktype;
+                std::memcpy(&linktype, test_output.data() + 20, sizeof(linktype));
+                REQUIRE(linktype == DLT_LINUX_SLL);
+                uint32_t ts_sec;
+                std::memcpy(&ts_sec, test_output.data() + 24 + 199 * (16 + 1000), sizeof(ts_sec));
+                REQUIRE(ts_sec == 199);
+                REQUIRE(test_writes < 10);
+            }
+        }
+    }
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "catch.hpp"
+
+#include "blockcbordata.hpp"
+#include "capturedns.hpp"
+#include "configuration.hpp"
+#include "ipaddress.hpp"
+
+#include "qrfilter.hpp"
+
+using namespace block_cbor;
+
+SCENARIO("QueryResponseFilter selects items using block tables", "[qrfilter]")
+{
+    GIVEN("A block with some addresses, names and signatures")
+    {
+        BlockParameters bp;
+        std::vector<BlockParameters> bpv;
+        bpv.push_back(bp);
+        BlockData cd(bpv);
+        Defaults defaults;
+
+        index_t client4 = cd.add_address(IPAddress("192.0.2.1").asNetworkBinary());
+        index_t client6 = cd.add_address(IPAddress("2001:db8::1").asNetworkBinary());
+        index_t server4 = cd.add_address(IPAddress("198.51.100.53").asNetworkBinary());
+        index_t www = cd.add_name_rdata(CaptureDNS::encode_domain_name("WWW.Example.com"));
+        index_t other = cd.add_name_rdata(CaptureDNS::encode_domain_name("notexample.com"));
+
+        ClassType ct_a;
+        ct_a.qclass = CaptureDNS::INTERNET;
+        ct_a.qtype = CaptureDNS::A;
+        index_t a = cd.add_classtype(ct_a);
+
+        ClassType ct_aaaa;
+        ct_aaaa.qclass = CaptureDNS::INTERNET;
+        ct_aaaa.qtype = CaptureDNS::AAAA;
+        index_t aaaa = cd.add_classtype(ct_aaaa);
+
+        QueryResponseSignature sig_udp4;
+        sig_udp4.server_address = server4;
+        sig_udp4.qr_transport_flags = UDP;
+        sig_udp4.query_classtype = a;
+        sig_udp4.response_rcode = CaptureDNS::NOERROR;
+        index_t udp4 = cd.add_query_response_signature(sig_udp4);
+
+        QueryResponseSignature sig_tcp6;
+        sig_tcp6.qr_transport_flags = TCP | IPV6;
+        sig_tcp6.query_classtype = aaaa;
+        sig_tcp6.response_rcode = CaptureDNS::NXDOMAIN;
+        index_t tcp6 = cd.add_query_response_signature(sig_tcp6);
+
+        QueryResponseItem qri4;
+        qri4.client_address = client4;
+        qri4.qname = www;
+        qri4.signature = udp4;
+
+        QueryResponseItem qri6;
+        qri6.client_address = client6;
+        qri6.qname = other;
+        qri6.signature = tcp6;
+
+        WHEN("filtering on client prefix")
+        {
+            QueryResponseFilter f;
+            f.add_client_prefix("192.0.2.0/24");
+            REQUIRE(!f.empty());
+
+            THEN("only the matching client is accepted")
+            {
+                REQUIRE(f.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(f.accept(qri4));
+                REQUIRE(!f.accept(qri6));
+            }
+        }
+
+        WHEN("filtering on server prefix")
+        {
+            QueryResponseFilter f;
+            f.add_server_prefix("198.51.100.53");
+
+            THEN("only the matching server is accepted")
+            {
+                REQUIRE(f.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(f.accept(qri4));
+                REQUIRE(!f.accept(qri6));
+            }
+        }
+
+        WHEN("filtering on qname suffix")
+        {
+            QueryResponseFilter f;
+            f.add_qname_suffix("example.COM.");
+
+            THEN("only whole label matches are accepted, ignoring case")
+            {
+                REQUIRE(f.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(f.accept(qri4));
+                REQUIRE(!f.accept(qri6));
+            }
+        }
+
+        WHEN("filtering on qtype, rcode and transport")
+        {
+            QueryResponseFilter f1;
+            f1.add_qtype("AAAA");
+            QueryResponseFilter f2;
+            f2.add_rcode("nxdomain");
+            QueryResponseFilter f3;
+            f3.add_transport("tcp");
+
+            THEN("only the matching signature is accepted")
+            {
+                for ( auto* f : { &f1, &f2, &f3 } )
+                {
+                    REQUIRE(f->select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                    REQUIRE(!f->accept(qri4));
+                    REQUIRE(f->accept(qri6));
+                }
+            }
+        }
+
+        WHEN("filters match nothing in the block tables")
+        {
+            QueryResponseFilter f1;
+            f1.add_client_prefix("10.0.0.0/8");
+            QueryResponseFilter f2;
+            f2.add_qname_suffix("example.net");
+            QueryResponseFilter f3;
+            f3.add_qtype("MX");
+            QueryResponseFilter f4;
+            f4.add_transport("doh");
+
+            THEN("the block is not selected")
+            {
+                REQUIRE(!f1.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(!f2.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(!f3.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(!f4.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+            }
+        }
+
+        WHEN("filters are combined")
+        {
+            QueryResponseFilter f;
+            f.add_qtype("A");
+            f.add_qtype("AAAA");
+            f.add_client_prefix("2001:db8::/32");
+
+            THEN("values are alternatives and criteria must all match")
+            {
+                REQUIRE(f.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(!f.accept(qri4));
+                REQUIRE(f.accept(qri6));
+            }
+        }
+    }
+}
+
+SCENARIO("QueryResponseFilter matches truncated addresses by transport", "[qrfilter]")
+{
+    GIVEN("A block with addresses stored with a short prefix")
+    {
+        BlockParameters bp;
+        bp.storage_parameters.client_address_prefix_ipv4 = 16;
+        bp.storage_parameters.client_address_prefix_ipv6 = 32;
+        std::vector<BlockParameters> bpv;
+        bpv.push_back(bp);
+        BlockData cd(bpv);
+        Defaults defaults;
+
+        // 4 bytes, so IPv4 or IPv6 depending on the transport.
+        const byte_string addr = { 0x20, 0x01, 0x0d, 0xb8 };
+        index_t client = cd.add_address(addr);
+
+        QueryResponseSignature sig4;
+        sig4.qr_transport_flags = UDP;
+        index_t udp4 = cd.add_query_response_signature(sig4);
+
+        QueryResponseSignature sig6;
+        sig6.qr_transport_flags = UDP | IPV6;
+        index_t udp6 = cd.add_query_response_signature(sig6);
+
+        QueryResponseItem qri4;
+        qri4.client_address = client;
+        qri4.signature = udp4;
+
+        QueryResponseItem qri6;
+        qri6.client_address = client;
+        qri6.signature = udp6;
+
+        WHEN("filtering on an IPv6 prefix")
+        {
+            QueryResponseFilter f;
+            f.add_client_prefix("2001:db8::/32");
+
+            THEN("only the IPv6 item is accepted")
+            {
+                REQUIRE(f.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(!f.accept(qri4));
+                REQUIRE(f.accept(qri6));
+            }
+        }
+
+        WHEN("filtering on an IPv4 prefix")
+        {
+            QueryResponseFilter f;
+            f.add_client_prefix("32.1.0.0/16");
+
+            THEN("only the IPv4 item is accepted")
+            {
+                REQUIRE(f.select_block(cd, bp.storage_parameters, defaults, FileFormatVersion::format_10));
+                REQUIRE(f.accept(qri4));
+                REQUIRE(!f.accept(qri6));
+            }
+        }
+    }
+}
+
+SCENARIO("QueryResponseFilter rejects bad criteria", "[qrfilter]")
+{
+    GIVEN("A filter")
+    {
+        QueryResponseFilter f;
+
+        THEN("invalid values are reported")
+        {
+            REQUIRE_THROWS_AS(f.add_client_prefix("192.0.2.0/33"), boost::program_options::error);
+            REQUIRE_THROWS_AS(f.add_server_prefix("not-an-address"), boost::program_options::error);
+            REQUIRE_THROWS_AS(f.add_qtype("NOTATYPE"), boost::program_options::error);
+            REQUIRE_THROWS_AS(f.add_rcode("NOTANRCODE"), boost::program_options::error);
+            REQUIRE_THROWS_AS(f.add_transport("quic"), boost::program_options::error);
+            REQUIRE(f.empty());
+        }
+    }
+}
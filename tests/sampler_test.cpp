@@ -0,0 +1,125 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <stdexcept>
+
+#include "catch.hpp"
+#include "ipaddress.hpp"
+#include "sampler.hpp"
+
+SCENARIO("Sampler methods can be found by name", "[sampler]")
+{
+    GIVEN("Some method names")
+    {
+        THEN("known names are found")
+        {
+            REQUIRE(Sampler::find_method("packet") == Sampler::Method::PACKET);
+            REQUIRE(Sampler::find_method("transaction") == Sampler::Method::TRANSACTION);
+            REQUIRE(Sampler::find_method("client") == Sampler::Method::CLIENT);
+        }
+
+        THEN("unknown names are rejected")
+        {
+            REQUIRE_THROWS_AS(Sampler::find_method("flow"), std::invalid_argument);
+        }
+    }
+}
+
+SCENARIO("Sampler keeps the expected traffic", "[sampler]")
+{
+    GIVEN("A packet sampler")
+    {
+        Sampler sampler(Sampler::Method::PACKET, 24, 48);
+
+        THEN("everything is kept until sampling starts")
+        {
+            REQUIRE(!sampler.by_packet());
+            REQUIRE(!sampler.by_message());
+            REQUIRE(sampler.keep(1));
+            REQUIRE(sampler.keep(IPAddress("192.0.2.1"), 1234, 1));
+        }
+
+        WHEN("sampling starts")
+        {
+            sampler.set_rate(10);
+
+            THEN("1 in rate packets are kept")
+            {
+                REQUIRE(sampler.by_packet());
+                REQUIRE(!sampler.by_message());
+                REQUIRE(sampler.keep(20));
+                REQUIRE(!sampler.keep(21));
+            }
+        }
+    }
+
+    GIVEN("A transaction sampler")
+    {
+        Sampler sampler(Sampler::Method::TRANSACTION, 24, 48);
+        sampler.set_rate(8);
+        IPAddress client4("192.0.2.1");
+        IPAddress client6("2001:db8::1");
+
+        THEN("messages are sampled")
+        {
+            REQUIRE(!sampler.by_packet());
+            REQUIRE(sampler.by_message());
+        }
+
+        THEN("decisions are consistent and approximately 1 in rate")
+        {
+            unsigned kept4 = 0, kept6 = 0;
+            for ( unsigned id = 0; id < 8000; ++id )
+            {
+                bool keep4 = sampler.keep(client4, 5353, id);
+                REQUIRE(keep4 == sampler.keep(client4, 5353, id));
+                if ( keep4 )
+                    kept4++;
+                if ( sampler.keep(client6, 5353, id) )
+                    kept6++;
+            }
+            REQUIRE(kept4 > 800);
+            REQUIRE(kept4 < 1200);
+            REQUIRE(kept6 > 800);
+            REQUIRE(kept6 < 1200);
+        }
+    }
+
+    GIVEN("A client sampler")
+    {
+        Sampler sampler(Sampler::Method::CLIENT, 24, 48);
+        sampler.set_rate(4);
+
+        THEN("all traffic from a client prefix is treated alike")
+        {
+            bool keep4 = sampler.keep(IPAddress("192.0.2.1"), 1, 1);
+            bool keep6 = sampler.keep(IPAddress("2001:db8:1::1"), 1, 1);
+            for ( unsigned i = 2; i < 200; ++i )
+            {
+                IPAddress a4("192.0.2." + std::to_string(i));
+                IPAddress a6("2001:db8:1:" + std::to_string(i) + "::1");
+                REQUIRE(sampler.keep(a4, i, i * 3) == keep4);
+                REQUIRE(sampler.keep(a6, i, i * 3) == keep6);
+            }
+        }
+
+        THEN("different client prefixes are sampled")
+        {
+            unsigned kept = 0;
+            for ( unsigned i = 0; i < 256; ++i )
+                if ( sampler.keep(IPAddress("10.0." + std::to_string(i) + ".1"), 1, 1) )
+                    kept++;
+            REQUIRE(kept > 32);
+            REQUIRE(kept < 96);
+        }
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <sstream>
+#include <thread>
+
+#include "catch.hpp"
+#include "stagetimes.hpp"
+
+SCENARIO("Histogram buckets have bounded error", "[stagetimes]")
+{
+    GIVEN("Some values")
+    {
+        THEN("small values are exact")
+        {
+            for ( uint64_t v = 0; v < 32; ++v )
+                REQUIRE(LatencyHistogram::highest_value(LatencyHistogram::bucket(v)) == v);
+        }
+
+        THEN("large values are within the bucket resolution")
+        {
+            for ( uint64_t v : { 100ULL, 1000ULL, 123456ULL, 999999999ULL, ~0ULL } )
+            {
+                std::size_t b = LatencyHistogram::bucket(v);
+                REQUIRE(b < LatencyHistogram::BUCKETS);
+                uint64_t high = LatencyHistogram::highest_value(b);
+                REQUIRE(high >= v);
+                REQUIRE(high - v <= v / LatencyHistogram::SUB_BUCKETS);
+                REQUIRE(LatencyHistogram::bucket(high) == b);
+                if ( high < ~0ULL )
+                    REQUIRE(LatencyHistogram::bucket(high + 1) == b + 1);
+            }
+        }
+    }
+}
+
+SCENARIO("Histograms give percentiles", "[stagetimes]")
+{
+    GIVEN("A histogram of the values 1 to 100")
+    {
+        LatencyHistogram h;
+        for ( uint64_t v = 1; v <= 100; ++v )
+            h.record(v);
+
+        THEN("the summary values are right")
+        {
+            REQUIRE(h.count() == 100);
+            REQUIRE(h.mean() == Approx(50.5));
+            REQUIRE(h.percentile(0) == 1);
+            REQUIRE(h.percentile(50) >= 50);
+            REQUIRE(h.percentile(50) <= 53);
+            REQUIRE(h.percentile(100) == h.max());
+            REQUIRE(h.max() >= 100);
+            REQUIRE(h.max() <= 103);
+        }
+
+        WHEN("an earlier copy is removed")
+        {
+            LatencyHistogram earlier = h;
+            h.record(1000);
+            h -= earlier;
+
+            THEN("only the later value remains")
+            {
+                REQUIRE(h.count() == 1);
+                REQUIRE(h.mean() == Approx(1000));
+            }
+        }
+    }
+
+    GIVEN("An empty histogram")
+    {
+        LatencyHistogram h;
+
+        THEN("the summary values are zero")
+        {
+            REQUIRE(h.count() == 0);
+            REQUIRE(h.mean() == 0);
+            REQUIRE(h.percentile(99) == 0);
+            REQUIRE(h.max() == 0);
+        }
+    }
+}
+
+SCENARIO("Stage times are combined from all threads", "[stagetimes]")
+{
+    GIVEN("Times recorded on two threads")
+    {
+        StageTimes::Snapshot before = StageTimes::snapshot();
+        StageTimes::record_ns(StageTimes::Stage::ENCODE, 2000);
+        std::thread t([]() { StageTimes::record_ns(StageTimes::Stage::ENCODE, 4000); });
+        t.join();
+
+        WHEN("a snapshot is taken")
+        {
+            StageTimes::Snapshot snapshot = StageTimes::snapshot();
+            for ( std::size_t s = 0; s < StageTimes::STAGES; ++s )
+                snapshot[s] -= before[s];
+
+            THEN("both times are present")
+            {
+                const LatencyHistogram& h = snapshot[static_cast<std::size_t>(StageTimes::Stage::ENCODE)];
+                REQUIRE(h.count() == 2);
+                REQUIRE(h.mean() == Approx(3000));
+            }
+
+            THEN("the report shows the stage")
+            {
+                std::vector<std::string> lines = StageTimes::format(snapshot);
+                REQUIRE(lines.size() == 2);
+                REQUIRE(lines[1].find("encode") == 0);
+            }
+        }
+    }
+}
+
+SCENARIO("Times between threads that appear negative are dropped", "[stagetimes]")
+{
+    GIVEN("A time whose end is before its start")
+    {
+        StageTimes::Snapshot before = StageTimes::snapshot();
+        StageTimes::record_between(StageTimes::Stage::CDNS_QUEUE, 1000, 900);
+        StageTimes::record_between(StageTimes::Stage::CDNS_QUEUE, 1000, 1100);
+
+        THEN("only the valid time is recorded")
+        {
+            StageTimes::Snapshot snapshot = StageTimes::snapshot();
+            LatencyHistogram& h = snapshot[static_cast<std::size_t>(StageTimes::Stage::CDNS_QUEUE)];
+            h -= before[static_cast<std::size_t>(StageTimes::Stage::CDNS_QUEUE)];
+            REQUIRE(h.count() == 1);
+            REQUIRE(h.max() < 1000000);
+        }
+    }
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <lzma.h>
+
+#include "catch.hpp"
+#include "streamwriter.hpp"
+
+namespace {
+    std::string test_data()
+    {
+        std::ostringstream oss;
+        for ( unsigned i = 0; i < 300000; ++i )
+            oss << "line " << i << "\n";
+        return oss.str();
+    }
+
+    template<typename Decompressor>
+    std::string decompress(const std::string& name)
+    {
+        std::ifstream ifs(name, std::ios::binary);
+        boost::iostreams::filtering_istream in;
+        in.push(Decompressor());
+        in.push(ifs);
+        std::ostringstream oss;
+        boost::iostreams::copy(in, oss);
+        return oss.str();
+    }
+
+    // The Boost lzma filter isn't available in all supported Boost
+    // versions, so decode xz with liblzma.
+    std::string xz_decompress(const std::string& name)
+    {
+        std::ifstream ifs(name, std::ios::binary);
+        std::string in((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        std::string res;
+        char buf[65536];
+
+        lzma_stream strm = LZMA_STREAM_INIT;
+        if ( lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK )
+            return res;
+        strm.next_in = reinterpret_cast<const uint8_t*>(in.data());
+        strm.avail_in = in.size();
+
+        lzma_ret ret;
+        do
+        {
+            strm.next_out = reinterpret_cast<uint8_t*>(buf);
+            strm.avail_out = sizeof(buf);
+            ret = lzma_code(&strm, LZMA_FINISH);
+            res.append(buf, sizeof(buf) - strm.avail_out);
+        } while ( ret == LZMA_OK );
+        lzma_end(&strm);
+
+        if ( ret != LZMA_STREAM_END )
+            res += "<xz decode error>";
+        return res;
+    }
+
+    template<typename Writer>
+    void write_file(const std::string& name, const std::string& data)
+    {
+        Writer writer(name, 1);
+        // Write in uneven pieces to cross chunk boundaries.
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+        for ( std::size_t pos = 0; pos < data.size(); pos += 99991 )
+            writer.writeBytes(p + pos, std::min<std::size_t>(99991, data.size() - pos));
+    }
+}
+
+SCENARIO("Compressed output can use several threads", "[streamwriter]")
+{
+    std::string data = test_data();
+
+    for ( unsigned threads : { 1U, 4U } )
+    {
+        GIVEN("Compression with " + std::to_string(threads) + " threads")
+        {
+            StreamWriter::set_compression_threads(threads);
+
+            WHEN("data is written with gzip")
+            {
+                std::string name = "streamwriter_test.gz";
+                write_file<GzipStreamWriter>(name, data);
+
+                THEN("it decompresses to the original")
+                {
+                    REQUIRE(decompress<boost::iostreams::gzip_decompressor>(name) == data);
+                }
+                std::remove(name.c_str());
+            }
+
+            WHEN("data is written with xz")
+            {
+                std::string name = "streamwriter_test.xz";
+                write_file<XzStreamWriter>(name, data);
+
+                THEN("it decompresses to the original")
+                {
+                    REQUIRE(xz_decompress(name) == data);
+                }
+                std::remove(name.c_str());
+            }
+
+            StreamWriter::set_compression_threads(1);
+        }
+    }
+
+    GIVEN("Empty gzip output on several threads")
+    {
+        StreamWriter::set_compression_threads(4);
+        std::string name = "streamwriter_test_empty.gz";
+        {
+            GzipStreamWriter writer(name, 6);
+        }
+        StreamWriter::set_compression_threads(1);
+
+        THEN("it is a valid empty file")
+        {
+            REQUIRE(decompress<boost::iostreams::gzip_decompressor>(name).empty());
+        }
+        std::remove(name.c_str());
+    }
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "catch.hpp"
+#include "threadplacement.hpp"
+
+SCENARIO("CPU lists can be parsed", "[threadplacement]")
+{
+    GIVEN("Some CPU lists")
+    {
+        THEN("valid lists are parsed")
+        {
+            REQUIRE(ThreadPlacement::parse_cpu_list("3") == std::vector<unsigned>({3}));
+            REQUIRE(ThreadPlacement::parse_cpu_list("5,1-3") == std::vector<unsigned>({1, 2, 3, 5}));
+            REQUIRE(ThreadPlacement::parse_cpu_list("2-3,3") == std::vector<unsigned>({2, 3}));
+        }
+
+        THEN("invalid lists are rejected")
+        {
+            REQUIRE_THROWS_AS(ThreadPlacement::parse_cpu_list(""), std::invalid_argument);
+            REQUIRE_THROWS_AS(ThreadPlacement::parse_cpu_list("a"), std::invalid_argument);
+            REQUIRE_THROWS_AS(ThreadPlacement::parse_cpu_list("3-1"), std::invalid_argument);
+            REQUIRE_THROWS_AS(ThreadPlacement::parse_cpu_list("1,,2"), std::invalid_argument);
+        }
+    }
+}
+
+SCENARIO("Thread placements can be set", "[threadplacement]")
+{
+    GIVEN("An empty placement")
+    {
+        ThreadPlacement placement;
+        REQUIRE(placement.empty());
+
+        WHEN("placements are set")
+        {
+            placement.set_cpus("sniffer:2-3");
+            placement.set_nice("compress:10");
+            placement.set_nice("sniffer:-5");
+
+            THEN("they are recorded")
+            {
+                std::ostringstream oss;
+                placement.dump(oss);
+                REQUIRE(!placement.empty());
+                REQUIRE(oss.str() ==
+                        "  Thread compress      : nice 10\n"
+                        "  Thread sniffer       : CPUs 2,3 nice -5\n");
+            }
+        }
+
+        THEN("invalid placements are rejected")
+        {
+            REQUIRE_THROWS_AS(placement.set_cpus("sniffer"), std::invalid_argument);
+            REQUIRE_THROWS_AS(placement.set_cpus("unknown:1"), std::invalid_argument);
+            REQUIRE_THROWS_AS(placement.set_nice("compress:20"), std::invalid_argument);
+            REQUIRE_THROWS_AS(placement.set_nice("compress:-21"), std::invalid_argument);
+            REQUIRE_THROWS_AS(placement.set_nice("compress:x"), std::invalid_argument);
+            REQUIRE(placement.empty());
+        }
+    }
+}
+
+#ifdef __linux__
+namespace {
+    int current_nice()
+    {
+        return getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+    }
+}
+
+SCENARIO("Threads without a placement are not placed like main", "[threadplacement]")
+{
+    GIVEN("A placement for the main thread only")
+    {
+        cpu_set_t original;
+        REQUIRE(pthread_getaffinity_np(pthread_self(), sizeof(original), &original) == 0);
+        int original_nice = current_nice();
+
+        unsigned cpu = 0;
+        while ( !CPU_ISSET(cpu, &original) )
+            ++cpu;
+
+        ThreadPlacement placement;
+        placement.set_cpus("main:" + std::to_string(cpu));
+        // Only a privileged process can lower its nice value again.
+        bool check_nice = ( geteuid() == 0 && original_nice < 19 );
+        if ( check_nice )
+            placement.set_nice("main:" + std::to_string(original_nice + 1));
+        ThreadPlacement::configure(placement);
+        ThreadPlacement::place_current_thread("main");
+
+        WHEN("another thread is started")
+        {
+            cpu_set_t thread_cpus;
+            int thread_nice = 0;
+            std::thread t([&]()
+            {
+                ThreadPlacement::place_current_thread("comp:sniffer");
+                pthread_getaffinity_np(pthread_self(), sizeof(thread_cpus), &thread_cpus);
+                thread_nice = current_nice();
+            });
+            t.join();
+
+            THEN("it has the original placement")
+            {
+                REQUIRE(CPU_EQUAL(&thread_cpus, &original));
+                if ( check_nice )
+                    REQUIRE(thread_nice == original_nice);
+            }
+        }
+
+        // Removing the placement restores main too.
+        ThreadPlacement::configure(ThreadPlacement());
+        ThreadPlacement::place_current_thread("main");
+        cpu_set_t restored;
+        REQUIRE(pthread_getaffinity_np(pthread_self(), sizeof(restored), &restored) == 0);
+        REQUIRE(CPU_EQUAL(&restored, &original));
+        REQUIRE(current_nice() == original_nice);
+    }
+}
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <tins/tins.h>
+
+#include "catch.hpp"
+#include "configuration.hpp"
+#include "packetstream.hpp"
+
+#include "trafficgen.hpp"
+
+namespace {
+    std::vector<PcapFrame> generate(const TrafficProfile& profile)
+    {
+        TrafficGenerator gen(profile);
+        std::vector<PcapFrame> res;
+        PcapFrame frame;
+
+        while ( gen.next(frame) )
+            res.push_back(frame);
+        return res;
+    }
+}
+
+SCENARIO("ZipfDistribution prefers low values", "[trafficgen]")
+{
+    GIVEN("A Zipf distribution with exponent 1")
+    {
+        ZipfDistribution zipf(100, 1.0);
+        std::mt19937 rng(1);
+        std::vector<unsigned> counts(100);
+
+        WHEN("values are chosen")
+        {
+            for ( unsigned i = 0; i < 10000; ++i )
+            {
+                std::size_t v = zipf(rng);
+                REQUIRE(v < 100);
+                ++counts[v];
+            }
+
+            THEN("the first value is about twice as popular as the second")
+            {
+                REQUIRE(counts[0] > counts[1]);
+                REQUIRE(counts[1] > counts[9]);
+                REQUIRE(counts[0] > 1.5 * counts[1]);
+                REQUIRE(counts[0] < 2.5 * counts[1]);
+            }
+        }
+    }
+}
+
+SCENARIO("TrafficGenerator generates repeatable traffic", "[trafficgen]")
+{
+    GIVEN("A UDP only profile")
+    {
+        TrafficProfile profile;
+        profile.queries = 500;
+        profile.tcp_share = 0.0;
+
+        WHEN("traffic is generated")
+        {
+            TrafficGenerator gen(profile);
+            std::vector<PcapFrame> frames;
+            PcapFrame frame;
+            while ( gen.next(frame) )
+                frames.push_back(frame);
+
+            THEN("each query has a response and frames are in order")
+            {
+                REQUIRE(gen.stats().queries == 500);
+                REQUIRE(gen.stats().tcp_queries == 0);
+                REQUIRE(gen.stats().packets == 1000);
+                REQUIRE(frames.size() == 1000);
+                REQUIRE(frames.front().timestamp() >= profile.start);
+                for ( std::size_t i = 1; i < frames.size(); ++i )
+                    REQUIRE(frames[i - 1].timestamp() <= frames[i].timestamp());
+            }
+
+            THEN("the query rate is about as requested")
+            {
+                auto secs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    frames.back().timestamp() - frames.front().timestamp()).count() / 1000.0;
+                REQUIRE(secs > 0.4);
+                REQUIRE(secs < 0.6);
+            }
+
+            THEN("the same profile gives the same traffic")
+            {
+                std::vector<PcapFrame> again = generate(profile);
+                REQUIRE(again.size() == frames.size());
+                for ( std::size_t i = 0; i < frames.size(); ++i )
+                    REQUIRE(again[i].record == frames[i].record);
+            }
+        }
+    }
+
+    GIVEN("A TCP only profile")
+    {
+        TrafficProfile profile;
+        profile.queries = 10;
+        profile.tcp_share = 1.0;
+
+        THEN("each query has a complete connection")
+        {
+            REQUIRE(generate(profile).size() == 80);
+        }
+    }
+
+    GIVEN("A profile losing all packets")
+    {
+        TrafficProfile profile;
+        profile.queries = 10;
+        profile.tcp_share = 0.0;
+        profile.loss = 1.0;
+        TrafficGenerator gen(profile);
+        PcapFrame frame;
+
+        THEN("no frames are generated")
+        {
+            REQUIRE(!gen.next(frame));
+            REQUIRE(gen.stats().queries == 10);
+            REQUIRE(gen.stats().lost_packets == 20);
+        }
+    }
+
+    GIVEN("An invalid profile")
+    {
+        TrafficProfile profile;
+        profile.tcp_share = 1.5;
+
+        THEN("the generator can't be created")
+        {
+            REQUIRE_THROWS_AS(TrafficGenerator{profile}, std::invalid_argument);
+        }
+    }
+}
+
+SCENARIO("Generated traffic can be captured", "[trafficgen]")
+{
+    GIVEN("Mixed UDP and TCP traffic")
+    {
+        TrafficProfile profile;
+        profile.queries = 200;
+        profile.tcp_share = 0.2;
+
+        Configuration config;
+        unsigned queries = 0, responses = 0;
+        PacketStream::DNSSink dns_sink =
+            [&](std::unique_ptr<DNSMessage>& dns)
+            {
+                if ( dns->dns.type() == CaptureDNS::QUERY )
+                    ++queries;
+                else
+                    ++responses;
+            };
+        PacketStream::AddressEventSink address_event_sink =
+            [&](std::shared_ptr<AddressEvent>) {};
+        PacketStream pkt_stream(config, dns_sink, address_event_sink);
+
+        WHEN("the frames are processed")
+        {
+            for ( const auto& frame : generate(profile) )
+            {
+                Tins::Packet pkt(Tins::EthernetII(frame.data(), frame.size()),
+                                 std::chrono::duration_cast<std::chrono::microseconds>(frame.timestamp().time_since_epoch()));
+                std::shared_ptr<PcapItem> pcap = std::make_shared<PcapItem>(pkt);
+                pkt_stream.process_packet(pcap);
+            }
+
+            THEN("all queries and responses are found")
+            {
+                REQUIRE(queries == 200);
+                REQUIRE(responses == 200);
+            }
+        }
+    }
+}
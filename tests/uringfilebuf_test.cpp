@@ -0,0 +1,230 @@
+/*
+ * Copyright 2023 Internet Corporation for Assigned Names and Numbers.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, you can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Developed by Sinodun IT (www.sinodun.com)
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+#include "makeunique.hpp"
+#include "streamwriter.hpp"
+#include "uringfilebuf.hpp"
+
+namespace {
+    std::string test_data(std::size_t len)
+    {
+        std::string res;
+        res.reserve(len);
+        for ( std::size_t i = 0; i < len; ++i )
+            res += static_cast<char>(i * 7 + i / 4099);
+        return res;
+    }
+
+    std::string read_file(const std::string& name)
+    {
+        std::ifstream ifs(name, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+
+    // Returns null if io_uring can't be set up here, for example
+    // in a container that blocks it.
+    std::unique_ptr<UringFileBuf> open_buf(const std::string& name, bool direct, bool sync)
+    {
+        try
+        {
+            return make_unique<UringFileBuf>(name, direct, sync);
+        }
+        catch (const uring_error& err)
+        {
+            WARN("io_uring not available, skipping: " << err.what());
+            return nullptr;
+        }
+    }
+
+    // Lower the open file limit so no more files can be opened, and
+    // so io_uring setup fails.
+    class NoMoreFiles
+    {
+    public:
+        NoMoreFiles()
+        {
+            getrlimit(RLIMIT_NOFILE, &old_);
+            struct rlimit lim = old_;
+            int fd = ::open("/dev/null", O_RDONLY);
+            lim.rlim_cur = fd;
+            ::close(fd);
+            setrlimit(RLIMIT_NOFILE, &lim);
+        }
+
+        ~NoMoreFiles()
+        {
+            setrlimit(RLIMIT_NOFILE, &old_);
+        }
+
+    private:
+        struct rlimit old_;
+    };
+
+    // Write in uneven pieces, so writes don't line up with buffers.
+    void write_data(std::ostream& os, const std::string& data)
+    {
+        for ( std::size_t pos = 0; pos < data.size(); pos += 99991 )
+            os.write(data.data() + pos, std::min<std::size_t>(99991, data.size() - pos));
+    }
+}
+
+SCENARIO("Files can be written with io_uring", "[uringfilebuf]")
+{
+    const std::size_t sizes[] = {
+        0,
+        1,
+        UringFileBuf::ALIGNMENT + 1,
+        UringFileBuf::BUFFER_SIZE,
+        UringFileBuf::BUFFERS * UringFileBuf::BUFFER_SIZE * 2 + 12345
+    };
+    std::string name = "uringfilebuf_test.out";
+
+    for ( bool direct : { false, true } )
+    {
+        for ( bool sync : { false, true } )
+        {
+            for ( auto size : sizes )
+            {
+                GIVEN("Output of " + std::to_string(size) + " bytes, direct " +
+                      std::to_string(direct) + ", sync " + std::to_string(sync))
+                {
+                    std::string data = test_data(size);
+                    std::unique_ptr<UringFileBuf> buf = open_buf(name, direct, sync);
+                    if ( !buf )
+                        return;
+
+                    std::ostream os(buf.get());
+                    write_data(os, data);
+                    REQUIRE(os.good());
+
+                    // With direct I/O, an unaligned tail is written
+                    // with pwrite() after the queued writes drain.
+                    // Any sync is queued after all writes.
+                    THEN("closing writes all the data")
+                    {
+                        REQUIRE_NOTHROW(buf->close());
+                        REQUIRE(read_file(name) == data);
+                    }
+
+                    THEN("the destructor writes all the data")
+                    {
+                        buf.reset();
+                        REQUIRE(read_file(name) == data);
+                    }
+                    std::remove(name.c_str());
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("io_uring output errors are reported", "[uringfilebuf]")
+{
+    GIVEN("io_uring is available")
+    {
+        std::string name = "uringfilebuf_test.out";
+        if ( !open_buf(name, false, false) )
+            return;
+        std::remove(name.c_str());
+
+        WHEN("a file can't be opened")
+        {
+            THEN("a file error, not a setup error, is thrown")
+            {
+                bool file_error = false;
+                try
+                {
+                    UringFileBuf buf("uringfilebuf_test_no_dir/test.out", false, false);
+                }
+                catch (const uring_setup_error&)
+                {
+                }
+                catch (const uring_error&)
+                {
+                    file_error = true;
+                }
+                REQUIRE(file_error);
+            }
+        }
+
+        WHEN("io_uring can't be set up")
+        {
+            NoMoreFiles no_more_files;
+
+            THEN("a setup error is thrown")
+            {
+                REQUIRE_THROWS_AS(UringFileBuf(name, false, false), uring_setup_error);
+            }
+        }
+    }
+}
+
+SCENARIO("Stream output falls back when io_uring can't be used", "[uringfilebuf]")
+{
+    GIVEN("io_uring output selected")
+    {
+        StreamWriter::set_output_mode(true, true, true);
+        std::string data = test_data(UringFileBuf::BUFFER_SIZE + 999);
+        std::string name = "uringfilebuf_test_fallback.out";
+
+        WHEN("io_uring can't be set up")
+        {
+            {
+                // The standard file can't be opened either.
+                NoMoreFiles no_more_files;
+                REQUIRE_THROWS_AS(StreamWriter(name, 0), std::runtime_error);
+            }
+
+            THEN("later files are written with standard output")
+            {
+                {
+                    StreamWriter writer(name, 0);
+                    writer.writeBytes(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+                }
+                REQUIRE(read_file(name) == data);
+                std::remove(name.c_str());
+            }
+        }
+
+        WHEN("a file can't be opened")
+        {
+            REQUIRE_THROWS_WITH(StreamWriter("uringfilebuf_test_no_dir/test.out", 0),
+                                "Can't open file uringfilebuf_test_no_dir/test.out.tmp");
+
+            THEN("later files are still written")
+            {
+                {
+                    StreamWriter writer(name, 0);
+                    writer.writeBytes(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+                }
+                REQUIRE(read_file(name) == data);
+                std::remove(name.c_str());
+            }
+        }
+
+        StreamWriter::set_output_mode(false, false, false);
+    }
+}